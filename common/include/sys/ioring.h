@@ -0,0 +1,79 @@
+
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Number of submission queue entries; a power of two.
+#define IORING_SQ_ENTRIES 32
+// Number of completion queue entries; a power of two.
+#define IORING_CQ_ENTRIES 64
+
+// Does nothing; completes with 0.
+#define IORING_OP_NOP   0
+// Open the file at the path in `buf` with `flags` as `oflags_t`; completes with the new file descriptor.
+#define IORING_OP_OPEN  1
+// Close `fd`; completes with 0.
+#define IORING_OP_CLOSE 2
+// Read `len` bytes from `fd` into `buf`; completes with the read count.
+#define IORING_OP_READ  3
+// Write `len` bytes from `buf` to `fd`; completes with the write count.
+#define IORING_OP_WRITE 4
+// Write back the data of `fd` to its filesystem; completes with 0.
+#define IORING_OP_FSYNC 5
+
+// Set while the worker is parked on an empty submission queue; new submissions need a doorbell.
+#define IORING_FLAG_SQ_WAKEUP 0x01
+// Set while the worker is parked on a full completion queue; taking completions needs a doorbell.
+#define IORING_FLAG_CQ_WAKEUP 0x02
+
+// Submission queue entry; one asynchronous filesystem operation.
+typedef struct {
+    // Copied to the completion so the process can tell which operation finished.
+    uint64_t user_data;
+    // Buffer to read into or write from, or path to open.
+    void    *buf;
+    // Length of `buf` in bytes.
+    long     len;
+    // Offset in the file, or -1 to use and advance the current offset.
+    long     offset;
+    // File descriptor to operate on.
+    int      fd;
+    // Operation-specific flags.
+    int      flags;
+    // One of the `IORING_OP_*` operations.
+    uint8_t  op;
+} ioring_sqe_t;
+
+// Completion queue entry; the result of one operation.
+typedef struct {
+    // `user_data` of the submission.
+    uint64_t user_data;
+    // Result of the operation; <= -1 on error.
+    long     res;
+} ioring_cqe_t;
+
+// Submission and completion ring shared between a process and the kernel.
+// Indices run freely and wrap around; an entry's slot is its index modulo the queue size.
+// Operations complete in the order they were submitted.
+// The kernel parks its worker when there is nothing to do; if the matching `IORING_FLAG_*` is set after updating
+// `sq_tail` or `cq_head`, the process rings the doorbell by calling `SYSCALL_FS_RING_WAIT` with `min_complete` 0.
+typedef struct {
+    // Index of the next submission the kernel takes; written by the kernel.
+    atomic_uint  sq_head;
+    // Index past the last submission; written by the process after filling in the entries.
+    atomic_uint  sq_tail;
+    // Index of the next completion the process takes; written by the process.
+    atomic_uint  cq_head;
+    // Index past the last completion; written by the kernel after filling in the entries.
+    atomic_uint  cq_tail;
+    // `IORING_FLAG_*` bits; written by the kernel.
+    atomic_uint  flags;
+    // Submission queue.
+    ioring_sqe_t sqes[IORING_SQ_ENTRIES];
+    // Completion queue.
+    ioring_cqe_t cqes[IORING_CQ_ENTRIES];
+} ioring_t;
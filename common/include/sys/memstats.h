@@ -0,0 +1,59 @@
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Number of slab size classes (32, 64, 128 and 256 bytes).
+#define MEMSTATS_SLAB_CLASSES 4
+// Number of buddy orders tracked; larger orders are counted in the last entry.
+#define MEMSTATS_BUDDY_ORDERS 20
+
+// Allocator counters for a single size class.
+typedef struct {
+    // Number of successful allocations.
+    uint64_t allocs;
+    // Number of deallocations.
+    uint64_t frees;
+    // Number of allocations that could not be satisfied.
+    uint64_t failures;
+    // Bytes currently allocated in this class.
+    uint64_t in_use;
+    // Highest value `in_use` has reached.
+    uint64_t peak;
+} memstats_class_t;
+
+// Kernel memory allocator statistics.
+typedef struct {
+    // Slab allocator size classes; bytes are counted per slab slot.
+    memstats_class_t slab[MEMSTATS_SLAB_CLASSES];
+    // Buddy allocator orders; bytes are counted per page, including pages used for slabs.
+    memstats_class_t buddy[MEMSTATS_BUDDY_ORDERS];
+    // Total pages managed by the buddy allocator.
+    uint64_t         total_pages;
+    // Pages currently free in the buddy allocator.
+    uint64_t         free_pages;
+    // Lowest value `free_pages` has reached.
+    uint64_t         min_free_pages;
+} memstats_t;
+
+// Memory usage of a single process.
+typedef struct {
+    // Bytes of address space mapped by the process, whether accessed yet or not.
+    uint64_t reserved;
+    // Bytes of physical memory backing the process' mappings.
+    uint64_t resident;
+    // Highest value `resident` has reached.
+    uint64_t peak_resident;
+    // Number of page faults that allocated memory on first access.
+    uint64_t faults;
+    // Number of superpages allocated on first access.
+    uint64_t superpages;
+    // Number of times a superpage could be used but no aligned physical memory was available.
+    uint64_t superpage_misses;
+    // Number of copy-on-write pages copied because they were written to.
+    uint64_t cow_copies;
+    // Bytes of page tables used to map the process' memory; 0 on systems without virtual memory.
+    uint64_t page_tables;
+} proc_memstats_t;
@@ -0,0 +1,52 @@
+
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Bit position of the file type in `stat_t.mode`.
+#define STAT_TYPE_BIT  12
+// Bit mask of the file type in `stat_t.mode`.
+#define STAT_TYPE_MASK 0xf000
+// File type of a directory in `stat_t.mode`.
+#define STAT_TYPE_DIR  (4 << STAT_TYPE_BIT)
+// File type of a regular file in `stat_t.mode`.
+#define STAT_TYPE_REG  (8 << STAT_TYPE_BIT)
+// File type of a symbolic link in `stat_t.mode`.
+#define STAT_TYPE_LINK (10 << STAT_TYPE_BIT)
+
+// File or directory status.
+typedef struct stat {
+    // ID of device containing file.
+    uint32_t device;
+    // Inode number.
+    long     inode;
+    // File type and protection.
+    uint16_t mode;
+    // Number of hard links.
+    long     links;
+    // Owner user ID.
+    // TODO: User ID type?
+    int      uid;
+    // Owner group ID.
+    // TODO: Group ID type?
+    int      gid;
+    // File size in bytes.
+    long     size;
+} stat_t;
+
+// Directory entry with the status of the file it names, as returned by `SYSCALL_FS_GETDENTS_STAT`.
+// The `record_len` field indicates the total size of the entry and is therefor the offset to the next one.
+// The name is zero-terminated and the record is padded to a multiple of `sizeof(long)`.
+typedef struct {
+    // Length of the file entry record.
+    long   record_len;
+    // Status of the file.
+    stat_t stat;
+    // Length of the filename.
+    long   name_len;
+    // Filename.
+    char   name[];
+} dirent_stat_t;
@@ -0,0 +1,17 @@
+
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stddef.h>
+
+// Maximum number of buffers in one vectored I/O request.
+#define IOV_MAX 16
+
+// One buffer of a vectored I/O request.
+typedef struct {
+    // Start of the buffer.
+    void  *base;
+    // Length of the buffer in bytes.
+    size_t len;
+} iovec_t;
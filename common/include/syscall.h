@@ -12,6 +12,10 @@
 #else
 
 #include "hal/gpio.h"
+#include "sys/ioring.h"
+#include "sys/memstats.h"
+#include "sys/stat.h"
+#include "sys/uio.h"
 
 #include <stdbool.h>
 #include <stddef.h>
@@ -61,6 +65,8 @@ typedef int tid_t;
 #define OFLAGS_CLOEXEC   0x00000040
 // Open a directory instead of a file.
 #define OFLAGS_DIRECTORY 0x00000080
+// Access will be random; disables readahead.
+#define OFLAGS_RANDOM    0x00000100
 
 #define MEMFLAGS_R   0x00000001
 #define MEMFLAGS_W   0x00000002
@@ -69,6 +75,9 @@ typedef int tid_t;
 #define MEMFLAGS_RX  0x00000005
 #define MEMFLAGS_WX  0x00000006
 #define MEMFLAGS_RWX 0x00000007
+
+// Writes to a file mapping change the file.
+#define MEMFLAGS_SHARED 0x00000008
 #endif
 
 #include <stdbool.h>
@@ -0,0 +1,18 @@
+
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stddef.h>
+
+// Get the length of a C string.
+size_t strlen(char const *cstr);
+// Write a C string to the log.
+void   print(char const *cstr);
+// Write an unsigned number to the log in decimal.
+void   print_dec(unsigned long value);
+// Write the rate of transferring `bytes` in `us` microseconds to the log in KiB/s.
+void   print_rate(unsigned long bytes, unsigned long us);
+// Write a line with the total time of `count` operations and the time each took:
+// "<name>: <time> us for <count> <unit>, <time per operation> ns each".
+void   report_each(char const *name, unsigned long time, unsigned long count, char const *unit);
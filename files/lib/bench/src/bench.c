@@ -0,0 +1,61 @@
+
+// SPDX-License-Identifier: MIT
+
+/* Output helpers shared by the benchmark programs
+ *
+ * There is no libc for user programs, so this provides just enough string
+ * handling and number formatting to print results through the log.
+ */
+
+#include "bench.h"
+
+#include "syscall.h"
+
+#include <stdint.h>
+
+
+
+// Get the length of a C string.
+size_t strlen(char const *cstr) {
+    char const *pre = cstr;
+    while (*cstr) cstr++;
+    return cstr - pre;
+}
+
+// Write a C string to the log.
+void print(char const *cstr) {
+    syscall_temp_write(cstr, strlen(cstr));
+}
+
+// Write an unsigned number to the log in decimal.
+void print_dec(unsigned long value) {
+    char  buf[24];
+    char *ptr = buf + sizeof(buf);
+    *--ptr    = 0;
+    do {
+        *--ptr  = '0' + value % 10;
+        value  /= 10;
+    } while (value);
+    print(ptr);
+}
+
+// Write the rate of transferring `bytes` in `us` microseconds to the log in KiB/s.
+void print_rate(unsigned long bytes, unsigned long us) {
+    print_dec(us ? (uint64_t)bytes * 1000000 / 1024 / us : 0);
+    print(" KiB/s");
+}
+
+// Write a line with the total time of `count` operations and the time each took:
+// "<name>: <time> us for <count> <unit>, <time per operation> ns each".
+void report_each(char const *name, unsigned long time, unsigned long count, char const *unit) {
+    print(name);
+    print(": ");
+    print_dec(time);
+    print(" us for ");
+    print_dec(count);
+    print(" ");
+    print(unit);
+    print(", ");
+    print_dec(count ? time * 1000 / count : 0);
+    print(" ns each\n");
+}
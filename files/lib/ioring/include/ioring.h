@@ -0,0 +1,45 @@
+
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "syscall.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Userspace side of the asynchronous I/O ring.
+typedef struct {
+    // Ring shared with the kernel.
+    ioring_t *ring;
+    // Index past the last prepared submission; published to the kernel by `ioring_submit`.
+    unsigned  sq_tail;
+} ioring_queue_t;
+
+// Create the I/O ring of this process; a process can only have one.
+bool          ioring_queue_init(ioring_queue_t *queue);
+// Get a free submission entry to prepare, or NULL if the submission queue is full.
+ioring_sqe_t *ioring_get_sqe(ioring_queue_t *queue);
+// Hand all prepared submissions to the kernel.
+// Returns the number of submissions the kernel hasn't taken yet.
+unsigned      ioring_submit(ioring_queue_t *queue);
+// Get the oldest completion without waiting, or NULL if there is none.
+ioring_cqe_t *ioring_peek_cqe(ioring_queue_t *queue);
+// Wait for the oldest completion; returns NULL if waiting failed.
+ioring_cqe_t *ioring_wait_cqe(ioring_queue_t *queue);
+// Wait until at least `count` completions are available, or `timeout_us` has passed if it isn't negative.
+// Returns the number of completions available.
+unsigned      ioring_wait_cqes(ioring_queue_t *queue, unsigned count, long timeout_us);
+// Release the oldest completion so its entry can be reused.
+void          ioring_cqe_seen(ioring_queue_t *queue);
+
+// Prepare opening the file at `path`; the path must stay valid until the open completes.
+void ioring_prep_open(ioring_sqe_t *sqe, char const *path, int oflags, uint64_t user_data);
+// Prepare closing `fd`.
+void ioring_prep_close(ioring_sqe_t *sqe, int fd, uint64_t user_data);
+// Prepare reading `len` bytes from `fd` at `offset`, or at the current offset if it is -1.
+void ioring_prep_read(ioring_sqe_t *sqe, int fd, void *buf, long len, long offset, uint64_t user_data);
+// Prepare writing `len` bytes to `fd` at `offset`, or at the current offset if it is -1.
+void ioring_prep_write(ioring_sqe_t *sqe, int fd, void const *buf, long len, long offset, uint64_t user_data);
+// Prepare writing back the data of `fd` to its filesystem.
+void ioring_prep_fsync(ioring_sqe_t *sqe, int fd, uint64_t user_data);
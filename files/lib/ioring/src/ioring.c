@@ -0,0 +1,150 @@
+
+// SPDX-License-Identifier: MIT
+
+/* Userspace wrapper for the asynchronous I/O ring of BadgerOS
+ *
+ * The kernel maps a ring with a submission and a completion queue into the
+ * process and a kernel worker performs the submitted operations in order. Adding
+ * submissions and taking completions only touches the shared memory, so a batch
+ * of operations costs no syscalls while the worker is busy. Once it has been
+ * idle for a moment the worker parks and says so in the ring flags; the next
+ * submission then rings the doorbell with a `SYSCALL_FS_RING_WAIT` for zero
+ * completions, which is also the syscall that blocks until completions arrive.
+ *
+ * Submissions are prepared in place in the ring and become visible to the
+ * kernel once `ioring_submit` publishes the new tail. User programs are
+ * single-threaded, so the queue itself is not locked.
+ */
+
+#include "ioring.h"
+
+
+
+// Create the I/O ring of this process; a process can only have one.
+bool ioring_queue_init(ioring_queue_t *queue) {
+    queue->ring = syscall_fs_ring_setup(0);
+    if (!queue->ring) {
+        return false;
+    }
+    queue->sq_tail = atomic_load_explicit(&queue->ring->sq_tail, memory_order_relaxed);
+    return true;
+}
+
+// Get a free submission entry to prepare, or NULL if the submission queue is full.
+ioring_sqe_t *ioring_get_sqe(ioring_queue_t *queue) {
+    unsigned head = atomic_load_explicit(&queue->ring->sq_head, memory_order_acquire);
+    if (queue->sq_tail - head >= IORING_SQ_ENTRIES) {
+        return NULL;
+    }
+    return &queue->ring->sqes[queue->sq_tail++ % IORING_SQ_ENTRIES];
+}
+
+// Hand all prepared submissions to the kernel.
+// Returns the number of submissions the kernel hasn't taken yet.
+unsigned ioring_submit(ioring_queue_t *queue) {
+    // Sequentially consistent so that the flag can't be read before the kernel sees the new tail.
+    atomic_store(&queue->ring->sq_tail, queue->sq_tail);
+    if (atomic_load(&queue->ring->flags) & IORING_FLAG_SQ_WAKEUP) {
+        syscall_fs_ring_wait(0, 0);
+    }
+    return queue->sq_tail - atomic_load_explicit(&queue->ring->sq_head, memory_order_relaxed);
+}
+
+// Get the oldest completion without waiting, or NULL if there is none.
+ioring_cqe_t *ioring_peek_cqe(ioring_queue_t *queue) {
+    unsigned head = atomic_load_explicit(&queue->ring->cq_head, memory_order_relaxed);
+    if (head == atomic_load_explicit(&queue->ring->cq_tail, memory_order_acquire)) {
+        return NULL;
+    }
+    return &queue->ring->cqes[head % IORING_CQ_ENTRIES];
+}
+
+// Wait for the oldest completion; returns NULL if waiting failed.
+ioring_cqe_t *ioring_wait_cqe(ioring_queue_t *queue) {
+    ioring_cqe_t *cqe = ioring_peek_cqe(queue);
+    while (!cqe) {
+        if (syscall_fs_ring_wait(1, -1) < 0) {
+            return NULL;
+        }
+        cqe = ioring_peek_cqe(queue);
+    }
+    return cqe;
+}
+
+// Wait until at least `count` completions are available, or `timeout_us` has passed if it isn't negative.
+// Returns the number of completions available.
+unsigned ioring_wait_cqes(ioring_queue_t *queue, unsigned count, long timeout_us) {
+    unsigned avail = atomic_load_explicit(&queue->ring->cq_tail, memory_order_acquire) -
+                     atomic_load_explicit(&queue->ring->cq_head, memory_order_relaxed);
+    if (avail >= count) {
+        return avail;
+    }
+    int res = syscall_fs_ring_wait(count, timeout_us);
+    return res < 0 ? avail : (unsigned)res;
+}
+
+// Release the oldest completion so its entry can be reused.
+void ioring_cqe_seen(ioring_queue_t *queue) {
+    unsigned head = atomic_load_explicit(&queue->ring->cq_head, memory_order_relaxed);
+    atomic_store(&queue->ring->cq_head, head + 1);
+    if (atomic_load(&queue->ring->flags) & IORING_FLAG_CQ_WAKEUP) {
+        syscall_fs_ring_wait(0, 0);
+    }
+}
+
+
+
+// Prepare opening the file at `path`; the path must stay valid until the open completes.
+void ioring_prep_open(ioring_sqe_t *sqe, char const *path, int oflags, uint64_t user_data) {
+    *sqe = (ioring_sqe_t){
+        .user_data = user_data,
+        .buf       = (void *)path,
+        .offset    = -1,
+        .flags     = oflags,
+        .op        = IORING_OP_OPEN,
+    };
+}
+
+// Prepare closing `fd`.
+void ioring_prep_close(ioring_sqe_t *sqe, int fd, uint64_t user_data) {
+    *sqe = (ioring_sqe_t){
+        .user_data = user_data,
+        .offset    = -1,
+        .fd        = fd,
+        .op        = IORING_OP_CLOSE,
+    };
+}
+
+// Prepare reading `len` bytes from `fd` at `offset`, or at the current offset if it is -1.
+void ioring_prep_read(ioring_sqe_t *sqe, int fd, void *buf, long len, long offset, uint64_t user_data) {
+    *sqe = (ioring_sqe_t){
+        .user_data = user_data,
+        .buf       = buf,
+        .len       = len,
+        .offset    = offset,
+        .fd        = fd,
+        .op        = IORING_OP_READ,
+    };
+}
+
+// Prepare writing `len` bytes to `fd` at `offset`, or at the current offset if it is -1.
+void ioring_prep_write(ioring_sqe_t *sqe, int fd, void const *buf, long len, long offset, uint64_t user_data) {
+    *sqe = (ioring_sqe_t){
+        .user_data = user_data,
+        .buf       = (void *)buf,
+        .len       = len,
+        .offset    = offset,
+        .fd        = fd,
+        .op        = IORING_OP_WRITE,
+    };
+}
+
+// Prepare writing back the data of `fd` to its filesystem.
+void ioring_prep_fsync(ioring_sqe_t *sqe, int fd, uint64_t user_data) {
+    *sqe = (ioring_sqe_t){
+        .user_data = user_data,
+        .offset    = -1,
+        .fd        = fd,
+        .op        = IORING_OP_FSYNC,
+    };
+}
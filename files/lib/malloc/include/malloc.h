@@ -0,0 +1,23 @@
+
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stddef.h>
+
+// Allocate `size` bytes aligned to at least 16 bytes.
+void  *malloc(size_t size);
+// Free memory allocated with `malloc`, `calloc`, `realloc` or `aligned_alloc`.
+void   free(void *ptr);
+// Allocate a zeroed array of `nmemb` elements of `size` bytes.
+void  *calloc(size_t nmemb, size_t size);
+// Resize an allocation, moving it if it can't be resized in place.
+void  *realloc(void *ptr, size_t size);
+// Resize an allocation to an array of `nmemb` elements of `size` bytes.
+void  *reallocarray(void *ptr, size_t nmemb, size_t size);
+// Allocate `size` bytes aligned to `alignment`, which must be a power of 2.
+void  *aligned_alloc(size_t alignment, size_t size);
+// Get the usable size of an allocation, which may be larger than requested.
+size_t malloc_usable_size(void *ptr);
+// Return cached objects to their pages and completely free arenas to the kernel.
+void   malloc_trim();
@@ -0,0 +1,589 @@
+
+// SPDX-License-Identifier: MIT
+
+/* Userspace heap allocator for BadgerOS
+ *
+ * Memory is requested from the kernel in arenas of `UMALLOC_ARENA_SIZE` bytes,
+ * which are divided into spans of whole pages. Every span starts with a `span_t`
+ * header, so the header of any allocation is found by rounding its address down
+ * to a page boundary.
+ *
+ * Small allocations are served from runs: single-page spans that hold objects of
+ * one size class. Freed small objects go to a per-thread cache first, so most
+ * malloc/free pairs never touch a run. Larger allocations get a span of their own
+ * and allocations that don't fit in an arena are mapped directly by the kernel.
+ *
+ * Free spans are kept in bins by page count and are merged with their neighbours
+ * when freed; a free span has a pointer to its header in its last word so the
+ * span after it can find it. Arenas that become completely free are returned to
+ * the kernel, except for `UMALLOC_ARENA_KEEP` arenas that are kept for reuse.
+ *
+ * User programs are single-threaded, so there is one thread cache and the shared
+ * state is not locked. The allocator must not be used from signal handlers.
+ */
+
+#include "malloc.h"
+
+#include "badge_strings.h"
+#include "syscall.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Page size assumed for arena and span layout.
+#define UMALLOC_PAGE_SIZE   4096
+// Number of pages in an arena requested from the kernel.
+#define UMALLOC_ARENA_PAGES 16
+// Size of an arena requested from the kernel.
+#define UMALLOC_ARENA_SIZE  (UMALLOC_ARENA_PAGES * UMALLOC_PAGE_SIZE)
+// Minimum alignment of all allocations.
+#define UMALLOC_ALIGN       16
+// Number of small size classes.
+#define UMALLOC_CLASSES     19
+// Largest small allocation; larger allocations get a span of their own.
+#define UMALLOC_SMALL_MAX   1008
+// Maximum number of objects per size class kept in the thread cache.
+#define UMALLOC_TCACHE_MAX  32
+// Number of completely free arenas kept instead of being returned to the kernel.
+#define UMALLOC_ARENA_KEEP  1
+// Number of different addresses to try when the kernel can't map memory.
+#define UMALLOC_MAP_TRIES   8
+// Magic value in every span header.
+#define UMALLOC_MAGIC       0xb4d6
+
+// Span is a free span in a bin.
+#define SPAN_FREE   0
+// Span is a run of small objects.
+#define SPAN_RUN    1
+// Span is a single large allocation.
+#define SPAN_LARGE  2
+// Span is a single allocation mapped directly by the kernel.
+#define SPAN_DIRECT 3
+
+// The span before this one in the arena is free.
+#define SPAN_PREV_FREE 0x01
+// This is the first span in its arena.
+#define SPAN_FIRST     0x02
+// This is the last span in its arena.
+#define SPAN_LAST      0x04
+// This span is in a run list or a bin.
+#define SPAN_LISTED    0x08
+
+typedef struct span span_t;
+
+// Header at the start of every span.
+struct span {
+    // Must be `UMALLOC_MAGIC`.
+    uint16_t magic;
+    // One of the `SPAN_*` kinds.
+    uint8_t  kind;
+    // `SPAN_*` flags.
+    uint8_t  flags;
+    // Size class of a run.
+    uint8_t  cls;
+    // Number of objects of a run that are allocated or in a thread cache.
+    uint16_t used;
+    // Number of objects of a run that have ever been handed out.
+    uint16_t fresh;
+    // Size in pages, or in bytes for direct mappings.
+    size_t   size;
+    // Freed objects of a run, or the mapping base of a direct mapping.
+    void    *objs;
+    // Previous span in a run list or bin.
+    span_t  *prev;
+    // Next span in a run list or bin.
+    span_t  *next;
+};
+
+// Size reserved for the span header.
+#define UMALLOC_HDR_SIZE ((sizeof(span_t) + UMALLOC_ALIGN - 1) & ~(size_t)(UMALLOC_ALIGN - 1))
+
+// Cache of recently freed small objects.
+typedef struct {
+    // Number of cached objects per size class.
+    uint8_t count[UMALLOC_CLASSES];
+    // Singly-linked cached objects per size class.
+    void   *objs[UMALLOC_CLASSES];
+} tcache_t;
+
+// Object size of each size class; chosen so that runs have little unused space.
+static uint16_t const class_size[UMALLOC_CLASSES] = {
+    16, 32, 48, 64, 80, 96, 112, 128, 144, 160, 192, 224, 256, 288, 336, 400, 496, 672, 1008,
+};
+
+// Runs with free objects per size class.
+static span_t  *runs[UMALLOC_CLASSES];
+// Free spans by page count minus one.
+static span_t  *bins[UMALLOC_ARENA_PAGES];
+// Bitmask of non-empty bins.
+static uint32_t bins_mask;
+// Number of completely free arenas in `bins`.
+static size_t   free_arenas;
+// Virtual address to try for the next mapping.
+static size_t   map_hint;
+// Thread cache of the main thread.
+static tcache_t main_tcache;
+
+
+
+// Round up to a multiple of a power of 2.
+static inline size_t align_up(size_t x, size_t align) {
+    return (x + align - 1) & ~(align - 1);
+}
+
+// Get the thread cache of the current thread.
+static inline tcache_t *tcache_get() {
+    return &main_tcache;
+}
+
+// Get the size class for a small allocation.
+static inline uint8_t size_to_class(size_t size) {
+    if (size <= 160) {
+        return size ? (size - 1) / 16 : 0;
+    }
+    uint8_t cls = 10;
+    while (class_size[cls] < size) {
+        cls++;
+    }
+    return cls;
+}
+
+// Number of objects in a run of a size class.
+static inline uint16_t class_capacity(uint8_t cls) {
+    return (UMALLOC_PAGE_SIZE - UMALLOC_HDR_SIZE) / class_size[cls];
+}
+
+// Find the span header of an allocation.
+static span_t *span_of(void *ptr) {
+    size_t  addr = (size_t)ptr;
+    span_t *span;
+    if (addr % UMALLOC_PAGE_SIZE) {
+        span = (span_t *)(addr - addr % UMALLOC_PAGE_SIZE);
+    } else {
+        // Page-aligned allocations are direct mappings with the header on the page before.
+        span = (span_t *)(addr - UMALLOC_PAGE_SIZE);
+    }
+    if (span->magic != UMALLOC_MAGIC) {
+        __builtin_trap();
+    }
+    return span;
+}
+
+// Get the span after this one in its arena, if any.
+static inline span_t *span_next(span_t *span) {
+    if (span->flags & SPAN_LAST) {
+        return NULL;
+    }
+    return (span_t *)((char *)span + span->size * UMALLOC_PAGE_SIZE);
+}
+
+// Add a span to a list.
+static void span_list_push(span_t **list, span_t *span) {
+    span->prev = NULL;
+    span->next = *list;
+    if (*list) {
+        (*list)->prev = span;
+    }
+    *list        = span;
+    span->flags |= SPAN_LISTED;
+}
+
+// Remove a span from a list.
+static void span_list_remove(span_t **list, span_t *span) {
+    if (span->prev) {
+        span->prev->next = span->next;
+    } else {
+        *list = span->next;
+    }
+    if (span->next) {
+        span->next->prev = span->prev;
+    }
+    span->flags &= ~SPAN_LISTED;
+}
+
+
+
+// Map memory from the kernel, trying different addresses if the preferred one is taken.
+static void *map_pages(size_t size, size_t align) {
+    size = align_up(size, UMALLOC_PAGE_SIZE);
+    for (int i = 0; i < UMALLOC_MAP_TRIES; i++) {
+        void *mem = syscall_mem_alloc(map_hint, size, align, MEMFLAGS_RW);
+        if (mem) {
+            map_hint = (size_t)mem + size;
+            return mem;
+        }
+        map_hint = i == UMALLOC_MAP_TRIES - 2 ? 0 : map_hint + size;
+    }
+    return NULL;
+}
+
+// Whether a span covers an entire arena.
+static inline bool span_is_arena(span_t *span) {
+    return (span->flags & (SPAN_FIRST | SPAN_LAST)) == (SPAN_FIRST | SPAN_LAST);
+}
+
+// Add a free span to its bin.
+static void bin_insert(span_t *span) {
+    span_list_push(&bins[span->size - 1], span);
+    bins_mask |= 1u << (span->size - 1);
+    if (span_is_arena(span)) {
+        free_arenas++;
+    }
+}
+
+// Remove a free span from its bin.
+static void bin_remove(span_t *span) {
+    span_list_remove(&bins[span->size - 1], span);
+    if (!bins[span->size - 1]) {
+        bins_mask &= ~(1u << (span->size - 1));
+    }
+    if (span_is_arena(span)) {
+        free_arenas--;
+    }
+}
+
+// Free a span, merging it with free neighbours; returns the arena to the kernel if it becomes completely free.
+static void span_release(span_t *span) {
+    span_t *next = span_next(span);
+    if (next && next->kind == SPAN_FREE) {
+        bin_remove(next);
+        span->size  += next->size;
+        span->flags |= next->flags & SPAN_LAST;
+    }
+    if (span->flags & SPAN_PREV_FREE) {
+        span_t *prev = *(span_t **)((char *)span - sizeof(span_t *));
+        bin_remove(prev);
+        prev->size  += span->size;
+        prev->flags |= span->flags & SPAN_LAST;
+        span         = prev;
+    }
+
+    if (span_is_arena(span) && free_arenas >= UMALLOC_ARENA_KEEP) {
+        syscall_mem_dealloc(span);
+        return;
+    }
+
+    span->kind = SPAN_FREE;
+    span->used = 0;
+    // Footer so the next span can find this one when merging.
+    *(span_t **)((char *)span + span->size * UMALLOC_PAGE_SIZE - sizeof(span_t *)) = span;
+    next = span_next(span);
+    if (next) {
+        next->flags |= SPAN_PREV_FREE;
+    }
+    bin_insert(span);
+}
+
+// Shrink an allocated span to `pages` pages and free the rest.
+static void span_trim(span_t *span, size_t pages) {
+    if (span->size <= pages) {
+        return;
+    }
+    span_t *rest  = (span_t *)((char *)span + pages * UMALLOC_PAGE_SIZE);
+    rest->magic   = UMALLOC_MAGIC;
+    rest->kind    = SPAN_LARGE;
+    rest->flags   = span->flags & SPAN_LAST;
+    rest->size    = span->size - pages;
+    span->flags  &= ~SPAN_LAST;
+    span->size    = pages;
+    span_release(rest);
+}
+
+// Map a new arena and add it to the bins.
+static bool arena_new() {
+    span_t *span = map_pages(UMALLOC_ARENA_SIZE, UMALLOC_PAGE_SIZE);
+    if (!span) {
+        return false;
+    }
+    span->magic = UMALLOC_MAGIC;
+    span->kind  = SPAN_FREE;
+    span->flags = SPAN_FIRST | SPAN_LAST;
+    span->size  = UMALLOC_ARENA_PAGES;
+    bin_insert(span);
+    return true;
+}
+
+// Allocate a span of `pages` pages from the smallest bin that fits.
+static span_t *span_alloc(size_t pages, uint8_t kind) {
+    uint32_t fit = bins_mask & ~((1u << (pages - 1)) - 1);
+    if (!fit) {
+        if (!arena_new()) {
+            return NULL;
+        }
+        fit = bins_mask & ~((1u << (pages - 1)) - 1);
+    }
+    span_t *span = bins[__builtin_ctz(fit)];
+    bin_remove(span);
+    span->kind   = kind;
+    span_t *next = span_next(span);
+    if (next) {
+        next->flags &= ~SPAN_PREV_FREE;
+    }
+    span_trim(span, pages);
+    return span;
+}
+
+
+
+// Allocate an object from a run of a size class.
+static void *run_alloc(uint8_t cls) {
+    span_t *run = runs[cls];
+    if (!run) {
+        run = span_alloc(1, SPAN_RUN);
+        if (!run) {
+            return NULL;
+        }
+        run->cls   = cls;
+        run->used  = 0;
+        run->fresh = 0;
+        run->objs  = NULL;
+        span_list_push(&runs[cls], run);
+    }
+
+    void *obj;
+    if (run->objs) {
+        obj       = run->objs;
+        run->objs = *(void **)obj;
+    } else {
+        obj = (char *)run + UMALLOC_HDR_SIZE + run->fresh * class_size[cls];
+        run->fresh++;
+    }
+    run->used++;
+    if (run->used == class_capacity(cls)) {
+        span_list_remove(&runs[cls], run);
+    }
+    return obj;
+}
+
+// Return an object to its run; frees the run if it is empty and not the only one with free space.
+static void run_free(span_t *run, void *obj) {
+    uint8_t cls   = run->cls;
+    *(void **)obj = run->objs;
+    run->objs     = obj;
+    if (!(run->flags & SPAN_LISTED)) {
+        span_list_push(&runs[cls], run);
+    }
+    run->used--;
+    if (!run->used && (runs[cls] != run || run->next)) {
+        span_list_remove(&runs[cls], run);
+        span_release(run);
+    }
+}
+
+// Return up to `count` cached objects of a size class to their runs.
+static size_t tcache_flush(tcache_t *tc, uint8_t cls, size_t count) {
+    size_t flushed = 0;
+    while (tc->objs[cls] && flushed < count) {
+        void *obj       = tc->objs[cls];
+        tc->objs[cls]   = *(void **)obj;
+        tc->count[cls] -= 1;
+        run_free(span_of(obj), obj);
+        flushed++;
+    }
+    return flushed;
+}
+
+// Return all cached objects to their runs.
+static size_t tcache_flush_all(tcache_t *tc) {
+    size_t flushed = 0;
+    for (uint8_t cls = 0; cls < UMALLOC_CLASSES; cls++) {
+        flushed += tcache_flush(tc, cls, UMALLOC_TCACHE_MAX);
+    }
+    return flushed;
+}
+
+// Free a small object into the thread cache.
+static void small_free(span_t *run, void *obj) {
+    tcache_t *tc  = tcache_get();
+    uint8_t   cls = run->cls;
+    if (tc->count[cls] >= UMALLOC_TCACHE_MAX) {
+        tcache_flush(tc, cls, UMALLOC_TCACHE_MAX / 2);
+    }
+    *(void **)obj = tc->objs[cls];
+    tc->objs[cls] = obj;
+    tc->count[cls]++;
+}
+
+// Map an allocation directly; the header is on the page before the returned pointer.
+static void *direct_alloc(size_t size, size_t align) {
+    size_t offset = align < UMALLOC_PAGE_SIZE ? align_up(UMALLOC_HDR_SIZE, align) : align;
+    if (size > SIZE_MAX / 2 - offset) {
+        return NULL;
+    }
+    char *base = map_pages(offset + size, align < UMALLOC_PAGE_SIZE ? UMALLOC_PAGE_SIZE : align);
+    if (!base) {
+        return NULL;
+    }
+    void   *ptr  = base + offset;
+    span_t *span = (span_t *)(((size_t)ptr - 1) & ~(size_t)(UMALLOC_PAGE_SIZE - 1));
+    span->magic  = UMALLOC_MAGIC;
+    span->kind   = SPAN_DIRECT;
+    span->flags  = 0;
+    span->size   = align_up(offset + size, UMALLOC_PAGE_SIZE);
+    span->objs   = base;
+    return ptr;
+}
+
+// Allocate memory with an alignment of at least `UMALLOC_ALIGN`.
+static void *malloc_impl(size_t size, size_t align) {
+    if (align <= UMALLOC_ALIGN && size <= UMALLOC_SMALL_MAX) {
+        uint8_t   cls = size_to_class(size);
+        tcache_t *tc  = tcache_get();
+        void     *obj = tc->objs[cls];
+        if (obj) {
+            tc->objs[cls] = *(void **)obj;
+            tc->count[cls]--;
+            return obj;
+        }
+        return run_alloc(cls);
+    }
+
+    if (align < UMALLOC_PAGE_SIZE) {
+        size_t offset = align_up(UMALLOC_HDR_SIZE, align);
+        if (size <= UMALLOC_ARENA_SIZE - offset) {
+            span_t *span = span_alloc((offset + size + UMALLOC_PAGE_SIZE - 1) / UMALLOC_PAGE_SIZE, SPAN_LARGE);
+            return span ? (char *)span + offset : NULL;
+        }
+    }
+
+    return direct_alloc(size, align);
+}
+
+// Allocate memory, returning cached objects to the kernel and retrying if out of memory.
+static void *malloc_retry(size_t size, size_t align) {
+    void *ptr = malloc_impl(size, align);
+    if (!ptr && tcache_flush_all(tcache_get())) {
+        ptr = malloc_impl(size, align);
+    }
+    return ptr;
+}
+
+
+
+void *malloc(size_t size) {
+    if (!size) {
+        return NULL;
+    }
+    return malloc_retry(size, UMALLOC_ALIGN);
+}
+
+void free(void *ptr) {
+    if (!ptr) {
+        return;
+    }
+    span_t *span = span_of(ptr);
+    switch (span->kind) {
+        case SPAN_RUN: small_free(span, ptr); break;
+        case SPAN_LARGE: span_release(span); break;
+        case SPAN_DIRECT: syscall_mem_dealloc(span->objs); break;
+        default: __builtin_trap();
+    }
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    size_t total;
+    if (__builtin_mul_overflow(nmemb, size, &total)) {
+        return NULL;
+    }
+    void *ptr = malloc(total);
+    if (ptr) {
+        mem_set(ptr, 0, total);
+    }
+    return ptr;
+}
+
+size_t malloc_usable_size(void *ptr) {
+    if (!ptr) {
+        return 0;
+    }
+    span_t *span = span_of(ptr);
+    switch (span->kind) {
+        case SPAN_RUN: return class_size[span->cls];
+        case SPAN_LARGE: return (char *)span + span->size * UMALLOC_PAGE_SIZE - (char *)ptr;
+        case SPAN_DIRECT: return (char *)span->objs + span->size - (char *)ptr;
+        default: __builtin_trap();
+    }
+}
+
+void *realloc(void *ptr, size_t size) {
+    if (!ptr) {
+        return malloc(size);
+    } else if (!size) {
+        free(ptr);
+        return NULL;
+    }
+
+    span_t *span   = span_of(ptr);
+    size_t  usable = malloc_usable_size(ptr);
+    if (span->kind == SPAN_RUN) {
+        // Stay in place unless the object would fit in a smaller class.
+        if (size <= usable && (!span->cls || size > class_size[span->cls - 1])) {
+            return ptr;
+        }
+    } else if (span->kind == SPAN_LARGE) {
+        size_t offset = (char *)ptr - (char *)span;
+        size_t pages  = (offset + size + UMALLOC_PAGE_SIZE - 1) / UMALLOC_PAGE_SIZE;
+        if (size > UMALLOC_SMALL_MAX && size <= UMALLOC_ARENA_SIZE - offset) {
+            // Grow into the following free span if there is one.
+            span_t *next = span_next(span);
+            if (pages > span->size && next && next->kind == SPAN_FREE && span->size + next->size >= pages) {
+                bin_remove(next);
+                span->size  += next->size;
+                span->flags |= next->flags & SPAN_LAST;
+                next         = span_next(span);
+                if (next) {
+                    next->flags &= ~SPAN_PREV_FREE;
+                }
+            }
+            if (pages <= span->size) {
+                span_trim(span, pages);
+                return ptr;
+            }
+        }
+    } else if (size <= usable && size > usable / 2) {
+        return ptr;
+    }
+
+    void *new_ptr = malloc(size);
+    if (!new_ptr) {
+        return NULL;
+    }
+    mem_copy(new_ptr, ptr, usable < size ? usable : size);
+    free(ptr);
+    return new_ptr;
+}
+
+void *reallocarray(void *ptr, size_t nmemb, size_t size) {
+    size_t total;
+    if (__builtin_mul_overflow(nmemb, size, &total)) {
+        return NULL;
+    }
+    return realloc(ptr, total);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    if (!size || (alignment & (alignment - 1))) {
+        return NULL;
+    }
+    return malloc_retry(size, alignment < UMALLOC_ALIGN ? UMALLOC_ALIGN : alignment);
+}
+
+void malloc_trim() {
+    tcache_flush_all(tcache_get());
+    for (uint8_t cls = 0; cls < UMALLOC_CLASSES; cls++) {
+        span_t *run = runs[cls];
+        if (run && !run->used && !run->next) {
+            span_list_remove(&runs[cls], run);
+            span_release(run);
+        }
+    }
+    span_t *span = bins[UMALLOC_ARENA_PAGES - 1];
+    while (span) {
+        span_t *next = span->next;
+        if (span_is_arena(span)) {
+            bin_remove(span);
+            syscall_mem_dealloc(span);
+        }
+        span = next;
+    }
+}
@@ -0,0 +1,132 @@
+
+// SPDX-License-Identifier: MIT
+
+#include "bench.h"
+#include "syscall.h"
+
+// File the asset is loaded from.
+#define ASSET_PATH "/assetbench.dat"
+// Size of the asset.
+#define ASSET_SIZE (4 * 1024 * 1024)
+// Buffer size used to create the asset.
+#define CHUNK      65536
+// Number of times the asset is loaded with each method.
+#define ROUNDS     8
+// Size of a page of memory.
+#define PAGE_SIZE  4096
+
+
+
+// Get the number of free physical pages in the system.
+unsigned long free_pages() {
+    memstats_t stats;
+    syscall_mem_stats(&stats, sizeof(stats));
+    return stats.free_pages;
+}
+
+// Read an entire asset like a program using it would.
+unsigned long sum(unsigned long const *buf) {
+    unsigned long total = 0;
+    for (size_t i = 0; i < ASSET_SIZE / sizeof(unsigned long); i++) {
+        total += buf[i];
+    }
+    return total;
+}
+
+// Create the asset file; returns false on error.
+bool create() {
+    static unsigned long buf[CHUNK / sizeof(unsigned long)];
+    int                  fd = syscall_fs_open(ASSET_PATH, -1, OFLAGS_WRITEONLY | OFLAGS_CREATE | OFLAGS_TRUNCATE);
+    if (fd < 0) {
+        return false;
+    }
+    for (long off = 0; off < ASSET_SIZE; off += CHUNK) {
+        for (size_t i = 0; i < CHUNK / sizeof(unsigned long); i++) {
+            buf[i] = off + i;
+        }
+        if (syscall_fs_write(fd, buf, CHUNK) != CHUNK) {
+            syscall_fs_close(fd);
+            return false;
+        }
+    }
+    syscall_fs_close(fd);
+    return true;
+}
+
+// Load the asset and read it; returns elapsed microseconds, or 0 on error.
+// If `map` is true, the file is mapped; otherwise, it is read into newly allocated memory.
+// `*extra` is set to the number of pages of memory the loaded asset uses on top of the file itself.
+unsigned long load(bool map, unsigned long *checksum, unsigned long *extra) {
+    unsigned long before = free_pages();
+    int64_t       start  = syscall_sys_uptime();
+    int           fd     = syscall_fs_open(ASSET_PATH, -1, OFLAGS_READONLY);
+    if (fd < 0) {
+        return 0;
+    }
+
+    unsigned long *mem;
+    if (map) {
+        // The mapping stays valid after the file is closed.
+        mem = syscall_mem_map_file(fd, 0, ASSET_SIZE, 0, MEMFLAGS_R);
+    } else {
+        mem = syscall_mem_alloc(0, ASSET_SIZE, 0, MEMFLAGS_RW);
+        if (mem && syscall_fs_read(fd, mem, ASSET_SIZE) != ASSET_SIZE) {
+            syscall_mem_dealloc(mem);
+            mem = NULL;
+        }
+    }
+    syscall_fs_close(fd);
+    if (!mem) {
+        return 0;
+    }
+    *checksum         = sum(mem);
+    unsigned long end = syscall_sys_uptime() - start;
+
+    unsigned long after = free_pages();
+    *extra              = before > after ? before - after : 0;
+    syscall_mem_dealloc(mem);
+    return end ? end : 1;
+}
+
+void report(char const *name, unsigned long time, unsigned long extra) {
+    print(name);
+    print(": ");
+    print_dec(time / ROUNDS);
+    print(" us per load, ");
+    print_dec(extra / ROUNDS * PAGE_SIZE / 1024);
+    print(" KiB extra memory\n");
+}
+
+int main() {
+    if (!create()) {
+        print("Failed to create asset\n");
+        return 1;
+    }
+
+    unsigned long time[2]  = {0};
+    unsigned long extra[2] = {0};
+    unsigned long checksum[2];
+    for (int i = 0; i < ROUNDS; i++) {
+        for (int map = 0; map < 2; map++) {
+            unsigned long pages;
+            unsigned long t = load(map, &checksum[map], &pages);
+            if (!t) {
+                print(map ? "Failed to map asset\n" : "Failed to read asset\n");
+                return 1;
+            }
+            time[map]  += t;
+            extra[map] += pages;
+        }
+        if (checksum[0] != checksum[1]) {
+            print("Mapped asset differs from file\n");
+            return 1;
+        }
+    }
+
+    print("Loading ");
+    print_dec(ASSET_SIZE / 1024);
+    print(" KiB asset\n");
+    report("read", time[0], extra[0]);
+    report("mmap", time[1], extra[1]);
+    return 0;
+}
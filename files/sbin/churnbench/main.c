@@ -0,0 +1,120 @@
+
+// SPDX-License-Identifier: MIT
+
+#include "bench.h"
+#include "sys/wait.h"
+#include "syscall.h"
+
+// Number of processes spawned and exited.
+#define SPAWNS    10000
+// Number of processes spawned first so caches are warm before memory is measured.
+#define WARMUP    100
+// Free pages that may be missing after churning without it counting as a leak; covers caches that grow slowly.
+#define TOLERANCE 128
+// Size of the memory each child maps; spans several page tables.
+#define MAP_SIZE  (4 * 1024 * 1024)
+// Size of a page.
+#define PAGE_SIZE 4096
+// Path of this program; spawned instances run it too.
+#define SELF      "/sbin/churnbench"
+
+
+
+// Get the page table memory of this process in bytes.
+unsigned long page_tables() {
+    proc_memstats_t stats = {0};
+    syscall_mem_proc_stats(0, &stats, sizeof(stats));
+    return stats.page_tables;
+}
+
+// Map, touch and unmap some memory; returns exit code 0 if the page tables shrank back afterwards.
+int child() {
+    unsigned long before = page_tables();
+    char         *mem    = syscall_mem_alloc(0x40000000, MAP_SIZE, 0, MEMFLAGS_RW);
+    if (!mem) {
+        return 1;
+    }
+    for (size_t i = 0; i < MAP_SIZE; i += PAGE_SIZE) {
+        mem[i] = 1;
+    }
+    syscall_mem_dealloc(mem);
+    return page_tables() == before ? 0 : 2;
+}
+
+// Get the number of free pages in the kernel.
+unsigned long free_pages() {
+    memstats_t stats = {0};
+    syscall_mem_stats(&stats, sizeof(stats));
+    return stats.free_pages;
+}
+
+// Spawn children cloned from a template and wait for each to exit.
+// Returns the number that failed, or -1 if one could not be spawned.
+long churn(int template, long count, char const *const *args) {
+    long failed = 0;
+    for (long i = 0; i < count; i++) {
+        int pid = syscall_proc_pclone(template, 2, args);
+        if (pid < 0 || !syscall_proc_pstart(pid)) {
+            return -1;
+        }
+        int status;
+        syscall_proc_waitpid(pid, &status, 0);
+        failed += !WIFEXITED(status) || WEXITSTATUS(status);
+    }
+    return failed;
+}
+
+int main() {
+    // Spawned instances are started with an extra argument; only whether the argument exists is checked.
+    size_t       args_buf[16] = {0};
+    char const **args         = (char const **)args_buf;
+    if (syscall_proc_getargs(sizeof(args_buf), args_buf) <= sizeof(args_buf) && args[0] && args[1]) {
+        return child();
+    }
+
+    char const *child_args[] = {SELF, "child"};
+    int         template     = syscall_proc_pcreate(SELF, 2, child_args);
+    if (template < 0) {
+        print("Failed to create template\n");
+        return 1;
+    }
+
+    long warmup = churn(template, WARMUP, child_args);
+    if (warmup < 0) {
+        syscall_proc_pdestroy(template);
+        print("Failed to spawn processes\n");
+        return 1;
+    }
+    unsigned long before = free_pages();
+    int64_t       start  = syscall_sys_uptime();
+    long          failed = churn(template, SPAWNS, child_args);
+    unsigned long time   = syscall_sys_uptime() - start;
+    unsigned long after  = free_pages();
+    syscall_proc_pdestroy(template);
+    if (failed < 0) {
+        print("Failed to spawn processes\n");
+        return 1;
+    }
+    failed += warmup;
+
+    print("Spawned ");
+    print_dec(SPAWNS);
+    print(" processes in ");
+    print_dec(time);
+    print(" us, ");
+    print_dec(time / SPAWNS);
+    print(" us each\n");
+    print("Free pages: ");
+    print_dec(before);
+    print(" before, ");
+    print_dec(after);
+    print(" after\n");
+    if (failed) {
+        print_dec(failed);
+        print(" processes did not release their page tables\n");
+    }
+    if (after + TOLERANCE < before) {
+        print("Memory leaked while churning processes\n");
+    }
+    return failed || after + TOLERANCE < before;
+}
@@ -0,0 +1,89 @@
+
+// SPDX-License-Identifier: MIT
+
+#include "bench.h"
+#include "syscall.h"
+
+// File copied from.
+#define SRC_PATH "/copybench.src"
+// File copied to.
+#define DST_PATH "/copybench.dst"
+// Buffer size of the read/write loop.
+#define CHUNK    65536
+// Smallest file size tested.
+#define MIN_SIZE (1024 * 1024)
+// Largest file size tested.
+#define MAX_SIZE (64 * 1024 * 1024)
+
+
+
+// Create the source file; returns false on error.
+bool fill(char *buf, long size) {
+    int fd = syscall_fs_open(SRC_PATH, -1, OFLAGS_WRITEONLY | OFLAGS_CREATE | OFLAGS_TRUNCATE);
+    if (fd < 0) {
+        return false;
+    }
+    for (long off = 0; off < size; off += CHUNK) {
+        if (syscall_fs_write(fd, buf, CHUNK) != CHUNK) {
+            syscall_fs_close(fd);
+            return false;
+        }
+    }
+    syscall_fs_close(fd);
+    return true;
+}
+
+// Copy the source file to the destination file; returns elapsed microseconds, or 0 on error.
+// If `in_kernel` is true, the kernel copies the data; otherwise it goes through `buf`.
+unsigned long copy(char *buf, long size, bool in_kernel) {
+    int in  = syscall_fs_open(SRC_PATH, -1, OFLAGS_READONLY);
+    int out = syscall_fs_open(DST_PATH, -1, OFLAGS_WRITEONLY | OFLAGS_CREATE | OFLAGS_TRUNCATE);
+    if (in < 0 || out < 0) {
+        syscall_fs_close(in);
+        syscall_fs_close(out);
+        return 0;
+    }
+
+    int64_t start = syscall_sys_uptime();
+    bool    ok    = true;
+    if (in_kernel) {
+        ok = syscall_fs_copy_range(in, -1, out, -1, size) == size;
+    } else {
+        for (long off = 0; off < size && ok; off += CHUNK) {
+            ok = syscall_fs_read(in, buf, CHUNK) == CHUNK && syscall_fs_write(out, buf, CHUNK) == CHUNK;
+        }
+    }
+    unsigned long time = syscall_sys_uptime() - start;
+
+    syscall_fs_close(in);
+    syscall_fs_close(out);
+    return !ok ? 0 : time ? time : 1;
+}
+
+int main() {
+    static char buf[CHUNK];
+    for (long i = 0; i < CHUNK; i++) {
+        buf[i] = (char)i;
+    }
+
+    for (long size = MIN_SIZE; size <= MAX_SIZE; size *= 4) {
+        if (!fill(buf, size)) {
+            print("Failed to create source file\n");
+            return 1;
+        }
+        unsigned long loop   = copy(buf, size, false);
+        unsigned long kernel = copy(buf, size, true);
+        if (!loop || !kernel) {
+            print("Failed to copy file\n");
+            return 1;
+        }
+
+        print_dec(size / 1024);
+        print(" KiB: read/write loop ");
+        print_rate(size, loop);
+        print(", copy_range ");
+        print_rate(size, kernel);
+        print("\n");
+    }
+    return 0;
+}
@@ -0,0 +1,45 @@
+
+// SPDX-License-Identifier: MIT
+
+#include "bench.h"
+#include "syscall.h"
+
+// Number of times each process yields.
+#define ROUNDS 10000
+
+
+
+// Yield `ROUNDS` times; returns elapsed microseconds.
+unsigned long yield_loop() {
+    int64_t start = syscall_sys_uptime();
+    for (int i = 0; i < ROUNDS; i++) {
+        syscall_thread_yield();
+    }
+    return syscall_sys_uptime() - start;
+}
+
+int main() {
+    // The child process is started with an extra argument and only yields back to its parent.
+    // Only whether the argument exists is checked.
+    size_t       args_buf[16] = {0};
+    char const **args         = (char const **)args_buf;
+    if (syscall_proc_getargs(sizeof(args_buf), args_buf) <= sizeof(args_buf) && args[0] && args[1]) {
+        yield_loop();
+        return 0;
+    }
+
+    // Without another process, a yield usually returns to the same address space.
+    report_each("Alone", yield_loop(), ROUNDS, "yields");
+
+    // With a second process, every yield switches address space.
+    char const *child_args[] = {"/sbin/ctxbench", "child"};
+    int         child        = syscall_proc_pcreate(child_args[0], 2, child_args);
+    if (child < 0 || !syscall_proc_pstart(child)) {
+        print("Failed to start child process\n");
+        return 1;
+    }
+    report_each("Ping-pong", yield_loop(), ROUNDS, "yields");
+    int status;
+    syscall_proc_waitpid(child, &status, 0);
+    return 0;
+}
@@ -0,0 +1,134 @@
+
+// SPDX-License-Identifier: MIT
+
+#include "bench.h"
+#include "syscall.h"
+
+// Directory all test files are created in.
+#define ROOT      "/fdbench"
+// Number of distinct files; every file is opened many times.
+#define FILES     8
+// Size of each file in bytes.
+#define FILE_SIZE 16384
+// Number of handles open during the many-handles test.
+#define HANDLES   1024
+// Number of handles used during the few-handles test.
+#define FEW       FILES
+// Size of each read in bytes.
+#define READ_SIZE 16
+// Number of reads per test.
+#define READS     4096
+
+
+
+// Get the path of a test file.
+void file_path(char *buf, int index) {
+    char const *root = ROOT "/file";
+    while (*root) *buf++ = *root++;
+    *buf++ = '0' + index / 10 % 10;
+    *buf++ = '0' + index % 10;
+    *buf   = 0;
+}
+
+// State of the PRNG used to pick handles.
+static uint32_t rng_state = 0x12345678;
+
+// Simple xorshift PRNG so the access pattern doesn't favor any handle.
+uint32_t rng() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+// Create the test files; returns false on error.
+bool setup() {
+    int fd = syscall_fs_open(ROOT, -1, OFLAGS_DIRECTORY | OFLAGS_READONLY | OFLAGS_CREATE);
+    if (fd < 0) {
+        return false;
+    }
+    syscall_fs_close(fd);
+
+    char buf[1024];
+    for (size_t i = 0; i < sizeof(buf); i++) {
+        buf[i] = (char)i;
+    }
+    for (int i = 0; i < FILES; i++) {
+        char path[32];
+        file_path(path, i);
+        fd = syscall_fs_open(path, -1, OFLAGS_WRITEONLY | OFLAGS_CREATE);
+        if (fd < 0) {
+            return false;
+        }
+        for (int off = 0; off < FILE_SIZE; off += (int)sizeof(buf)) {
+            if (syscall_fs_write(fd, buf, sizeof(buf)) != sizeof(buf)) {
+                syscall_fs_close(fd);
+                return false;
+            }
+        }
+        syscall_fs_close(fd);
+    }
+    return true;
+}
+
+// Open `count` read handles spread over the test files; returns false on error.
+bool open_handles(int *fds, int count) {
+    for (int i = 0; i < count; i++) {
+        char path[32];
+        file_path(path, i % FILES);
+        fds[i] = syscall_fs_open(path, -1, OFLAGS_READONLY);
+        if (fds[i] < 0) {
+            while (i--) syscall_fs_close(fds[i]);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Do small reads from randomly chosen handles; returns elapsed microseconds or 0 on error.
+unsigned long run(int const *fds, int count) {
+    char    buf[READ_SIZE];
+    int64_t start = syscall_sys_uptime();
+    for (int i = 0; i < READS; i++) {
+        if (syscall_fs_read(fds[rng() % count], buf, READ_SIZE) != READ_SIZE) {
+            return 0;
+        }
+    }
+    return syscall_sys_uptime() - start;
+}
+
+int main() {
+    static int fds[HANDLES];
+    if (!setup()) {
+        print("Failed to create test files\n");
+        return 1;
+    }
+
+    // Baseline with only a few handles open.
+    if (!open_handles(fds, FEW)) {
+        print("Failed to open files\n");
+        return 1;
+    }
+    unsigned long few = run(fds, FEW);
+    for (int i = 0; i < FEW; i++) {
+        syscall_fs_close(fds[i]);
+    }
+
+    // The same reads with many handles open; the time per read should stay the same.
+    if (!open_handles(fds, HANDLES)) {
+        print("Failed to open files\n");
+        return 1;
+    }
+    unsigned long many = run(fds, HANDLES);
+    for (int i = 0; i < HANDLES; i++) {
+        syscall_fs_close(fds[i]);
+    }
+
+    if (!few || !many) {
+        print("Read failed\n");
+        return 1;
+    }
+    report_each("8 handles", few, READS, "reads");
+    report_each("1024 handles", many, READS, "reads");
+    return 0;
+}
@@ -0,0 +1,73 @@
+
+// SPDX-License-Identifier: MIT
+
+#include "bench.h"
+#include "syscall.h"
+
+// Scratch file that is written and read back.
+#define PATH      "/iobench.tmp"
+// Largest buffer size tested.
+#define MAX_BUF   (1024 * 1024)
+// Smallest buffer size tested.
+#define MIN_BUF   64
+// Number of bytes transferred for each buffer size.
+#define TOTAL     (4 * 1024 * 1024)
+// Maximum number of system calls per buffer size, so small buffers don't take forever.
+#define MAX_CALLS 4096
+
+
+
+// Write or read `calls` times `size` bytes; returns elapsed microseconds, or 0 on error.
+unsigned long transfer(char *buf, long size, int calls, bool write) {
+    int fd = syscall_fs_open(PATH, -1, write ? OFLAGS_WRITEONLY | OFLAGS_CREATE | OFLAGS_TRUNCATE : OFLAGS_READONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    int64_t start = syscall_sys_uptime();
+    for (int i = 0; i < calls; i++) {
+        long res = write ? syscall_fs_write(fd, buf, size) : syscall_fs_read(fd, buf, size);
+        if (res != size) {
+            syscall_fs_close(fd);
+            return 0;
+        }
+    }
+    unsigned long time = syscall_sys_uptime() - start;
+    syscall_fs_close(fd);
+    return time ? time : 1;
+}
+
+int main() {
+    char *buf = syscall_mem_alloc(0, MAX_BUF, 0, MEMFLAGS_RW);
+    if (!buf) {
+        print("Out of memory\n");
+        return 1;
+    }
+    for (long i = 0; i < MAX_BUF; i++) {
+        buf[i] = (char)i;
+    }
+
+    for (long size = MIN_BUF; size <= MAX_BUF; size *= 4) {
+        int           calls = TOTAL / size < MAX_CALLS ? TOTAL / size : MAX_CALLS;
+        unsigned long bytes = (unsigned long)size * calls;
+        unsigned long wtime = transfer(buf, size, calls, true);
+        unsigned long rtime = wtime ? transfer(buf, size, calls, false) : 0;
+        if (!rtime) {
+            print("I/O error\n");
+            return 1;
+        }
+        print_dec(size);
+        print(" B: write ");
+        print_rate(bytes, wtime);
+        print(", read ");
+        print_rate(bytes, rtime);
+        print("\n");
+    }
+
+    // Leave the scratch file empty.
+    int fd = syscall_fs_open(PATH, -1, OFLAGS_WRITEONLY | OFLAGS_TRUNCATE);
+    if (fd >= 0) {
+        syscall_fs_close(fd);
+    }
+    syscall_mem_dealloc(buf);
+    return 0;
+}
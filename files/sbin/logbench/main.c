@@ -0,0 +1,86 @@
+
+// SPDX-License-Identifier: MIT
+
+#include "bench.h"
+#include "syscall.h"
+
+// Scratch log file.
+#define PATH    "/logbench.tmp"
+// Number of records written per method.
+#define RECORDS 20000
+// Size of the message in each record.
+#define MSG_LEN 48
+
+// Header in front of every log record.
+typedef struct {
+    // Time the record was made.
+    int64_t  time;
+    // Record sequence number.
+    uint32_t seq;
+    // Length of the message that follows.
+    uint32_t len;
+} rec_hdr_t;
+
+
+
+// Log records using the given method; returns elapsed microseconds, or 0 on error.
+// 0: separate writes for header and message, 1: one vectored write, 2: positional write of a copied record.
+unsigned long run(int method, char const *msg) {
+    int fd = syscall_fs_open(PATH, -1, OFLAGS_WRITEONLY | OFLAGS_CREATE | OFLAGS_TRUNCATE);
+    if (fd < 0) {
+        return 0;
+    }
+
+    long    rec_len = sizeof(rec_hdr_t) + MSG_LEN;
+    int64_t start   = syscall_sys_uptime();
+    for (uint32_t i = 0; i < RECORDS; i++) {
+        rec_hdr_t hdr = {syscall_sys_uptime(), i, MSG_LEN};
+        bool      ok;
+        if (method == 0) {
+            ok = syscall_fs_write(fd, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+                 syscall_fs_write(fd, msg, MSG_LEN) == MSG_LEN;
+        } else if (method == 1) {
+            iovec_t iov[2] = {{&hdr, sizeof(hdr)}, {(void *)msg, MSG_LEN}};
+            ok             = syscall_fs_writev(fd, iov, 2) == rec_len;
+        } else {
+            char rec[sizeof(rec_hdr_t) + MSG_LEN];
+            for (size_t j = 0; j < sizeof(hdr); j++) {
+                rec[j] = ((char const *)&hdr)[j];
+            }
+            for (size_t j = 0; j < MSG_LEN; j++) {
+                rec[sizeof(hdr) + j] = msg[j];
+            }
+            ok = syscall_fs_pwrite(fd, rec, rec_len, (long)i * rec_len) == rec_len;
+        }
+        if (!ok) {
+            syscall_fs_close(fd);
+            return 0;
+        }
+    }
+    unsigned long time = syscall_sys_uptime() - start;
+    syscall_fs_close(fd);
+    return time ? time : 1;
+}
+
+int main() {
+    static char const *const names[] = {"write + write", "writev", "pwrite"};
+    char                     msg[MSG_LEN];
+    for (int i = 0; i < MSG_LEN; i++) {
+        msg[i] = 'a' + i % 26;
+    }
+
+    for (int method = 0; method < 3; method++) {
+        unsigned long time = run(method, msg);
+        if (!time) {
+            print("Failed to write log\n");
+            return 1;
+        }
+        print(names[method]);
+        print(": ");
+        print_dec((uint64_t)RECORDS * 1000000 / time);
+        print(" records/s, ");
+        print_dec(time * 1000 / RECORDS);
+        print(" ns per record\n");
+    }
+    return 0;
+}
@@ -0,0 +1,132 @@
+
+// SPDX-License-Identifier: MIT
+
+#include "bench.h"
+#include "syscall.h"
+
+// Directory all test files are created in.
+#define ROOT    "/lookupbench"
+// Number of nested directories above the deep file.
+#define DEPTH   8
+// Number of files in the wide directory.
+#define WIDTH   64
+// Number of lookups per test.
+#define LOOKUPS 4096
+
+
+
+// Append a string to a path; returns the new end of the path.
+char *append(char *end, char const *str) {
+    while (*str) *end++ = *str++;
+    *end = 0;
+    return end;
+}
+
+// Append a two-digit number to a path; returns the new end of the path.
+char *append_num(char *end, int num) {
+    *end++ = '0' + num / 10 % 10;
+    *end++ = '0' + num % 10;
+    *end   = 0;
+    return end;
+}
+
+// Open and immediately close a path; returns whether it could be opened.
+bool open_close(char const *path, int oflags) {
+    int fd = syscall_fs_open(path, -1, oflags);
+    if (fd < 0) {
+        return false;
+    }
+    syscall_fs_close(fd);
+    return true;
+}
+
+// Create the deep and wide directory trees; returns false on error.
+bool setup(char *deep_path) {
+    char *end = append(deep_path, ROOT);
+    if (!open_close(deep_path, OFLAGS_DIRECTORY | OFLAGS_READONLY | OFLAGS_CREATE)) {
+        return false;
+    }
+    for (int i = 0; i < DEPTH; i++) {
+        end = append_num(append(end, "/dir"), i);
+        if (!open_close(deep_path, OFLAGS_DIRECTORY | OFLAGS_READONLY | OFLAGS_CREATE)) {
+            return false;
+        }
+    }
+    append(end, "/file");
+    if (!open_close(deep_path, OFLAGS_WRITEONLY | OFLAGS_CREATE)) {
+        return false;
+    }
+
+    char  wide_path[64];
+    char *wide_end = append(wide_path, ROOT "/wide");
+    if (!open_close(wide_path, OFLAGS_DIRECTORY | OFLAGS_READONLY | OFLAGS_CREATE)) {
+        return false;
+    }
+    for (int i = 0; i < WIDTH; i++) {
+        append_num(append(wide_end, "/file"), i);
+        if (!open_close(wide_path, OFLAGS_WRITEONLY | OFLAGS_CREATE)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Look up the deep file repeatedly; returns elapsed microseconds or 0 on error.
+unsigned long run_deep(char const *deep_path) {
+    int64_t start = syscall_sys_uptime();
+    for (int i = 0; i < LOOKUPS; i++) {
+        if (!open_close(deep_path, OFLAGS_READONLY)) {
+            return 0;
+        }
+    }
+    return syscall_sys_uptime() - start;
+}
+
+// Look up every file in the wide directory in turn, like a stat of each entry in a listing.
+// Returns elapsed microseconds or 0 on error.
+unsigned long run_wide() {
+    char    path[64];
+    char   *end   = append(path, ROOT "/wide/file");
+    int64_t start = syscall_sys_uptime();
+    for (int i = 0; i < LOOKUPS; i++) {
+        append_num(end, i % WIDTH);
+        if (!open_close(path, OFLAGS_READONLY)) {
+            return 0;
+        }
+    }
+    return syscall_sys_uptime() - start;
+}
+
+// Look up files that don't exist, like searching a path list for a program.
+// Returns elapsed microseconds or 0 on error.
+unsigned long run_missing() {
+    char    path[64];
+    char   *end   = append(path, ROOT "/wide/missing");
+    int64_t start = syscall_sys_uptime();
+    for (int i = 0; i < LOOKUPS; i++) {
+        append_num(end, i % WIDTH);
+        if (open_close(path, OFLAGS_READONLY)) {
+            return 0;
+        }
+    }
+    return syscall_sys_uptime() - start;
+}
+
+int main() {
+    char deep_path[128];
+    if (!setup(deep_path)) {
+        print("Failed to create test files\n");
+        return 1;
+    }
+    unsigned long deep    = run_deep(deep_path);
+    unsigned long wide    = run_wide();
+    unsigned long missing = run_missing();
+    if (!deep || !wide || !missing) {
+        print("Lookup failed\n");
+        return 1;
+    }
+    report_each("Deep path", deep, LOOKUPS, "lookups");
+    report_each("Wide directory", wide, LOOKUPS, "lookups");
+    report_each("Missing files", missing, LOOKUPS, "lookups");
+    return 0;
+}
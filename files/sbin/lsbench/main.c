@@ -0,0 +1,170 @@
+
+// SPDX-License-Identifier: MIT
+
+#include "bench.h"
+#include "syscall.h"
+
+// Directory all test files are created in.
+#define ROOT      "/lsbench"
+// Number of files in the directory.
+#define ENTRIES   10000
+// Size of the buffer `SYSCALL_FS_GETDENTS` reads the whole directory into.
+#define DENTS_BUF (512 * 1024)
+// Size of the buffer `SYSCALL_FS_GETDENTS_STAT` reads part of the directory into at a time.
+#define STAT_BUF  (16 * 1024)
+
+// Header of a `dirent_t` record as read by `SYSCALL_FS_GETDENTS`.
+typedef struct {
+    // Length of the file entry record.
+    long record_len;
+    // Inode number.
+    long inode;
+    // Node is a directory.
+    bool is_dir;
+    // Node is a symbolic link.
+    bool is_symlink;
+    // Length of the filename.
+    long name_len;
+    // Filename.
+    char name[];
+} dirent_hdr_t;
+
+
+
+// Append a string to a path; returns the new end of the path.
+char *append(char *end, char const *str) {
+    while (*str) *end++ = *str++;
+    *end = 0;
+    return end;
+}
+
+// Append a five-digit number to a path; returns the new end of the path.
+char *append_num(char *end, int num) {
+    for (int div = 10000; div; div /= 10) {
+        *end++ = '0' + num / div % 10;
+    }
+    *end = 0;
+    return end;
+}
+
+// Create a file in the test directory, which also changes the directory so its listing has to be read again.
+// Returns false on error.
+bool create(char const *prefix, int num) {
+    char path[64];
+    append_num(append(append(path, ROOT "/"), prefix), num);
+    int fd = syscall_fs_open(path, -1, OFLAGS_WRITEONLY | OFLAGS_CREATE);
+    if (fd < 0) {
+        return false;
+    }
+    syscall_fs_close(fd);
+    return true;
+}
+
+// Create the test directory and its files; returns false on error.
+bool setup() {
+    int fd = syscall_fs_open(ROOT, -1, OFLAGS_DIRECTORY | OFLAGS_READONLY | OFLAGS_CREATE);
+    if (fd < 0) {
+        return false;
+    }
+    syscall_fs_close(fd);
+    for (int i = 0; i < ENTRIES; i++) {
+        if (!create("f", i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// List the directory the old way: read all names, then stat every entry by path.
+// Returns the number of entries listed, or -1 on error.
+long list_getdents(long *total_size) {
+    static char buf[DENTS_BUF];
+    int         fd = syscall_fs_open(ROOT, -1, OFLAGS_DIRECTORY | OFLAGS_READONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    long len = syscall_fs_getdents(fd, buf, DENTS_BUF);
+    syscall_fs_close(fd);
+    if (len < 0) {
+        return -1;
+    }
+
+    char  path[64];
+    char *end   = append(path, ROOT "/");
+    long  count = 0;
+    for (long off = 0; off + (long)sizeof(dirent_hdr_t) <= len;) {
+        dirent_hdr_t *ent = (dirent_hdr_t *)(buf + off);
+        if (ent->record_len <= 0 || off + ent->record_len > len) {
+            break;
+        }
+        append(end, ent->name);
+        stat_t stat;
+        if (!syscall_fs_stat(-1, path, &stat)) {
+            return -1;
+        }
+        *total_size += stat.size;
+        count++;
+        off += ent->record_len;
+    }
+    return count;
+}
+
+// List the directory the new way: read names and status together, a buffer at a time.
+// Returns the number of entries listed, or -1 on error.
+long list_getdents_stat(long *total_size) {
+    static char buf[STAT_BUF];
+    int         fd = syscall_fs_open(ROOT, -1, OFLAGS_DIRECTORY | OFLAGS_READONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    long count = 0;
+    long len;
+    while ((len = syscall_fs_getdents_stat(fd, buf, STAT_BUF)) > 0) {
+        for (long off = 0; off < len;) {
+            dirent_stat_t *ent  = (dirent_stat_t *)(buf + off);
+            *total_size        += ent->stat.size;
+            count++;
+            off += ent->record_len;
+        }
+    }
+    syscall_fs_close(fd);
+    return len < 0 ? -1 : count;
+}
+
+// Time one `ls -l`-style listing; `change` is the number of the file to create first, or -1 for none.
+// Returns elapsed microseconds, or 0 on error.
+unsigned long run(bool with_stat, int change, long *count) {
+    if (change >= 0 && !create("new", change)) {
+        return 0;
+    }
+    long    total_size = 0;
+    int64_t start      = syscall_sys_uptime();
+    *count             = with_stat ? list_getdents_stat(&total_size) : list_getdents(&total_size);
+    int64_t time       = syscall_sys_uptime() - start;
+    if (*count < ENTRIES) {
+        return 0;
+    }
+    return time ? (unsigned long)time : 1;
+}
+
+int main() {
+    if (!setup()) {
+        print("Failed to create test files\n");
+        return 1;
+    }
+
+    long          count[4];
+    unsigned long old_changed  = run(false, 0, &count[0]);
+    unsigned long old_cached   = run(false, -1, &count[1]);
+    unsigned long stat_changed = run(true, 1, &count[2]);
+    unsigned long stat_cached  = run(true, -1, &count[3]);
+    if (!old_changed || !old_cached || !stat_changed || !stat_cached) {
+        print("Listing failed\n");
+        return 1;
+    }
+    report_each("getdents + stat, after a change", old_changed, count[0], "entries");
+    report_each("getdents + stat, unchanged", old_cached, count[1], "entries");
+    report_each("getdents_stat, after a change", stat_changed, count[2], "entries");
+    report_each("getdents_stat, unchanged", stat_cached, count[3], "entries");
+    return 0;
+}
@@ -0,0 +1,131 @@
+
+// SPDX-License-Identifier: MIT
+
+#include "bench.h"
+#include "malloc.h"
+#include "syscall.h"
+
+// Number of allocations live at the same time.
+#define BATCH       64
+// Number of times each batch is allocated and freed.
+#define ROUNDS      32
+// Number of different addresses to try for a raw mapping.
+#define TRIES       8
+// Number of pages in each mapping freed by the deallocation storm.
+#define STORM_PAGES 4
+
+
+
+// Virtual address to try for the next raw mapping.
+static size_t raw_hint;
+
+// Allocate with a raw system call; addresses must be unique, so the hint is moved past every mapping.
+void *raw_alloc(size_t size) {
+    size_t pages_size = (size + 4095) & ~(size_t)4095;
+    for (int i = 0; i < TRIES; i++) {
+        void *mem = syscall_mem_alloc(raw_hint, size, 0, MEMFLAGS_RW);
+        if (mem) {
+            raw_hint = (size_t)mem + pages_size;
+            return mem;
+        }
+        raw_hint += pages_size;
+    }
+    return NULL;
+}
+
+void raw_free(void *ptr) {
+    syscall_mem_dealloc(ptr);
+}
+
+// Pseudo-random allocation size between 16 and `max` bytes.
+size_t next_size(unsigned long *seed, size_t max) {
+    *seed = *seed * 1103515245 + 12345;
+    return 16 + (*seed >> 8) % (max - 15);
+}
+
+// Allocate and free batches of random sizes; returns elapsed microseconds or 0 on failure.
+unsigned long run(void *(*alloc)(size_t), void (*dealloc)(void *), size_t max_size) {
+    void         *ptrs[BATCH];
+    unsigned long seed  = 1;
+    int64_t       start = syscall_sys_uptime();
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; i < BATCH; i++) {
+            ptrs[i] = alloc(next_size(&seed, max_size));
+            if (!ptrs[i]) {
+                print("Out of memory\n");
+                return 0;
+            }
+            *(char *)ptrs[i] = i;
+        }
+        for (int i = 0; i < BATCH; i++) {
+            dealloc(ptrs[i]);
+        }
+    }
+    return syscall_sys_uptime() - start;
+}
+
+void compare(char const *name, size_t max_size) {
+    unsigned long heap = run(malloc, free, max_size);
+    unsigned long raw  = run(raw_alloc, raw_free, max_size);
+    print(name);
+    print(": malloc ");
+    print_dec(heap);
+    print(" us, syscall ");
+    print_dec(raw);
+    print(" us for ");
+    print_dec(BATCH * ROUNDS);
+    print(" allocations\n");
+}
+
+// Map and touch a batch of regions, then time how long it takes to unmap them all.
+void storm() {
+    void *ptrs[BATCH];
+    for (int i = 0; i < BATCH; i++) {
+        ptrs[i] = raw_alloc(STORM_PAGES * 4096);
+        if (!ptrs[i]) {
+            print("Out of memory\n");
+            return;
+        }
+        for (int j = 0; j < STORM_PAGES; j++) {
+            ((char *)ptrs[i])[j * 4096] = j;
+        }
+    }
+    int64_t start = syscall_sys_uptime();
+    for (int i = 0; i < BATCH; i++) {
+        syscall_mem_dealloc(ptrs[i]);
+    }
+    unsigned long elapsed = syscall_sys_uptime() - start;
+    print("Deallocation storm: ");
+    print_dec(elapsed);
+    print(" us for ");
+    print_dec(BATCH);
+    print(" mappings of ");
+    print_dec(STORM_PAGES);
+    print(" pages\n");
+}
+
+// Print how much of the process' reserved memory is actually resident.
+void print_mem(char const *when) {
+    proc_memstats_t stats = {0};
+    syscall_mem_proc_stats(0, &stats, sizeof(stats));
+    print(when);
+    print(": ");
+    print_dec(stats.resident / 1024);
+    print(" of ");
+    print_dec(stats.reserved / 1024);
+    print(" KiB resident, peak ");
+    print_dec(stats.peak_resident / 1024);
+    print(" KiB\n");
+}
+
+int main() {
+    print_mem("Start");
+    compare("16-256 bytes", 256);
+    compare("16-4096 bytes", 4096);
+    compare("16-32768 bytes", 32768);
+    storm();
+    print_mem("Before trim");
+    malloc_trim();
+    print_mem("After trim");
+    return 0;
+}
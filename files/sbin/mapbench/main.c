@@ -0,0 +1,91 @@
+
+// SPDX-License-Identifier: MIT
+
+#include "bench.h"
+#include "syscall.h"
+
+// Size of a page.
+#define PAGE_SIZE 4096
+// Number of mappings made at once.
+#define MAPS      4096
+
+
+
+// Print the time one phase took.
+void print_phase(char const *name, int64_t start, int64_t end, int count) {
+    print(name);
+    print(": ");
+    print_dec(end - start);
+    print(" us for ");
+    print_dec(count);
+    print("\n");
+}
+
+// One-page mappings that are tested.
+static char *maps[MAPS];
+
+int main() {
+    // Map with no address hint, so every mapping goes through the free range search.
+    int64_t start = syscall_sys_uptime();
+    for (int i = 0; i < MAPS; i++) {
+        maps[i] = syscall_mem_alloc(0, PAGE_SIZE, 0, MEMFLAGS_RW);
+        if (!maps[i]) {
+            print("Out of memory\n");
+            return 1;
+        }
+    }
+    int64_t mapped = syscall_sys_uptime();
+
+    // The first access to every page looks up its region in the page fault handler.
+    for (int i = 0; i < MAPS; i++) {
+        *maps[i] = 1;
+    }
+    int64_t touched = syscall_sys_uptime();
+
+    // Look up every region by address.
+    for (int i = 0; i < MAPS; i++) {
+        if (syscall_mem_size(maps[i]) != PAGE_SIZE) {
+            print("Wrong size\n");
+            return 1;
+        }
+    }
+    int64_t sized = syscall_sys_uptime();
+
+    // Punch holes and fill them again; the search should find the holes instead of growing the address space.
+    char *highest = 0;
+    for (int i = 0; i < MAPS; i++) {
+        if (maps[i] > highest) {
+            highest = maps[i];
+        }
+    }
+    for (int i = 0; i < MAPS; i += 2) {
+        syscall_mem_dealloc(maps[i]);
+    }
+    int64_t holes  = syscall_sys_uptime();
+    int     reused = 0;
+    for (int i = 0; i < MAPS; i += 2) {
+        maps[i]  = syscall_mem_alloc(0, PAGE_SIZE, 0, MEMFLAGS_RW);
+        reused  += maps[i] && maps[i] < highest;
+    }
+    int64_t refilled = syscall_sys_uptime();
+
+    for (int i = 0; i < MAPS; i++) {
+        if (maps[i]) {
+            syscall_mem_dealloc(maps[i]);
+        }
+    }
+    int64_t unmapped = syscall_sys_uptime();
+
+    print_phase("Map", start, mapped, MAPS);
+    print_phase("First touch", mapped, touched, MAPS);
+    print_phase("Size lookup", touched, sized, MAPS);
+    print_phase("Unmap half", sized, holes, MAPS / 2);
+    print_phase("Refill holes", holes, refilled, MAPS / 2);
+    print_phase("Unmap all", refilled, unmapped, MAPS);
+    print("Holes reused: ");
+    print_dec(reused);
+    print(" of ");
+    print_dec(MAPS / 2);
+    print("\n");
+    return 0;
+}
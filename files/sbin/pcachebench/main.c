@@ -0,0 +1,90 @@
+
+// SPDX-License-Identifier: MIT
+
+#include "bench.h"
+#include "syscall.h"
+
+// Scratch file holding the working set.
+// Point this at a block-backed mount; ramfs files already live in memory and bypass the page cache.
+#define PATH    "/pcachebench.tmp"
+// Size of each read in bytes.
+#define CHUNK   4096
+// Smallest working set tested.
+#define MIN_SET (1024 * 1024)
+// Largest working set tested; larger than the page cache so eviction is measured too.
+#define MAX_SET (8 * 1024 * 1024)
+// Number of times each working set is read.
+#define PASSES  4
+
+
+
+// Write the working set to the scratch file; returns false on error.
+bool fill(char *buf, long size) {
+    int fd = syscall_fs_open(PATH, -1, OFLAGS_WRITEONLY | OFLAGS_CREATE | OFLAGS_TRUNCATE);
+    if (fd < 0) {
+        return false;
+    }
+    for (long off = 0; off < size; off += CHUNK) {
+        if (syscall_fs_write(fd, buf, CHUNK) != CHUNK) {
+            syscall_fs_close(fd);
+            return false;
+        }
+    }
+    syscall_fs_close(fd);
+    return true;
+}
+
+// Read the whole working set once; returns elapsed microseconds, or 0 on error.
+unsigned long read_pass(char *buf, long size) {
+    int fd = syscall_fs_open(PATH, -1, OFLAGS_READONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    int64_t start = syscall_sys_uptime();
+    for (long off = 0; off < size; off += CHUNK) {
+        if (syscall_fs_read(fd, buf, CHUNK) != CHUNK) {
+            syscall_fs_close(fd);
+            return 0;
+        }
+    }
+    unsigned long time = syscall_sys_uptime() - start;
+    syscall_fs_close(fd);
+    return time ? time : 1;
+}
+
+int main() {
+    static char buf[CHUNK];
+    for (long i = 0; i < CHUNK; i++) {
+        buf[i] = (char)i;
+    }
+
+    for (long size = MIN_SET; size <= MAX_SET; size *= 2) {
+        if (!fill(buf, size)) {
+            print("Failed to write working set\n");
+            return 1;
+        }
+
+        // The first pass fills the cache, the others should be served from it.
+        unsigned long first = read_pass(buf, size);
+        unsigned long rest  = 0;
+        for (int i = 1; i < PASSES && first; i++) {
+            unsigned long time = read_pass(buf, size);
+            if (!time) {
+                first = 0;
+            }
+            rest += time;
+        }
+        if (!first) {
+            print("Failed to read working set\n");
+            return 1;
+        }
+
+        print_dec(size / 1024);
+        print(" KiB working set: first pass ");
+        print_rate(size, first);
+        print(", later passes ");
+        print_rate((unsigned long)size * (PASSES - 1), rest);
+        print("\n");
+    }
+    return 0;
+}
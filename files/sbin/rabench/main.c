@@ -0,0 +1,75 @@
+
+// SPDX-License-Identifier: MIT
+
+#include "bench.h"
+#include "syscall.h"
+
+// Scratch file that is written and read back.
+// Point this at a block-backed mount; readahead only applies to files on block devices.
+#define PATH  "/rabench.tmp"
+// Size of the scratch file.
+#define SIZE  (64 * 1024 * 1024)
+// Size of each read and write.
+#define CHUNK 4096
+
+
+
+// Write the scratch file; returns false on error.
+bool fill(char *buf) {
+    int fd = syscall_fs_open(PATH, -1, OFLAGS_WRITEONLY | OFLAGS_CREATE | OFLAGS_TRUNCATE);
+    if (fd < 0) {
+        return false;
+    }
+    for (long off = 0; off < SIZE; off += CHUNK) {
+        if (syscall_fs_write(fd, buf, CHUNK) != CHUNK) {
+            syscall_fs_close(fd);
+            return false;
+        }
+    }
+    syscall_fs_close(fd);
+    return true;
+}
+
+// Read the scratch file from start to end; returns elapsed microseconds, or 0 on error.
+// `OFLAGS_RANDOM` in `oflags` disables readahead.
+unsigned long read_all(char *buf, int oflags) {
+    int fd = syscall_fs_open(PATH, -1, OFLAGS_READONLY | oflags);
+    if (fd < 0) {
+        return 0;
+    }
+    int64_t start = syscall_sys_uptime();
+    for (long off = 0; off < SIZE; off += CHUNK) {
+        if (syscall_fs_read(fd, buf, CHUNK) != CHUNK) {
+            syscall_fs_close(fd);
+            return 0;
+        }
+    }
+    unsigned long time = syscall_sys_uptime() - start;
+    syscall_fs_close(fd);
+    return time ? time : 1;
+}
+
+int main() {
+    static char buf[CHUNK];
+    for (long i = 0; i < CHUNK; i++) {
+        buf[i] = (char)i;
+    }
+    if (!fill(buf)) {
+        print("Failed to write test file\n");
+        return 1;
+    }
+
+    // The file is much larger than the page cache, so neither run benefits from the other.
+    unsigned long without = read_all(buf, OFLAGS_RANDOM);
+    unsigned long with    = read_all(buf, 0);
+    if (!without || !with) {
+        print("Failed to read test file\n");
+        return 1;
+    }
+    print("Without readahead: ");
+    print_rate(SIZE, without);
+    print("\nWith readahead:    ");
+    print_rate(SIZE, with);
+    print("\n");
+    return 0;
+}
@@ -0,0 +1,126 @@
+
+// SPDX-License-Identifier: MIT
+
+#include "bench.h"
+#include "ioring.h"
+#include "syscall.h"
+
+// Scratch file that is read.
+#define PATH      "/ringbench.tmp"
+// Size of each read in bytes.
+#define CHUNK     4096
+// Size of the scratch file.
+#define FILE_SIZE (1024 * 1024)
+// Number of reads per measurement.
+#define OPS       4096
+// Largest number of reads submitted at once.
+#define MAX_BATCH IORING_SQ_ENTRIES
+
+
+
+// Print a number of operations per second.
+void print_ops(unsigned long ops, unsigned long us) {
+    print_dec(us ? (uint64_t)ops * 1000000 / us : 0);
+    print(" ops/s");
+}
+
+// Write the scratch file; returns false on error.
+bool fill(char *buf) {
+    int fd = syscall_fs_open(PATH, -1, OFLAGS_WRITEONLY | OFLAGS_CREATE | OFLAGS_TRUNCATE);
+    if (fd < 0) {
+        return false;
+    }
+    for (long off = 0; off < FILE_SIZE; off += CHUNK) {
+        if (syscall_fs_write(fd, buf, CHUNK) != CHUNK) {
+            syscall_fs_close(fd);
+            return false;
+        }
+    }
+    syscall_fs_close(fd);
+    return true;
+}
+
+// Do `OPS` reads with one syscall each; returns elapsed microseconds, or 0 on error.
+unsigned long sync_reads(int fd, char *buf) {
+    int64_t start = syscall_sys_uptime();
+    for (long i = 0; i < OPS; i++) {
+        if (syscall_fs_pread(fd, buf, CHUNK, i * CHUNK % FILE_SIZE) != CHUNK) {
+            return 0;
+        }
+    }
+    unsigned long time = syscall_sys_uptime() - start;
+    return time ? time : 1;
+}
+
+// Do `OPS` reads through the ring, submitting `batch` at a time and reaping them before the next batch.
+// Returns elapsed microseconds, or 0 on error.
+unsigned long ring_reads(ioring_queue_t *queue, int fd, char *bufs, int batch) {
+    int64_t start = syscall_sys_uptime();
+    for (long i = 0; i < OPS; i += batch) {
+        for (int j = 0; j < batch; j++) {
+            ioring_sqe_t *sqe = ioring_get_sqe(queue);
+            if (!sqe) {
+                return 0;
+            }
+            ioring_prep_read(sqe, fd, bufs + j * CHUNK, CHUNK, (i + j) * CHUNK % FILE_SIZE, j);
+        }
+        ioring_submit(queue);
+        ioring_wait_cqes(queue, batch, -1);
+        for (int j = 0; j < batch; j++) {
+            ioring_cqe_t *cqe = ioring_wait_cqe(queue);
+            if (!cqe || cqe->res != CHUNK) {
+                return 0;
+            }
+            ioring_cqe_seen(queue);
+        }
+    }
+    unsigned long time = syscall_sys_uptime() - start;
+    return time ? time : 1;
+}
+
+int main() {
+    static char bufs[MAX_BATCH * CHUNK];
+    for (long i = 0; i < CHUNK; i++) {
+        bufs[i] = (char)i;
+    }
+    if (!fill(bufs)) {
+        print("Failed to write scratch file\n");
+        return 1;
+    }
+
+    ioring_queue_t queue;
+    if (!ioring_queue_init(&queue)) {
+        print("Failed to create I/O ring\n");
+        return 1;
+    }
+    int fd = syscall_fs_open(PATH, -1, OFLAGS_READONLY);
+    if (fd < 0) {
+        print("Failed to open scratch file\n");
+        return 1;
+    }
+
+    unsigned long sync = sync_reads(fd, bufs);
+    if (!sync) {
+        print("Synchronous reads failed\n");
+        return 1;
+    }
+    print("Synchronous 4 KiB reads: ");
+    print_ops(OPS, sync);
+    print("\n");
+
+    for (int batch = 1; batch <= MAX_BATCH; batch *= 2) {
+        unsigned long ring = ring_reads(&queue, fd, bufs, batch);
+        if (!ring) {
+            print("Ring reads failed\n");
+            return 1;
+        }
+        print("Ring 4 KiB reads, batches of ");
+        print_dec(batch);
+        print(": ");
+        print_ops(OPS, ring);
+        print("\n");
+    }
+
+    syscall_fs_close(fd);
+    return 0;
+}
@@ -0,0 +1,173 @@
+
+// SPDX-License-Identifier: MIT
+
+#include "bench.h"
+#include "syscall.h"
+
+// Size of a frame passed from the producer to the consumer.
+#define FRAME_SIZE (256 * 1024)
+// Number of frames passed with each method.
+#define FRAMES     64
+// File that holds the shared memory IDs for the consumer.
+#define ID_PATH    "/shmbench.id"
+// File that frames are passed through for the file-based method.
+#define DATA_PATH  "/shmbench.dat"
+// Virtual address to map the handoff counters at; the frame is mapped right after.
+#define MAP_BASE   0x50000000
+
+// Counters used to hand frames between the processes.
+typedef struct {
+    // Number of frames made available by the producer.
+    unsigned produced;
+    // Number of frames finished by the consumer.
+    unsigned consumed;
+} ctl_t;
+
+
+
+// Handoff counters; shared between both processes.
+static ctl_t                 *ctl;
+// Frame buffer; read-write for the producer and read-only for the consumer.
+static unsigned long         *frame;
+// Private buffer for the file-based method.
+static unsigned long          local[FRAME_SIZE / sizeof(unsigned long)];
+// Sum of all consumed frames, so reading them is not optimized away.
+static volatile unsigned long checksum;
+
+// Wait until a counter reaches a value.
+void wait_for(unsigned *counter, unsigned value) {
+    while (__atomic_load_n(counter, __ATOMIC_ACQUIRE) < value) {
+        syscall_thread_yield();
+    }
+}
+
+// Fill a frame with a pattern that depends on the frame number.
+void fill(unsigned long *buf, unsigned n) {
+    for (size_t i = 0; i < FRAME_SIZE / sizeof(unsigned long); i++) {
+        buf[i] = n + i;
+    }
+}
+
+// Read an entire frame.
+unsigned long sum(unsigned long const *buf) {
+    unsigned long total = 0;
+    for (size_t i = 0; i < FRAME_SIZE / sizeof(unsigned long); i++) {
+        total += buf[i];
+    }
+    return total;
+}
+
+// Consume frames; first through shared memory and then through a file.
+int consumer() {
+    int ids[2];
+    int fd = syscall_fs_open(ID_PATH, -1, OFLAGS_READONLY);
+    if (fd < 0 || syscall_fs_read(fd, ids, sizeof(ids)) != (long)sizeof(ids)) {
+        return 1;
+    }
+    syscall_fs_close(fd);
+    ctl   = syscall_mem_shm_map(ids[0], MAP_BASE, MEMFLAGS_RW);
+    frame = syscall_mem_shm_map(ids[1], MAP_BASE + 4096, MEMFLAGS_R);
+    if (!ctl || !frame) {
+        return 1;
+    }
+
+    for (unsigned n = 0; n < FRAMES; n++) {
+        wait_for(&ctl->produced, n + 1);
+        checksum += sum(frame);
+        __atomic_store_n(&ctl->consumed, n + 1, __ATOMIC_RELEASE);
+    }
+    for (unsigned n = FRAMES; n < 2 * FRAMES; n++) {
+        wait_for(&ctl->produced, n + 1);
+        fd = syscall_fs_open(DATA_PATH, -1, OFLAGS_READONLY);
+        for (long pos = 0; pos < FRAME_SIZE;) {
+            long len = syscall_fs_read(fd, (char *)local + pos, FRAME_SIZE - pos);
+            if (len <= 0) {
+                break;
+            }
+            pos += len;
+        }
+        syscall_fs_close(fd);
+        checksum += sum(local);
+        __atomic_store_n(&ctl->consumed, n + 1, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+// Produce frames through shared memory; returns elapsed microseconds.
+unsigned long produce_shm() {
+    int64_t start = syscall_sys_uptime();
+    for (unsigned n = 0; n < FRAMES; n++) {
+        fill(frame, n);
+        __atomic_store_n(&ctl->produced, n + 1, __ATOMIC_RELEASE);
+        wait_for(&ctl->consumed, n + 1);
+    }
+    return syscall_sys_uptime() - start;
+}
+
+// Produce frames through a file; returns elapsed microseconds.
+unsigned long produce_file() {
+    int64_t start = syscall_sys_uptime();
+    for (unsigned n = FRAMES; n < 2 * FRAMES; n++) {
+        fill(local, n);
+        int fd = syscall_fs_open(DATA_PATH, -1, OFLAGS_WRITEONLY | OFLAGS_CREATE | OFLAGS_TRUNCATE);
+        syscall_fs_write(fd, local, FRAME_SIZE);
+        syscall_fs_close(fd);
+        __atomic_store_n(&ctl->produced, n + 1, __ATOMIC_RELEASE);
+        wait_for(&ctl->consumed, n + 1);
+    }
+    return syscall_sys_uptime() - start;
+}
+
+void report(char const *name, unsigned long time) {
+    print(name);
+    print(": ");
+    print_dec(time);
+    print(" us for ");
+    print_dec(FRAMES);
+    print(" frames, ");
+    print_dec(time ? (unsigned long)FRAMES * FRAME_SIZE / time : 0);
+    print(" MB/s\n");
+}
+
+int main() {
+    // The consumer is started with an extra argument; only whether the argument exists is checked.
+    size_t       args_buf[16] = {0};
+    char const **args         = (char const **)args_buf;
+    if (syscall_proc_getargs(sizeof(args_buf), args_buf) <= sizeof(args_buf) && args[0] && args[1]) {
+        return consumer();
+    }
+
+    // Create the shared memory and tell the consumer where to find it.
+    int ids[2] = {
+        syscall_mem_shm_create(sizeof(ctl_t)),
+        syscall_mem_shm_create(FRAME_SIZE),
+    };
+    if (ids[0] < 0 || ids[1] < 0) {
+        print("Failed to create shared memory\n");
+        return 1;
+    }
+    ctl   = syscall_mem_shm_map(ids[0], MAP_BASE, MEMFLAGS_RW);
+    frame = syscall_mem_shm_map(ids[1], MAP_BASE + 4096, MEMFLAGS_RW);
+    int fd = syscall_fs_open(ID_PATH, -1, OFLAGS_WRITEONLY | OFLAGS_CREATE | OFLAGS_TRUNCATE);
+    if (!ctl || !frame || fd < 0) {
+        print("Failed to map shared memory\n");
+        return 1;
+    }
+    syscall_fs_write(fd, ids, sizeof(ids));
+    syscall_fs_close(fd);
+
+    char const *child_args[] = {"/sbin/shmbench", "consumer"};
+    int         child        = syscall_proc_pcreate(child_args[0], 2, child_args);
+    if (child < 0 || !syscall_proc_pstart(child)) {
+        print("Failed to start consumer process\n");
+        return 1;
+    }
+    report("Shared memory", produce_shm());
+    report("File", produce_file());
+
+    int status;
+    syscall_proc_waitpid(child, &status, 0);
+    syscall_mem_shm_unlink(ids[0]);
+    syscall_mem_shm_unlink(ids[1]);
+    return 0;
+}
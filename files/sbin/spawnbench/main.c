@@ -0,0 +1,81 @@
+
+// SPDX-License-Identifier: MIT
+
+#include "bench.h"
+#include "syscall.h"
+
+// Number of processes spawned with each method.
+#define SPAWNS 32
+// Path of this program; spawned instances run it too.
+#define SELF   "/sbin/spawnbench"
+
+
+
+// Start a pre-start child and wait for it to exit; returns false if it could not be started.
+bool run(int pid) {
+    if (pid < 0 || !syscall_proc_pstart(pid)) {
+        return false;
+    }
+    int status;
+    syscall_proc_waitpid(pid, &status, 0);
+    return true;
+}
+
+// Spawn instances that load the executable themselves; returns elapsed microseconds or 0 on failure.
+unsigned long spawn_create(char const *const *args) {
+    int64_t start = syscall_sys_uptime();
+    for (int i = 0; i < SPAWNS; i++) {
+        if (!run(syscall_proc_pcreate(SELF, 2, args))) {
+            return 0;
+        }
+    }
+    return syscall_sys_uptime() - start;
+}
+
+// Spawn instances cloned from a template, which is loaded by the first clone; returns elapsed microseconds or 0.
+unsigned long spawn_clone(char const *const *args) {
+    int64_t start    = syscall_sys_uptime();
+    int     template = syscall_proc_pcreate(SELF, 2, args);
+    if (template < 0) {
+        return 0;
+    }
+    for (int i = 0; i < SPAWNS; i++) {
+        if (!run(syscall_proc_pclone(template, 2, args))) {
+            syscall_proc_pdestroy(template);
+            return 0;
+        }
+    }
+    syscall_proc_pdestroy(template);
+    return syscall_sys_uptime() - start;
+}
+
+void report(char const *name, unsigned long time) {
+    print(name);
+    print(": ");
+    print_dec(time);
+    print(" us for ");
+    print_dec(SPAWNS);
+    print(" processes, ");
+    print_dec(time / SPAWNS);
+    print(" us each\n");
+}
+
+int main() {
+    // Spawned instances are started with an extra argument; only whether the argument exists is checked.
+    size_t       args_buf[16] = {0};
+    char const **args         = (char const **)args_buf;
+    if (syscall_proc_getargs(sizeof(args_buf), args_buf) <= sizeof(args_buf) && args[0] && args[1]) {
+        return 0;
+    }
+
+    char const   *child_args[] = {SELF, "child"};
+    unsigned long create       = spawn_create(child_args);
+    unsigned long clone        = spawn_clone(child_args);
+    if (!create || !clone) {
+        print("Failed to spawn processes\n");
+        return 1;
+    }
+    report("Load from file", create);
+    report("Clone from template", clone);
+    return 0;
+}
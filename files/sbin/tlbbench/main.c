@@ -0,0 +1,105 @@
+
+// SPDX-License-Identifier: MIT
+
+#include "bench.h"
+#include "syscall.h"
+
+// Size of a page.
+#define PAGE_SIZE 4096
+// Number of pages touched by each pass.
+#define PAGES     4096
+// Number of pages in each mapping when superpages are avoided; too small to hold a superpage.
+#define SMALL_MAP 256
+// Step between pages touched one after another; coprime with `PAGES` so every page is touched.
+#define STRIDE    1021
+// Number of passes over all pages.
+#define ROUNDS    16
+
+
+
+// Virtual address to request for the next mapping; moved past every mapping so they never overlap.
+static size_t map_hint = 0x40000000;
+
+// Map memory at a new virtual address.
+char *map(size_t size) {
+    char *mem = syscall_mem_alloc(map_hint, size, 0, MEMFLAGS_RW);
+    if (mem) {
+        map_hint = (size_t)mem + size;
+    }
+    return mem;
+}
+
+// Touch one byte in every page in a scattered order; returns elapsed microseconds.
+unsigned long touch(char **pages) {
+    // Make every page resident first so the timing only includes TLB misses.
+    for (int i = 0; i < PAGES; i++) {
+        *pages[i] = 1;
+    }
+    int64_t start = syscall_sys_uptime();
+    size_t  page  = 0;
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; i < PAGES; i++) {
+            (*pages[page])++;
+            page = (page + STRIDE) % PAGES;
+        }
+    }
+    return syscall_sys_uptime() - start;
+}
+
+// Pages of the buffer that is being tested.
+static char *pages[PAGES];
+
+// Test with one large mapping that the kernel can back with superpages.
+unsigned long run_large() {
+    char *mem = map(PAGES * PAGE_SIZE);
+    if (!mem) {
+        return 0;
+    }
+    for (int i = 0; i < PAGES; i++) {
+        pages[i] = mem + i * PAGE_SIZE;
+    }
+    unsigned long time = touch(pages);
+    syscall_mem_dealloc(mem);
+    return time;
+}
+
+// Test with many small mappings that can only be backed by normal pages.
+unsigned long run_small() {
+    char *maps[PAGES / SMALL_MAP];
+    for (int i = 0; i < PAGES / SMALL_MAP; i++) {
+        maps[i] = map(SMALL_MAP * PAGE_SIZE);
+        if (!maps[i]) {
+            return 0;
+        }
+        for (int j = 0; j < SMALL_MAP; j++) {
+            pages[i * SMALL_MAP + j] = maps[i] + j * PAGE_SIZE;
+        }
+    }
+    unsigned long time = touch(pages);
+    for (int i = 0; i < PAGES / SMALL_MAP; i++) {
+        syscall_mem_dealloc(maps[i]);
+    }
+    return time;
+}
+
+int main() {
+    unsigned long small = run_small();
+    unsigned long large = run_large();
+
+    proc_memstats_t stats = {0};
+    syscall_mem_proc_stats(0, &stats, sizeof(stats));
+
+    print("Small pages: ");
+    print_dec(small);
+    print(" us, superpages: ");
+    print_dec(large);
+    print(" us for ");
+    print_dec(PAGES * ROUNDS);
+    print(" accesses\n");
+    print("Superpages: ");
+    print_dec(stats.superpages);
+    print(" of ");
+    print_dec(stats.superpages + stats.superpage_misses);
+    print(" possible\n");
+    return 0;
+}
@@ -0,0 +1,90 @@
+
+// SPDX-License-Identifier: MIT
+
+#include "bench.h"
+#include "syscall.h"
+
+// Number of scratch files; each holds one kernel buffer with its own virtual address range.
+#define FILES    64
+// Number of times every file is emptied and refilled.
+#define ROUNDS   32
+// Smallest file size; files this large are stored in virtually contiguous kernel buffers.
+#define MIN_SIZE (16 * 1024)
+// Number of different file sizes, each twice the previous, so the kernel's address space gets fragmented.
+#define SIZES    4
+// Step between files refilled one after another; coprime with `FILES` so every file is refilled each round.
+#define STRIDE   37
+
+
+
+// Path of scratch file `index`.
+void file_path(char *buf, int index) {
+    char const prefix[] = "/vmabench.";
+    for (size_t i = 0; i < sizeof(prefix) - 1; i++) {
+        *buf++ = prefix[i];
+    }
+    *buf++ = '0' + index / 10;
+    *buf++ = '0' + index % 10;
+    *buf   = 0;
+}
+
+// Empty a scratch file and write `size` bytes to it; each resize of its kernel buffer moves it to a new address range.
+// Returns false on error.
+bool refill(int index, char const *buf, long size) {
+    char path[16];
+    file_path(path, index);
+    int fd = syscall_fs_open(path, -1, OFLAGS_WRITEONLY | OFLAGS_CREATE | OFLAGS_TRUNCATE);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = !size || syscall_fs_write(fd, buf, size) == size;
+    syscall_fs_close(fd);
+    return ok;
+}
+
+int main() {
+    long  max = MIN_SIZE << (SIZES - 1);
+    char *buf = syscall_mem_alloc(0, max, 0, MEMFLAGS_RW);
+    if (!buf) {
+        print("Out of memory\n");
+        return 1;
+    }
+    for (long i = 0; i < max; i++) {
+        buf[i] = (char)i;
+    }
+
+    // Fill every file once so the timed rounds free a buffer for every one they allocate.
+    for (int i = 0; i < FILES; i++) {
+        if (!refill(i, buf, MIN_SIZE << (i % SIZES))) {
+            print("I/O error\n");
+            return 1;
+        }
+    }
+
+    int64_t start = syscall_sys_uptime();
+    int     index = 0;
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; i < FILES; i++) {
+            index = (index + STRIDE) % FILES;
+            if (!refill(index, buf, MIN_SIZE << ((index + round) % SIZES))) {
+                print("I/O error\n");
+                return 1;
+            }
+        }
+    }
+    unsigned long time = syscall_sys_uptime() - start;
+
+    // Leave the scratch files empty.
+    for (int i = 0; i < FILES; i++) {
+        refill(i, buf, 0);
+    }
+    syscall_mem_dealloc(buf);
+
+    print_dec(FILES * ROUNDS);
+    print(" buffer reallocations in ");
+    print_dec(time);
+    print(" us, ");
+    print_dec(time / (FILES * ROUNDS));
+    print(" us each\n");
+    return 0;
+}
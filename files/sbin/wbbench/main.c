@@ -0,0 +1,79 @@
+
+// SPDX-License-Identifier: MIT
+
+#include "bench.h"
+#include "syscall.h"
+
+// Scratch file the records are appended to.
+// Point this at a block-backed mount; ramfs files already live in memory and bypass the page cache.
+#define PATH     "/wbbench.tmp"
+// Total amount of data written per record size; more than the hard dirty limit so throttling is measured too.
+#define TOTAL    (4 * 1024 * 1024)
+// Smallest record size tested.
+#define MIN_SIZE 16
+// Largest record size tested.
+#define MAX_SIZE 4096
+
+
+
+// Append `TOTAL` bytes in records of `size` bytes and report throughput and per-write latency.
+// Returns false on error.
+bool run(char const *buf, long size) {
+    int fd = syscall_fs_open(PATH, -1, OFLAGS_WRITEONLY | OFLAGS_CREATE | OFLAGS_TRUNCATE);
+    if (fd < 0) {
+        return false;
+    }
+
+    unsigned long min   = -1;
+    unsigned long max   = 0;
+    int64_t       start = syscall_sys_uptime();
+    for (long off = 0; off < TOTAL; off += size) {
+        int64_t before = syscall_sys_uptime();
+        if (syscall_fs_write(fd, buf, size) != size) {
+            syscall_fs_close(fd);
+            return false;
+        }
+        unsigned long time = syscall_sys_uptime() - before;
+        if (time < min) {
+            min = time;
+        }
+        if (time > max) {
+            max = time;
+        }
+    }
+    unsigned long total = syscall_sys_uptime() - start;
+
+    // Closing the file writes back whatever is still dirty.
+    int64_t before = syscall_sys_uptime();
+    syscall_fs_close(fd);
+    unsigned long close = syscall_sys_uptime() - before;
+
+    print_dec(size);
+    print(" byte writes: ");
+    print_rate(TOTAL, total);
+    print(", latency min ");
+    print_dec(min);
+    print(" us, avg ");
+    print_dec(total / (TOTAL / size));
+    print(" us, max ");
+    print_dec(max);
+    print(" us, close ");
+    print_dec(close);
+    print(" us\n");
+    return true;
+}
+
+int main() {
+    static char buf[MAX_SIZE];
+    for (long i = 0; i < MAX_SIZE; i++) {
+        buf[i] = (char)i;
+    }
+
+    for (long size = MIN_SIZE; size <= MAX_SIZE; size *= 4) {
+        if (!run(buf, size)) {
+            print("Failed to write records\n");
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -14,6 +14,12 @@
 #define MMU_BITS_PER_LEVEL     9
 #define MMU_PAGE_SIZE          0x1000LLU
 #define MMU_SUPPORT_SUPERPAGES 1
+// Bit position of the generation in `mpu_ctx_t::asid`; equal to the maximum ASID width.
+#define MMU_ASID_SHIFT         16
+// Largest range in pages that is flushed from the TLB page by page; larger ranges flush the entire TLB.
+#define MMU_FLUSH_MAX_PAGES    32
+// Bit in `mmu_pte_t::rsw` that marks a copy-on-write page.
+#define MMU_RSW_COW            1
 
 // PBMT modes.
 typedef enum {
@@ -116,6 +122,8 @@ extern size_t mmu_hhdm_size;
 extern int    mmu_levels;
 // Whether RISC-V Svpbmt is supported.
 extern bool   mmu_svpbmt;
+// Number of implemented ASID bits, 0 if ASIDs are not supported.
+extern int    mmu_asid_bits;
 // Virtual page number offset used for HHDM.
 #define mmu_hhdm_vpn   (mmu_hhdm_vaddr / MMU_PAGE_SIZE)
 // Virtual page number of the higher half.
@@ -152,6 +160,7 @@ static inline mmu_pte_t mmu_pte_new_leaf(size_t ppn, uint32_t flags) {
     pte.g         = !!(flags & MEMPROTECT_FLAG_GLOBAL);
     pte.a         = 1;
     pte.d         = 1;
+    pte.rsw       = (flags & MEMPROTECT_FLAG_COW) ? MMU_RSW_COW : 0;
     if (mmu_svpbmt && flags & MEMPROTECT_FLAG_IO) {
         pte.pbmt = RISCV_PBMT_IO;
     } else if (mmu_svpbmt && flags & MEMPROTECT_FLAG_NC) {
@@ -180,7 +189,8 @@ static inline bool mmu_pte_is_leaf(mmu_pte_t pte) {
 }
 // Get memory protection flags encoded in PTE.
 static inline uint32_t mmu_pte_get_flags(mmu_pte_t pte) {
-    return pte.rwx | (pte.g * MEMPROTECT_FLAG_GLOBAL) | (!pte.u * MEMPROTECT_FLAG_KERNEL);
+    return pte.rwx | (pte.g * MEMPROTECT_FLAG_GLOBAL) | (!pte.u * MEMPROTECT_FLAG_KERNEL) |
+           (!!(pte.rsw & MMU_RSW_COW) * MEMPROTECT_FLAG_COW);
 }
 // Get physical page number encoded in PTE.
 static inline size_t mmu_pte_get_ppn(mmu_pte_t pte) {
@@ -198,8 +208,35 @@ static inline void mmu_disable_sum() {
 
 
 
+// Flush TLB entries for a range of virtual addresses on other CPUs.
+// Uses one SBI remote fence call per group of up to 64 consecutive HART IDs.
+void mmu_remote_fence(uint64_t cpus, size_t vaddr, size_t size);
+
+// Get the bit for a CPU in `mpu_ctx_t::cpus`; only the first 64 CPUs are tracked.
+static inline uint64_t mmu_cpu_bit(int cpu) {
+    return cpu < 64 ? 1LLU << cpu : 0;
+}
+
+// Make a context use a new ASID the next time it is swapped in.
+// Used when mappings are removed, so that stale TLB entries for the old ASID are never used again.
+static inline void mmu_asid_invalidate(mpu_ctx_t *ctx) {
+    ctx->asid = 0;
+}
+
 // Notify the MMU of global mapping changes.
 static inline void mmu_vmem_fence() {
     asm volatile("fence rw,rw" ::: "memory");
     asm volatile("sfence.vma" ::: "memory");
 }
+
+// Notify the MMU of mapping changes in a range of virtual addresses.
+static inline void mmu_vmem_fence_range(size_t vaddr, size_t size) {
+    if (size > MMU_FLUSH_MAX_PAGES * MMU_PAGE_SIZE) {
+        mmu_vmem_fence();
+        return;
+    }
+    asm volatile("fence rw,rw" ::: "memory");
+    for (size_t end = vaddr + size; vaddr < end; vaddr += MMU_PAGE_SIZE) {
+        asm volatile("sfence.vma %0" ::"r"(vaddr) : "memory");
+    }
+}
@@ -98,12 +98,28 @@ void riscv_trap_handler() {
                 isr_ctx_swap(kctx);
                 return;
 
+#if MEMMAP_VMEM
+            case RISCV_TRAP_IPAGE:
+            case RISCV_TRAP_LPAGE:
+            case RISCV_TRAP_SPAGE:
+                // Page faults may be the first access to reserved memory or a write to a copy-on-write page.
+                sched_raise_from_isr(kctx->thread, true, proc_pagefault_handler);
+                kctx->thread->kernel_isr_ctx.regs.a0 = tval;
+                kctx->thread->kernel_isr_ctx.regs.a1 = trapno == RISCV_TRAP_SPAGE   ? MEMPROTECT_FLAG_W
+                                                       : trapno == RISCV_TRAP_IPAGE ? MEMPROTECT_FLAG_X
+                                                                                    : MEMPROTECT_FLAG_R;
+                isr_ctx_swap(kctx);
+                return;
+#endif
+
             case RISCV_TRAP_IACCESS:
             case RISCV_TRAP_LACCESS:
             case RISCV_TRAP_SACCESS:
+#if !MEMMAP_VMEM
             case RISCV_TRAP_IPAGE:
             case RISCV_TRAP_LPAGE:
             case RISCV_TRAP_SPAGE:
+#endif
                 // Memory access faults go to the SIGSEGV handler.
                 sched_raise_from_isr(kctx->thread, true, proc_sigsegv_handler);
                 kctx->thread->kernel_isr_ctx.regs.a0 = tval;
@@ -6,6 +6,8 @@
 #include "assertions.h"
 #include "badge_strings.h"
 #include "cpu/panic.h"
+#include "cpu/riscv_sbi.h"
+#include "cpulocal.h"
 #include "interrupt.h"
 #include "isr_ctx.h"
 #include "limine.h"
@@ -13,6 +15,10 @@
 #include "memprotect.h"
 #include "page_alloc.h"
 #include "port/hardware_allocation.h"
+#include "smp.h"
+#include "spinlock.h"
+
+#include <stdatomic.h>
 
 _Static_assert(MEMMAP_PAGE_SIZE == MMU_PAGE_SIZE, "MEMMAP_PAGE_SIZE must equal MMU_PAGE_SIZE");
 
@@ -28,6 +34,18 @@ size_t mmu_hhdm_size;
 int    mmu_levels;
 // Whether RISC-V Svpbmt is supported.
 bool   mmu_svpbmt;
+// Number of implemented ASID bits, 0 if ASIDs are not supported.
+int    mmu_asid_bits;
+
+// Mask of the ASID in `mpu_ctx_t::asid`.
+#define ASID_MASK ((1LLU << MMU_ASID_SHIFT) - 1)
+
+// Guards ASID allocation.
+static spinlock_t       asid_lock = SPINLOCK_T_INIT;
+// Current ASID generation; the lower `MMU_ASID_SHIFT` bits are always 0.
+static _Atomic uint64_t asid_gen  = 1LLU << MMU_ASID_SHIFT;
+// Next ASID to hand out in the current generation; ASID 0 belongs to the global context.
+static uint64_t         asid_next = 1;
 
 
 
@@ -66,6 +84,13 @@ void mmu_early_init() {
     mmu_levels     = satp.mode - RISCV_SATP_SV39 + 3;
     mmu_half_size  = 1LLU << (11 + 9 * mmu_levels);
     mmu_high_vaddr = -mmu_half_size;
+
+    // Unimplemented ASID bits are read-only zero, so writing all ones reveals the ASID width.
+    riscv_satp_t probe = satp;
+    probe.asid         = ASID_MASK;
+    asm volatile("csrw satp, %0; csrr %0, satp" : "+r"(probe.val)::"memory");
+    asm volatile("csrw satp, %0; sfence.vma" ::"r"(satp.val) : "memory");
+    mmu_asid_bits = probe.asid ? 64 - __builtin_clzll(probe.asid) : 0;
 }
 
 // MMU-specific init code.
@@ -86,6 +111,9 @@ void mmu_init() {
     if (mmu_svpbmt) {
         logkf(LOG_INFO, "MMU supports Svpbmt");
     }
+    if (mmu_asid_bits) {
+        logkf(LOG_INFO, "MMU supports %{d}-bit ASIDs", mmu_asid_bits);
+    }
 
     memprotect_free_vaddr(va);
 }
@@ -102,11 +130,65 @@ void mmu_write_pte(size_t pte_paddr, mmu_pte_t pte) {
 
 
 
+// Flush TLB entries for a range of virtual addresses on other CPUs.
+// Uses one SBI remote fence call per group of up to 64 consecutive HART IDs.
+void mmu_remote_fence(uint64_t cpus, size_t vaddr, size_t size) {
+    cpus &= ~mmu_cpu_bit(smp_cur_cpu());
+    if (size > MMU_FLUSH_MAX_PAGES * MMU_PAGE_SIZE) {
+        // SBI treats a size of all ones as a full flush.
+        vaddr = 0;
+        size  = -1;
+    }
+    unsigned long hart_base = 0;
+    unsigned long hart_mask = 0;
+    while (cpus) {
+        int    cpu   = __builtin_ctzll(cpus);
+        size_t hart  = smp_get_cpuid(cpu);
+        cpus        &= cpus - 1;
+        if (hart == (size_t)-1) {
+            continue;
+        }
+        if (hart_mask && (hart < hart_base || hart - hart_base >= sizeof(long) * 8)) {
+            sbi_remote_sfence_vma(hart_mask, hart_base, vaddr, size);
+            hart_mask = 0;
+        }
+        if (!hart_mask) {
+            hart_base = hart;
+        }
+        hart_mask |= 1LU << (hart - hart_base);
+    }
+    if (hart_mask) {
+        sbi_remote_sfence_vma(hart_mask, hart_base, vaddr, size);
+    }
+}
+
 // Swap in memory protections for the given context.
 void memprotect_swap_from_isr() {
     memprotect_swap(isr_ctx_get()->mpu_ctx);
 }
 
+// Assign an ASID from the current generation to a context.
+// Returns the new value of `mpu->asid`.
+static uint64_t mmu_asid_alloc(mpu_ctx_t *mpu) {
+    spinlock_take(&asid_lock);
+    uint64_t gen  = atomic_load(&asid_gen);
+    uint64_t asid = mpu->asid;
+    // Another CPU may have assigned one in the meantime.
+    if ((asid & ~ASID_MASK) != gen) {
+        if (asid_next >> mmu_asid_bits) {
+            // Out of ASIDs; start a new generation.
+            // Each CPU flushes its TLB before it first uses an ASID from the new generation.
+            gen       += 1LLU << MMU_ASID_SHIFT;
+            asid_next  = 1;
+            atomic_store(&asid_gen, gen);
+        }
+        asid      = gen | asid_next++;
+        mpu->asid = asid;
+    }
+    spinlock_release(&asid_lock);
+    return asid;
+}
+
 // Swap in memory protections for a given context.
 void memprotect_swap(mpu_ctx_t *mpu) {
     mpu               = mpu ?: &mpu_global_ctx;
@@ -116,7 +198,52 @@ void memprotect_swap(mpu_ctx_t *mpu) {
         .asid = 0,
         .mode = RISCV_SATP_SV39 + mmu_levels - 3,
     };
-    asm volatile("csrw satp, %0; sfence.vma" ::"r"(satp) : "memory");
+    cpulocal_t *cpulocal = isr_ctx_get()->cpulocal;
+    uint64_t    gen      = 0;
+    bool        flush    = true;
+
+    // Track which CPUs have the context loaded for TLB shootdowns.
+    // This happens before the ASID is read so either an unmap sees this CPU or this CPU sees the new ASID.
+    if (cpulocal) {
+        uint64_t   bit = mmu_cpu_bit(cpulocal->cpu);
+        mpu_ctx_t *old = isr_ctx_get()->mpu_ctx;
+        if (old && old != mpu && old != &mpu_global_ctx) {
+            atomic_fetch_and(&old->cpus, ~bit);
+        }
+        if (mpu != &mpu_global_ctx) {
+            atomic_fetch_or(&mpu->cpus, bit);
+        }
+        if (!(atomic_load(&mpu_global_ctx.cpus) & bit)) {
+            atomic_fetch_or(&mpu_global_ctx.cpus, bit);
+        }
+    }
+
+    if (mmu_asid_bits && cpulocal) {
+        if (mpu == &mpu_global_ctx) {
+            // The global context only has global mappings and ASID 0 is not used by any other context,
+            // so only entries left over from the bootloader's page table need to be flushed.
+            gen   = atomic_load(&asid_gen);
+            flush = !cpulocal->asid_gen;
+        } else {
+            uint64_t asid = mpu->asid;
+            if ((asid & ~ASID_MASK) != atomic_load(&asid_gen)) {
+                asid = mmu_asid_alloc(mpu);
+            }
+            satp.asid = asid & ASID_MASK;
+            gen       = asid & ~ASID_MASK;
+            // Entries for this ASID may be left over from an older generation.
+            flush     = cpulocal->asid_gen != gen;
+        }
+    }
+
+    if (flush) {
+        asm volatile("csrw satp, %0; sfence.vma" ::"r"(satp) : "memory");
+        if (cpulocal) {
+            cpulocal->asid_gen = gen;
+        }
+    } else {
+        asm volatile("csrw satp, %0" ::"r"(satp) : "memory");
+    }
     isr_ctx_get()->mpu_ctx = mpu;
     irq_enable_if(ie);
 }
@@ -97,8 +97,12 @@ bool sched_signal_enter(size_t handler_vaddr, size_t return_vaddr, int signum) {
     // Ensure the user has enough stack.
     size_t usp   = thread->user_isr_ctx.regs.sp;
     size_t usize = sizeof(size_t) * 20;
-    if ((proc_map_contains_raw(thread->process, usp - usize, usize) & MEMPROTECT_FLAG_RW) != MEMPROTECT_FLAG_RW) {
+    // Hold the memory map so the stack can't be unmapped while it is written.
+    mutex_acquire(NULL, &thread->process->memmap.mtx, TIMESTAMP_US_MAX);
+    if ((proc_map_contains_raw(thread->process, usp - usize, usize) & MEMPROTECT_FLAG_RW) != MEMPROTECT_FLAG_RW ||
+        !proc_map_populate_raw(thread->process, usp - usize, usize, true)) {
         // Not enough stack that the process owns.
+        mutex_release(NULL, &thread->process->memmap.mtx);
         return false;
     }
     thread->user_isr_ctx.regs.sp -= usize;
@@ -129,6 +133,7 @@ bool sched_signal_enter(size_t handler_vaddr, size_t return_vaddr, int signum) {
 #if MEMMAP_VMEM
     mmu_disable_sum();
 #endif
+    mutex_release(NULL, &thread->process->memmap.mtx);
 
     // Set up registers for entering signal handler.
     thread->user_isr_ctx.regs.s0 = thread->user_isr_ctx.regs.sp + usize;
@@ -152,8 +157,11 @@ bool sched_signal_exit() {
     // Ensure the user still has the stack.
     size_t usp   = thread->user_isr_ctx.regs.sp;
     size_t usize = sizeof(size_t) * 20;
-    if ((proc_map_contains_raw(thread->process, usp, usize) & MEMPROTECT_FLAG_RW) != MEMPROTECT_FLAG_RW) {
+    mutex_acquire(NULL, &thread->process->memmap.mtx, TIMESTAMP_US_MAX);
+    if ((proc_map_contains_raw(thread->process, usp, usize) & MEMPROTECT_FLAG_RW) != MEMPROTECT_FLAG_RW ||
+        !proc_map_populate_raw(thread->process, usp, usize, false)) {
         // If this happens, the process probably corrupted it's own stack.
+        mutex_release(NULL, &thread->process->memmap.mtx);
         return false;
     }
 
@@ -183,6 +191,7 @@ bool sched_signal_exit() {
 #if MEMMAP_VMEM
     mmu_disable_sum();
 #endif
+    mutex_release(NULL, &thread->process->memmap.mtx);
 
     // Restore user's stack pointer.
     thread->user_isr_ctx.regs.sp += usize;
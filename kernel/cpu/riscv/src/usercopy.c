@@ -3,62 +3,41 @@
 
 #include "usercopy.h"
 
-#include "assertions.h"
 #include "badge_strings.h"
-#include "interrupt.h"
 #include "isr_ctx.h"
 #include "memprotect.h"
+#include "port/hardware.h"
 #include "process/internal.h"
 #if MEMMAP_VMEM
 #include "cpu/mmu.h"
 #endif
 
-// TODO: Convert to page fault intercepting memcpy.
 // TODO: Migrate into generic process API.
 
 
 
+#if RISCV_M_MODE_KERNEL
+
 // Determine string length in memory a user owns.
 // Returns -1 if the user doesn't have access to any byte in the string.
 ptrdiff_t strlen_from_user_raw(process_t *process, size_t user_vaddr, ptrdiff_t max_len) {
-    if (!max_len) {
-        return 0;
-    }
+    // Without faults, the memory map can be held for the whole scan so it can't be unmapped halfway through.
+    mutex_acquire(NULL, &process->memmap.mtx, TIMESTAMP_US_MAX);
     ptrdiff_t len = 0;
-
-    // Check first page permissions.
-    if (!(proc_map_contains_raw(process, user_vaddr, 1) & MEMPROTECT_FLAG_R)) {
-        return -1;
-    }
-
-    // String length loop.
-    mpu_ctx_t *old_mpu = isr_ctx_get()->mpu_ctx;
-    memprotect_swap(&process->memmap.mpu_ctx);
-#if !RISCV_M_MODE_KERNEL
-    asm("csrs sstatus, %0" ::"r"((1 << RISCV_STATUS_SUM_BIT) | (1 << RISCV_STATUS_MXR_BIT)));
-#endif
-    while (len < max_len && *(char const *)user_vaddr) {
+    while (len < max_len) {
+        // Check permissions once per page.
+        if ((len == 0 || user_vaddr % MEMMAP_PAGE_SIZE == 0) &&
+            !(proc_map_contains_raw(process, user_vaddr, 1) & MEMPROTECT_FLAG_R)) {
+            len = -1;
+            break;
+        }
+        if (!*(char const *)user_vaddr) {
+            break;
+        }
         len++;
         user_vaddr++;
-        if (user_vaddr % MEMMAP_PAGE_SIZE == 0) {
-            // Check further page permissions.
-#if !RISCV_M_MODE_KERNEL
-            asm("csrc sstatus, %0" ::"r"((1 << RISCV_STATUS_SUM_BIT) | (1 << RISCV_STATUS_MXR_BIT)));
-#endif
-            if (!(proc_map_contains_raw(process, user_vaddr, 1) & MEMPROTECT_FLAG_R)) {
-                memprotect_swap(old_mpu);
-                return -1;
-            }
-#if !RISCV_M_MODE_KERNEL
-            asm("csrs sstatus, %0" ::"r"((1 << RISCV_STATUS_SUM_BIT) | (1 << RISCV_STATUS_MXR_BIT)));
-#endif
-        }
     }
-#if !RISCV_M_MODE_KERNEL
-    asm("csrc sstatus, %0" ::"r"((1 << RISCV_STATUS_SUM_BIT) | (1 << RISCV_STATUS_MXR_BIT)));
-#endif
-
-    memprotect_swap(old_mpu);
+    mutex_release(NULL, &process->memmap.mtx);
     return len;
 }
 
@@ -66,43 +45,181 @@ ptrdiff_t strlen_from_user_raw(process_t *process, size_t user_vaddr, ptrdiff_t
 // Returns whether the user has access to all of these bytes.
 // If the user doesn't have access, no copy is performed.
 bool copy_from_user_raw(process_t *process, void *kernel_vaddr, size_t user_vaddr, size_t len) {
-    if (!proc_map_contains_raw(process, user_vaddr, len)) {
-        return false;
+    mutex_acquire(NULL, &process->memmap.mtx, TIMESTAMP_US_MAX);
+    bool ok = proc_map_contains_raw(process, user_vaddr, len);
+    if (ok) {
+        mem_copy(kernel_vaddr, (void const *)user_vaddr, len);
     }
-#if RISCV_M_MODE_KERNEL
-    mem_copy(kernel_vaddr, (void const *)user_vaddr, len);
-#else
-    mpu_ctx_t *old_mpu = isr_ctx_get()->mpu_ctx;
-    memprotect_swap(&process->memmap.mpu_ctx);
-    asm("csrs sstatus, %0" ::"r"((1 << RISCV_STATUS_SUM_BIT) | (1 << RISCV_STATUS_MXR_BIT)));
-    mem_copy(kernel_vaddr, (void *)user_vaddr, len);
-    asm("csrc sstatus, %0" ::"r"((1 << RISCV_STATUS_SUM_BIT) | (1 << RISCV_STATUS_MXR_BIT)));
-    memprotect_swap(old_mpu);
-#endif
-    return true;
+    mutex_release(NULL, &process->memmap.mtx);
+    return ok;
 }
 
 // Copy from kernel to user.
 // Returns whether the user has access to all of these bytes.
 // If the user doesn't have access, no copy is performed.
-bool copy_to_user_raw(process_t *process, size_t user_vaddr, void *kernel_vaddr0, size_t len) {
-    uint8_t const *kernel_vaddr = kernel_vaddr0;
-    if (!proc_map_contains_raw(process, user_vaddr, len)) {
-        return false;
+bool copy_to_user_raw(process_t *process, size_t user_vaddr, void *kernel_vaddr, size_t len) {
+    mutex_acquire(NULL, &process->memmap.mtx, TIMESTAMP_US_MAX);
+    bool ok = proc_map_contains_raw(process, user_vaddr, len);
+    if (ok) {
+        mem_copy((void *)user_vaddr, kernel_vaddr, len);
     }
-#if RISCV_M_MODE_KERNEL
-    mem_copy((void *)user_vaddr, kernel_vaddr, len);
+    mutex_release(NULL, &process->memmap.mtx);
+    return ok;
+}
+
 #else
-    while (len) {
-        virt2phys_t info = memprotect_virt2phys(&process->memmap.mpu_ctx, user_vaddr);
-        assert_dev_drop((info.flags & (MEMPROTECT_FLAG_KERNEL | MEMPROTECT_FLAG_KERNEL)) == 0);
-        size_t max_len = info.page_size - (user_vaddr & (info.page_size - 1));
-        max_len        = len < max_len ? len : max_len;
-        mem_copy((uint8_t *)mmu_hhdm_vaddr + info.paddr, kernel_vaddr, max_len);
-        len          -= max_len;
-        user_vaddr   += max_len;
-        kernel_vaddr += max_len;
+
+// Maximum number of bytes copied per `isr_noexc_run`, which runs with interrupts disabled.
+#define USERCOPY_CHUNK  16384
+// SSTATUS bits that allow the kernel to access user memory.
+#define USERCOPY_STATUS ((1 << RISCV_STATUS_SUM_BIT) | (1 << RISCV_STATUS_MXR_BIT))
+
+// State of a user copy that runs with `isr_noexc_run`.
+typedef struct {
+    // User virtual address that is copied from or to.
+    size_t   user_vaddr;
+    // Kernel buffer that is copied from or to, NULL to look for a NUL terminator instead.
+    uint8_t *kernel_vaddr;
+    // Whether to copy to the user instead of from the user.
+    bool     to_user;
+    // Number of bytes to copy or scan.
+    size_t   len;
+    // Number of bytes done so far; a copy that faulted is resumed from here.
+    size_t   done;
+    // Trap cause of the last fault.
+    long     cause;
+    // Address that caused the last fault.
+    size_t   tval;
+} usercopy_t;
+
+// Get the end of the chunk that the next `isr_noexc_run` should copy.
+static inline size_t usercopy_chunk_end(usercopy_t const *copy) {
+    return copy->len - copy->done > USERCOPY_CHUNK ? copy->done + USERCOPY_CHUNK : copy->len;
+}
+
+// Copy one chunk between user and kernel one page at a time, so a fault loses at most one page of progress.
+static void usercopy_copy_func(void *cookie) {
+    usercopy_t *copy = cookie;
+    size_t      end  = usercopy_chunk_end(copy);
+    while (copy->done < end) {
+        size_t user    = copy->user_vaddr + copy->done;
+        size_t max_len = MEMMAP_PAGE_SIZE - user % MEMMAP_PAGE_SIZE;
+        max_len        = end - copy->done < max_len ? end - copy->done : max_len;
+        if (copy->to_user) {
+            mem_copy((void *)user, copy->kernel_vaddr + copy->done, max_len);
+        } else {
+            mem_copy(copy->kernel_vaddr + copy->done, (void const *)user, max_len);
+        }
+        copy->done += max_len;
     }
-#endif
-    return true;
 }
+
+// Scan one chunk of a user string; the length is cut short when the NUL terminator is found.
+static void usercopy_strlen_func(void *cookie) {
+    usercopy_t *copy = cookie;
+    size_t      end  = usercopy_chunk_end(copy);
+    while (copy->done < end) {
+        if (!*(char const *)(copy->user_vaddr + copy->done)) {
+            copy->len = copy->done;
+            return;
+        }
+        copy->done++;
+    }
+}
+
+// Trap handler for user copies; records the fault so it can be resolved with interrupts enabled.
+static void usercopy_catch(void *cookie, cpu_regs_t *regs) {
+    (void)regs;
+    usercopy_t *copy = cookie;
+    asm volatile("csrr %0, " CSR_CAUSE_STR : "=r"(copy->cause));
+    asm volatile("csrr %0, " CSR_TVAL_STR : "=r"(copy->tval));
+}
+
+// Resolve a fault caught during a user copy the same way a fault from the user itself would be.
+// Takes the memory map mutex for the duration of the fault, so the caller must not hold it.
+// Returns whether the page is now accessible and the copy can be resumed.
+static bool usercopy_fault(process_t *process, usercopy_t const *copy) {
+    uint32_t access;
+    switch (copy->cause & RISCV_VT_ICAUSE_MASK) {
+        case RISCV_TRAP_LPAGE: access = MEMPROTECT_FLAG_R; break;
+        case RISCV_TRAP_SPAGE: access = MEMPROTECT_FLAG_W; break;
+        default: return false;
+    }
+    if (copy->tval < copy->user_vaddr || copy->tval - copy->user_vaddr >= copy->len) {
+        // Faults on the kernel side of the copy are bugs, not something the user can cause.
+        return false;
+    }
+    mutex_acquire(NULL, &process->memmap.mtx, TIMESTAMP_US_MAX);
+    bool ok = proc_map_fault_raw(process, copy->tval, access);
+    mutex_release(NULL, &process->memmap.mtx);
+    return ok;
+}
+
+// Run a user copy in the process' address space, faulting in pages the copy touches as needed.
+// Returns false if the process doesn't own one of the bytes or if out of memory.
+static bool usercopy_run(process_t *process, usercopy_t *copy, isr_noexc_t func) {
+    if (copy->user_vaddr >= mmu_half_size || copy->len > mmu_half_size - copy->user_vaddr) {
+        return false;
+    }
+    mpu_ctx_t *old_mpu = isr_ctx_get()->mpu_ctx;
+    memprotect_swap(&process->memmap.mpu_ctx);
+    bool ok = true;
+    while (ok && copy->done < copy->len) {
+        asm("csrs sstatus, %0" ::"r"(USERCOPY_STATUS));
+        bool trap = isr_noexc_run(func, usercopy_catch, copy);
+        asm("csrc sstatus, %0" ::"r"(USERCOPY_STATUS));
+        if (trap) {
+            ok = usercopy_fault(process, copy);
+        }
+    }
+    memprotect_swap(old_mpu);
+    return ok;
+}
+
+// Determine string length in memory a user owns.
+// Returns -1 if the user doesn't have access to any byte in the string.
+ptrdiff_t strlen_from_user_raw(process_t *process, size_t user_vaddr, ptrdiff_t max_len) {
+    if (user_vaddr >= mmu_half_size) {
+        return -1;
+    }
+    // The string can't continue past the end of user memory.
+    size_t     limit  = mmu_half_size - user_vaddr;
+    bool       capped = (size_t)max_len > limit;
+    usercopy_t copy   = {
+        .user_vaddr = user_vaddr,
+        .len        = capped ? limit : (size_t)max_len,
+    };
+    if (!usercopy_run(process, &copy, usercopy_strlen_func) || (capped && copy.done == limit)) {
+        return -1;
+    }
+    return (ptrdiff_t)copy.done;
+}
+
+// Copy bytes from user to kernel.
+// Returns whether the user has access to all of these bytes.
+// If the user doesn't have access, the copy may have been partially performed.
+bool copy_from_user_raw(process_t *process, void *kernel_vaddr, size_t user_vaddr, size_t len) {
+    usercopy_t copy = {
+        .user_vaddr   = user_vaddr,
+        .kernel_vaddr = kernel_vaddr,
+        .to_user      = false,
+        .len          = len,
+    };
+    return usercopy_run(process, &copy, usercopy_copy_func);
+}
+
+// Copy from kernel to user.
+// Returns whether the user has access to all of these bytes.
+// If the user doesn't have access, the copy may have been partially performed.
+bool copy_to_user_raw(process_t *process, size_t user_vaddr, void *kernel_vaddr, size_t len) {
+    // Stores to copy-on-write pages fault like they would for the user, which breaks the sharing.
+    usercopy_t copy = {
+        .user_vaddr   = user_vaddr,
+        .kernel_vaddr = kernel_vaddr,
+        .to_user      = true,
+        .len          = len,
+    };
+    return usercopy_run(process, &copy, usercopy_copy_func);
+}
+
+#endif
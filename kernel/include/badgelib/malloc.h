@@ -1,6 +1,9 @@
 
 // SPDX-License-Identifier: MIT
 
+#include "sys/memstats.h"
+
+#include <stdbool.h>
 #include <stddef.h>
 
 void *malloc(size_t size);
@@ -10,3 +13,20 @@ void *realloc(void *ptr, size_t size);
 void *reallocarray(void *ptr, size_t nmemb, size_t size);
 
 void kernel_heap_init();
+
+// Get the usable size of an allocation, which may be larger than requested.
+size_t malloc_usable_size(void *ptr);
+
+// Allocate whole pages for the physical page allocator, running the shrinkers if needed.
+void  *heap_alloc_pages(size_t size, bool for_user);
+// Get the size of pages allocated with `heap_alloc_pages`.
+size_t heap_pages_size(void *ptr);
+// Free pages allocated with `heap_alloc_pages`.
+void   heap_free_pages(void *ptr);
+
+// Get a consistent snapshot of the allocator statistics.
+void malloc_get_stats(memstats_t *out);
+#ifdef BADGEROS_MALLOC_TRACK_CALLERS
+// Print all live allocations and the code that allocated them.
+void malloc_dump_tags();
+#endif
@@ -65,3 +65,7 @@ bool mutex_acquire_shared_from_isr(badge_err_t *ec, mutex_t *mutex, timestamp_us
 // Release `mutex`, if it was initially acquired by this thread.
 // Returns true if the mutex was successfully released.
 bool mutex_release_shared_from_isr(badge_err_t *ec, mutex_t *mutex);
+
+// Whether `mutex` is currently held exclusively by any thread.
+// Only meant for asserting that a caller holds a lock it is required to.
+bool mutex_is_held(mutex_t const *mutex);
@@ -0,0 +1,65 @@
+
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+
+
+// Node in a `rangetree_t`; embedded in the structure describing the range.
+typedef struct rangetree_node_t {
+    // Parent node, NULL for the root.
+    struct rangetree_node_t *parent;
+    // Subtree with lower addresses.
+    struct rangetree_node_t *left;
+    // Subtree with higher addresses.
+    struct rangetree_node_t *right;
+    // Start address of the range.
+    size_t                   base;
+    // Size of the range; must not change while the node is in a tree.
+    size_t                   size;
+    // Lowest address covered by this subtree.
+    size_t                   sub_base;
+    // End address of the highest range in this subtree.
+    size_t                   sub_end;
+    // Largest unused space between two ranges in this subtree.
+    size_t                   sub_gap;
+    // Height of this subtree, 1 for a leaf.
+    int                      height;
+} rangetree_node_t;
+
+// AVL tree of non-overlapping address ranges.
+// Every subtree tracks the largest gap between its ranges, so free space can be found in O(log n).
+typedef struct {
+    // Root node, NULL if the tree is empty.
+    rangetree_node_t *root;
+    // Number of ranges in the tree.
+    size_t            len;
+} rangetree_t;
+
+// Empty `rangetree_t`.
+#define RANGETREE_EMPTY ((rangetree_t){NULL, 0})
+
+
+
+// Find the range that contains an address.
+// Returns NULL if no range contains it.
+rangetree_node_t *rangetree_find(rangetree_t const *tree, size_t addr);
+// Find the lowest range that ends after an address.
+// Returns NULL if all ranges end at or before it.
+rangetree_node_t *rangetree_find_after(rangetree_t const *tree, size_t addr);
+// Get the range with the lowest address, NULL if the tree is empty.
+rangetree_node_t *rangetree_first(rangetree_t const *tree);
+// Get the next range in address order, NULL if `node` is the last.
+rangetree_node_t *rangetree_next(rangetree_node_t const *node);
+// Insert a range with its `base` and `size` already set.
+// Returns false without inserting if it overlaps a range already in the tree.
+bool              rangetree_insert(rangetree_t *tree, rangetree_node_t *node);
+// Remove a range from the tree.
+void              rangetree_remove(rangetree_t *tree, rangetree_node_t *node);
+// Find the lowest free address in [`min`, `max`) aligned to `align` where `size` bytes fit.
+// `align` must be a power of two; the range found must fit before `max`.
+// Returns false if there is no space.
+bool rangetree_find_gap(rangetree_t const *tree, size_t min, size_t max, size_t size, size_t align, size_t *out);
@@ -0,0 +1,31 @@
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stddef.h>
+
+// Maximum number of registered shrinkers.
+#define SHRINKER_MAX 16
+
+// Memory that is only retained for speed, like empty slab pages and dead thread stacks.
+#define SHRINKER_PRIO_RETAINED 0
+// Caches that can be dropped without doing I/O.
+#define SHRINKER_PRIO_CLEAN    10
+// Caches that must be written back before they can be dropped.
+#define SHRINKER_PRIO_DIRTY    20
+
+// Memory reclaim callback.
+// Should try to free at least `target_pages` pages and returns how many pages it actually freed.
+// Shrinkers may be called from any thread that runs out of memory, so they must not block for long.
+typedef size_t (*shrinker_func_t)(size_t target_pages, void *cookie);
+
+// Register a memory reclaim callback; shrinkers with a lower priority value run first.
+// Returns a handle for `shrinker_unregister`, or -1 if there are too many shrinkers.
+int    shrinker_register(char const *name, int priority, shrinker_func_t func, void *cookie);
+// Remove a memory reclaim callback.
+void   shrinker_unregister(int handle);
+// Run shrinkers in priority order until at least `target_pages` pages have been freed.
+// Returns how many pages were freed; returns 0 if called while shrinkers are already running.
+size_t shrinker_run(size_t target_pages);
+// Start background reclaim that keeps free memory above the watermarks.
+void   shrinker_init();
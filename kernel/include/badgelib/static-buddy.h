@@ -6,6 +6,7 @@
 #endif
 
 #include "config.h"
+#include "sys/memstats.h"
 
 #include <stdbool.h>
 #include <stddef.h>
@@ -13,11 +14,16 @@
 
 #define PAGE_SIZE 4096
 #ifdef CONFIG_TARGET_generic
-#define MAX_MEMORY_POOLS 16
+#define MAX_MEMORY_POOLS  16
+// Blocks up to this order are aligned to their own size in memory, so they can be mapped as superpages.
+#define BUDDY_ALIGN_ORDER 9
 #else
-#define MAX_MEMORY_POOLS 4
+#define MAX_MEMORY_POOLS  4
+#define BUDDY_ALIGN_ORDER 0
 #endif
 #define MAX_SLAB_SIZE 256
+// Highest block order; pools larger than this many pages are truncated.
+#define BUDDY_MAX_ORDER 31
 
 #define ALIGN_UP(x, y)   (void *)(((size_t)(x) + (y - 1)) & ~(y - 1))
 #define ALIGN_DOWN(x, y) (void *)((size_t)(x) & ~(y - 1))
@@ -31,10 +37,12 @@ enum slab_type { SLAB_TYPE_SLAB };
 void init_pool(void *mem_start, void *mem_end, uint32_t flags);
 void init_kernel_slabs();
 void print_allocator();
+void print_allocator_stats();
 
 void  *slab_allocate(size_t size, enum slab_type type, uint32_t flags);
 void   slab_deallocate(void *ptr);
 size_t slab_get_size(void *ptr);
+size_t slab_release_empty();
 
 void           *buddy_allocate(size_t size, enum block_type type, uint32_t flags);
 void           *buddy_reallocate(void *ptr, size_t size);
@@ -42,31 +50,65 @@ void            buddy_deallocate(void *ptr);
 enum block_type buddy_get_type(void *ptr);
 size_t          buddy_get_size(void *ptr);
 
-typedef struct buddy_block {
-    uint8_t             pid;
-    uint8_t             order;
-    bool                in_list;
-    bool                is_waste;
-    enum block_type     type;
-    struct buddy_block *next;
-    struct buddy_block *prev;
+// Per-page allocator state; only meaningful for the first page of a block.
+typedef struct {
+    // Order of the block starting at this page.
+    uint8_t order : 5;
+    // `enum block_type` of the block starting at this page.
+    uint8_t type  : 3;
 } buddy_block_t;
 
+// Free blocks of a single order.
+typedef struct {
+    // Bitmap with one bit per block of this order; set bits are free blocks.
+    size_t *bits;
+    // Bitmap with one bit per word of `bits`; set bits are words that are not zero.
+    size_t *summary;
+    // Number of words in `bits`.
+    size_t  words;
+    // Index of the lowest word in `summary` that may have a bit set.
+    size_t  hint;
+    // Number of free blocks of this order.
+    size_t  count;
+} buddy_free_map_t;
+
 typedef struct {
-    uint32_t       flags;
-    void          *start;
-    void          *end;
-    void          *pages_start;
-    void          *pages_end;
-    size_t         pages;
-    size_t         free_pages;
-    uint8_t        max_order;
-    uint8_t        max_order_free;
-    uint32_t       max_order_waste;
-    buddy_block_t  waste_list;
-    buddy_block_t *free_lists;
-    buddy_block_t *blocks;
+    uint32_t          flags;
+    void             *start;
+    void             *end;
+    void             *pages_start;
+    void             *pages_end;
+    // Address of page index 0; pages between this and `pages_start` are never free.
+    void             *pages_base;
+    // Index of the first waste page.
+    size_t            pages;
+    size_t            free_pages;
+    uint8_t           max_order;
+    uint8_t           max_order_free;
+    uint32_t          max_order_waste;
+    // Bitmask of orders that have at least one free block.
+    uint32_t          free_orders;
+    buddy_free_map_t *free_maps;
+    buddy_block_t    *blocks;
 } memory_pool_t;
 
 extern uint8_t       memory_pool_num;
 extern memory_pool_t memory_pools[MAX_MEMORY_POOLS];
+
+// Allocator statistics; updated under the same lock that protects the allocator.
+extern memstats_t alloc_stats;
+
+// Account a successful allocation of `bytes` in a size class.
+__attribute__((always_inline)) static inline void alloc_stats_add(memstats_class_t *cls, size_t bytes) {
+    cls->allocs++;
+    cls->in_use += bytes;
+    if (cls->in_use > cls->peak) {
+        cls->peak = cls->in_use;
+    }
+}
+
+// Account a deallocation of `bytes` in a size class.
+__attribute__((always_inline)) static inline void alloc_stats_sub(memstats_class_t *cls, size_t bytes) {
+    cls->frees++;
+    cls->in_use -= bytes;
+}
@@ -4,6 +4,7 @@
 #pragma once
 
 #include "blockdevice.h"
+#include "mutex.h"
 
 // Block device virtual function table.
 typedef struct blkdev_vtable blkdev_vtable_t;
@@ -34,6 +35,8 @@ typedef struct {
     blkdev_flags_t *block_flags;
     // Amount of cache entries.
     size_t          cache_depth;
+    // Shrinker handle if the cache was created by `blkdev_create_cache`, 0 otherwise.
+    int             shrinker;
 } blkdev_cache_t;
 
 // Block device descriptor.
@@ -51,6 +54,8 @@ struct blkdev {
     // Write and optionally read cache.
     // This may be statically allocated, or created using `blkdev_create_cache`.
     blkdev_cache_t        *cache;
+    // Guards `cache` and its entries; held for the duration of every cached operation.
+    mutex_t                mtx;
     // Cookie for device driver.
     void                  *cookie;
 };
@@ -24,6 +24,8 @@ typedef struct {
     sched_cpulocal_t *sched;
     // CPU-local timer data.
     time_cpulocal_t   time;
+    // ASID generation this CPU's TLB was last flushed for, 0 if never.
+    uint64_t          asid_gen;
 } cpulocal_t;
 
 // Per-CPU CPU-local data.
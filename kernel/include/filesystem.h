@@ -6,6 +6,8 @@
 #include "attributes.h"
 #include "badge_err.h"
 #include "blockdevice.h"
+#include "sys/stat.h"
+#include "sys/uio.h"
 
 // Maximum number of mountable filesystems.
 #define FILESYSTEM_MOUNT_MAX   8
@@ -41,10 +43,13 @@ typedef uint32_t mountflags_t;
 #define OFLAGS_CLOEXEC   0x00000040
 // Open a directory instead of a file.
 #define OFLAGS_DIRECTORY 0x00000080
+// Access will be random; disables readahead.
+#define OFLAGS_RANDOM    0x00000100
 
 // Bitmask of all opening flags valid without the use of `OFLAGS_DIRECTORY` and without the use of `OFLAGS_EXCLUSIVE`.
 #define VALID_OFLAGS_FILE                                                                                              \
-    (OFLAGS_READWRITE | OFLAGS_APPEND | OFLAGS_TRUNCATE | OFLAGS_CREATE | OFLAGS_EXCLUSIVE | OFLAGS_CLOEXEC)
+    (OFLAGS_READWRITE | OFLAGS_APPEND | OFLAGS_TRUNCATE | OFLAGS_CREATE | OFLAGS_EXCLUSIVE | OFLAGS_CLOEXEC |        \
+     OFLAGS_RANDOM)
 // Bitmask of all opening flags valid in conjunction with `OFLAGS_DIRECTORY`.
 #define VALID_OFLAGS_DIRECTORY (OFLAGS_DIRECTORY | OFLAGS_CREATE | OFLAGS_EXCLUSIVE | OFLAGS_READONLY | OFLAGS_CLOEXEC)
 
@@ -120,26 +125,6 @@ typedef struct {
     char      name[FILESYSTEM_NAME_MAX + 1];
 } dirent_t;
 
-// File or directory status.
-typedef struct stat {
-    // ID of device containing file.
-    uint32_t  device;
-    // Inode number.
-    inode_t   inode;
-    // File type and protection.
-    uint16_t  mode;
-    // Number of hard links.
-    size_t    links;
-    // Owner user ID.
-    // TODO: User ID type?
-    int       uid;
-    // Owner group ID.
-    // TODO: Group ID type?
-    int       gid;
-    // File size in bytes.
-    fileoff_t size;
-} stat_t;
-
 // Try to mount a filesystem.
 // Some filesystems (like RAMFS) do not use a block device, for which `media` must be NULL.
 // Filesystems which do use a block device can often be automatically detected.
@@ -164,15 +149,19 @@ bool fs_fstat(badge_err_t *ec, stat_t *stat_out, file_t file);
 
 // Create a new directory.
 // Returns whether the target exists and is a directory.
-bool   fs_dir_create(badge_err_t *ec, char const *path);
+bool      fs_dir_create(badge_err_t *ec, char const *path);
 // Open a directory for reading.
-file_t fs_dir_open(badge_err_t *ec, char const *path, oflags_t oflags);
+file_t    fs_dir_open(badge_err_t *ec, char const *path, oflags_t oflags);
 // Close a directory opened by `fs_dir_open`.
 // Only raises an error if `dir` is an invalid directory descriptor.
-void   fs_dir_close(badge_err_t *ec, file_t dir);
+void      fs_dir_close(badge_err_t *ec, file_t dir);
 // Read the current directory entry.
 // Returns whether a directory entry was successfully read.
-bool   fs_dir_read(badge_err_t *ec, dirent_t *dirent_out, file_t dir);
+bool      fs_dir_read(badge_err_t *ec, dirent_t *dirent_out, file_t dir);
+// Read directory entries along with the status of the files they name, continuing from the current offset.
+// Refer to `dirent_stat_t` for the format; only whole entries are read.
+// Returns the amount of data read, which is 0 at the end of the directory.
+fileoff_t fs_dir_read_stat(badge_err_t *ec, file_t dir, void *readbuf, fileoff_t readlen);
 
 // Open a file for reading and/or writing.
 file_t    fs_open(badge_err_t *ec, char const *path, oflags_t oflags);
@@ -185,6 +174,28 @@ fileoff_t fs_read(badge_err_t *ec, file_t file, void *readbuf, fileoff_t readlen
 // Write bytes to a file.
 // Returns the amount of data successfully written.
 fileoff_t fs_write(badge_err_t *ec, file_t file, void const *writebuf, fileoff_t writelen);
+// Read bytes from a file into several buffers, filled in order.
+// If `offset` is negative, reads at and advances the current offset; otherwise reads at `offset` and leaves it be.
+// Returns the amount of data successfully read.
+fileoff_t fs_readv(badge_err_t *ec, file_t file, iovec_t const *iov, int iovcnt, fileoff_t offset);
+// Write bytes to a file from several buffers, written in order.
+// If `offset` is negative, writes at and advances the current offset; otherwise writes at `offset` and leaves it be.
+// Returns the amount of data successfully written.
+fileoff_t fs_writev(badge_err_t *ec, file_t file, iovec_t const *iov, int iovcnt, fileoff_t offset);
+// Copy bytes from one file to another without passing them through a caller's buffer.
+// Negative offsets use and advance the current offset of that file; other offsets leave it be.
+// Copying between overlapping ranges of the same file is not allowed.
+// Returns the amount of data successfully copied, which is less than `len` at the end of `src`.
+fileoff_t fs_copy_range(
+    badge_err_t *ec, file_t src, fileoff_t src_offset, file_t dst, fileoff_t dst_offset, fileoff_t len
+);
+// Open another handle to a file for mapping it into memory, which is closed with `fs_close` when it is unmapped.
+// The file must be readable, and writable if `write` is true, in which case writes to the mapping change the file.
+file_t    fs_map_open(badge_err_t *ec, file_t file, bool write);
+// Get the physical page of file data at a page-aligned offset to map into a process.
+// The page is referenced for the caller, which drops it with `phys_page_unref` when it is unmapped.
+// Returns 0 if the offset is past the end of the file or the page could not be read.
+size_t    fs_map_page(badge_err_t *ec, file_t file, fileoff_t offset);
 // Get the current offset in the file.
 fileoff_t fs_tell(badge_err_t *ec, file_t file);
 // Set the current offset in the file.
@@ -23,3 +23,41 @@ long syscall_fs_write(int fd, void const *write_buf, long write_len);
 // See `dirent_t` for the format.
 // Returns <= -1 on error, read count on success.
 long syscall_fs_getdents(int fd, void *read_buf, long read_len);
+
+// Read directory entries along with the status of the files they name, continuing where the previous read stopped.
+// See `dirent_stat_t` for the format.
+// Returns <= -1 on error, 0 at the end of the directory, read count on success.
+long syscall_fs_getdents_stat(int fd, void *read_buf, long read_len);
+
+// Get file status given file handle or path.
+// If `path` is NULL, gets the status of `fd`.
+bool syscall_fs_stat(int fd, char const *path, stat_t *stat_out);
+
+// Read bytes from a file into several buffers, filled in order.
+// Returns <= -1 on error, read count on success.
+long syscall_fs_readv(int fd, iovec_t const *iov, int iovcnt);
+
+// Write bytes to a file from several buffers, written in order.
+// Returns <= -1 on error, write count on success.
+long syscall_fs_writev(int fd, iovec_t const *iov, int iovcnt);
+
+// Read bytes from a file at `offset` without using or changing the current offset.
+// Returns <= -1 on error, read count on success.
+long syscall_fs_pread(int fd, void *read_buf, long read_len, long offset);
+
+// Write bytes to a file at `offset` without using or changing the current offset.
+// Returns <= -1 on error, write count on success.
+long syscall_fs_pwrite(int fd, void const *write_buf, long write_len, long offset);
+
+// Copy bytes from one file to another in the kernel, without passing them through userspace.
+// An offset of -1 uses and advances the current offset of that file; other offsets leave it be.
+// Returns <= -1 on error, copy count on success; less than `len` means the end of `fd_in` was reached.
+long syscall_fs_copy_range(int fd_in, long off_in, int fd_out, long off_out, long len);
+
+// Create the asynchronous I/O ring of this process and map it at an arbitrary virtual address.
+// Returns NULL on failure or if the process already has a ring.
+ioring_t *syscall_fs_ring_setup(size_t vaddr);
+
+// Wait until at least `min_complete` completions are in the ring of this process, or `timeout_us` has passed.
+// Returns <= -1 on error, number of completions available on success.
+int syscall_fs_ring_wait(unsigned min_complete, long timeout_us);
@@ -0,0 +1,38 @@
+
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "filesystem/vfs_types.h"
+
+#include <stdint.h>
+
+// Maximum number of entries in the dentry cache.
+#define VFS_DCACHE_MAX     1024
+// Number of hash buckets in the dentry cache; must be a power of two.
+#define VFS_DCACHE_BUCKETS 256
+
+// Result of a dentry cache lookup.
+typedef enum {
+    // The entry is not cached.
+    VFS_DCACHE_MISS,
+    // The entry is cached and exists.
+    VFS_DCACHE_FOUND,
+    // The entry is cached as not existing.
+    VFS_DCACHE_NOTFOUND,
+} vfs_dcache_res_t;
+
+
+
+// Look up a directory entry by parent directory inode and name.
+// On a miss, `*gen` is set to the value to pass to `vfs_dcache_insert` after looking up the entry on the filesystem.
+vfs_dcache_res_t vfs_dcache_lookup(vfs_t *vfs, inode_t dir, char const *name, dirent_t *ent, uint32_t *gen);
+// Add the result of a filesystem lookup to the cache; `ent` is NULL if the entry does not exist.
+// Dropped if anything was invalidated since the `vfs_dcache_lookup` that returned `gen`, since it may be stale.
+void             vfs_dcache_insert(vfs_t *vfs, inode_t dir, char const *name, dirent_t const *ent, uint32_t gen);
+// Forget a directory entry; must be called after the entry is created or removed.
+void             vfs_dcache_invalidate(vfs_t *vfs, inode_t dir, char const *name);
+// Forget all entries in a directory; used when the directory is removed so its inode number can be reused.
+void             vfs_dcache_invalidate_dir(vfs_t *vfs, inode_t dir);
+// Forget all entries of a filesystem.
+void             vfs_dcache_invalidate_vfs(vfs_t *vfs);
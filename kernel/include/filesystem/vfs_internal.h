@@ -24,38 +24,28 @@ extern mutex_t   vfs_mount_mtx;
 // Taken shared when a handle is used.
 extern mutex_t   vfs_handle_mtx;
 
-// List of open shared file handles.
-extern vfs_file_shared_t **vfs_file_shared_list;
-// Number of open shared file handles.
-extern size_t              vfs_file_shared_list_len;
-// Capacity of open shared file handles list.
-extern size_t              vfs_file_shared_list_cap;
-
-// List of open file handles.
-extern vfs_file_handle_t *vfs_file_handle_list;
-// Number of open file handles.
-extern size_t             vfs_file_handle_list_len;
-// Capacity of open file handles list.
-extern size_t             vfs_file_handle_list_cap;
-
 
 
 /* ==== Thread-unsafe functions ==== */
 
 // Find a shared file handle by inode, if any.
-ptrdiff_t vfs_shared_by_inode(vfs_t *vfs, inode_t inode);
+vfs_file_shared_t *vfs_shared_by_inode(vfs_t *vfs, inode_t inode);
 // Get a file handle by number.
-ptrdiff_t vfs_file_by_handle(file_t fileno);
+// Returns NULL if there is no such handle.
+vfs_file_handle_t *vfs_file_by_handle(file_t fileno);
 // Create a new empty shared file handle.
-ptrdiff_t vfs_file_create_shared();
+// It becomes visible to `vfs_shared_by_inode` once opened by `vfs_root_open` or `vfs_file_open`.
+vfs_file_shared_t *vfs_file_create_shared();
 // Destroy a shared file handle assuming the underlying file is already closed.
-void      vfs_file_destroy_shared(ptrdiff_t shared);
+void               vfs_file_destroy_shared(vfs_file_shared_t *shared);
 // Create a new file handle.
-// If `shared` is -1, a new shared empty handle is created.
-ptrdiff_t vfs_file_create_handle(ptrdiff_t shared);
+// If `shared` is NULL, a new shared empty handle is created.
+vfs_file_handle_t *vfs_file_create_handle(vfs_file_shared_t *shared);
 // Delete a file handle.
 // If this is the last handle referring to one file, the shared handle is closed too.
-void      vfs_file_destroy_handle(ptrdiff_t handle);
+void               vfs_file_destroy_handle(vfs_file_handle_t *handle);
+// Delete all file handles referring to files on a filesystem.
+void               vfs_file_destroy_all(vfs_t *vfs);
 
 
 
@@ -75,11 +65,15 @@ void vfs_create_dir(badge_err_t *ec, vfs_file_shared_t *dir, char const *name);
 void vfs_unlink(badge_err_t *ec, vfs_file_shared_t *dir, char const *name);
 
 // Atomically read all directory entries and cache them into the directory handle.
+// Listings are shared through the listing cache, so a directory is only read again after it changes.
 // Refer to `dirent_t` for the structure of the cache.
 void vfs_dir_read(badge_err_t *ec, vfs_file_handle_t *dir);
 // Atomically read the directory entry with the matching name.
 // Returns true if the entry was found.
 bool vfs_dir_find_ent(badge_err_t *ec, vfs_file_shared_t *dir, dirent_t *ent, char const *name);
+// Get the attributes of an inode.
+// Sets all fields but `device`.
+void vfs_stat(badge_err_t *ec, vfs_t *vfs, inode_t inode, stat_t *stat_out);
 
 // Open a file for reading and/or writing given parent directory handle.
 // Also handles OFLAGS_EXCLUSIVE and OFLAGS_CREATE.
@@ -89,13 +83,45 @@ void vfs_file_open(badge_err_t *ec, vfs_file_shared_t *dir, vfs_file_shared_t *f
 void vfs_file_close(badge_err_t *ec, vfs_file_shared_t *file);
 // Read bytes from a file.
 // The entire read succeeds or the entire read fails, never partial read.
+// Block-backed filesystems are read through the page cache.
 void vfs_file_read(badge_err_t *ec, vfs_file_shared_t *file, fileoff_t offset, uint8_t *readbuf, fileoff_t readlen);
+// Read bytes from a file, bypassing the page cache.
+void vfs_file_read_uncached(
+    badge_err_t *ec, vfs_file_shared_t *file, fileoff_t offset, uint8_t *readbuf, fileoff_t readlen
+);
 // Write bytes to a file.
 // If the file is not large enough, it expanded.
 // The entire write succeeds or the entire write fails, never partial write.
+// Block-backed filesystems are written through the page cache.
 void vfs_file_write(
     badge_err_t *ec, vfs_file_shared_t *file, fileoff_t offset, uint8_t const *writebuf, fileoff_t writelen
 );
+// Write bytes to a file, bypassing the page cache.
+void vfs_file_write_uncached(
+    badge_err_t *ec, vfs_file_shared_t *file, fileoff_t offset, uint8_t const *writebuf, fileoff_t writelen
+);
+// Read `readlen` bytes from a file into several buffers, filled in order.
+// The entire read succeeds or the entire read fails, never partial read.
+void vfs_file_readv(
+    badge_err_t *ec, vfs_file_shared_t *file, fileoff_t offset, iovec_t const *iov, int iovcnt, fileoff_t readlen
+);
+// Write bytes to a file from several buffers, written in order.
+// The entire write succeeds or the entire write fails, never partial write.
+void vfs_file_writev(badge_err_t *ec, vfs_file_shared_t *file, fileoff_t offset, iovec_t const *iov, int iovcnt);
+// Copy bytes from one file to another without going through a caller's buffer.
+// The ranges must be within the files and must not overlap if both are in the same file.
+void vfs_file_copy(
+    badge_err_t       *ec,
+    vfs_file_shared_t *src,
+    fileoff_t          src_offset,
+    vfs_file_shared_t *dst,
+    fileoff_t          dst_offset,
+    fileoff_t          len
+);
+// Get the physical page of file data at a page-aligned offset to map into a process, taking a reference to it.
+// The caller drops the reference with `phys_page_unref` when it unmaps the page.
+// Only supported with virtual memory.
+size_t vfs_file_map_page(badge_err_t *ec, vfs_file_shared_t *file, fileoff_t offset);
 // Change the length of a file opened by `vfs_file_open`.
 void vfs_file_resize(badge_err_t *ec, vfs_file_shared_t *file, fileoff_t new_size);
 
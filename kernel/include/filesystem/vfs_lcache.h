@@ -0,0 +1,36 @@
+
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "filesystem/vfs_types.h"
+
+#include <stdint.h>
+
+// Maximum number of directory listings in the listing cache.
+#define VFS_LCACHE_MAX       32
+// Maximum number of bytes of listings in the listing cache; memory pressure can shrink it further.
+#define VFS_LCACHE_MAX_BYTES (1024 * 1024)
+// Number of hash buckets in the listing cache; must be a power of two.
+#define VFS_LCACHE_BUCKETS   32
+
+
+
+// Register the listing cache with memory reclaim.
+void               vfs_lcache_init();
+// Allocate a listing of `size` bytes for a filesystem to fill in, holding one reference.
+// Returns NULL if out of memory.
+vfs_dir_listing_t *vfs_listing_alloc(size_t size);
+// Drop a reference to a listing; it is freed when the last reference is gone. Does nothing if `listing` is NULL.
+void               vfs_listing_unref(vfs_dir_listing_t *listing);
+
+// Look up the cached listing of a directory and take a reference to it.
+// On a miss, returns NULL and sets `*gen` to the value to pass to `vfs_lcache_insert` after reading the directory.
+vfs_dir_listing_t *vfs_lcache_lookup(vfs_t *vfs, inode_t dir, uint32_t *gen);
+// Add a listing read from the filesystem to the cache, which takes a reference of its own.
+// Dropped if anything was invalidated since the `vfs_lcache_lookup` that returned `gen`, since it may be stale.
+void               vfs_lcache_insert(vfs_t *vfs, inode_t dir, vfs_dir_listing_t *listing, uint32_t gen);
+// Forget the listing of a directory; must be called after an entry in it is created or removed.
+void               vfs_lcache_invalidate(vfs_t *vfs, inode_t dir);
+// Forget all listings of a filesystem.
+void               vfs_lcache_invalidate_vfs(vfs_t *vfs);
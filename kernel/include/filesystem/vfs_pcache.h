@@ -0,0 +1,55 @@
+
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "filesystem/vfs_types.h"
+#include "port/hardware_allocation.h"
+#include "time.h"
+
+// Size of a page in the page cache.
+#define VFS_PCACHE_PAGE_SIZE MEMMAP_PAGE_SIZE
+// Maximum number of pages in the page cache; memory pressure can shrink it further.
+#define VFS_PCACHE_MAX       1024
+// Number of hash buckets in the page cache; must be a power of two.
+#define VFS_PCACHE_BUCKETS   256
+// Number of dirty pages above which the flusher writes back pages regardless of their age.
+#define VFS_PCACHE_DIRTY_BG  (VFS_PCACHE_MAX / 10)
+// Number of dirty pages above which writers have to write back pages themselves.
+#define VFS_PCACHE_DIRTY_MAX (VFS_PCACHE_MAX / 4)
+
+
+
+// Register the page cache with memory reclaim.
+void vfs_pcache_init();
+
+// Read bytes from a file through the page cache, filling missing pages from the filesystem.
+// The range must be within the file.
+void vfs_pcache_read(badge_err_t *ec, vfs_file_shared_t *file, fileoff_t offset, uint8_t *readbuf, fileoff_t readlen);
+// Read pages into the cache ahead of use; pages that are already cached are skipped.
+void vfs_pcache_prefetch(vfs_file_shared_t *file, fileoff_t offset, fileoff_t len);
+#if MEMMAP_VMEM
+// Get the physical page of file data at an offset to map into a process, taking a reference to it.
+// The page must be within the file; it is read into the cache first if it isn't cached yet.
+size_t vfs_pcache_map_page(badge_err_t *ec, vfs_file_shared_t *file, fileoff_t offset);
+#endif
+// Write bytes to a file through the page cache; the filesystem is updated when the pages are written back.
+// The file must already be large enough; writers are throttled while too many pages are dirty.
+// Must be called with `vfs_handle_mtx` held.
+void vfs_pcache_write(
+    badge_err_t *ec, vfs_file_shared_t *file, fileoff_t offset, uint8_t const *writebuf, fileoff_t writelen
+);
+// Write back dirty pages that became dirty before `expire`, and the oldest ones while more than `keep` are dirty.
+// Writes back at most `max` pages.
+// Must be called with `vfs_handle_mtx` held.
+// Returns the number of pages written back.
+size_t vfs_pcache_writeback(badge_err_t *ec, timestamp_us_t expire, size_t keep, size_t max);
+// Write back all dirty pages of a file.
+// Must be called with `vfs_handle_mtx` held.
+void vfs_pcache_writeback_file(badge_err_t *ec, vfs_file_shared_t *file);
+// Forget cached pages past the end of a file after it was resized.
+void vfs_pcache_resize(vfs_file_shared_t *file, fileoff_t old_size, fileoff_t new_size);
+// Forget all cached pages of an inode; used when it is deleted so its inode number can be reused.
+void vfs_pcache_invalidate_inode(vfs_t *vfs, inode_t inode);
+// Forget all cached pages of a filesystem.
+void vfs_pcache_invalidate_vfs(vfs_t *vfs);
@@ -4,6 +4,7 @@
 #pragma once
 
 #include "filesystem/vfs_internal.h"
+#include "port/hardware_allocation.h"
 
 // Inode number of the root directory of a RAM filesystem.
 #define VFS_RAMFS_INODE_ROOT  1
@@ -31,12 +32,15 @@ void vfs_ramfs_unlink(badge_err_t *ec, vfs_t *vfs, vfs_file_shared_t *dir, char
 // If `dir` is NULL, the root directory is used.
 bool vfs_ramfs_exists(badge_err_t *ec, vfs_t *vfs, vfs_file_shared_t *dir, char const *name);
 
-// Atomically read all directory entries and cache them into the directory handle.
-// Refer to `dirent_t` for the structure of the cache.
-void vfs_ramfs_dir_read(badge_err_t *ec, vfs_t *vfs, vfs_file_handle_t *dir);
+// Atomically read all directory entries into a new listing.
+// Refer to `dirent_t` for the structure of the listing.
+vfs_dir_listing_t *vfs_ramfs_dir_read(badge_err_t *ec, vfs_t *vfs, vfs_file_shared_t *dir);
 // Atomically read the directory entry with the matching name.
 // Returns true if the entry was found.
 bool vfs_ramfs_dir_find_ent(badge_err_t *ec, vfs_t *vfs, vfs_file_shared_t *dir, dirent_t *ent, char const *name);
+// Get the attributes of an inode.
+// Sets all fields but `device`.
+void vfs_ramfs_stat(badge_err_t *ec, vfs_t *vfs, inode_t inode, stat_t *stat_out);
 
 // Open a file handle for the root directory.
 void vfs_ramfs_root_open(badge_err_t *ec, vfs_t *vfs, vfs_file_shared_t *file);
@@ -55,6 +59,21 @@ void vfs_ramfs_file_read(
 void vfs_ramfs_file_write(
     badge_err_t *ec, vfs_t *vfs, vfs_file_shared_t *file, fileoff_t offset, uint8_t const *writebuf, fileoff_t writelen
 );
+// Copy bytes from one file to another.
+// The ranges must not overlap if both are in the same file.
+void vfs_ramfs_file_copy(
+    badge_err_t       *ec,
+    vfs_t             *vfs,
+    vfs_file_shared_t *src,
+    fileoff_t          src_offset,
+    vfs_file_shared_t *dst,
+    fileoff_t          dst_offset,
+    fileoff_t          len
+);
+#if MEMMAP_VMEM
+// Get the physical page of file data at a page-aligned offset to map into a process, taking a reference to it.
+size_t vfs_ramfs_file_map_page(badge_err_t *ec, vfs_t *vfs, vfs_file_shared_t *file, fileoff_t offset);
+#endif
 // Change the length of a file opened by `vfs_ramfs_file_open`.
 void vfs_ramfs_file_resize(badge_err_t *ec, vfs_t *vfs, vfs_file_shared_t *file, fileoff_t new_size);
 
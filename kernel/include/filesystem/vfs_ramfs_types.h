@@ -22,6 +22,9 @@
 // Bit mask of file type in mode field.
 #define VFS_RAMFS_MODE_MASK 0xf000
 
+// Number of inodes the inode table grows by at a time.
+#define VFS_RAMFS_INODE_CHUNK 32
+
 
 
 /* ==== In-memory structures ==== */
@@ -34,6 +37,8 @@ typedef struct {
     size_t   cap;
     // Data buffer.
     char    *buf;
+    // Data buffer has been mapped into a process; it stays in `vmalloc` memory from then on.
+    bool     mapped;
     // Inode number.
     inode_t  inode;
     // File type and protection.
@@ -65,17 +70,18 @@ typedef vfs_ramfs_inode_t *vfs_ramfs_file_t;
 // Mounted RAM filesystem.
 typedef struct {
     // RAM limit for the entire filesystem.
-    size_t             ram_limit;
+    size_t              ram_limit;
     // RAM usage.
-    atomic_size_t      ram_usage;
-    // Inode table, indices 0 and 1 are unused.
-    vfs_ramfs_inode_t *inode_list;
+    atomic_size_t       ram_usage;
+    // Inode table in chunks of `VFS_RAMFS_INODE_CHUNK`, so inodes don't move when it grows.
+    // Indices 0 and 1 are unused.
+    vfs_ramfs_inode_t **inode_list;
     // Inode table usage map.
-    bool              *inode_usage;
+    bool               *inode_usage;
     // Number of allocated inodes.
-    size_t             inode_list_len;
+    size_t              inode_list_len;
     // THE RAMFS mutex.
     // Acquired shared for all read-only operations.
     // Acquired exclusive for any write operation.
-    mutex_t            mtx;
+    mutex_t             mtx;
 } vfs_ramfs_t;
@@ -0,0 +1,23 @@
+
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "filesystem/vfs_pcache.h"
+#include "filesystem/vfs_types.h"
+
+// Readahead window after the first sequential read.
+#define VFS_READAHEAD_MIN     (4 * VFS_PCACHE_PAGE_SIZE)
+// Largest readahead window; the window doubles on every sequential read until it gets here.
+#define VFS_READAHEAD_MAX     (64 * VFS_PCACHE_PAGE_SIZE)
+// Maximum number of queued readahead requests; requests beyond this are dropped.
+#define VFS_READAHEAD_QUEUE   16
+// Longest time the readahead worker stays parked when there is nothing to do, in microseconds.
+// Queuing a request wakes it up early; the timeout only bounds the delay of a wakeup that raced with parking.
+#define VFS_READAHEAD_IDLE_US 1000000
+
+
+
+// Update the access pattern of a handle after a read and queue prefetching of the data expected to be read next.
+// Must be called with the handle's mutex held.
+void vfs_readahead(vfs_file_handle_t *handle, fileoff_t offset, fileoff_t len);
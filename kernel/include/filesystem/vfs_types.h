@@ -9,17 +9,19 @@
 #include "filesystem/vfs_ramfs_types.h"
 #include "mutex.h"
 
+#include <stdatomic.h>
+
 typedef struct vfs vfs_t;
 
 // VFS shared opened file handle.
 // Shared between all file handles referring to the same file.
-typedef struct {
+typedef struct vfs_file_shared {
     // Reference count.
-    size_t    refcount;
-    // Index in the shared file handle table.
-    ptrdiff_t index;
+    size_t                  refcount;
+    // Next shared handle in the same inode hash bucket.
+    struct vfs_file_shared *next;
     // Current file size.
-    fileoff_t size;
+    fileoff_t               size;
     // Filesystem-specific information.
     union {
         // RAMFS.
@@ -28,13 +30,6 @@ typedef struct {
         vfs_fat_file_t   fat_file;
     };
 
-    // Cached region offset.
-    fileoff_t cache_off;
-    // Cached region size.
-    fileoff_t cache_size;
-    // Cached register buffer.
-    char     *cache;
-
     // Inode number (gauranteed to be unique per VFS).
     // No file or directory may have the same inode number.
     // Any file is required to name an inode number of 3 or higher.
@@ -43,6 +38,17 @@ typedef struct {
     vfs_t  *vfs;
 } vfs_file_shared_t;
 
+// Listing of a directory; `dirent_t` records as read from a directory handle.
+// Immutable once built; shared between the listing cache and the handles reading it.
+typedef struct {
+    // Number of references; the cache and every handle using the listing hold one.
+    atomic_size_t refcount;
+    // Size of `data` in bytes.
+    fileoff_t     size;
+    // Directory entries.
+    char          data[];
+} vfs_dir_listing_t;
+
 // VFS opened file handle.
 typedef struct {
     // Current access position.
@@ -54,13 +60,20 @@ typedef struct {
     bool      read;
     // Handle refers to a directory.
     bool      is_dir;
+    // Access is random, so readahead is disabled.
+    bool      random;
     // Handle mutex for concurrency.
     mutex_t   mutex;
 
-    // Directories: Cached size.
-    fileoff_t dir_cache_size;
-    // Directories: Cache.
-    char     *dir_cache;
+    // Directories: Listing read when the handle was last read from the start, NULL before that.
+    vfs_dir_listing_t *dir_cache;
+
+    // Files: Offset the next read starts at if access is sequential.
+    fileoff_t ra_next;
+    // Files: Readahead window in bytes, 0 while access is not sequential.
+    fileoff_t ra_window;
+    // Files: End of the data already queued for readahead.
+    fileoff_t ra_end;
 
     // Pointer to shared file handle.
     // Directories do not have a shared handle.
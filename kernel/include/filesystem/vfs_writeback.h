@@ -0,0 +1,19 @@
+
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "badge_err.h"
+#include "blockdevice.h"
+
+// Interval between runs of the background flusher in microseconds.
+#define VFS_WRITEBACK_INTERVAL (BLKDEV_WRITE_CACHE_TIMEOUT / 4)
+// Maximum number of pages the background flusher writes back per run.
+#define VFS_WRITEBACK_BATCH    64
+
+
+
+// Start writing back dirty data in the background.
+void vfs_writeback_init();
+// Write back all dirty data and flush every mounted filesystem.
+void vfs_writeback_sync(badge_err_t *ec);
@@ -22,6 +22,8 @@
 #define MEMPROTECT_FLAG_IO     0x00000040
 // Non-cachable; if possible, mark region as non-cacheable.
 #define MEMPROTECT_FLAG_NC     0x00000080
+// Copy-on-write; the page is shared read-only and copied on the first write (VMEM only).
+#define MEMPROTECT_FLAG_COW    0x00000100
 
 #include "port/hardware_allocation.h"
 #include "port/memprotect.h"
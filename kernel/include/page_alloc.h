@@ -3,6 +3,8 @@
 
 #pragma once
 
+#include "port/hardware_allocation.h"
+
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -18,3 +20,15 @@ size_t phys_page_size(size_t ppn);
 // Free pages of physical memory.
 // Uses physical page numbers (paddr / MEMMAP_PAGE_SIZE).
 void   phys_page_free(size_t ppn);
+
+#if MEMMAP_VMEM
+// Add a reference to a block of physical pages so it can be mapped more than once.
+// The block is only freed after every reference has been dropped with `phys_page_unref`.
+// Uses physical page numbers (paddr / MEMMAP_PAGE_SIZE).
+bool   phys_page_ref(size_t ppn);
+// Drop a reference to a block of physical pages, freeing it if this was the last one.
+// Returns whether the block was freed.
+bool   phys_page_unref(size_t ppn);
+// Get the number of references to a block of physical pages; blocks that were never shared have one.
+size_t phys_page_refs(size_t ppn);
+#endif
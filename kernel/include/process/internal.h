@@ -5,6 +5,7 @@
 
 #include "filesystem.h"
 #include "process/process.h"
+#include "process/shm.h"
 
 extern mutex_t proc_mtx;
 
@@ -41,14 +42,52 @@ void proc_start_raw(badge_err_t *ec, process_t *process);
 tid_t    proc_create_thread_raw(badge_err_t *ec, process_t *process, size_t entry_point, size_t arg, int priority);
 // Delete a thread in a process.
 void   proc_delete_thread_raw_unsafe(badge_err_t *ec, process_t *process, sched_thread_t *thread);
+// Get the alignment to use for a new mapping.
+// Mappings of at least a superpage are aligned to one so they can be backed by superpages.
+size_t proc_map_align(size_t size, size_t min_align);
+// The `proc_map*_raw` and `proc_unmap*_raw` functions below expect the caller to hold `process->memmap.mtx`.
 // Allocate more memory to a process.
 // Returns actual virtual address on success, 0 on failure.
 size_t proc_map_raw(badge_err_t *ec, process_t *process, size_t vaddr, size_t size, size_t align, uint32_t flags);
+// Map a shared memory object into a process.
+// On success, takes over the reference to `shm`, which is dropped when the region is unmapped.
+// Returns actual virtual address on success, 0 on failure.
+size_t proc_map_shm_raw(badge_err_t *ec, process_t *process, shm_t *shm, size_t vaddr, uint32_t flags);
+// Map part of a file into a process; pages are read from the file when they are first accessed.
+// If `shared` is true, writes change the file; otherwise, written pages are copied and the file stays the same.
+// Returns actual virtual address on success, 0 on failure.
+size_t proc_map_file_raw(
+    badge_err_t *ec,
+    process_t   *process,
+    file_t       file,
+    fileoff_t    offset,
+    size_t       size,
+    size_t       vaddr,
+    uint32_t     flags,
+    bool         shared
+);
+// Share all memory of a process with another process that has nothing mapped yet.
+// Expects the caller to hold the memory map mutex of both processes.
+// Private pages are shared copy-on-write and shared memory objects are mapped into both processes.
+bool   proc_map_clone_raw(badge_err_t *ec, process_t *dest, process_t *src);
 // Release memory allocated to a process.
 void   proc_unmap_raw(badge_err_t *ec, process_t *process, size_t base);
+// Release all memory allocated to a process.
+void   proc_unmap_all_raw(process_t *process);
+// Get the size of the region that starts at `base`.
+// Returns 0 if no region starts there.
+size_t proc_map_size_raw(process_t *process, size_t base);
 // Whether the process owns this range of memory.
 // Returns the lowest common denominator of the access bits.
 int    proc_map_contains_raw(process_t *proc, size_t base, size_t size);
+// Allocate and map physical pages for the part of a range that hasn't been accessed yet.
+// If `write` is true, copy-on-write pages in the range are copied so they can be written to.
+// Returns false if the process doesn't own the entire range or if out of memory.
+bool   proc_map_populate_raw(process_t *proc, size_t base, size_t size, bool write);
+// Handle a page fault on memory that is reserved but not yet resident, or a write to a copy-on-write page.
+// `access` is the `MEMPROTECT_FLAG_R`, `MEMPROTECT_FLAG_W` or `MEMPROTECT_FLAG_X` access that faulted.
+// Returns true if the page was mapped and the access should be retried.
+bool   proc_map_fault_raw(process_t *proc, size_t vaddr, uint32_t access);
 // Add a file to the process file handle list.
 int    proc_add_fd_raw(badge_err_t *ec, process_t *process, file_t real);
 // Find a file in the process file handle list.
@@ -0,0 +1,34 @@
+
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "badge_err.h"
+#include "process/process.h"
+#include "sys/ioring.h"
+#include "time.h"
+
+// Size of the buffer the worker copies data through between files and process memory.
+#define PROC_IORING_CHUNK   4096
+// Time the worker keeps polling after its last submission before it parks.
+#define PROC_IORING_SPIN_US 2000
+// Longest time a parked worker or waiting thread sleeps; only bounds the delay of a raced wakeup.
+#define PROC_IORING_PARK_US 1000000
+// Time the worker waits for the process mutex before checking whether the ring is being destroyed.
+#define PROC_IORING_LOCK_US 10000
+
+
+
+// Create the asynchronous I/O ring of a process, map it into the process and start its worker.
+// Must be called with the process' mutex held.
+// Returns the virtual address of the ring on success, 0 on failure.
+size_t   proc_ioring_setup_raw(badge_err_t *ec, process_t *process, size_t vaddr);
+// Wait until at least `min_complete` completions are in a ring or `timeout` has passed.
+// Returns the number of completions available.
+unsigned proc_ioring_wait(proc_ioring_t *ioring, unsigned min_complete, timestamp_us_t timeout);
+// Wake the thread waiting on the ring of a process so it notices the process is exiting; does nothing if it has none.
+// Must be called with the process' mutex held.
+void     proc_ioring_interrupt_raw(process_t *process);
+// Stop the worker and release the ring of a process; does nothing if the process has none.
+// Must be called with the process' mutex held, after all threads of the process have stopped.
+void     proc_ioring_destroy_raw(process_t *process);
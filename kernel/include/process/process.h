@@ -4,6 +4,7 @@
 #pragma once
 
 #include "scheduler/scheduler.h"
+#include "sys/memstats.h"
 
 
 
@@ -20,12 +21,17 @@
 // Process has a state change not acknowledged.
 #define PROC_STATECHG 0x00000020
 
+// Writes to a file mapping change the file.
+#define MEMFLAGS_SHARED 0x00000008
+
 
 
 // A process and all of its resources.
-typedef struct process_t process_t;
+typedef struct process_t     process_t;
+// Asynchronous I/O ring of a process.
+typedef struct proc_ioring_t proc_ioring_t;
 // Globally unique process ID.
-typedef int              pid_t;
+typedef int                  pid_t;
 
 // Send a signal to all running processes in the system except the init process.
 void proc_signal_all(int signal);
@@ -34,6 +40,9 @@ bool proc_has_noninit();
 
 // Create a new, empty process.
 pid_t    proc_create(badge_err_t *ec, pid_t parent, char const *binary, int argc, char const *const *argv);
+// Create a new pre-start process from a snapshot of a pre-start template process.
+// The template is loaded when it is first cloned and its memory is shared copy-on-write with every clone.
+pid_t    proc_clone(badge_err_t *ec, pid_t parent, pid_t template, int argc, char const *const *argv);
 // Delete a process only if it hasn't been started yet.
 bool     proc_delete_prestart(pid_t pid);
 // Delete a process and release any resources it had.
@@ -53,6 +62,9 @@ void   proc_unmap(badge_err_t *ec, pid_t pid, size_t base);
 // Whether the process owns this range of memory.
 // Returns the lowest common denominator of the access bits bitwise or 8.
 int    proc_map_contains(badge_err_t *ec, pid_t pid, size_t base, size_t size);
+// Get the memory usage of a process.
+// Returns false if the process does not exist.
+bool   proc_get_memstats(pid_t pid, proc_memstats_t *stats);
 
 // Raise a signal to a process, which may be the current process.
 void proc_raise_signal(badge_err_t *ec, pid_t pid, int signum);
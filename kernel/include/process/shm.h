@@ -0,0 +1,50 @@
+
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "badge_err.h"
+#include "port/hardware_allocation.h"
+#include "process/process.h"
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+
+
+// Shared memory object that can be mapped into several processes at once.
+typedef struct shm_t {
+    // Globally unique ID used to map the object.
+    int        id;
+    // Process that created the object and may unlink it.
+    pid_t      owner;
+    // Number of mappings, plus one while the object is linked.
+    atomic_int refcount;
+    // Size in pages.
+    size_t     pages;
+#if MEMMAP_VMEM
+    // Physical page numbers of the individually allocated pages backing the object.
+    size_t    *ppns;
+#else
+    // Physical page number of the contiguous memory backing the object.
+    size_t     ppn;
+#endif
+} shm_t;
+
+// Create a zero-filled shared memory object.
+// Returns its ID, or 0 on failure.
+int    shm_create(badge_err_t *ec, pid_t owner, size_t size);
+// Create a zero-filled shared memory object that is never linked, so only the kernel can map it.
+// Returns the object with one reference held by the caller, or NULL on failure.
+shm_t *shm_create_anon(badge_err_t *ec, pid_t owner, size_t size);
+// Look up a shared memory object and take a reference to it.
+// Returns NULL if no object with this ID is linked.
+shm_t *shm_get(int id);
+// Take another reference to a shared memory object the caller already holds a reference to.
+void   shm_ref(shm_t *shm);
+// Drop a reference to a shared memory object; it is freed when the last reference is gone.
+void   shm_unref(shm_t *shm);
+// Unlink a shared memory object so it can't be mapped again; existing mappings stay valid.
+void   shm_unlink(badge_err_t *ec, pid_t owner, int id);
+// Unlink all shared memory objects created by a process.
+void   shm_unlink_owned(pid_t owner);
@@ -6,6 +6,7 @@
 #include "attributes.h"
 
 #include <stddef.h>
+#include <stdint.h>
 
 // Kernel side of the signal handler.
 // Called in the kernel side of a used thread when a signal might be queued.
@@ -13,6 +14,10 @@ void proc_signal_handler() NORETURN;
 // Raises a segmentation fault to the current thread.
 // Called in the kernel side of a used thread when hardware detects a segmentation fault.
 void proc_sigsegv_handler(size_t vaddr) NORETURN;
+// Handles a page fault in the current thread.
+// Allocates memory that was reserved but not accessed yet, copies copy-on-write pages that are written to,
+// or raises a segmentation fault otherwise.
+void proc_pagefault_handler(size_t vaddr, uint32_t access) NORETURN;
 // Raises an illegal instruction fault to the current thread.
 // Called in the kernel side of a used thread when hardware detects an illegal instruction fault.
 void proc_sigill_handler() NORETURN;
@@ -9,6 +9,7 @@
 #include "mutex.h"
 #include "port/hardware_allocation.h"
 #include "port/memprotect.h"
+#include "rangetree.h"
 #include "scheduler/scheduler.h"
 #include "signal.h"
 
@@ -21,25 +22,45 @@
 // A memory map entry.
 typedef struct {
     // Base physical address of the region.
-    size_t paddr;
+    // Unused with VMEM, where pages are allocated individually on first access.
+    size_t           paddr;
 #if MEMMAP_VMEM
     // Base virtual address of the region.
-    size_t vaddr;
+    size_t           vaddr;
 #endif
     // Size of the region.
-    size_t size;
+    size_t           size;
     // Write permission.
-    bool   write;
+    bool             write;
     // Execution permission.
-    bool   exec;
+    bool             exec;
+    // Shared memory object backing the region, or NULL if the memory is private.
+    struct shm_t    *shm;
+#if MEMMAP_VMEM
+    // File handle backing the region, or `FILE_NONE` if the memory is anonymous.
+    file_t           file;
+    // Offset in `file` that the start of the region maps.
+    fileoff_t        file_offset;
+    // Writes go to the file instead of to private copies of its pages.
+    bool             file_shared;
+    // Node in the region tree, covering the same range as `vaddr` and `size`.
+    rangetree_node_t node;
+#endif
 } proc_memmap_ent_t;
 
 // Process memory map information.
 typedef struct proc_memmap_t {
     // Memory management cache.
-    mpu_ctx_t mpu_ctx;
+    mpu_ctx_t   mpu_ctx;
+    // Guards the regions, the page tables in `mpu_ctx` and the counters below.
+    // Taken after the process' `mtx` if both are held; never held across a user memory copy.
+    mutex_t     mtx;
+#if MEMMAP_VMEM
+    // Mapped regions by virtual address.
+    rangetree_t regions;
+#else
     // Number of mapped regions.
-    size_t    regions_len;
+    size_t      regions_len;
 #ifdef PROC_MEMMAP_MAX_REGIONS
     // Mapped regions.
     proc_memmap_ent_t regions[PROC_MEMMAP_MAX_REGIONS];
@@ -49,6 +70,21 @@ typedef struct proc_memmap_t {
     // Mapped regions.
     proc_memmap_ent_t *regions;
 #endif
+#endif
+    // Bytes of memory reserved by mapped regions.
+    size_t reserved;
+    // Bytes of physical memory backing mapped regions.
+    size_t resident;
+    // Highest value `resident` has reached.
+    size_t peak_resident;
+    // Number of pages allocated on first access.
+    size_t faults;
+    // Number of superpages allocated on first access.
+    size_t superpages;
+    // Number of times a superpage could be used but no aligned physical memory was available.
+    size_t superpage_misses;
+    // Number of copy-on-write pages copied because they were written to.
+    size_t cow_copies;
 } proc_memmap_t;
 
 // Process file descriptor.
@@ -66,47 +102,53 @@ typedef struct {
 } sigpending_t;
 
 // Globally unique process ID.
-typedef int pid_t;
+typedef int                  pid_t;
+// Asynchronous I/O ring of a process; defined in process/ioring.c.
+typedef struct proc_ioring_t proc_ioring_t;
 
 // A process and all of its resources.
 typedef struct process_t {
     // Node for child process list.
-    dlist_node_t  node;
+    dlist_node_t   node;
     // Parent process, NULL for process 1.
-    process_t    *parent;
+    process_t     *parent;
     // Process binary.
-    char const   *binary;
+    char const    *binary;
     // Number of arguments.
-    int           argc;
+    int            argc;
     // Value of arguments.
-    char        **argv;
+    char         **argv;
     // Size required to store all of argv.
-    size_t        argv_size;
+    size_t         argv_size;
     // Number of file descriptors.
-    size_t        fds_len;
+    size_t         fds_len;
     // File descriptors.
-    proc_fd_t    *fds;
+    proc_fd_t     *fds;
     // Number of threads.
-    size_t        threads_len;
+    size_t         threads_len;
     // Thread handles.
-    tid_t        *threads;
+    tid_t         *threads;
     // Process ID.
-    pid_t         pid;
+    pid_t          pid;
     // Memory map information.
-    proc_memmap_t memmap;
+    proc_memmap_t  memmap;
     // Resource mutex used for multithreading processes.
-    mutex_t       mtx;
+    mutex_t        mtx;
     // Process status flags.
-    atomic_int    flags;
+    atomic_int     flags;
     // Pending signals list.
-    dlist_t       sigpending;
+    dlist_t        sigpending;
     // Child process list.
-    dlist_t       children;
+    dlist_t        children;
     // Signal handler virtual addresses.
     // First index is for signal handler returns.
-    size_t        sighandlers[SIG_COUNT];
+    size_t         sighandlers[SIG_COUNT];
     // Exit code if applicable.
-    int           state_code;
+    int            state_code;
     // Total time usage.
-    timeusage_t   timeusage;
+    timeusage_t    timeusage;
+    // Entry point once the executable has been loaded, 0 before that.
+    size_t         entry;
+    // Asynchronous I/O ring, NULL if the process hasn't created one.
+    proc_ioring_t *ioring;
 } process_t;
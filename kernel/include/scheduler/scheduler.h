@@ -83,6 +83,7 @@ void thread_sleep(timestamp_us_t delay);
 // If `suspend_kernel` is false, the thread won't be suspended until it enters user mode.
 void thread_suspend(badge_err_t *ec, tid_t thread, bool suspend_kernel);
 // Resumes a previously suspended thread or starts it.
+// If the thread is about to suspend but hasn't yet, the suspension is cancelled.
 void thread_resume(badge_err_t *ec, tid_t thread);
 // Resumes a previously suspended thread or starts it.
 // Immediately schedules the thread instead of putting it in the queue first.
@@ -5,18 +5,21 @@
 
 #include "process/process.h"
 
+// The user copy functions look up and fault in user pages themselves, taking the process' memory map mutex
+// (`process->memmap.mtx`) while they do so. Callers may hold the process mutex, but must not hold the memory map mutex.
+
 // Determine string length in memory a user owns.
 // Returns -1 if the user doesn't have access to any byte in the string.
 ptrdiff_t strlen_from_user_raw(process_t *process, size_t user_vaddr, ptrdiff_t max_len);
 
 // Copy bytes from user to kernel.
 // Returns whether the user has access to all of these bytes.
-// If the user doesn't have access, no copy is performed.
+// If the user doesn't have access, the copy may have been partially performed.
 bool copy_from_user_raw(process_t *process, void *kernel_vaddr, size_t user_vaddr, size_t len);
 
 // Copy from kernel to user.
 // Returns whether the user has access to all of these bytes.
-// If the user doesn't have access, no copy is performed.
+// If the user doesn't have access, the copy may have been partially performed.
 bool copy_to_user_raw(process_t *process, size_t user_vaddr, void *const kernel_vaddr, size_t len);
 
 // Determine string length in memory a user owns.
@@ -25,10 +28,10 @@ ptrdiff_t strlen_from_user(pid_t pid, size_t user_vaddr, ptrdiff_t max_len);
 
 // Copy bytes from user to kernel.
 // Returns whether the user has access to all of these bytes.
-// If the user doesn't have access, no copy is performed.
+// If the user doesn't have access, the copy may have been partially performed.
 bool copy_from_user(pid_t pid, void *kernel_vaddr, size_t user_vaddr, size_t len);
 
 // Copy from kernel to user.
 // Returns whether the user has access to all of these bytes.
-// If the user doesn't have access, no copy is performed.
+// If the user doesn't have access, the copy may have been partially performed.
 bool copy_to_user(pid_t pid, size_t user_vaddr, void *const kernel_vaddr, size_t len);
@@ -0,0 +1,21 @@
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+
+// Allocate a zeroed, virtually contiguous kernel buffer.
+// On systems with VMEM, this maps individual physical pages so it does not need physically contiguous memory.
+// On other systems, this is equivalent to `calloc(1, size)`.
+void  *vmalloc(size_t size);
+// Resize a buffer allocated with `vmalloc`.
+// Existing pages are remapped instead of copied where possible.
+void  *vrealloc(void *ptr, size_t size);
+// Free a buffer allocated with `vmalloc`.
+void   vfree(void *ptr);
+// Get the usable size of a buffer allocated with `vmalloc`.
+size_t vmalloc_size(void *ptr);
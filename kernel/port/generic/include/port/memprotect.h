@@ -4,16 +4,36 @@
 #pragma once
 
 #include "list.h"
+#include "spinlock.h"
 
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
 typedef struct {
     // Linked list node.
-    dlist_node_t node;
+    dlist_node_t     node;
     // Page table root physical page number.
-    size_t       root_ppn;
+    size_t           root_ppn;
+    // ASID generation in the upper bits and ASID in the lower `MMU_ASID_SHIFT` bits; 0 if none assigned.
+    _Atomic uint64_t asid;
+    // Bitmask of CPUs that currently have this context loaded.
+    // For the global context, CPUs that have loaded any context and so cache global mappings.
+    _Atomic uint64_t cpus;
+    // Guards `flush_start`, `flush_end`, `flush_remote` and `pt_garbage`; taken with interrupts disabled.
+    // Held until the TLBs are flushed so a commit can't return while another CPU is still flushing its changes.
+    spinlock_t       flush_lock;
+    // Start of the virtual address range with changes not yet flushed from the TLBs.
+    size_t           flush_start;
+    // End of the virtual address range with changes not yet flushed from the TLBs.
+    size_t           flush_end;
+    // Whether the pending changes removed mappings, so other CPUs must flush them too.
+    bool             flush_remote;
+    // Number of page table pages used by this context, including the root.
+    size_t           pt_pages;
+    // Page tables removed from this context that are released after the next TLB flush; 0 if none.
+    size_t           pt_garbage;
 } mpu_ctx_t;
 
 // HHDM length in pages.
@@ -3,14 +3,19 @@
 
 #include "memprotect.h"
 
-#include "arrays.h"
 #include "assertions.h"
 #include "badge_strings.h"
 #include "cpu/mmu.h"
 #include "cpu/panic.h"
+#include "interrupt.h"
 #include "isr_ctx.h"
+#include "malloc.h"
 #include "page_alloc.h"
 #include "port/port.h"
+#include "rangetree.h"
+#include "shrinker.h"
+#include "smp.h"
+#include "spinlock.h"
 
 // Page table walk result.
 typedef struct {
@@ -26,35 +31,26 @@ typedef struct {
     bool      vaddr_valid;
 } pt_walk_t;
 
-// Allocable virtual memory area.
+// Number of small allocation sizes that have per-CPU caches; size N caches ranges of N + 1 usable pages.
+#define VMM_CACHE_CLASSES 4
+// Maximum number of free ranges of each size in a per-CPU cache.
+#define VMM_CACHE_DEPTH   8
+
+// Per-CPU cache of recently freed kernel virtual address ranges.
+// Cached ranges stay in `vmm_used`, so nothing else can allocate them.
 typedef struct {
-    // Base virtual page number.
-    size_t vpn;
-    // Size in pages.
-    size_t pages;
-} vmm_info_t;
-
-// Sort `vmm_info_t` by `vpn`.
-static int vmm_info_cmp(void const *a, void const *b) {
-    vmm_info_t const *info_a = a;
-    vmm_info_t const *info_b = b;
-    if (info_a->vpn > info_b->vpn) {
-        return 1;
-    } else if (info_a->vpn < info_b->vpn) {
-        return -1;
-    } else {
-        return 0;
-    }
-}
+    // Guards the cache; taken with interrupts disabled.
+    spinlock_t        lock;
+    // Number of cached ranges of each size.
+    size_t            len[VMM_CACHE_CLASSES];
+    // Cached ranges of each size.
+    rangetree_node_t *ranges[VMM_CACHE_CLASSES][VMM_CACHE_DEPTH];
+} vmm_cache_t;
 
-// Allocated VMM ranges that can be freed.
-static size_t      vmm_used_len, vmm_used_cap;
-// Allocated VMM ranges that can be freed.
-static vmm_info_t *vmm_used;
-// Unallocated VMM ranges.
-static size_t      vmm_free_len, vmm_free_cap;
-// Unallocated VMM ranges.
-static vmm_info_t *vmm_free;
+// Allocated and reserved kernel virtual ranges, in pages and including guard pages.
+static rangetree_t  vmm_used = RANGETREE_EMPTY;
+// Per-CPU caches of free ranges; NULL until the number of CPUs is known.
+static vmm_cache_t *vmm_cache;
 
 
 
@@ -82,6 +78,124 @@ mpu_ctx_t      mpu_global_ctx;
 // All active non-global MMU contexts.
 static dlist_t ctx_list = DLIST_EMPTY;
 
+// Maximum number of free page table pages kept for reuse.
+#define PT_CACHE_MAX 64
+
+// Free page table pages kept for reuse, linked through their first PTE; 0 if none.
+static size_t     pt_cache_head;
+// Number of pages in the page table page cache.
+static size_t     pt_cache_len;
+// Guards the page table page cache.
+static spinlock_t pt_cache_lock = SPINLOCK_T_INIT;
+
+
+
+// Link a page table page that is no longer used into a list through its first PTE.
+// The link has the valid bit clear, so the MMU ignores it if it walks the table before the TLBs are flushed.
+static inline void pt_link(size_t pt_ppn, size_t next_ppn) {
+    mmu_write_pte(pt_ppn * MMU_PAGE_SIZE, (mmu_pte_t){.val = next_ppn * MMU_PAGE_SIZE});
+}
+
+// Get the next page table page in a list made with `pt_link`.
+static inline size_t pt_link_next(size_t pt_ppn) {
+    return mmu_read_pte(pt_ppn * MMU_PAGE_SIZE).val / MMU_PAGE_SIZE;
+}
+
+// Allocate an empty page table page for a context, reusing a cached one if possible.
+static size_t pt_alloc(mpu_ctx_t *ctx) {
+    spinlock_take(&pt_cache_lock);
+    size_t ppn = pt_cache_head;
+    if (ppn) {
+        pt_cache_head = pt_link_next(ppn);
+        pt_cache_len--;
+    }
+    spinlock_release(&pt_cache_lock);
+
+    if (ppn) {
+        mem_set((void *)(mmu_hhdm_vaddr + ppn * MMU_PAGE_SIZE), 0, MMU_PAGE_SIZE);
+    } else {
+        ppn = phys_page_alloc(1, false);
+        assert_always(ppn);
+    }
+    ctx->pt_pages++;
+    return ppn;
+}
+
+// Return a page table page that no TLB can refer to anymore to the cache, or free it if the cache is full.
+static void pt_release(size_t pt_ppn) {
+    spinlock_take(&pt_cache_lock);
+    bool cached = pt_cache_len < PT_CACHE_MAX;
+    if (cached) {
+        pt_link(pt_ppn, pt_cache_head);
+        pt_cache_head = pt_ppn;
+        pt_cache_len++;
+    }
+    spinlock_release(&pt_cache_lock);
+    if (!cached) {
+        phys_page_free(pt_ppn);
+    }
+}
+
+// Shrinker that frees the cached page table pages.
+static size_t pt_cache_shrinker(size_t target_pages, void *cookie) {
+    (void)cookie;
+    size_t freed = 0;
+    while (freed < target_pages) {
+        spinlock_take(&pt_cache_lock);
+        size_t ppn = pt_cache_head;
+        if (ppn) {
+            pt_cache_head = pt_link_next(ppn);
+            pt_cache_len--;
+        }
+        spinlock_release(&pt_cache_lock);
+        if (!ppn) {
+            break;
+        }
+        phys_page_free(ppn);
+        freed++;
+    }
+    return freed;
+}
+
+// Remove a page table and all tables below it from a context.
+// They are released by `memprotect_commit` once the TLBs no longer refer to them.
+static void pt_discard(mpu_ctx_t *ctx, size_t pt_ppn, int pt_level) {
+    if (pt_level) {
+        for (size_t i = 0; i < (1 << MMU_BITS_PER_LEVEL); i++) {
+            mmu_pte_t pte = mmu_read_pte(pt_ppn * MMU_PAGE_SIZE + i * sizeof(mmu_pte_t));
+            if (mmu_pte_is_valid(pte) && !mmu_pte_is_leaf(pte)) {
+                pt_discard(ctx, mmu_pte_get_ppn(pte), pt_level - 1);
+            }
+        }
+    }
+    bool ie = irq_disable();
+    spinlock_take(&ctx->flush_lock);
+    pt_link(pt_ppn, ctx->pt_garbage);
+    ctx->pt_garbage = pt_ppn;
+    spinlock_release(&ctx->flush_lock);
+    irq_enable_if(ie);
+    ctx->pt_pages--;
+}
+
+// Release a list of page tables taken from `pt_garbage` once no TLB refers to them anymore.
+static void pt_collect(size_t garbage) {
+    while (garbage) {
+        size_t ppn = garbage;
+        garbage    = pt_link_next(ppn);
+        pt_release(ppn);
+    }
+}
+
+// Whether a page table has no valid entries.
+static bool pt_is_empty(size_t pt_ppn) {
+    for (size_t i = 0; i < (1 << MMU_BITS_PER_LEVEL); i++) {
+        if (mmu_pte_is_valid(mmu_read_pte(pt_ppn * MMU_PAGE_SIZE + i * sizeof(mmu_pte_t)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
 
 
 // Walk a page table; vaddr to paddr or return where the page table ends.
@@ -143,15 +257,15 @@ static pt_walk_t pt_walk(size_t pt_ppn, size_t vpn) {
 
 // Split a PTE into the next page table level to allow for edits of superpages.
 // Returns PPN of new table.
-static inline size_t pt_split(size_t pt_ppn, int pt_level, size_t pte_paddr, mmu_pte_t pte, size_t vpn) {
+static inline size_t
+    pt_split(mpu_ctx_t *ctx, size_t pt_ppn, int pt_level, size_t pte_paddr, mmu_pte_t pte, size_t vpn) {
 #if MMU_SUPPORT_SUPERPAGES
     (void)pt_ppn;
     (void)pt_level;
     (void)vpn;
 
     // Allocate new table.
-    size_t next_pt = phys_page_alloc(1, false);
-    assert_always(next_pt);
+    size_t next_pt = pt_alloc(ctx);
 
     // Populate with new entries.
     size_t   ppn   = mmu_pte_get_ppn(pte);
@@ -165,6 +279,7 @@ static inline size_t pt_split(size_t pt_ppn, int pt_level, size_t pte_paddr, mmu
     mmu_write_pte(pte_paddr, mmu_pte_new(next_pt));
     return next_pt;
 #else
+    (void)ctx;
     (void)pt_ppn;
 
     // MMU does not support superpages.
@@ -182,7 +297,8 @@ static inline size_t pt_split(size_t pt_ppn, int pt_level, size_t pte_paddr, mmu
 
 // Walk from an arbitrary page table level to another to create a new mapping.
 // Returns true if the top level of the page table was edited.
-static bool pt_map_1(size_t pt_ppn, int pt_level, size_t vpn, size_t ppn, int pte_level, uint32_t flags) {
+static bool
+    pt_map_1(mpu_ctx_t *ctx, size_t pt_ppn, int pt_level, size_t vpn, size_t ppn, int pte_level, uint32_t flags) {
     bool top_edit      = pt_level == pte_level;
     int  orig_pt_level = pt_level;
 
@@ -205,14 +321,13 @@ static bool pt_map_1(size_t pt_ppn, int pt_level, size_t vpn, size_t ppn, int pt
         mmu_pte_t pte       = mmu_read_pte(pte_paddr);
         if (!mmu_pte_is_valid(pte)) {
             // Make new level of page table.
-            size_t next_pt = phys_page_alloc(1, false);
-            assert_always(next_pt);
+            size_t next_pt = pt_alloc(ctx);
             mmu_write_pte(pte_paddr, mmu_pte_new(next_pt));
             top_edit |= orig_pt_level == pt_level;
             pt_ppn    = next_pt;
         } else if (mmu_pte_is_leaf(pte)) {
             // Split page.
-            pt_ppn    = pt_split(pt_ppn, pt_level, pte_paddr, pte, vpn);
+            pt_ppn    = pt_split(ctx, pt_ppn, pt_level, pte_paddr, pte, vpn);
             top_edit |= orig_pt_level == pt_level;
         } else {
             // Walk to next level of page table.
@@ -221,14 +336,19 @@ static bool pt_map_1(size_t pt_ppn, int pt_level, size_t vpn, size_t ppn, int pt
     }
 
     // At the correct level; write leaf PTE.
-    size_t pte_paddr = pt_ppn * MMU_PAGE_SIZE + mmu_vpn_part(vpn, pte_level) * sizeof(mmu_pte_t);
+    size_t    pte_paddr = pt_ppn * MMU_PAGE_SIZE + mmu_vpn_part(vpn, pte_level) * sizeof(mmu_pte_t);
+    mmu_pte_t pte       = mmu_read_pte(pte_paddr);
     mmu_write_pte(pte_paddr, mmu_pte_new_leaf(ppn, flags));
+    if (pte_level && mmu_pte_is_valid(pte) && !mmu_pte_is_leaf(pte) && ctx != &mpu_global_ctx) {
+        // A superpage replaces a whole page table.
+        pt_discard(ctx, mmu_pte_get_ppn(pte), pte_level - 1);
+    }
     return top_edit;
 }
 
 // Walk from an arbitrary page table level to another to remove a mapping.
 // Returns true if the top level of the page table was edited.
-static bool pt_unmap_1(size_t pt_ppn, int pt_level, size_t vpn, int pte_level) {
+static bool pt_unmap_1(mpu_ctx_t *ctx, size_t pt_ppn, int pt_level, size_t vpn, int pte_level) {
     bool top_edit      = pt_level == pte_level;
     int  orig_pt_level = pt_level;
 
@@ -244,7 +364,7 @@ static bool pt_unmap_1(size_t pt_ppn, int pt_level, size_t vpn, int pte_level) {
 
     // Walk the page table, adding new tables as needed.
     for (; pte_level < pt_level; pt_level--) {
-        size_t    pte_paddr = pt_ppn * MMU_PAGE_SIZE + mmu_vpn_part(vpn, pte_level) * sizeof(mmu_pte_t);
+        size_t    pte_paddr = pt_ppn * MMU_PAGE_SIZE + mmu_vpn_part(vpn, pt_level) * sizeof(mmu_pte_t);
         // Too high; read PTE to go to next table.
         mmu_pte_t pte       = mmu_read_pte(pte_paddr);
         if (!mmu_pte_is_valid(pte)) {
@@ -252,7 +372,7 @@ static bool pt_unmap_1(size_t pt_ppn, int pt_level, size_t vpn, int pte_level) {
             return top_edit;
         } else if (mmu_pte_is_leaf(pte)) {
             // Split page.
-            pt_ppn    = pt_split(pt_ppn, pt_level, pte_paddr, pte, vpn);
+            pt_ppn    = pt_split(ctx, pt_ppn, pt_level, pte_paddr, pte, vpn);
             top_edit |= orig_pt_level == pt_level;
         } else {
             // Walk to next level of page table.
@@ -260,9 +380,14 @@ static bool pt_unmap_1(size_t pt_ppn, int pt_level, size_t vpn, int pte_level) {
         }
     }
 
-    // At the correct level; write leaf PTE.
-    size_t pte_paddr = pt_ppn * MMU_PAGE_SIZE + mmu_vpn_part(vpn, pte_level) * sizeof(mmu_pte_t);
+    // At the correct level; clear the PTE.
+    size_t    pte_paddr = pt_ppn * MMU_PAGE_SIZE + mmu_vpn_part(vpn, pte_level) * sizeof(mmu_pte_t);
+    mmu_pte_t pte       = mmu_read_pte(pte_paddr);
     mmu_write_pte(pte_paddr, MMU_PTE_NULL);
+    if (pte_level && mmu_pte_is_valid(pte) && !mmu_pte_is_leaf(pte) && ctx != &mpu_global_ctx) {
+        // A whole page table was unmapped at once.
+        pt_discard(ctx, mmu_pte_get_ppn(pte), pte_level - 1);
+    }
     return top_edit;
 }
 
@@ -281,11 +406,12 @@ static int pt_calc_superpage(int max_level, size_t vpn, size_t ppn, size_t max_l
 
 // Walk from an arbitrary page table level to create new mappings.
 // Returns true if the top level of the page table was edited.
-static bool pt_map(size_t pt_ppn, int pt_level, size_t vpn, size_t ppn, size_t pages, uint32_t flags) {
+static bool
+    pt_map(mpu_ctx_t *ctx, size_t pt_ppn, int pt_level, size_t vpn, size_t ppn, size_t pages, uint32_t flags) {
     bool top_edit = false;
     while (pages) {
         int pte_level     = pt_calc_superpage(pt_level, vpn, ppn, pages);
-        top_edit         |= pt_map_1(pt_ppn, pt_level, vpn, ppn, pte_level, flags);
+        top_edit         |= pt_map_1(ctx, pt_ppn, pt_level, vpn, ppn, pte_level, flags);
         size_t super_len  = 1LLU << (MMU_BITS_PER_LEVEL * pte_level);
         vpn              += super_len;
         ppn              += super_len;
@@ -294,17 +420,45 @@ static bool pt_map(size_t pt_ppn, int pt_level, size_t vpn, size_t ppn, size_t p
     return top_edit;
 }
 
+// Remove the page tables below an arbitrary page table level that no longer map anything in a range.
+static void pt_prune(mpu_ctx_t *ctx, size_t pt_ppn, int pt_level, size_t vpn, size_t pages) {
+    size_t span = 1LLU << (MMU_BITS_PER_LEVEL * pt_level);
+    size_t end  = vpn + pages;
+    while (vpn < end) {
+        size_t    next      = (vpn & ~(span - 1)) + span;
+        size_t    pte_paddr = pt_ppn * MMU_PAGE_SIZE + mmu_vpn_part(vpn, pt_level) * sizeof(mmu_pte_t);
+        mmu_pte_t pte       = mmu_read_pte(pte_paddr);
+        if (mmu_pte_is_valid(pte) && !mmu_pte_is_leaf(pte)) {
+            size_t next_pt = mmu_pte_get_ppn(pte);
+            if (pt_level > 1) {
+                pt_prune(ctx, next_pt, pt_level - 1, vpn, (next < end ? next : end) - vpn);
+            }
+            if (pt_is_empty(next_pt)) {
+                mmu_write_pte(pte_paddr, MMU_PTE_NULL);
+                pt_discard(ctx, next_pt, pt_level - 1);
+            }
+        }
+        vpn = next;
+    }
+}
+
 // Walk from an arbitrary page table level to remove mappings.
 // Returns true if the top level of the page table was edited.
-static bool pt_unmap(size_t pt_ppn, int pt_level, size_t vpn, size_t pages) {
-    bool top_edit = false;
+static bool pt_unmap(mpu_ctx_t *ctx, size_t pt_ppn, int pt_level, size_t vpn, size_t pages) {
+    bool   top_edit = false;
+    size_t orig_vpn = vpn;
+    size_t orig_len = pages;
     while (pages) {
         int pte_level     = pt_calc_superpage(pt_level, vpn, 0, pages);
-        top_edit         |= pt_unmap_1(pt_ppn, pt_level, vpn, pte_level);
+        top_edit         |= pt_unmap_1(ctx, pt_ppn, pt_level, vpn, pte_level);
         size_t super_len  = 1LLU << (MMU_BITS_PER_LEVEL * pte_level);
         vpn              += super_len;
         pages            -= super_len;
     }
+    if (ctx != &mpu_global_ctx && pt_level) {
+        // The top levels of the global page table are shared with every context, so it is never pruned.
+        pt_prune(ctx, pt_ppn, pt_level, orig_vpn, orig_len);
+    }
     return top_edit;
 }
 
@@ -350,84 +504,104 @@ static void vmm_mark_reserved(size_t vpn, size_t pages) {
         pages -= mmu_high_vpn - vpn;
         vpn    = mmu_high_vpn;
     }
-    if (vpn + pages > mmu_high_vpn + mmu_half_size) {
-        pages = mmu_high_vpn + mmu_half_size - vpn;
+    if (vpn + pages > mmu_high_vpn + mmu_half_pages) {
+        pages = mmu_high_vpn + mmu_half_pages - vpn;
     }
 
-    // Look up which entry to cut.
-    array_binsearch_t idx = array_binsearch(vmm_free, sizeof(vmm_info_t), vmm_free_len, &vpn, vmm_info_cmp);
-    assert_dev_drop(idx.found || idx.index > 0);
-    idx.index        -= !idx.found;
-    vmm_info_t range  = vmm_free[idx.index];
-    assert_dev_drop(vpn >= range.vpn);
-    assert_dev_drop(vpn + pages <= range.vpn + range.pages);
-
-    if (range.vpn == vpn && range.pages == pages) {
-        // Remove the entry from free list.
-        array_lencap_remove(&vmm_free, sizeof(vmm_info_t), &vmm_free_len, &vmm_free_cap, NULL, idx.index);
+    rangetree_node_t *range = malloc(sizeof(rangetree_node_t));
+    assert_always(range);
+    range->base = vpn;
+    range->size = pages;
+    assert_always(rangetree_insert(&vmm_used, range));
+}
 
-    } else if (vpn > range.vpn && vpn + pages < range.vpn + range.pages) {
-        // Add entry to the free list.
-        vmm_info_t new_ent = {
-            .vpn   = vpn + pages,
-            .pages = range.vpn + range.pages - vpn - pages,
-        };
-        assert_always(
-            array_lencap_insert(&vmm_free, sizeof(vmm_info_t), &vmm_free_len, &vmm_free_cap, &new_ent, idx.index + 1)
-        );
-        // Modify the other one.
-        vmm_free[idx.index] = (vmm_info_t){
-            .vpn   = range.vpn,
-            .pages = vpn - range.vpn,
-        };
+// Alloc vaddr mutex; taken shared to look up ranges and exclusively to add or remove them.
+static mutex_t vmm_mtx = MUTEX_T_INIT_SHARED;
 
-    } else if (vpn > range.vpn) {
-        // Modify the entry.
-        vmm_free[idx.index].pages = vpn - range.vpn;
+// Take a free range of `pages` pages, including guard pages, from the current CPU's cache.
+// Returns NULL if there is none.
+static rangetree_node_t *vmm_cache_pop(size_t pages) {
+    size_t class = pages - 3;
+    if (!vmm_cache || class >= VMM_CACHE_CLASSES) {
+        return NULL;
+    }
+    bool         ie    = irq_disable();
+    vmm_cache_t *cache = &vmm_cache[smp_cur_cpu()];
+    spinlock_take(&cache->lock);
+    rangetree_node_t *range = cache->len[class] ? cache->ranges[class][--cache->len[class]] : NULL;
+    spinlock_release(&cache->lock);
+    irq_enable_if(ie);
+    return range;
+}
 
-    } else /* vpn + pages < range.vpn + range.pages */ {
-        // Modify the entry.
-        vmm_free[idx.index].vpn   = vpn + pages;
-        vmm_free[idx.index].pages = range.vpn + range.pages - vpn - pages;
+// Put a freed range in the current CPU's cache.
+// Returns false if it does not fit, in which case it must be removed from `vmm_used` instead.
+static bool vmm_cache_push(rangetree_node_t *range) {
+    size_t class = range->size - 3;
+    if (!vmm_cache || class >= VMM_CACHE_CLASSES) {
+        return false;
+    }
+    bool         ie    = irq_disable();
+    vmm_cache_t *cache = &vmm_cache[smp_cur_cpu()];
+    spinlock_take(&cache->lock);
+    bool cached = cache->len[class] < VMM_CACHE_DEPTH;
+    if (cached) {
+        cache->ranges[class][cache->len[class]++] = range;
     }
+    spinlock_release(&cache->lock);
+    irq_enable_if(ie);
+    return cached;
 }
 
-// Alloc vaddr mutex.
-static mutex_t vmm_mtx = MUTEX_T_INIT;
+// Release the ranges in every per-CPU cache; `vmm_mtx` must be held exclusively.
+// Returns whether any ranges were released.
+static bool vmm_cache_drain() {
+    bool drained = false;
+    for (int cpu = 0; vmm_cache && cpu < smp_count; cpu++) {
+        vmm_cache_t *cache = &vmm_cache[cpu];
+        for (size_t class = 0; class < VMM_CACHE_CLASSES; class++) {
+            while (1) {
+                bool ie = irq_disable();
+                spinlock_take(&cache->lock);
+                rangetree_node_t *range = cache->len[class] ? cache->ranges[class][--cache->len[class]] : NULL;
+                spinlock_release(&cache->lock);
+                irq_enable_if(ie);
+                if (!range) {
+                    break;
+                }
+                rangetree_remove(&vmm_used, range);
+                free(range);
+                drained = true;
+            }
+        }
+    }
+    return drained;
+}
 
 // Allocare a kernel virtual address to a certain physical address.
 size_t memprotect_alloc_vaddr(size_t len) {
-    mutex_acquire(NULL, &vmm_mtx, TIMESTAMP_US_MAX);
-    size_t pages = (len - 1) / MEMMAP_PAGE_SIZE + 3;
-    size_t i;
-    for (i = 0; i < vmm_free_len; i++) {
-        if (vmm_free[i].pages >= pages) {
-            break;
+    // One guard page is left unmapped on either side.
+    size_t            pages = (len - 1) / MEMMAP_PAGE_SIZE + 3;
+    rangetree_node_t *range = vmm_cache_pop(pages);
+
+    if (!range) {
+        range = malloc(sizeof(rangetree_node_t));
+        assert_always(range);
+        mutex_acquire(NULL, &vmm_mtx, TIMESTAMP_US_MAX);
+        size_t min   = mmu_high_vpn;
+        size_t max   = mmu_high_vpn + mmu_half_pages;
+        bool   found = rangetree_find_gap(&vmm_used, min, max, pages, 1, &range->base);
+        if (!found && vmm_cache_drain()) {
+            found = rangetree_find_gap(&vmm_used, min, max, pages, 1, &range->base);
         }
+        assert_always(found);
+        range->size = pages;
+        assert_always(rangetree_insert(&vmm_used, range));
+        mutex_release(NULL, &vmm_mtx);
     }
-    assert_always(i < vmm_free_len);
-    vmm_info_t range      = vmm_free[i];
-    vmm_info_t used_range = {
-        .vpn   = range.vpn,
-        .pages = pages,
-    };
-    assert_always(array_lencap_sorted_insert(
-        &vmm_used,
-        sizeof(vmm_info_t),
-        &vmm_used_len,
-        &vmm_used_cap,
-        &used_range,
-        vmm_info_cmp
-    ));
-    if (vmm_free[i].pages > pages) {
-        vmm_free[i].vpn   += pages;
-        vmm_free[i].pages -= pages;
-    } else {
-        array_lencap_remove(&vmm_free, sizeof(vmm_info_t), &vmm_free_len, &vmm_free_cap, NULL, i);
-    }
-    mutex_release(NULL, &vmm_mtx);
-    logkf(LOG_DEBUG, "memprotect_alloc_vaddr(0x%{size;x}) = 0x%{size;x}", len, (range.vpn + 1) * MEMMAP_PAGE_SIZE);
-    return (range.vpn + 1) * MEMMAP_PAGE_SIZE;
+
+    logkf(LOG_DEBUG, "memprotect_alloc_vaddr(0x%{size;x}) = 0x%{size;x}", len, (range->base + 1) * MEMMAP_PAGE_SIZE);
+    return (range->base + 1) * MEMMAP_PAGE_SIZE;
 }
 
 // Free a virtual address range allocated with `memprotect_alloc_vaddr`.
@@ -435,42 +609,21 @@ void memprotect_free_vaddr(size_t vaddr) {
     logkf(LOG_DEBUG, "memprotect_free_vaddr(0x%{size;x})", vaddr);
     assert_always(vaddr % MEMMAP_PAGE_SIZE == 0);
     size_t vpn = vaddr / MEMMAP_PAGE_SIZE - 1;
-    mutex_acquire(NULL, &vmm_mtx, TIMESTAMP_US_MAX);
-
-    // Look up the in-use entry.
-    array_binsearch_t res = array_binsearch(vmm_used, sizeof(vmm_info_t), vmm_used_len, &vpn, vmm_info_cmp);
-    assert_always(res.found);
-    vmm_info_t range;
-    array_lencap_remove(&vmm_used, sizeof(vmm_info_t), &vmm_used_len, &vmm_used_cap, &range, res.index);
-    assert_always(range.vpn == vpn);
-
-    // Insert into the free list.
-    res = array_binsearch(vmm_free, sizeof(vmm_info_t), vmm_free_len, &range, vmm_info_cmp);
-    assert_dev_drop(!res.found);
-    if (res.index && vmm_free[res.index - 1].vpn + vmm_free[res.index - 1].pages == range.vpn &&
-        range.vpn + range.pages == vmm_free[res.index].vpn) {
-        // Merge both.
-        vmm_free[res.index - 1].pages =
-            vmm_free[res.index].vpn + vmm_free[res.index].pages - vmm_free[res.index - 1].vpn;
-        array_lencap_remove(&vmm_free, sizeof(vmm_info_t), &vmm_free_len, &vmm_free_cap, NULL, res.index);
-
-    } else if (res.index && vmm_free[res.index - 1].vpn + vmm_free[res.index - 1].pages == range.vpn) {
-        // Merge left.
-        vmm_free[res.index - 1].pages = range.vpn + range.pages - vmm_free[res.index - 1].vpn;
-
-    } else if (range.vpn + range.pages == vmm_free[res.index].vpn) {
-        // Merge right.
-        vmm_free[res.index].pages += vmm_free[res.index].vpn - range.vpn;
-        vmm_free[res.index].vpn    = range.vpn;
 
-    } else {
-        // Not mergable.
-        assert_always(
-            array_lencap_insert(&vmm_free, sizeof(vmm_info_t), &vmm_free_len, &vmm_free_cap, &range, res.index)
-        );
+    // Look up the in-use range.
+    mutex_acquire_shared(NULL, &vmm_mtx, TIMESTAMP_US_MAX);
+    rangetree_node_t *range = rangetree_find(&vmm_used, vpn);
+    assert_always(range && range->base == vpn);
+    bool cached = vmm_cache_push(range);
+    mutex_release_shared(NULL, &vmm_mtx);
+
+    if (!cached) {
+        // Only the owner of a range frees it, so it can't have been removed in the meantime.
+        mutex_acquire(NULL, &vmm_mtx, TIMESTAMP_US_MAX);
+        rangetree_remove(&vmm_used, range);
+        mutex_release(NULL, &vmm_mtx);
+        free(range);
     }
-
-    mutex_release(NULL, &vmm_mtx);
 }
 
 
@@ -482,25 +635,16 @@ void memprotect_early_init() {
 
 // Initialise memory protection driver.
 void memprotect_postheap_init() {
-    // Mark entire space as free.
-    vmm_info_t mem;
-    mem.vpn      = mmu_high_vpn;
-    mem.pages    = mmu_half_pages;
-    vmm_free     = malloc(sizeof(vmm_info_t));
-    vmm_free[0]  = mem;
-    vmm_free_len = 1;
-    vmm_free_cap = 1;
-
     // Remove HHDM and kernel from free area.
     vmm_mark_reserved(memprotect_kernel_vpn - 1, memprotect_kernel_pages + 2);
     vmm_mark_reserved(mmu_hhdm_vpn - 1, memprotect_hhdm_pages + 2);
 
     // Allocate global page table.
-    mpu_global_ctx.root_ppn = phys_page_alloc(1, false);
-    assert_always(mpu_global_ctx.root_ppn);
+    mpu_global_ctx.root_ppn = pt_alloc(&mpu_global_ctx);
 
     // HHDM mapping (without execute this time).
     pt_map(
+        &mpu_global_ctx,
         mpu_global_ctx.root_ppn,
         mmu_levels - 1,
         mmu_hhdm_vaddr / MMU_PAGE_SIZE,
@@ -516,6 +660,7 @@ void memprotect_postheap_init() {
     sect_len = (__stop_text - __start_text) / MMU_PAGE_SIZE;
     assert_dev_drop((__stop_text - __start_text) % MMU_PAGE_SIZE == 0);
     pt_map(
+        &mpu_global_ctx,
         mpu_global_ctx.root_ppn,
         mmu_levels - 1,
         vpn,
@@ -529,6 +674,7 @@ void memprotect_postheap_init() {
     sect_len  = (__stop_rodata - __start_rodata) / MMU_PAGE_SIZE;
     assert_dev_drop((__stop_rodata - __start_rodata) % MMU_PAGE_SIZE == 0);
     pt_map(
+        &mpu_global_ctx,
         mpu_global_ctx.root_ppn,
         mmu_levels - 1,
         vpn,
@@ -542,6 +688,7 @@ void memprotect_postheap_init() {
     sect_len  = (__stop_data - __start_data) / MMU_PAGE_SIZE;
     assert_dev_drop((__stop_data - __start_data) % MMU_PAGE_SIZE == 0);
     pt_map(
+        &mpu_global_ctx,
         mpu_global_ctx.root_ppn,
         mmu_levels - 1,
         vpn,
@@ -561,15 +708,26 @@ void memprotect_postheap_init() {
 
 // Initialise memory protection driver.
 void memprotect_init() {
+    // All CPUs are known by now.
+    vmm_cache = calloc(smp_count, sizeof(vmm_cache_t));
+    assert_always(vmm_cache);
+    shrinker_register("pagetables", SHRINKER_PRIO_RETAINED, pt_cache_shrinker, NULL);
 }
 
 
 
 // Create a memory protection context.
 void memprotect_create(mpu_ctx_t *ctx) {
-    ctx->node     = DLIST_NODE_EMPTY;
-    ctx->root_ppn = phys_page_alloc(1, false);
-    assert_always(ctx->root_ppn);
+    ctx->node         = DLIST_NODE_EMPTY;
+    ctx->asid         = 0;
+    ctx->cpus         = 0;
+    ctx->flush_lock   = SPINLOCK_T_INIT;
+    ctx->flush_start  = 0;
+    ctx->flush_end    = 0;
+    ctx->flush_remote = false;
+    ctx->pt_pages     = 0;
+    ctx->pt_garbage   = 0;
+    ctx->root_ppn     = pt_alloc(ctx);
     size_t src_vaddr  = mmu_hhdm_vaddr + mpu_global_ctx.root_ppn * MMU_PAGE_SIZE;
     size_t dest_vaddr = mmu_hhdm_vaddr + ctx->root_ppn * MMU_PAGE_SIZE;
     mem_copy((void *)dest_vaddr, (void const *)src_vaddr, MMU_PAGE_SIZE);
@@ -579,7 +737,22 @@ void memprotect_create(mpu_ctx_t *ctx) {
 // Clean up a memory protection context.
 void memprotect_destroy(mpu_ctx_t *ctx) {
     dlist_remove(&ctx_list, &ctx->node);
-    logkf(LOG_DEBUG, "TODO: Memprotect cleanup");
+
+    // The upper half of the root table points to the global page tables, which are shared.
+    for (size_t i = 0; i < (1 << (MMU_BITS_PER_LEVEL - 1)); i++) {
+        mmu_pte_t pte = mmu_read_pte(ctx->root_ppn * MMU_PAGE_SIZE + i * sizeof(mmu_pte_t));
+        if (mmu_pte_is_valid(pte) && !mmu_pte_is_leaf(pte)) {
+            pt_discard(ctx, mmu_pte_get_ppn(pte), mmu_levels - 2);
+        }
+    }
+    pt_discard(ctx, ctx->root_ppn, 0);
+    assert_dev_drop(ctx->pt_pages == 0);
+
+    // No CPU has the context loaded anymore and its ASID is not handed out again until every CPU has flushed,
+    // so stale TLB entries will never be used to walk the tables again.
+    size_t garbage  = ctx->pt_garbage;
+    ctx->pt_garbage = 0;
+    pt_collect(garbage);
 }
 
 // Add a memory protection region.
@@ -593,9 +766,9 @@ void memprotect_impl(mpu_ctx_t *ctx, size_t vpn, size_t ppn, size_t pages, uint3
 
     // Apply change.
     if (flags & MEMPROTECT_FLAG_RWX) {
-        top_mod = pt_map(ctx->root_ppn, mmu_levels - 1, vpn, ppn, pages, flags);
+        top_mod = pt_map(ctx, ctx->root_ppn, mmu_levels - 1, vpn, ppn, pages, flags);
     } else {
-        top_mod = pt_unmap(ctx->root_ppn, mmu_levels - 1, vpn, pages);
+        top_mod = pt_unmap(ctx, ctx->root_ppn, mmu_levels - 1, vpn, pages);
     }
 
     // Broadcast global changes.
@@ -607,8 +780,28 @@ void memprotect_impl(mpu_ctx_t *ctx, size_t vpn, size_t ppn, size_t pages, uint3
         }
     }
 
-    // Perform VMEM fence.
-    mmu_vmem_fence();
+    // Record the change so `memprotect_commit` can flush it from the TLBs in one go.
+    size_t vaddr = vpn * MMU_PAGE_SIZE;
+    size_t size  = pages * MMU_PAGE_SIZE;
+    bool   ie    = irq_disable();
+    spinlock_take(&ctx->flush_lock);
+    if (ctx->flush_start == ctx->flush_end) {
+        ctx->flush_start = vaddr;
+        ctx->flush_end   = vaddr + size;
+    } else {
+        ctx->flush_start = vaddr < ctx->flush_start ? vaddr : ctx->flush_start;
+        ctx->flush_end   = vaddr + size > ctx->flush_end ? vaddr + size : ctx->flush_end;
+    }
+    // Write-protecting pages for copy-on-write removes permissions, just like unmapping.
+    // Other CPUs may also cache the page tables that were removed.
+    ctx->flush_remote |= !(flags & MEMPROTECT_FLAG_RWX) || (flags & MEMPROTECT_FLAG_COW) || ctx->pt_garbage;
+    spinlock_release(&ctx->flush_lock);
+    irq_enable_if(ie);
+
+    if (ctx == &mpu_global_ctx) {
+        // Kernel mappings may be used before the next commit.
+        mmu_vmem_fence_range(vaddr, size);
+    }
 }
 
 // Add a memory protection region for user memory.
@@ -627,6 +820,15 @@ bool memprotect_u(proc_memmap_t *new_mm, mpu_ctx_t *ctx, size_t vaddr, size_t pa
     }
     flags &= ~(MEMPROTECT_FLAG_GLOBAL | MEMPROTECT_FLAG_KERNEL);
     memprotect_impl(ctx, vaddr, paddr, length, flags);
+    bool ie = irq_disable();
+    spinlock_take(&ctx->flush_lock);
+    bool garbage = ctx->pt_garbage;
+    spinlock_release(&ctx->flush_lock);
+    irq_enable_if(ie);
+    if (!(flags & MEMPROTECT_FLAG_RWX) || (flags & MEMPROTECT_FLAG_COW) || garbage) {
+        // Other CPUs may still cache the removed mappings or page tables under this context's ASID.
+        mmu_asid_invalidate(ctx);
+    }
     return true;
 }
 
@@ -649,9 +851,44 @@ bool memprotect_k(size_t vaddr, size_t paddr, size_t length, uint32_t flags) {
 }
 
 // Commit pending memory protections, if any.
+// Returns once every change made to the context before the call is flushed, even if another CPU took it to flush.
 void memprotect_commit(mpu_ctx_t *ctx) {
-    (void)ctx;
-    // TODO: Run mmu_vmem_fence on other CPUs.
-    mmu_vmem_fence();
-    // TODO: Garbage collection is now safe to do.
+    // A commit that finds nothing pending may race with one that took its changes but hasn't flushed them yet;
+    // holding the lock until the flush is done makes it wait for that flush.
+    bool ie = irq_disable();
+    spinlock_take(&ctx->flush_lock);
+    if (ctx->flush_start == ctx->flush_end) {
+        spinlock_release(&ctx->flush_lock);
+        irq_enable_if(ie);
+        return;
+    }
+    size_t vaddr      = ctx->flush_start;
+    size_t size       = ctx->flush_end - ctx->flush_start;
+    bool   remote     = ctx->flush_remote;
+    size_t garbage    = ctx->pt_garbage;
+    ctx->flush_start  = 0;
+    ctx->flush_end    = 0;
+    ctx->flush_remote = false;
+    ctx->pt_garbage   = 0;
+
+    if (garbage) {
+        // Removed page tables may still be cached as non-leaf entries, which only a full flush removes.
+        // They may have been removed after the change that set `flush_remote`, so other CPUs always flush too.
+        vaddr  = 0;
+        size   = SIZE_MAX;
+        remote = true;
+    }
+    if (ctx != &mpu_global_ctx) {
+        mmu_vmem_fence_range(vaddr, size);
+    }
+    if (remote) {
+        // Only removed mappings need to be shot down on other CPUs.
+        // `memprotect_u` already dropped the ASID, so CPUs that load this context after this point use a new one.
+        mmu_remote_fence(atomic_load(&ctx->cpus), vaddr, size);
+    }
+    spinlock_release(&ctx->flush_lock);
+    irq_enable_if(ie);
+
+    // No TLB refers to the removed page tables anymore.
+    pt_collect(garbage);
 }
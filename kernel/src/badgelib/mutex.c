@@ -305,3 +305,9 @@ bool mutex_acquire_shared_from_isr(badge_err_t *ec, mutex_t *mutex, timestamp_us
 bool mutex_release_shared_from_isr(badge_err_t *ec, mutex_t *mutex) {
     return mutex_release_shared_impl(ec, mutex, true);
 }
+
+// Whether `mutex` is currently held exclusively by any thread.
+// Only meant for asserting that a caller holds a lock it is required to.
+bool mutex_is_held(mutex_t const *mutex) {
+    return atomic_load(&mutex->shares) >= EXCLUSIVE_MAGIC;
+}
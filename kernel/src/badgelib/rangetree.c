@@ -0,0 +1,272 @@
+
+// SPDX-License-Identifier: MIT
+
+#include "rangetree.h"
+
+#include <stdint.h>
+
+
+
+// Height of a subtree that may be empty.
+static inline int rangetree_height(rangetree_node_t const *node) {
+    return node ? node->height : 0;
+}
+
+// Recompute the cached subtree information of a node from its children.
+static void rangetree_update(rangetree_node_t *node) {
+    size_t end     = node->base + node->size;
+    size_t gap     = 0;
+    node->sub_base = node->base;
+    node->sub_end  = end;
+    if (node->left) {
+        node->sub_base = node->left->sub_base;
+        gap            = node->left->sub_gap;
+        if (node->base - node->left->sub_end > gap) {
+            gap = node->base - node->left->sub_end;
+        }
+    }
+    if (node->right) {
+        node->sub_end = node->right->sub_end;
+        if (node->right->sub_gap > gap) {
+            gap = node->right->sub_gap;
+        }
+        if (node->right->sub_base - end > gap) {
+            gap = node->right->sub_base - end;
+        }
+    }
+    node->sub_gap = gap;
+    int left      = rangetree_height(node->left);
+    int right     = rangetree_height(node->right);
+    node->height  = 1 + (left > right ? left : right);
+}
+
+// Replace `old` with `new` as the child of `parent`, or as the root if `parent` is NULL.
+static void rangetree_replace(
+    rangetree_t *tree, rangetree_node_t *parent, rangetree_node_t *old, rangetree_node_t *new
+) {
+    if (!parent) {
+        tree->root = new;
+    } else if (parent->left == old) {
+        parent->left = new;
+    } else {
+        parent->right = new;
+    }
+    if (new) {
+        new->parent = parent;
+    }
+}
+
+// Rotate a subtree to the left; returns the new root of the subtree.
+static rangetree_node_t *rangetree_rotate_left(rangetree_t *tree, rangetree_node_t *node) {
+    rangetree_node_t *pivot = node->right;
+    rangetree_replace(tree, node->parent, node, pivot);
+    node->right = pivot->left;
+    if (pivot->left) {
+        pivot->left->parent = node;
+    }
+    pivot->left  = node;
+    node->parent = pivot;
+    rangetree_update(node);
+    rangetree_update(pivot);
+    return pivot;
+}
+
+// Rotate a subtree to the right; returns the new root of the subtree.
+static rangetree_node_t *rangetree_rotate_right(rangetree_t *tree, rangetree_node_t *node) {
+    rangetree_node_t *pivot = node->left;
+    rangetree_replace(tree, node->parent, node, pivot);
+    node->left = pivot->right;
+    if (pivot->right) {
+        pivot->right->parent = node;
+    }
+    pivot->right = node;
+    node->parent = pivot;
+    rangetree_update(node);
+    rangetree_update(pivot);
+    return pivot;
+}
+
+// Update cached information and restore balance from `node` up to the root.
+static void rangetree_fixup(rangetree_t *tree, rangetree_node_t *node) {
+    while (node) {
+        rangetree_update(node);
+        int balance = rangetree_height(node->left) - rangetree_height(node->right);
+        if (balance > 1) {
+            if (rangetree_height(node->left->left) < rangetree_height(node->left->right)) {
+                rangetree_rotate_left(tree, node->left);
+            }
+            node = rangetree_rotate_right(tree, node);
+        } else if (balance < -1) {
+            if (rangetree_height(node->right->right) < rangetree_height(node->right->left)) {
+                rangetree_rotate_right(tree, node->right);
+            }
+            node = rangetree_rotate_left(tree, node);
+        }
+        node = node->parent;
+    }
+}
+
+
+
+// Find the range that contains an address.
+// Returns NULL if no range contains it.
+rangetree_node_t *rangetree_find(rangetree_t const *tree, size_t addr) {
+    rangetree_node_t *node = tree->root;
+    while (node) {
+        if (addr < node->base) {
+            node = node->left;
+        } else if (addr - node->base < node->size) {
+            return node;
+        } else {
+            node = node->right;
+        }
+    }
+    return NULL;
+}
+
+// Find the lowest range that ends after an address.
+// Returns NULL if all ranges end at or before it.
+rangetree_node_t *rangetree_find_after(rangetree_t const *tree, size_t addr) {
+    rangetree_node_t *node = tree->root;
+    rangetree_node_t *best = NULL;
+    while (node) {
+        if (node->base + node->size > addr) {
+            best = node;
+            node = node->left;
+        } else {
+            node = node->right;
+        }
+    }
+    return best;
+}
+
+// Get the range with the lowest address, NULL if the tree is empty.
+rangetree_node_t *rangetree_first(rangetree_t const *tree) {
+    rangetree_node_t *node = tree->root;
+    while (node && node->left) {
+        node = node->left;
+    }
+    return node;
+}
+
+// Get the next range in address order, NULL if `node` is the last.
+rangetree_node_t *rangetree_next(rangetree_node_t const *node) {
+    if (node->right) {
+        node = node->right;
+        while (node->left) {
+            node = node->left;
+        }
+        return (rangetree_node_t *)node;
+    }
+    while (node->parent && node->parent->right == node) {
+        node = node->parent;
+    }
+    return node->parent;
+}
+
+// Insert a range with its `base` and `size` already set.
+// Returns false without inserting if it overlaps a range already in the tree.
+bool rangetree_insert(rangetree_t *tree, rangetree_node_t *node) {
+    // The ranges directly before and after the new one are both on the path down, so this catches any overlap.
+    rangetree_node_t  *parent = NULL;
+    rangetree_node_t **link   = &tree->root;
+    while (*link) {
+        parent = *link;
+        if (node->base + node->size <= parent->base) {
+            link = &parent->left;
+        } else if (node->base >= parent->base + parent->size) {
+            link = &parent->right;
+        } else {
+            return false;
+        }
+    }
+    node->parent = parent;
+    node->left   = NULL;
+    node->right  = NULL;
+    *link        = node;
+    tree->len++;
+    rangetree_fixup(tree, node);
+    return true;
+}
+
+// Remove a range from the tree.
+void rangetree_remove(rangetree_t *tree, rangetree_node_t *node) {
+    rangetree_node_t *fix;
+    if (node->left && node->right) {
+        // Put the next range, which has no left child, in place of the removed one.
+        rangetree_node_t *next = node->right;
+        while (next->left) {
+            next = next->left;
+        }
+        if (next->parent == node) {
+            fix = next;
+        } else {
+            fix       = next->parent;
+            fix->left = next->right;
+            if (next->right) {
+                next->right->parent = fix;
+            }
+            next->right         = node->right;
+            node->right->parent = next;
+        }
+        next->left         = node->left;
+        node->left->parent = next;
+        rangetree_replace(tree, node->parent, node, next);
+    } else {
+        fix = node->parent;
+        rangetree_replace(tree, node->parent, node, node->left ? node->left : node->right);
+    }
+    tree->len--;
+    rangetree_fixup(tree, fix);
+}
+
+// Search a subtree and the free space around it for the lowest fit.
+// `before` is the end of the range before the subtree and `after` is the start of the range after it.
+static bool rangetree_gap_search(
+    rangetree_node_t const *node,
+    size_t                  before,
+    size_t                  after,
+    size_t                  min,
+    size_t                  max,
+    size_t                  size,
+    size_t                  align,
+    size_t                 *out
+) {
+    if (before >= max || after <= min) {
+        return false;
+    }
+    if (!node) {
+        size_t lo   = before > min ? before : min;
+        size_t hi   = after < max ? after : max;
+        size_t addr = (lo + align - 1) & ~(align - 1);
+        if (addr < lo || addr > hi || hi - addr < size) {
+            return false;
+        }
+        *out = addr;
+        return true;
+    }
+
+    // Skip subtrees that don't have a large enough gap anywhere.
+    size_t gap = node->sub_gap;
+    if (node->sub_base - before > gap) {
+        gap = node->sub_base - before;
+    }
+    if (after - node->sub_end > gap) {
+        gap = after - node->sub_end;
+    }
+    if (gap < size) {
+        return false;
+    }
+    return rangetree_gap_search(node->left, before, node->base, min, max, size, align, out) ||
+           rangetree_gap_search(node->right, node->base + node->size, after, min, max, size, align, out);
+}
+
+// Find the lowest free address in [`min`, `max`) aligned to `align` where `size` bytes fit.
+// `align` must be a power of two; the range found must fit before `max`.
+// Returns false if there is no space.
+bool rangetree_find_gap(rangetree_t const *tree, size_t min, size_t max, size_t size, size_t align, size_t *out) {
+    if (!align) {
+        align = 1;
+    }
+    return rangetree_gap_search(tree->root, 0, SIZE_MAX, min, max, size, align, out);
+}
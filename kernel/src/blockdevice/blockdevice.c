@@ -9,8 +9,9 @@
 #include "blockdevice/blkdev_internal.h"
 #include "log.h"
 #include "malloc.h"
-
-// TODO: Integrate mutexes to prevent race conditions.
+#include "port/hardware_allocation.h"
+#include "shrinker.h"
+#include "vmalloc.h"
 
 
 
@@ -225,13 +226,17 @@ bool blkdev_is_erased(badge_err_t *ec, blkdev_t *dev, blksize_t block) {
     }
 
     // Check cache before querying hardware.
+    mutex_acquire(NULL, &dev->mtx, TIMESTAMP_US_MAX);
+    bool      erased;
     ptrdiff_t i = blkdev_find_cache(dev, block);
     if (i >= 0) {
         badge_err_set_ok(ec);
-        return dev->cache->block_flags[i].erase;
+        erased = dev->cache->block_flags[i].erase;
+    } else {
+        erased = dev->vtable->is_erased(ec, dev, block);
     }
-
-    return dev->vtable->is_erased(ec, dev, block);
+    mutex_release(NULL, &dev->mtx);
+    return erased;
 }
 
 // Explicitly erase a block, if possible.
@@ -252,11 +257,11 @@ void blkdev_erase(badge_err_t *ec, blkdev_t *dev, blksize_t block) {
         return;
     }
 
-    blkdev_flags_t *flags = dev->cache->block_flags;
-
     // Attempt to cache erase operation.
+    mutex_acquire(NULL, &dev->mtx, TIMESTAMP_US_MAX);
     ptrdiff_t i = blkdev_alloc_cache(dev, block);
     if (i >= 0) {
+        blkdev_flags_t *flags = dev->cache->block_flags;
         if (flags[i].present) {
             // Set flag in existing cache entry.
             flags[i].erase = true;
@@ -277,6 +282,7 @@ void blkdev_erase(badge_err_t *ec, blkdev_t *dev, blksize_t block) {
         // Uncached or out of free cache.
         dev->vtable->erase(ec, dev, block);
     }
+    mutex_release(NULL, &dev->mtx);
 }
 
 // Erase if necessary and write a block.
@@ -297,12 +303,12 @@ void blkdev_write(badge_err_t *ec, blkdev_t *dev, blksize_t block, uint8_t const
         return;
     }
 
-    uint8_t        *cache = dev->cache->block_cache;
-    blkdev_flags_t *flags = dev->cache->block_flags;
-
     // Attempt to cache write operation.
+    mutex_acquire(NULL, &dev->mtx, TIMESTAMP_US_MAX);
     ptrdiff_t i = blkdev_alloc_cache(dev, block);
     if (i >= 0) {
+        uint8_t        *cache = dev->cache->block_cache;
+        blkdev_flags_t *flags = dev->cache->block_flags;
         if (flags[i].present) {
             // Set flag in existing cache entry.
             flags[i].erase = false;
@@ -324,6 +330,7 @@ void blkdev_write(badge_err_t *ec, blkdev_t *dev, blksize_t block, uint8_t const
         // Uncached or out of free cache.
         dev->vtable->write(ec, dev, block, writebuf);
     }
+    mutex_release(NULL, &dev->mtx);
 }
 
 // Read a block.
@@ -340,11 +347,11 @@ void blkdev_read(badge_err_t *ec, blkdev_t *dev, blksize_t block, uint8_t *readb
         return;
     }
 
-    uint8_t        *cache = dev->cache->block_cache;
-    blkdev_flags_t *flags = dev->cache->block_flags;
-
     // Look for the entry in the cache.
-    ptrdiff_t i = blkdev_alloc_cache(dev, block);
+    mutex_acquire(NULL, &dev->mtx, TIMESTAMP_US_MAX);
+    ptrdiff_t       i     = blkdev_alloc_cache(dev, block);
+    uint8_t        *cache = i >= 0 ? dev->cache->block_cache : NULL;
+    blkdev_flags_t *flags = i >= 0 ? dev->cache->block_flags : NULL;
     if (i >= 0 && flags[i].present) {
         // Existing cache entry.
         if (flags[i].erase) {
@@ -372,13 +379,14 @@ void blkdev_read(badge_err_t *ec, blkdev_t *dev, blksize_t block, uint8_t *readb
             .dirty       = false,
         };
 
-        if (!badge_err_is_ok(ec))
-            return;
-        mem_copy(readbuf, cache + i * dev->block_size, dev->block_size);
+        if (badge_err_is_ok(ec)) {
+            mem_copy(readbuf, cache + i * dev->block_size, dev->block_size);
+        }
     } else {
         // Uncached or out of free cache.
         dev->vtable->read(ec, dev, block, readbuf);
     }
+    mutex_release(NULL, &dev->mtx);
 }
 
 // Partially write a block.
@@ -415,12 +423,12 @@ void blkdev_write_partial(
         return;
     }
 
-    uint8_t        *cache = dev->cache->block_cache;
-    blkdev_flags_t *flags = dev->cache->block_flags;
-
     // Attempt to cache write operation.
+    mutex_acquire(NULL, &dev->mtx, TIMESTAMP_US_MAX);
     ptrdiff_t i = blkdev_alloc_cache(dev, block);
     if (i >= 0) {
+        uint8_t        *cache = dev->cache->block_cache;
+        blkdev_flags_t *flags = dev->cache->block_flags;
         if (flags[i].present) {
             // Set flag in existing cache entry.
             flags[i].erase = false;
@@ -442,6 +450,7 @@ void blkdev_write_partial(
         // Uncached or out of free cache.
         dev->vtable->write_partial(ec, dev, block, subblock_offset, writebuf, writebuf_len);
     }
+    mutex_release(NULL, &dev->mtx);
 }
 
 // Partially read a block.
@@ -469,11 +478,11 @@ void blkdev_read_partial(
         return;
     }
 
-    uint8_t        *cache = dev->cache->block_cache;
-    blkdev_flags_t *flags = dev->cache->block_flags;
-
     // Look for the entry in the cache.
-    ptrdiff_t i = blkdev_alloc_cache(dev, block);
+    mutex_acquire(NULL, &dev->mtx, TIMESTAMP_US_MAX);
+    ptrdiff_t       i     = blkdev_alloc_cache(dev, block);
+    uint8_t        *cache = i >= 0 ? dev->cache->block_cache : NULL;
+    blkdev_flags_t *flags = i >= 0 ? dev->cache->block_flags : NULL;
     if (i >= 0 && flags[i].present) {
         // Existing cache entry.
         if (flags[i].erase) {
@@ -501,17 +510,57 @@ void blkdev_read_partial(
             .dirty       = false,
         };
 
-        if (!badge_err_is_ok(ec))
-            return;
-        mem_copy(readbuf, cache + i * dev->block_size + subblock_offset, readbuf_len);
+        if (badge_err_is_ok(ec)) {
+            mem_copy(readbuf, cache + i * dev->block_size + subblock_offset, readbuf_len);
+        }
     } else {
         // Uncached or out of free cache.
         dev->vtable->read_partial(ec, dev, block, subblock_offset, readbuf, readbuf_len);
     }
+    mutex_release(NULL, &dev->mtx);
 }
 
 
 
+// Write back all dirty cache entries.
+// The caller must hold the device mutex.
+static void blkdev_flush_locked(badge_err_t *ec, blkdev_t *dev) {
+    badge_err_set_ok(ec);
+    if (!dev->cache) {
+        // Nothing is cached.
+        return;
+    }
+    blkdev_flags_t *flags = dev->cache->block_flags;
+
+    for (size_t i = 0; i < dev->cache->cache_depth; i++) {
+        if (flags[i].present && (flags[i].dirty || flags[i].erase)) {
+            blkdev_flush_cache(ec, dev, i);
+            if (!badge_err_is_ok(ec))
+                return;
+        }
+    }
+}
+
+// Write back and free the cache, after which operations go straight to the device.
+// The caller must hold the device mutex.
+static void blkdev_delete_cache_locked(badge_err_t *ec, blkdev_t *dev) {
+    if (!dev->cache) {
+        badge_err_set_ok(ec);
+        return;
+    }
+    blkdev_flush_locked(ec, dev);
+    if (!badge_err_is_ok(ec))
+        return;
+
+    if (dev->cache->shrinker) {
+        shrinker_unregister(dev->cache->shrinker);
+    }
+    vfree(dev->cache->block_cache);
+    free(dev->cache->block_flags);
+    free(dev->cache);
+    dev->cache = NULL;
+}
+
 // Flush the write cache to the block device.
 void blkdev_flush(badge_err_t *ec, blkdev_t *dev) {
     if (!dev) {
@@ -523,19 +572,12 @@ void blkdev_flush(badge_err_t *ec, blkdev_t *dev) {
         return;
     }
 
-    blkdev_flags_t *flags = dev->cache->block_flags;
-
     badge_err_t ec0;
     if (!ec)
         ec = &ec0;
-
-    for (size_t i = 0; i < dev->cache->cache_depth; i++) {
-        if (flags[i].present && (flags[i].dirty || flags[i].erase)) {
-            blkdev_flush_cache(ec, dev, i);
-            if (ec)
-                return;
-        }
-    }
+    mutex_acquire(NULL, &dev->mtx, TIMESTAMP_US_MAX);
+    blkdev_flush_locked(ec, dev);
+    mutex_release(NULL, &dev->mtx);
 }
 
 // Call this function occasionally per block device to do housekeeping.
@@ -548,19 +590,47 @@ void blkdev_housekeeping(badge_err_t *ec, blkdev_t *dev) {
     timestamp_us_t now     = time_us();
     timestamp_us_t timeout = now - BLKDEV_WRITE_CACHE_TIMEOUT;
 
-    blkdev_flags_t *flags = dev->cache->block_flags;
-
     badge_err_t ec0;
     if (!ec)
         ec = &ec0;
+    badge_err_set_ok(ec);
+    mutex_acquire(NULL, &dev->mtx, TIMESTAMP_US_MAX);
+    if (!dev->cache) {
+        // Nothing is cached.
+        mutex_release(NULL, &dev->mtx);
+        return;
+    }
+    blkdev_flags_t *flags = dev->cache->block_flags;
 
     for (size_t i = 0; i < dev->cache->cache_depth; i++) {
         if (blkdev_is_dirty(flags[i]) && flags[i].update_time < timeout) {
             blkdev_flush_cache(ec, dev, i);
             if (!badge_err_is_ok(ec))
-                return;
+                break;
         }
     }
+    mutex_release(NULL, &dev->mtx);
+}
+
+// Shrinker that drops a block device cache, writing back dirty blocks first.
+// Only try-locks the device, so an allocation made while the device is in use can't deadlock on it.
+static size_t blkdev_shrinker(size_t target_pages, void *cookie) {
+    (void)target_pages;
+    blkdev_t *dev = cookie;
+    if (!mutex_acquire(NULL, &dev->mtx, 0)) {
+        return 0;
+    }
+    size_t freed = 0;
+    if (dev->cache) {
+        size_t      bytes = dev->block_size * dev->cache->cache_depth;
+        badge_err_t ec    = {0};
+        blkdev_delete_cache_locked(&ec, dev);
+        if (badge_err_is_ok(&ec)) {
+            freed = (bytes + MEMMAP_PAGE_SIZE - 1) / MEMMAP_PAGE_SIZE;
+        }
+    }
+    mutex_release(NULL, &dev->mtx);
+    return freed;
 }
 
 // Allocate a cache for a block device.
@@ -573,44 +643,53 @@ void blkdev_create_cache(badge_err_t *ec, blkdev_t *dev, size_t cache_depth, boo
         badge_err_set(ec, ELOC_BLKDEV, ECAUSE_READONLY);
         return;
     }
-    if (dev->cache) {
-        // If cache is already present, flush and remove it first.
-        badge_err_t ec0;
-        if (!ec)
-            ec = &ec0;
-        blkdev_flush(ec, dev);
-        if (!badge_err_is_ok(ec))
-            return;
+    badge_err_t ec0;
+    if (!ec)
+        ec = &ec0;
+    mutex_acquire(NULL, &dev->mtx, TIMESTAMP_US_MAX);
+
+    // If cache is already present, flush and remove it first.
+    blkdev_delete_cache_locked(ec, dev);
+    if (!badge_err_is_ok(ec)) {
+        mutex_release(NULL, &dev->mtx);
+        return;
     }
 
     // Allocate cache info.
-    dev->cache = malloc(sizeof(blkdev_cache_t));
-    if (!dev->cache) {
+    blkdev_cache_t *cache = malloc(sizeof(blkdev_cache_t));
+    if (!cache) {
         badge_err_set(ec, ELOC_BLKDEV, ECAUSE_NOMEM);
+        mutex_release(NULL, &dev->mtx);
         return;
     }
-    dev->cache->cache_depth = cache_depth;
-    dev->cache_read         = cache_reads;
+    cache->cache_depth = cache_depth;
 
     // Allocate block cache.
-    dev->cache->block_cache = malloc(dev->block_size * cache_depth);
-    if (!dev->cache->block_cache) {
+    cache->block_cache = vmalloc(dev->block_size * cache_depth);
+    if (!cache->block_cache) {
         badge_err_set(ec, ELOC_BLKDEV, ECAUSE_NOMEM);
-        free(dev->cache);
-        dev->cache = NULL;
+        free(cache);
+        mutex_release(NULL, &dev->mtx);
         return;
     }
 
     // Allocate block flags.
-    dev->cache->block_flags = malloc(sizeof(blkdev_flags_t) * cache_depth);
-    if (!dev->cache->block_flags) {
+    cache->block_flags = malloc(sizeof(blkdev_flags_t) * cache_depth);
+    if (!cache->block_flags) {
         badge_err_set(ec, ELOC_BLKDEV, ECAUSE_NOMEM);
-        free(dev->cache->block_cache);
-        free(dev->cache);
-        dev->cache = NULL;
+        vfree(cache->block_cache);
+        free(cache);
+        mutex_release(NULL, &dev->mtx);
         return;
     }
-    mem_set(dev->cache->block_flags, 0, sizeof(blkdev_flags_t) * cache_depth);
+    mem_set(cache->block_flags, 0, sizeof(blkdev_flags_t) * cache_depth);
+    cache->shrinker = shrinker_register("blkdev", SHRINKER_PRIO_DIRTY, blkdev_shrinker, dev);
+    if (cache->shrinker < 0) {
+        cache->shrinker = 0;
+    }
+    dev->cache      = cache;
+    dev->cache_read = cache_reads;
+    mutex_release(NULL, &dev->mtx);
     badge_err_set_ok(ec);
 }
 
@@ -620,20 +699,12 @@ void blkdev_delete_cache(badge_err_t *ec, blkdev_t *dev) {
         badge_err_set(ec, ELOC_BLKDEV, ECAUSE_PARAM);
         return;
     }
-    if (dev->cache) {
-        badge_err_t ec0 = {.cause = ECAUSE_OK};
-        if (!ec)
-            ec = &ec0;
-        blkdev_flush(ec, dev);
-        if (!badge_err_is_ok(ec))
-            return;
-
-        free(dev->cache->block_cache);
-        free(dev->cache->block_flags);
-        free(dev->cache);
-        dev->cache = NULL;
-    }
-    badge_err_set_ok(ec);
+    badge_err_t ec0 = {.cause = ECAUSE_OK};
+    if (!ec)
+        ec = &ec0;
+    mutex_acquire(NULL, &dev->mtx, TIMESTAMP_US_MAX);
+    blkdev_delete_cache_locked(ec, dev);
+    mutex_release(NULL, &dev->mtx);
 }
 
 
@@ -648,6 +719,7 @@ blkdev_t *blkdev_impl_create(badge_err_t *ec, blkdev_vtable_t const *vtable, voi
 
     handle->vtable = vtable;
     handle->cookie = cookie;
+    mutex_init(NULL, &handle->mtx, false, false);
 
     badge_err_set_ok(ec);
     return handle;
@@ -680,8 +752,10 @@ void blkdev_dump_cache(blkdev_t *dev) {
     if (!dev)
         return;
 
+    mutex_acquire(NULL, &dev->mtx, TIMESTAMP_US_MAX);
     if (!dev->cache) {
         logk(LOG_DEBUG, "BLKDEV: uncached");
+        mutex_release(NULL, &dev->mtx);
         return;
     }
 
@@ -720,4 +794,5 @@ void blkdev_dump_cache(blkdev_t *dev) {
             }
         }
     }
+    mutex_release(NULL, &dev->mtx);
 }
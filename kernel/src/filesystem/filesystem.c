@@ -2,8 +2,13 @@
 // SPDX-License-Identifier: MIT
 
 #include "badge_strings.h"
+#include "filesystem/vfs_dcache.h"
 #include "filesystem/vfs_internal.h"
+#include "filesystem/vfs_lcache.h"
+#include "filesystem/vfs_pcache.h"
 #include "filesystem/vfs_ramfs.h"
+#include "filesystem/vfs_readahead.h"
+#include "filesystem/vfs_writeback.h"
 #include "log.h"
 #include "malloc.h"
 
@@ -18,30 +23,24 @@ static void root_reopen(badge_err_t *ec, vfs_file_handle_t *dir) {
     assert_always(mutex_acquire(NULL, &vfs_handle_mtx, VFS_MUTEX_TIMEOUT));
 
     // Create or obtain a new shared handle.
-    ptrdiff_t          shared = vfs_shared_by_inode(&vfs_table[vfs_root_index], vfs_table[vfs_root_index].inode_root);
-    vfs_file_shared_t *shptr;
-    if (shared == -1) {
+    vfs_file_shared_t *shptr = vfs_shared_by_inode(&vfs_table[vfs_root_index], vfs_table[vfs_root_index].inode_root);
+    if (!shptr) {
         // Open new handle.
-        shared = vfs_file_create_shared();
-        if (shared == -1) {
+        shptr = vfs_file_create_shared();
+        if (!shptr) {
             mutex_release(NULL, &vfs_handle_mtx);
             badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_NOMEM);
             return;
         }
-        shptr = vfs_file_shared_list[shared];
 
         // Open root directory.
         vfs_root_open(ec, shptr);
         if (!badge_err_is_ok(ec)) {
-            vfs_file_destroy_shared(shared);
+            vfs_file_destroy_shared(shptr);
             mutex_release(NULL, &vfs_handle_mtx);
             return;
         }
         shptr->refcount = 0;
-
-    } else {
-        // Use existing handle.
-        shptr = vfs_file_shared_list[shared];
     }
 
     // Switch to new handle.
@@ -54,7 +53,7 @@ static void root_reopen(badge_err_t *ec, vfs_file_handle_t *dir) {
     if (old->refcount == 0) {
         vfs_file_close(ec, old);
         badge_err_assert_dev(ec);
-        vfs_file_destroy_shared(old->index);
+        vfs_file_destroy_shared(old);
     } else {
         badge_err_set_ok(ec);
     }
@@ -72,30 +71,24 @@ static void dir_reopen(badge_err_t *ec, vfs_file_handle_t *dir, dirent_t const *
 
     // TODO: This is the location in which mounted filesystems are handled.
     // Create or obtain a new shared handle.
-    ptrdiff_t          shared = vfs_shared_by_inode(dir->shared->vfs, ent->inode);
-    vfs_file_shared_t *shptr;
-    if (shared == -1) {
+    vfs_file_shared_t *shptr = vfs_shared_by_inode(dir->shared->vfs, ent->inode);
+    if (!shptr) {
         // Open new handle.
-        shared = vfs_file_create_shared();
-        if (shared == -1) {
+        shptr = vfs_file_create_shared();
+        if (!shptr) {
             mutex_release(NULL, &vfs_handle_mtx);
             badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_NOMEM);
             return;
         }
-        shptr = vfs_file_shared_list[shared];
 
         // Open entry.
         vfs_file_open(ec, dir->shared, shptr, ent->name, 0);
         if (!badge_err_is_ok(ec)) {
-            vfs_file_destroy_shared(shared);
+            vfs_file_destroy_shared(shptr);
             mutex_release(NULL, &vfs_handle_mtx);
             return;
         }
         shptr->refcount = 0;
-
-    } else {
-        // Use existing handle.
-        shptr = vfs_file_shared_list[shared];
     }
 
     // Switch to new handle.
@@ -108,7 +101,7 @@ static void dir_reopen(badge_err_t *ec, vfs_file_handle_t *dir, dirent_t const *
     if (old->refcount == 0) {
         vfs_file_close(ec, old);
         badge_err_assert_dev(ec);
-        vfs_file_destroy_shared(old->index);
+        vfs_file_destroy_shared(old);
     } else {
         badge_err_set_ok(ec);
     }
@@ -189,10 +182,20 @@ static ptrdiff_t walk(badge_err_t *ec, vfs_file_handle_t *dir, char path[FILESYS
         if (end < 0)
             end = len;
 
-        // Read current directory.
-        char tmp    = path[end];
-        path[end]   = 0;
-        found       = vfs_dir_find_ent(ec, dir->shared, ent, path + begin);
+        // Read current directory, going to the filesystem only if the entry is not cached.
+        char             tmp = path[end];
+        path[end]            = 0;
+        uint32_t         gen;
+        vfs_dcache_res_t res = vfs_dcache_lookup(dir->shared->vfs, dir->shared->inode, path + begin, ent, &gen);
+        if (res == VFS_DCACHE_MISS) {
+            found = vfs_dir_find_ent(ec, dir->shared, ent, path + begin);
+            if (badge_err_is_ok(ec)) {
+                vfs_dcache_insert(dir->shared->vfs, dir->shared->inode, path + begin, found ? ent : NULL, gen);
+            }
+        } else {
+            badge_err_set_ok(ec);
+            found = res == VFS_DCACHE_FOUND;
+        }
         path[end]   = tmp;
         // Whether the current entry represents an intermediate directory.
         bool is_int = path[end] == '/' && path[end + 1] != 0;
@@ -237,27 +240,30 @@ static vfs_file_handle_t *root_open(badge_err_t *ec) {
         ec = &ec0;
     assert_always(mutex_acquire(NULL, &vfs_handle_mtx, VFS_MUTEX_TIMEOUT));
 
-    ptrdiff_t          existing = vfs_shared_by_inode(&vfs_table[vfs_root_index], vfs_table[vfs_root_index].inode_root);
-    ptrdiff_t          handle   = vfs_file_create_handle(existing);
-    vfs_file_handle_t *ptr      = &vfs_file_handle_list[handle];
+    vfs_file_shared_t *existing = vfs_shared_by_inode(&vfs_table[vfs_root_index], vfs_table[vfs_root_index].inode_root);
+    vfs_file_handle_t *ptr      = vfs_file_create_handle(existing);
+    if (!ptr) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_NOMEM);
+        mutex_release(NULL, &vfs_handle_mtx);
+        return NULL;
+    }
 
-    if (existing == -1) {
+    if (!existing) {
         // Open new shared handle.
         vfs_root_open(ec, ptr->shared);
         if (!badge_err_is_ok(ec)) {
-            vfs_file_destroy_handle(handle);
+            vfs_file_destroy_handle(ptr);
             mutex_release(NULL, &vfs_handle_mtx);
             return NULL;
         }
     }
 
     // Create file handle.
-    ptr->offset         = 0;
-    ptr->write          = false;
-    ptr->read           = true;
-    ptr->is_dir         = true;
-    ptr->dir_cache      = NULL;
-    ptr->dir_cache_size = 0;
+    ptr->offset    = 0;
+    ptr->write     = false;
+    ptr->read      = true;
+    ptr->is_dir    = true;
+    ptr->dir_cache = NULL;
 
     mutex_release(NULL, &vfs_handle_mtx);
     return ptr;
@@ -428,6 +434,9 @@ error_cleanup:
 // Unmount a filesystem.
 // Only raises an error if there isn't a valid filesystem to unmount.
 void fs_umount(badge_err_t *ec, char const *mountpoint) {
+    // Take the filesystem mounting mutex so the background flusher leaves this filesystem alone.
+    assert_always(mutex_acquire(NULL, &vfs_mount_mtx, VFS_MUTEX_TIMEOUT));
+
     // TODO: Remove redundant slashes from path.
     size_t vfs_index;
     for (vfs_index = 0; vfs_index < FILESYSTEM_MOUNT_MAX; vfs_index++) {
@@ -438,17 +447,19 @@ void fs_umount(badge_err_t *ec, char const *mountpoint) {
     if (vfs_index == FILESYSTEM_MOUNT_MAX) {
         logkf(LOG_ERROR, "fs_umount: %{cs}: Not mounted.", mountpoint);
         badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_NOTFOUND);
+        mutex_release(NULL, &vfs_mount_mtx);
         return;
     }
 
-    // Close file handles.
-    for (size_t i = 0; i < vfs_file_handle_list_len; i++) {
-        if (vfs_file_handle_list[i].shared->vfs == &vfs_table[vfs_index]) {
-            fs_close(NULL, vfs_file_handle_list[i].fileno);
-        }
-    }
+    // Close file handles, which writes back their dirty pages.
+    assert_always(mutex_acquire(NULL, &vfs_handle_mtx, VFS_MUTEX_TIMEOUT));
+    vfs_file_destroy_all(&vfs_table[vfs_index]);
+    mutex_release(NULL, &vfs_handle_mtx);
 
     // Delegate to filesystem-specific mount.
+    vfs_dcache_invalidate_vfs(&vfs_table[vfs_index]);
+    vfs_lcache_invalidate_vfs(&vfs_table[vfs_index]);
+    vfs_pcache_invalidate_vfs(&vfs_table[vfs_index]);
     switch (vfs_table[vfs_index].type) {
         // case FS_TYPE_FAT: vfs_fat_umount(&vfs_table[vfs_index]); break;
         case FS_TYPE_RAMFS: vfs_ramfs_umount(&vfs_table[vfs_index]); break;
@@ -458,6 +469,7 @@ void fs_umount(badge_err_t *ec, char const *mountpoint) {
     // Release memory.
     free(vfs_table[vfs_index].mountpoint);
     vfs_table[vfs_index].mountpoint = NULL;
+    mutex_release(NULL, &vfs_mount_mtx);
 }
 
 // Try to identify the filesystem stored in the block device
@@ -500,19 +512,105 @@ bool fs_is_canonical_path(char const *path) {
 
 
 
+// Get the status of an inode.
+// The size of an open file is taken from its shared handle, because it may be ahead of the filesystem.
+// Must be called with `vfs_handle_mtx` held.
+static void stat_inode(badge_err_t *ec, vfs_t *vfs, inode_t inode, stat_t *stat_out) {
+    badge_err_t ec0;
+    if (!ec)
+        ec = &ec0;
+    vfs_stat(ec, vfs, inode, stat_out);
+    if (!badge_err_is_ok(ec)) {
+        return;
+    }
+    stat_out->device = (uint32_t)(vfs - vfs_table);
+
+    vfs_file_shared_t *shared = vfs_shared_by_inode(vfs, inode);
+    if (shared && (stat_out->mode & STAT_TYPE_MASK) != STAT_TYPE_DIR) {
+        stat_out->size = shared->size;
+    }
+}
+
+// Get file status given path.
+// Symlinks are not resolved by `walk` yet, so the final element is never followed.
+static bool stat_path(badge_err_t *ec, stat_t *stat_out, char const *path) {
+    badge_err_t ec0 = {.cause = ECAUSE_OK};
+    if (!ec)
+        ec = &ec0;
+
+    // Copy the path.
+    char canon_path[FILESYSTEM_PATH_MAX + 1];
+    if (path[cstr_copy(canon_path, sizeof(canon_path), path)] != 0) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_TOOLONG);
+        return false;
+    }
+
+    // Locate the file.
+    vfs_file_handle_t *parent = root_open(ec);
+    if (!badge_err_is_ok(ec)) {
+        return false;
+    }
+    dirent_t  ent   = {0};
+    ptrdiff_t slash = walk(ec, parent, canon_path, &ent);
+    if (badge_err_is_ok(ec) && slash == -2) {
+        // The root directory itself.
+        ent.inode = parent->shared->inode;
+    } else if (badge_err_is_ok(ec) && !ent.inode) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_NOTFOUND);
+    }
+
+    assert_always(mutex_acquire(NULL, &vfs_handle_mtx, VFS_MUTEX_TIMEOUT));
+    if (badge_err_is_ok(ec)) {
+        stat_inode(ec, parent->shared->vfs, ent.inode, stat_out);
+    }
+    vfs_file_destroy_handle(parent);
+    mutex_release(NULL, &vfs_handle_mtx);
+    return badge_err_is_ok(ec);
+}
+
+// Get file status given path.
+bool fs_stat(badge_err_t *ec, stat_t *stat_out, char const *path) {
+    return stat_path(ec, stat_out, path);
+}
+
+// Get file status given path.
+// If the path ends in a symlink, show it's status instead of that of the target file.
+bool fs_lstat(badge_err_t *ec, stat_t *stat_out, char const *path) {
+    return stat_path(ec, stat_out, path);
+}
+
+// Get file status given file handle.
+bool fs_fstat(badge_err_t *ec, stat_t *stat_out, file_t file) {
+    badge_err_t ec0;
+    if (!ec)
+        ec = &ec0;
+    assert_always(mutex_acquire_shared(NULL, &vfs_handle_mtx, VFS_MUTEX_TIMEOUT));
+
+    vfs_file_handle_t *ptr = vfs_file_by_handle(file);
+    if (!ptr) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_PARAM);
+    } else {
+        stat_inode(ec, ptr->shared->vfs, ptr->shared->inode, stat_out);
+    }
+
+    mutex_release_shared(NULL, &vfs_handle_mtx);
+    return badge_err_is_ok(ec);
+}
+
+
+
 // Test that the handle exists and is a directory handle.
 static bool is_dir_handle(badge_err_t *ec, file_t dir) {
     assert_always(mutex_acquire_shared(ec, &vfs_handle_mtx, VFS_MUTEX_TIMEOUT));
 
     // Check the handle exists.
-    ptrdiff_t index = vfs_file_by_handle(dir);
-    if (index < 0) {
+    vfs_file_handle_t *handle = vfs_file_by_handle(dir);
+    if (!handle) {
         badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_PARAM);
         mutex_release_shared(ec, &vfs_handle_mtx);
         return false;
     }
     // Check the handle is that of a directory.
-    vfs_file_handle_t *handle = &vfs_file_handle_list[index];
     if (!handle->is_dir) {
         badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_IS_FILE);
         mutex_release_shared(ec, &vfs_handle_mtx);
@@ -596,6 +694,77 @@ bool fs_dir_read(badge_err_t *ec, dirent_t *dirent_out, file_t dir) {
     return true;
 }
 
+// Read directory entries along with the status of the files they name, continuing from the current offset.
+// Refer to `dirent_stat_t` for the format; only whole entries are read.
+// Returns the amount of data read, which is 0 at the end of the directory.
+fileoff_t fs_dir_read_stat(badge_err_t *ec, file_t dir, void *readbuf, fileoff_t readlen) {
+    badge_err_t ec0;
+    if (!ec)
+        ec = &ec0;
+    if (readlen < 0) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_PARAM);
+        return 0;
+    }
+    assert_always(mutex_acquire_shared(NULL, &vfs_handle_mtx, VFS_MUTEX_TIMEOUT));
+
+    // Look up the handle.
+    vfs_file_handle_t *ptr = vfs_file_by_handle(dir);
+    if (!ptr) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_PARAM);
+        mutex_release_shared(NULL, &vfs_handle_mtx);
+        return 0;
+    } else if (!ptr->is_dir) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_IS_FILE);
+        mutex_release_shared(NULL, &vfs_handle_mtx);
+        return 0;
+    } else if (!ptr->read) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_PERM);
+        mutex_release_shared(NULL, &vfs_handle_mtx);
+        return 0;
+    }
+
+    // Like `fs_read`, the listing is read again when starting from the beginning.
+    assert_always(mutex_acquire(NULL, &ptr->mutex, VFS_MUTEX_TIMEOUT));
+    badge_err_set_ok(ec);
+    if (ptr->offset == 0) {
+        vfs_dir_read(ec, ptr);
+    }
+    vfs_dir_listing_t *listing = ptr->dir_cache;
+    fileoff_t          out_off = 0;
+    while (badge_err_is_ok(ec) && listing && ptr->offset < listing->size) {
+        dirent_t const *ent = (dirent_t const *)(listing->data + ptr->offset);
+        fileoff_t       rec = (fileoff_t)offsetof(dirent_stat_t, name) + ent->name_len + 1;
+        rec                += (fileoff_t)((size_t)(~rec + 1) % sizeof(long));
+        if (out_off + rec > readlen) {
+            if (out_off == 0) {
+                // Not even one entry fits.
+                badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_TOOLONG);
+            }
+            break;
+        }
+
+        // Entries unlinked since the listing was read are skipped.
+        dirent_stat_t out;
+        stat_inode(ec, ptr->shared->vfs, ent->inode, &out.stat);
+        ptr->offset += ent->record_len;
+        if (!badge_err_is_ok(ec)) {
+            if (ec->cause == ECAUSE_NOTFOUND) {
+                badge_err_set_ok(ec);
+            }
+            continue;
+        }
+        out.record_len = rec;
+        out.name_len   = ent->name_len;
+        mem_copy((char *)readbuf + out_off, &out, offsetof(dirent_stat_t, name));
+        mem_copy((char *)readbuf + out_off + offsetof(dirent_stat_t, name), ent->name, ent->name_len + 1);
+        out_off += rec;
+    }
+    mutex_release(NULL, &ptr->mutex);
+
+    mutex_release_shared(NULL, &vfs_handle_mtx);
+    return out_off;
+}
+
 
 
 // Open a file for reading and/or writing.
@@ -650,8 +819,8 @@ file_t fs_open(badge_err_t *ec, char const *path, oflags_t oflags) {
     }
 
     assert_always(mutex_acquire(ec, &vfs_handle_mtx, VFS_MUTEX_TIMEOUT));
-    ptrdiff_t existing = -1;
-    bool      is_dir;
+    vfs_file_shared_t *existing = NULL;
+    bool               is_dir;
     if (found) {
         // File exists.
         is_dir = ent.is_dir;
@@ -673,45 +842,48 @@ file_t fs_open(badge_err_t *ec, char const *path, oflags_t oflags) {
     } else {
         // File does not exist.
         is_dir   = (oflags & OFLAGS_DIRECTORY);
-        existing = -1;
+        existing = NULL;
     }
 
     // Create a new handle from existing shared handle.
-    ptrdiff_t handle = vfs_file_create_handle(existing);
-    if (handle == -1) {
+    vfs_file_handle_t *ptr = vfs_file_create_handle(existing);
+    if (!ptr) {
         badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_NOMEM);
         mutex_release(NULL, &vfs_handle_mtx);
         goto error;
     }
-    vfs_file_handle_t *ptr = &vfs_file_handle_list[handle];
 
     // Apply opening flags.
     ptr->read   = oflags & OFLAGS_READONLY;
     ptr->write  = oflags & OFLAGS_WRITEONLY;
     ptr->is_dir = is_dir;
+    ptr->random = oflags & OFLAGS_RANDOM;
 
-    if (existing == -1) {
+    if (!existing) {
         // Create new shared file handle.
         vfs_file_shared_t *shared = ptr->shared;
         vfs_file_open(ec, parent->shared, shared, filename, oflags);
         if (!badge_err_is_ok(ec)) {
-            vfs_file_destroy_handle(handle);
+            vfs_file_destroy_handle(ptr);
             mutex_release(NULL, &vfs_handle_mtx);
             goto error;
         }
         shared->refcount = 1;
+    } else {
+        existing->refcount++;
     }
 
-    // Successful opening of new handle.
+    // Successful opening of new handle; the directory handle is no longer needed.
+    file_t fileno = ptr->fileno;
+    vfs_file_destroy_handle(parent);
     mutex_release(NULL, &vfs_handle_mtx);
 
-    return ptr->fileno;
+    return fileno;
 
 error:
     // Destroy directory handle.
     assert_always(mutex_acquire(NULL, &vfs_handle_mtx, VFS_MUTEX_TIMEOUT));
-    ptrdiff_t index = vfs_file_by_handle(parent->fileno);
-    vfs_file_destroy_handle(index);
+    vfs_file_destroy_handle(parent);
     mutex_release(NULL, &vfs_handle_mtx);
     return FILE_NONE;
 }
@@ -721,12 +893,12 @@ error:
 void fs_close(badge_err_t *ec, file_t file) {
     assert_always(mutex_acquire(ec, &vfs_handle_mtx, VFS_MUTEX_TIMEOUT));
 
-    ptrdiff_t index = vfs_file_by_handle(file);
-    if (index == -1) {
+    vfs_file_handle_t *ptr = vfs_file_by_handle(file);
+    if (!ptr) {
         badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_PARAM);
     } else {
         badge_err_set_ok(ec);
-        vfs_file_destroy_handle(index);
+        vfs_file_destroy_handle(ptr);
     }
 
     mutex_release(NULL, &vfs_handle_mtx);
@@ -735,21 +907,22 @@ void fs_close(badge_err_t *ec, file_t file) {
 // Read bytes from a file.
 // Returns the amount of data successfully read.
 fileoff_t fs_read(badge_err_t *ec, file_t file, void *readbuf, fileoff_t readlen) {
+    badge_err_t ec0;
+    if (!ec)
+        ec = &ec0;
     if (readlen < 0) {
         badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_PARAM);
-        mutex_release_shared(NULL, &vfs_handle_mtx);
         return 0;
     }
     assert_always(mutex_acquire_shared(NULL, &vfs_handle_mtx, VFS_MUTEX_TIMEOUT));
 
     // Look up the handle.
-    ptrdiff_t index = vfs_file_by_handle(file);
-    if (index == -1) {
+    vfs_file_handle_t *ptr = vfs_file_by_handle(file);
+    if (!ptr) {
         badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_PARAM);
         mutex_release_shared(NULL, &vfs_handle_mtx);
         return 0;
     }
-    vfs_file_handle_t *ptr = &vfs_file_handle_list[index];
 
     // Check permission.
     if (!ptr->read) {
@@ -766,10 +939,13 @@ fileoff_t fs_read(badge_err_t *ec, file_t file, void *readbuf, fileoff_t readlen
             vfs_dir_read(ec, ptr);
         }
         if (ptr->offset != 0 || badge_err_is_ok(ec)) {
-            if (readlen + ptr->offset < 0 || readlen + ptr->offset > ptr->dir_cache_size) {
-                readlen = ptr->dir_cache_size - ptr->offset;
+            fileoff_t size = ptr->dir_cache ? ptr->dir_cache->size : 0;
+            if (readlen + ptr->offset < 0 || readlen + ptr->offset > size) {
+                readlen = size - ptr->offset;
+            }
+            if (readlen > 0) {
+                mem_copy(readbuf, ptr->dir_cache->data + ptr->offset, readlen);
             }
-            mem_copy(readbuf, ptr->dir_cache + ptr->offset, readlen);
             ptr->offset += readlen;
         }
 
@@ -779,6 +955,9 @@ fileoff_t fs_read(badge_err_t *ec, file_t file, void *readbuf, fileoff_t readlen
             readlen = ptr->shared->size - ptr->offset;
         }
         vfs_file_read(ec, ptr->shared, ptr->offset, readbuf, readlen);
+        if (badge_err_is_ok(ec)) {
+            vfs_readahead(ptr, ptr->offset, readlen);
+        }
         ptr->offset += readlen;
     }
     mutex_release(NULL, &ptr->mutex);
@@ -791,20 +970,106 @@ fileoff_t fs_read(badge_err_t *ec, file_t file, void *readbuf, fileoff_t readlen
 // Returns the amount of data successfully written.
 fileoff_t fs_write(badge_err_t *ec, file_t file, void const *writebuf, fileoff_t writelen) {
     if (writelen < 0) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_PARAM);
+        return 0;
+    }
+    iovec_t iov = {(void *)writebuf, writelen};
+    return fs_writev(ec, file, &iov, 1, -1);
+}
+
+// Get the total length of a vectored I/O request.
+// Returns -1 if there are too many buffers or the total is too large.
+static fileoff_t iov_total(iovec_t const *iov, int iovcnt) {
+    if (iovcnt < 0 || iovcnt > IOV_MAX) {
+        return -1;
+    }
+    fileoff_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        if (iov[i].len > (size_t)(__LONG_MAX__ - total)) {
+            return -1;
+        }
+        total += (fileoff_t)iov[i].len;
+    }
+    return total;
+}
+
+// Read bytes from a file into several buffers, filled in order.
+// If `offset` is negative, reads at and advances the current offset; otherwise reads at `offset` and leaves it be.
+// Returns the amount of data successfully read.
+fileoff_t fs_readv(badge_err_t *ec, file_t file, iovec_t const *iov, int iovcnt, fileoff_t offset) {
+    badge_err_t ec0;
+    if (!ec)
+        ec = &ec0;
+    fileoff_t readlen = iov_total(iov, iovcnt);
+    if (readlen < 0) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_PARAM);
+        return 0;
+    }
+    assert_always(mutex_acquire_shared(NULL, &vfs_handle_mtx, VFS_MUTEX_TIMEOUT));
+
+    // Look up the handle.
+    vfs_file_handle_t *ptr = vfs_file_by_handle(file);
+    if (!ptr) {
         badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_PARAM);
         mutex_release_shared(NULL, &vfs_handle_mtx);
         return 0;
     }
+
+    // Check permission.
+    if (!ptr->read) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_PERM);
+        mutex_release_shared(NULL, &vfs_handle_mtx);
+        return 0;
+    } else if (ptr->is_dir) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_IS_DIR);
+        mutex_release_shared(NULL, &vfs_handle_mtx);
+        return 0;
+    }
+
+    // Read data from the handle.
+    assert_always(mutex_acquire(NULL, &ptr->mutex, VFS_MUTEX_TIMEOUT));
+    fileoff_t pos = offset < 0 ? ptr->offset : offset;
+    if (pos >= ptr->shared->size) {
+        readlen = 0;
+    } else if (readlen > ptr->shared->size - pos) {
+        readlen = ptr->shared->size - pos;
+    }
+    vfs_file_readv(ec, ptr->shared, pos, iov, iovcnt, readlen);
+    if (badge_err_is_ok(ec)) {
+        vfs_readahead(ptr, pos, readlen);
+        if (offset < 0) {
+            ptr->offset += readlen;
+        }
+    } else {
+        readlen = 0;
+    }
+    mutex_release(NULL, &ptr->mutex);
+
+    mutex_release_shared(NULL, &vfs_handle_mtx);
+    return readlen;
+}
+
+// Write bytes to a file from several buffers, written in order.
+// If `offset` is negative, writes at and advances the current offset; otherwise writes at `offset` and leaves it be.
+// Returns the amount of data successfully written.
+fileoff_t fs_writev(badge_err_t *ec, file_t file, iovec_t const *iov, int iovcnt, fileoff_t offset) {
+    badge_err_t ec0;
+    if (!ec)
+        ec = &ec0;
+    fileoff_t writelen = iov_total(iov, iovcnt);
+    if (writelen < 0) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_PARAM);
+        return 0;
+    }
     assert_always(mutex_acquire_shared(NULL, &vfs_handle_mtx, VFS_MUTEX_TIMEOUT));
 
     // Look up the handle.
-    ptrdiff_t index = vfs_file_by_handle(file);
-    if (index == -1) {
+    vfs_file_handle_t *ptr = vfs_file_by_handle(file);
+    if (!ptr) {
         badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_PARAM);
         mutex_release_shared(NULL, &vfs_handle_mtx);
         return 0;
     }
-    vfs_file_handle_t *ptr = &vfs_file_handle_list[index];
 
     // Check permission.
     if (!ptr->write) {
@@ -813,38 +1078,197 @@ fileoff_t fs_write(badge_err_t *ec, file_t file, void const *writebuf, fileoff_t
         return 0;
     }
 
-    // Read data from the handle.
+    // Write data to the handle.
     assert_always(mutex_acquire(NULL, &ptr->mutex, VFS_MUTEX_TIMEOUT));
     // File writes go through VFS.
-    if (writelen + ptr->offset < 0) {
+    fileoff_t pos = offset < 0 ? ptr->offset : offset;
+    if (writelen + pos < 0) {
         // Integer overflow: Assume no space.
         badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_NOSPACE);
         mutex_release(NULL, &ptr->mutex);
         mutex_release_shared(NULL, &vfs_handle_mtx);
         return 0;
     }
-    if (ptr->offset + writelen > ptr->shared->size) {
-        vfs_file_resize(ec, ptr->shared, ptr->offset + writelen);
+    badge_err_set_ok(ec);
+    if (pos + writelen > ptr->shared->size) {
+        vfs_file_resize(ec, ptr->shared, pos + writelen);
+    }
+    if (badge_err_is_ok(ec)) {
+        vfs_file_writev(ec, ptr->shared, pos, iov, iovcnt);
+    }
+    if (!badge_err_is_ok(ec)) {
+        writelen = 0;
+    } else if (offset < 0) {
+        ptr->offset += writelen;
     }
-    vfs_file_write(ec, ptr->shared, ptr->offset, writebuf, writelen);
     mutex_release(NULL, &ptr->mutex);
 
     mutex_release_shared(NULL, &vfs_handle_mtx);
     return writelen;
 }
 
+// Copy bytes from one file to another without passing them through a caller's buffer.
+// Negative offsets use and advance the current offset of that file; other offsets leave it be.
+// Copying between overlapping ranges of the same file is not allowed.
+// Returns the amount of data successfully copied, which is less than `len` at the end of `src`.
+fileoff_t fs_copy_range(
+    badge_err_t *ec, file_t src, fileoff_t src_offset, file_t dst, fileoff_t dst_offset, fileoff_t len
+) {
+    badge_err_t ec0;
+    if (!ec)
+        ec = &ec0;
+    if (len < 0) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_PARAM);
+        return 0;
+    }
+    assert_always(mutex_acquire_shared(NULL, &vfs_handle_mtx, VFS_MUTEX_TIMEOUT));
+
+    // Look up the handles and check permission.
+    vfs_file_handle_t *in  = vfs_file_by_handle(src);
+    vfs_file_handle_t *out = vfs_file_by_handle(dst);
+    if (!in || !out) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_PARAM);
+        mutex_release_shared(NULL, &vfs_handle_mtx);
+        return 0;
+    } else if (!in->read || !out->write) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_PERM);
+        mutex_release_shared(NULL, &vfs_handle_mtx);
+        return 0;
+    } else if (in->is_dir || out->is_dir) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_IS_DIR);
+        mutex_release_shared(NULL, &vfs_handle_mtx);
+        return 0;
+    }
+
+    // Lock both handles in file number order so two opposite copies can't deadlock.
+    vfs_file_handle_t *first  = in->fileno < out->fileno ? in : out;
+    vfs_file_handle_t *second = in->fileno < out->fileno ? out : in;
+    assert_always(mutex_acquire(NULL, &first->mutex, VFS_MUTEX_TIMEOUT));
+    if (second != first) {
+        assert_always(mutex_acquire(NULL, &second->mutex, VFS_MUTEX_TIMEOUT));
+    }
+
+    fileoff_t src_pos = src_offset < 0 ? in->offset : src_offset;
+    fileoff_t dst_pos = dst_offset < 0 ? out->offset : dst_offset;
+    if (src_pos >= in->shared->size) {
+        len = 0;
+    } else if (len > in->shared->size - src_pos) {
+        len = in->shared->size - src_pos;
+    }
+    badge_err_set_ok(ec);
+    if (dst_pos + len < 0) {
+        // Integer overflow: Assume no space.
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_NOSPACE);
+    } else if (in->shared == out->shared && src_pos < dst_pos + len && dst_pos < src_pos + len) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_PARAM);
+    } else if (dst_pos + len > out->shared->size) {
+        vfs_file_resize(ec, out->shared, dst_pos + len);
+    }
+    if (badge_err_is_ok(ec) && len > 0) {
+        vfs_file_copy(ec, in->shared, src_pos, out->shared, dst_pos, len);
+    }
+    if (!badge_err_is_ok(ec)) {
+        len = 0;
+    } else {
+        if (src_offset < 0) {
+            in->offset += len;
+        }
+        if (dst_offset < 0) {
+            out->offset += len;
+        }
+    }
+
+    if (second != first) {
+        mutex_release(NULL, &second->mutex);
+    }
+    mutex_release(NULL, &first->mutex);
+    mutex_release_shared(NULL, &vfs_handle_mtx);
+    return len;
+}
+
+// Open another handle to a file for mapping it into memory, which is closed with `fs_close` when it is unmapped.
+// The file must be readable, and writable if `write` is true, in which case writes to the mapping change the file.
+file_t fs_map_open(badge_err_t *ec, file_t file, bool write) {
+    assert_always(mutex_acquire(NULL, &vfs_handle_mtx, VFS_MUTEX_TIMEOUT));
+
+    // Look up the handle and check permission.
+    vfs_file_handle_t *ptr = vfs_file_by_handle(file);
+    if (!ptr) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_PARAM);
+        mutex_release(NULL, &vfs_handle_mtx);
+        return FILE_NONE;
+    } else if (ptr->is_dir) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_IS_DIR);
+        mutex_release(NULL, &vfs_handle_mtx);
+        return FILE_NONE;
+    } else if (!ptr->read || (write && !ptr->write)) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_PERM);
+        mutex_release(NULL, &vfs_handle_mtx);
+        return FILE_NONE;
+    } else if (write && ptr->shared->vfs->media) {
+        // The page cache can't tell when a mapped page is written to, so the change would never be written back.
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_UNSUPPORTED);
+        mutex_release(NULL, &vfs_handle_mtx);
+        return FILE_NONE;
+    }
+
+    vfs_file_handle_t *dup = vfs_file_create_handle(ptr->shared);
+    if (!dup) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_NOMEM);
+        mutex_release(NULL, &vfs_handle_mtx);
+        return FILE_NONE;
+    }
+    dup->read  = true;
+    dup->write = write;
+    ptr->shared->refcount++;
+    file_t fileno = dup->fileno;
+
+    mutex_release(NULL, &vfs_handle_mtx);
+    badge_err_set_ok(ec);
+    return fileno;
+}
+
+// Get the physical page of file data at a page-aligned offset to map into a process.
+// The page is referenced for the caller, which drops it with `phys_page_unref` when it is unmapped.
+// Returns 0 if the offset is past the end of the file or the page could not be read.
+size_t fs_map_page(badge_err_t *ec, file_t file, fileoff_t offset) {
+    badge_err_t ec0;
+    if (!ec)
+        ec = &ec0;
+    assert_always(mutex_acquire_shared(NULL, &vfs_handle_mtx, VFS_MUTEX_TIMEOUT));
+
+    // Look up the handle.
+    vfs_file_handle_t *ptr = vfs_file_by_handle(file);
+    if (!ptr || ptr->is_dir) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_PARAM);
+        mutex_release_shared(NULL, &vfs_handle_mtx);
+        return 0;
+    }
+
+    size_t ppn = 0;
+    assert_always(mutex_acquire(NULL, &ptr->mutex, VFS_MUTEX_TIMEOUT));
+    if (offset < 0 || offset >= ptr->shared->size) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_RANGE);
+    } else {
+        ppn = vfs_file_map_page(ec, ptr->shared, offset);
+    }
+    mutex_release(NULL, &ptr->mutex);
+
+    mutex_release_shared(NULL, &vfs_handle_mtx);
+    return ppn;
+}
+
 // Get the current offset in the file.
 fileoff_t fs_tell(badge_err_t *ec, file_t file) {
     assert_always(mutex_acquire_shared(NULL, &vfs_handle_mtx, VFS_MUTEX_TIMEOUT));
 
     // Look up the handle.
-    ptrdiff_t index = vfs_file_by_handle(file);
-    if (index == -1) {
+    vfs_file_handle_t *ptr = vfs_file_by_handle(file);
+    if (!ptr) {
         badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_PARAM);
         mutex_release_shared(NULL, &vfs_handle_mtx);
         return 0;
     }
-    vfs_file_handle_t *ptr = &vfs_file_handle_list[index];
 
     // Get the position atomically.
     assert_always(mutex_acquire(NULL, &ptr->mutex, VFS_MUTEX_TIMEOUT));
@@ -861,13 +1285,12 @@ fileoff_t fs_seek(badge_err_t *ec, file_t file, fileoff_t off, fs_seek_t seekmod
     assert_always(mutex_acquire_shared(NULL, &vfs_handle_mtx, VFS_MUTEX_TIMEOUT));
 
     // Look up the handle.
-    ptrdiff_t index = vfs_file_by_handle(file);
-    if (index == -1) {
+    vfs_file_handle_t *ptr = vfs_file_by_handle(file);
+    if (!ptr) {
         badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_PARAM);
         mutex_release_shared(NULL, &vfs_handle_mtx);
         return 0;
     }
-    vfs_file_handle_t *ptr = &vfs_file_handle_list[index];
 
     // Update the position atomically.
     assert_always(mutex_acquire(NULL, &ptr->mutex, VFS_MUTEX_TIMEOUT));
@@ -883,8 +1306,8 @@ fileoff_t fs_seek(badge_err_t *ec, file_t file, fileoff_t off, fs_seek_t seekmod
         ptr->offset = 0;
     } else if (!ptr->is_dir && ptr->offset > ptr->shared->size) {
         ptr->offset = ptr->shared->size;
-    } else if (ptr->is_dir && ptr->offset > ptr->dir_cache_size) {
-        ptr->offset = ptr->dir_cache_size;
+    } else if (ptr->is_dir && ptr->offset > (ptr->dir_cache ? ptr->dir_cache->size : 0)) {
+        ptr->offset = ptr->dir_cache ? ptr->dir_cache->size : 0;
     }
     mutex_release(NULL, &ptr->mutex);
 
@@ -895,6 +1318,28 @@ fileoff_t fs_seek(badge_err_t *ec, file_t file, fileoff_t off, fs_seek_t seekmod
 // Force any write caches to be flushed for a given file.
 // If the file is `FILE_NONE`, all open files are flushed.
 void fs_flush(badge_err_t *ec, file_t file) {
-    (void)file;
-    badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_UNSUPPORTED);
+    badge_err_t ec0;
+    if (!ec)
+        ec = &ec0;
+    if (file == FILE_NONE) {
+        vfs_writeback_sync(ec);
+        return;
+    }
+    assert_always(mutex_acquire_shared(NULL, &vfs_handle_mtx, VFS_MUTEX_TIMEOUT));
+
+    // Look up the handle.
+    vfs_file_handle_t *ptr = vfs_file_by_handle(file);
+    if (!ptr) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_PARAM);
+        mutex_release_shared(NULL, &vfs_handle_mtx);
+        return;
+    }
+
+    // Write back the file's pages, then make the filesystem commit them.
+    vfs_pcache_writeback_file(ec, ptr->shared);
+    if (badge_err_is_ok(ec)) {
+        vfs_flush(ec, ptr->shared->vfs);
+    }
+
+    mutex_release_shared(NULL, &vfs_handle_mtx);
 }
@@ -3,8 +3,12 @@
 
 #include "filesystem/syscall_impl.h"
 
+#include "badge_strings.h"
 #include "filesystem.h"
 #include "process/internal.h"
+#include "process/ioring.h"
+#include "process/types.h"
+#include "syscall_util.h"
 
 
 
@@ -43,6 +47,10 @@ bool syscall_fs_close(int virt) {
 // Read bytes from a file.
 // Returns -1 on EOF, <= -2 on error, read count on success.
 long syscall_fs_read(int virt, void *read_buf, long read_len) {
+    // Filesystems access the buffer directly, so it is checked and faulted in up front.
+    if (read_len > 0) {
+        sysutil_memassert_rw(read_buf, read_len);
+    }
     file_t fd = proc_find_fd_raw(NULL, proc_current(), virt);
     if (fd != -1) {
         return fs_read(NULL, fd, read_buf, read_len);
@@ -53,6 +61,9 @@ long syscall_fs_read(int virt, void *read_buf, long read_len) {
 // Write bytes to a file.
 // Returns <= -1 on error, write count on success.
 long syscall_fs_write(int virt, void const *write_buf, long write_len) {
+    if (write_len > 0) {
+        sysutil_memassert_r(write_buf, write_len);
+    }
     file_t fd = proc_find_fd_raw(NULL, proc_current(), virt);
     if (fd != -1) {
         return fs_write(NULL, fd, write_buf, write_len);
@@ -64,7 +75,169 @@ long syscall_fs_write(int virt, void const *write_buf, long write_len) {
 // See `dirent_t` for the format.
 // Returns <= -1 on error, read count on success.
 long syscall_fs_getdents(int virt, void *read_buf, long read_len) {
+    if (read_len > 0) {
+        sysutil_memassert_rw(read_buf, read_len);
+    }
     file_t fd = proc_find_fd_raw(NULL, proc_current(), virt);
     fs_seek(NULL, fd, 0, SEEK_ABS);
     return fs_read(NULL, fd, read_buf, read_len);
 }
+
+// Read directory entries along with the status of the files they name, continuing where the previous read stopped.
+// See `dirent_stat_t` for the format.
+// Returns <= -1 on error, 0 at the end of the directory, read count on success.
+long syscall_fs_getdents_stat(int virt, void *read_buf, long read_len) {
+    if (read_len > 0) {
+        sysutil_memassert_rw(read_buf, read_len);
+    }
+    file_t fd = proc_find_fd_raw(NULL, proc_current(), virt);
+    if (fd == -1) {
+        return -1;
+    }
+    badge_err_t ec;
+    fileoff_t   len = fs_dir_read_stat(&ec, fd, read_buf, read_len);
+    return badge_err_is_ok(&ec) ? len : -1;
+}
+
+// Get file status given file handle or path.
+// If `path` is NULL, gets the status of `fd`.
+bool syscall_fs_stat(int virt, char const *path, stat_t *stat_out) {
+    sysutil_memassert_rw(stat_out, sizeof(stat_t));
+    if (path) {
+        return fs_stat(NULL, stat_out, path);
+    }
+    file_t fd = proc_find_fd_raw(NULL, proc_current(), virt);
+    if (fd == -1) {
+        return false;
+    }
+    return fs_fstat(NULL, stat_out, fd);
+}
+
+// Copy a vectored I/O request from user memory and check its buffers.
+// If `writable` is true, the buffers are checked for being written to by the kernel.
+// Returns false if there are too many buffers.
+static bool iov_copyin(iovec_t *out, iovec_t const *iov, int iovcnt, bool writable) {
+    if (iovcnt < 0 || iovcnt > IOV_MAX) {
+        return false;
+    }
+    // Copied so another thread can't change the buffers after they were checked.
+    sysutil_memassert_r(iov, iovcnt * sizeof(iovec_t));
+    mem_copy(out, iov, iovcnt * sizeof(iovec_t));
+    for (int i = 0; i < iovcnt; i++) {
+        if (out[i].len > 0 && writable) {
+            sysutil_memassert_rw(out[i].base, out[i].len);
+        } else if (out[i].len > 0) {
+            sysutil_memassert_r(out[i].base, out[i].len);
+        }
+    }
+    return true;
+}
+
+// Read bytes from a file into several buffers, filled in order.
+// Returns <= -1 on error, read count on success.
+long syscall_fs_readv(int virt, iovec_t const *iov, int iovcnt) {
+    iovec_t kiov[IOV_MAX];
+    if (!iov_copyin(kiov, iov, iovcnt, true)) {
+        return -1;
+    }
+    file_t fd = proc_find_fd_raw(NULL, proc_current(), virt);
+    if (fd == -1) {
+        return -1;
+    }
+    badge_err_t ec;
+    fileoff_t   res = fs_readv(&ec, fd, kiov, iovcnt, -1);
+    return badge_err_is_ok(&ec) ? res : -1;
+}
+
+// Write bytes to a file from several buffers, written in order.
+// Returns <= -1 on error, write count on success.
+long syscall_fs_writev(int virt, iovec_t const *iov, int iovcnt) {
+    iovec_t kiov[IOV_MAX];
+    if (!iov_copyin(kiov, iov, iovcnt, false)) {
+        return -1;
+    }
+    file_t fd = proc_find_fd_raw(NULL, proc_current(), virt);
+    if (fd == -1) {
+        return -1;
+    }
+    badge_err_t ec;
+    fileoff_t   res = fs_writev(&ec, fd, kiov, iovcnt, -1);
+    return badge_err_is_ok(&ec) ? res : -1;
+}
+
+// Read bytes from a file at `offset` without using or changing the current offset.
+// Returns <= -1 on error, read count on success.
+long syscall_fs_pread(int virt, void *read_buf, long read_len, long offset) {
+    if (read_len < 0 || offset < 0) {
+        return -1;
+    } else if (read_len > 0) {
+        sysutil_memassert_rw(read_buf, read_len);
+    }
+    file_t fd = proc_find_fd_raw(NULL, proc_current(), virt);
+    if (fd == -1) {
+        return -1;
+    }
+    iovec_t     iov = {read_buf, read_len};
+    badge_err_t ec;
+    fileoff_t   res = fs_readv(&ec, fd, &iov, 1, offset);
+    return badge_err_is_ok(&ec) ? res : -1;
+}
+
+// Write bytes to a file at `offset` without using or changing the current offset.
+// Returns <= -1 on error, write count on success.
+long syscall_fs_pwrite(int virt, void const *write_buf, long write_len, long offset) {
+    if (write_len < 0 || offset < 0) {
+        return -1;
+    } else if (write_len > 0) {
+        sysutil_memassert_r(write_buf, write_len);
+    }
+    file_t fd = proc_find_fd_raw(NULL, proc_current(), virt);
+    if (fd == -1) {
+        return -1;
+    }
+    iovec_t     iov = {(void *)write_buf, write_len};
+    badge_err_t ec;
+    fileoff_t   res = fs_writev(&ec, fd, &iov, 1, offset);
+    return badge_err_is_ok(&ec) ? res : -1;
+}
+
+// Copy bytes from one file to another in the kernel, without passing them through userspace.
+// An offset of -1 uses and advances the current offset of that file; other offsets leave it be.
+// Returns <= -1 on error, copy count on success; less than `len` means the end of `fd_in` was reached.
+long syscall_fs_copy_range(int virt_in, long off_in, int virt_out, long off_out, long len) {
+    if (off_in < -1 || off_out < -1 || len < 0) {
+        return -1;
+    }
+    file_t fd_in  = proc_find_fd_raw(NULL, proc_current(), virt_in);
+    file_t fd_out = proc_find_fd_raw(NULL, proc_current(), virt_out);
+    if (fd_in == -1 || fd_out == -1) {
+        return -1;
+    }
+    badge_err_t ec;
+    fileoff_t   res = fs_copy_range(&ec, fd_in, off_in, fd_out, off_out, len);
+    return badge_err_is_ok(&ec) ? res : -1;
+}
+
+// Create the asynchronous I/O ring of this process and map it at an arbitrary virtual address.
+// Returns NULL on failure or if the process already has a ring.
+ioring_t *syscall_fs_ring_setup(size_t vaddr_req) {
+    process_t *const proc = proc_current();
+    mutex_acquire(NULL, &proc->mtx, TIMESTAMP_US_MAX);
+    size_t vaddr = proc_ioring_setup_raw(NULL, proc, vaddr_req);
+    mutex_release(NULL, &proc->mtx);
+    return (ioring_t *)vaddr;
+}
+
+// Wait until at least `min_complete` completions are in the ring of this process, or `timeout_us` has passed.
+// Returns <= -1 on error, number of completions available on success.
+int syscall_fs_ring_wait(unsigned min_complete, long timeout_us) {
+    // The ring is only destroyed once all threads of the process have stopped.
+    process_t *const proc = proc_current();
+    mutex_acquire_shared(NULL, &proc->mtx, TIMESTAMP_US_MAX);
+    proc_ioring_t *ioring = proc->ioring;
+    mutex_release_shared(NULL, &proc->mtx);
+    if (!ioring || min_complete > IORING_CQ_ENTRIES) {
+        return -1;
+    }
+    return (int)proc_ioring_wait(ioring, min_complete, timeout_us);
+}
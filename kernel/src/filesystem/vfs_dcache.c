@@ -0,0 +1,203 @@
+
+// SPDX-License-Identifier: MIT
+
+#include "filesystem/vfs_dcache.h"
+
+#include "assertions.h"
+#include "badge_strings.h"
+#include "filesystem/vfs_internal.h"
+#include "malloc.h"
+#include "meta.h"
+
+#include <stddef.h>
+
+// Cached directory entry.
+typedef struct vfs_dentry {
+    // Node in the LRU list; least recently used first.
+    dlist_node_t       node;
+    // Next entry in the same hash bucket.
+    struct vfs_dentry *next;
+    // Filesystem the entry is on.
+    vfs_t             *vfs;
+    // Inode of the directory containing the entry.
+    inode_t            dir;
+    // Inode of the entry itself, 0 if the entry does not exist.
+    inode_t            inode;
+    // Hash of `vfs`, `dir` and `name`.
+    uint32_t           hash;
+    // Entry is a directory.
+    bool               is_dir;
+    // Entry is a symbolic link.
+    bool               is_symlink;
+    // Length of the filename.
+    size_t             name_len;
+    // Filename, null-terminated.
+    char               name[];
+} vfs_dentry_t;
+
+// Guards the dentry cache.
+static mutex_t       dcache_mtx = MUTEX_T_INIT;
+// Hash buckets of cached entries.
+static vfs_dentry_t *dcache_buckets[VFS_DCACHE_BUCKETS];
+// Cached entries ordered from least to most recently used.
+static dlist_t       dcache_lru = DLIST_EMPTY;
+// Incremented on every invalidation so lookups racing with a change don't insert stale entries.
+static uint32_t      dcache_gen;
+
+
+
+// Hash a directory entry key with FNV-1a.
+static uint32_t dcache_hash(vfs_t *vfs, inode_t dir, char const *name, size_t name_len) {
+    uint32_t hash = 2166136261u;
+    size_t   key  = (size_t)vfs ^ (size_t)dir * 0x9e3779b9u;
+    for (size_t i = 0; i < sizeof(key); i++) {
+        hash = (hash ^ (uint8_t)(key >> (i * 8))) * 16777619u;
+    }
+    for (size_t i = 0; i < name_len; i++) {
+        hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Find the link in its hash bucket that points to an entry.
+static vfs_dentry_t **dcache_link(vfs_t *vfs, inode_t dir, char const *name, size_t name_len, uint32_t hash) {
+    vfs_dentry_t **link = &dcache_buckets[hash & (VFS_DCACHE_BUCKETS - 1)];
+    while (*link) {
+        vfs_dentry_t *dentry = *link;
+        if (dentry->hash == hash && dentry->vfs == vfs && dentry->dir == dir && dentry->name_len == name_len &&
+            mem_equals(dentry->name, name, name_len)) {
+            break;
+        }
+        link = &dentry->next;
+    }
+    return link;
+}
+
+// Remove an entry from the cache and free it.
+static void dcache_remove(vfs_dentry_t **link) {
+    vfs_dentry_t *dentry = *link;
+    *link                = dentry->next;
+    dlist_remove(&dcache_lru, &dentry->node);
+    free(dentry);
+}
+
+// Remove all entries that match a filter from the cache.
+static void dcache_remove_if(vfs_t *vfs, bool match_dir, inode_t dir) {
+    for (size_t i = 0; i < VFS_DCACHE_BUCKETS; i++) {
+        vfs_dentry_t **link = &dcache_buckets[i];
+        while (*link) {
+            if ((*link)->vfs == vfs && (!match_dir || (*link)->dir == dir)) {
+                dcache_remove(link);
+            } else {
+                link = &(*link)->next;
+            }
+        }
+    }
+}
+
+
+
+// Look up a directory entry by parent directory inode and name.
+// On a miss, `*gen` is set to the value to pass to `vfs_dcache_insert` after looking up the entry on the filesystem.
+vfs_dcache_res_t vfs_dcache_lookup(vfs_t *vfs, inode_t dir, char const *name, dirent_t *ent, uint32_t *gen) {
+    size_t   name_len = cstr_length(name);
+    uint32_t hash     = dcache_hash(vfs, dir, name, name_len);
+    assert_always(mutex_acquire(NULL, &dcache_mtx, VFS_MUTEX_TIMEOUT));
+
+    vfs_dentry_t *dentry = *dcache_link(vfs, dir, name, name_len, hash);
+    if (!dentry) {
+        *gen = dcache_gen;
+        mutex_release(NULL, &dcache_mtx);
+        return VFS_DCACHE_MISS;
+    }
+
+    // Mark as most recently used.
+    dlist_remove(&dcache_lru, &dentry->node);
+    dlist_append(&dcache_lru, &dentry->node);
+
+    vfs_dcache_res_t res = VFS_DCACHE_NOTFOUND;
+    if (dentry->inode) {
+        ent->record_len  = offsetof(dirent_t, name) + name_len + 1;
+        ent->record_len += (fileoff_t)((size_t)(~ent->record_len + 1) % sizeof(size_t));
+        ent->inode       = dentry->inode;
+        ent->is_dir      = dentry->is_dir;
+        ent->is_symlink  = dentry->is_symlink;
+        ent->name_len    = (fileoff_t)name_len;
+        mem_copy(ent->name, name, name_len + 1);
+        res = VFS_DCACHE_FOUND;
+    }
+
+    mutex_release(NULL, &dcache_mtx);
+    return res;
+}
+
+// Add the result of a filesystem lookup to the cache; `ent` is NULL if the entry does not exist.
+// Dropped if anything was invalidated since the `vfs_dcache_lookup` that returned `gen`, since it may be stale.
+void vfs_dcache_insert(vfs_t *vfs, inode_t dir, char const *name, dirent_t const *ent, uint32_t gen) {
+    size_t        name_len = cstr_length(name);
+    vfs_dentry_t *dentry   = malloc(sizeof(vfs_dentry_t) + name_len + 1);
+    if (!dentry) {
+        return;
+    }
+    *dentry = (vfs_dentry_t){
+        .node       = DLIST_NODE_EMPTY,
+        .vfs        = vfs,
+        .dir        = dir,
+        .inode      = ent ? ent->inode : 0,
+        .hash       = dcache_hash(vfs, dir, name, name_len),
+        .is_dir     = ent && ent->is_dir,
+        .is_symlink = ent && ent->is_symlink,
+        .name_len   = name_len,
+    };
+    mem_copy(dentry->name, name, name_len + 1);
+
+    assert_always(mutex_acquire(NULL, &dcache_mtx, VFS_MUTEX_TIMEOUT));
+    vfs_dentry_t **link = dcache_link(vfs, dir, name, name_len, dentry->hash);
+    if (gen != dcache_gen || *link) {
+        // Possibly stale, or another thread cached it first.
+        mutex_release(NULL, &dcache_mtx);
+        free(dentry);
+        return;
+    }
+
+    // Make room by evicting the least recently used entry.
+    if (dcache_lru.len >= VFS_DCACHE_MAX) {
+        vfs_dentry_t *lru = field_parent_ptr(vfs_dentry_t, node, dcache_lru.head);
+        dcache_remove(dcache_link(lru->vfs, lru->dir, lru->name, lru->name_len, lru->hash));
+        // The new entry may have been in the same bucket right after the victim.
+        link = dcache_link(vfs, dir, name, name_len, dentry->hash);
+    }
+
+    *link = dentry;
+    dlist_append(&dcache_lru, &dentry->node);
+    mutex_release(NULL, &dcache_mtx);
+}
+
+// Forget a directory entry; must be called after the entry is created or removed.
+void vfs_dcache_invalidate(vfs_t *vfs, inode_t dir, char const *name) {
+    size_t   name_len = cstr_length(name);
+    uint32_t hash     = dcache_hash(vfs, dir, name, name_len);
+    assert_always(mutex_acquire(NULL, &dcache_mtx, VFS_MUTEX_TIMEOUT));
+    dcache_gen++;
+    vfs_dentry_t **link = dcache_link(vfs, dir, name, name_len, hash);
+    if (*link) {
+        dcache_remove(link);
+    }
+    mutex_release(NULL, &dcache_mtx);
+}
+
+// Forget all entries in a directory; used when the directory is removed so its inode number can be reused.
+void vfs_dcache_invalidate_dir(vfs_t *vfs, inode_t dir) {
+    assert_always(mutex_acquire(NULL, &dcache_mtx, VFS_MUTEX_TIMEOUT));
+    dcache_gen++;
+    dcache_remove_if(vfs, true, dir);
+    mutex_release(NULL, &dcache_mtx);
+}
+
+// Forget all entries of a filesystem.
+void vfs_dcache_invalidate_vfs(vfs_t *vfs) {
+    assert_always(mutex_acquire(NULL, &dcache_mtx, VFS_MUTEX_TIMEOUT));
+    dcache_gen++;
+    dcache_remove_if(vfs, false, 0);
+    mutex_release(NULL, &dcache_mtx);
+}
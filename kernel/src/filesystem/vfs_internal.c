@@ -5,12 +5,13 @@
 
 #include "assertions.h"
 #include "badge_strings.h"
+#include "filesystem/vfs_dcache.h"
+#include "filesystem/vfs_lcache.h"
+#include "filesystem/vfs_pcache.h"
 #include "filesystem/vfs_ramfs.h"
 #include "log.h"
 #include "malloc.h"
 
-#include <stdatomic.h>
-
 // Index in the VFS table of the filesystem mounted at /.
 // Set to -1 if no filesystem is mounted at /.
 // If no filesystem is mounted at /, the FS API will not work.
@@ -26,22 +27,38 @@ mutex_t   vfs_mount_mtx                   = MUTEX_T_INIT_SHARED;
 // Taken shared when a handle is used.
 mutex_t   vfs_handle_mtx                  = MUTEX_T_INIT_SHARED;
 
-// List of open shared file handles.
-vfs_file_shared_t **vfs_file_shared_list;
-// Number of open shared file handles.
-size_t              vfs_file_shared_list_len;
-// Capacity of open shared file handles list.
-size_t              vfs_file_shared_list_cap;
-
-// List of open file handles.
-vfs_file_handle_t *vfs_file_handle_list;
-// Number of open file handles.
-size_t             vfs_file_handle_list_len;
-// Capacity of open file handles list.
-size_t             vfs_file_handle_list_cap;
-
-// Next file / directory handle number.
-static atomic_int vfs_handle_no = 0;
+// Number of low bits of a file number that select its slot in the handle table.
+#define VFS_HANDLE_SLOT_BITS 16
+// Mask of the slot index in a file number.
+#define VFS_HANDLE_SLOT_MASK ((1 << VFS_HANDLE_SLOT_BITS) - 1)
+// Mask of the generation in a file number, chosen so file numbers are never negative.
+#define VFS_HANDLE_GEN_MASK ((1 << (31 - VFS_HANDLE_SLOT_BITS)) - 1)
+// Number of hash buckets for shared file handles; must be a power of two.
+#define VFS_SHARED_BUCKETS 64
+// Vectored requests up to this many bytes are gathered into one buffer so the filesystem is called once.
+#define VFS_IOV_BOUNCE 256
+// Minimum capacity of the handle table.
+#define VFS_HANDLE_TABLE_MIN 16
+
+// Slot in the file handle table.
+typedef struct {
+    // Handle in this slot, NULL if the slot is free.
+    vfs_file_handle_t *handle;
+    // Next free slot if this slot is free, -1 if there are no more.
+    ptrdiff_t          next_free;
+    // Incremented every time the slot is freed so stale file numbers don't match the next handle.
+    int                gen;
+} vfs_handle_slot_t;
+
+// Table of open file handles indexed by the low bits of their file number.
+static vfs_handle_slot_t *vfs_handle_table;
+// Capacity of the handle table.
+static size_t             vfs_handle_table_cap;
+// First free slot in the handle table, -1 if the table is full.
+static ptrdiff_t          vfs_handle_free = -1;
+
+// Open shared file handles hashed by filesystem and inode.
+static vfs_file_shared_t *vfs_shared_table[VFS_SHARED_BUCKETS];
 
 // Abstraction for return thing from VFS.
 #define vfs_impl_return(type, method, ...)                                                                             \
@@ -74,177 +91,174 @@ static atomic_int vfs_handle_no = 0;
 
 
 
-// Create a new file_t number.
-static file_t next_fileno() {
-    return atomic_fetch_add(&vfs_handle_no, 1);
+// Get the shared handle hash bucket for an inode.
+static vfs_file_shared_t **shared_bucket(vfs_t *vfs, inode_t inode) {
+    size_t hash = (size_t)inode * 0x9e3779b9 ^ (size_t)vfs >> 4;
+    return &vfs_shared_table[(hash ^ hash >> 16) & (VFS_SHARED_BUCKETS - 1)];
 }
 
-
-
-/* ==== Thread-unsafe functions ==== */
-
-// Look up shared file handle by pointer.
-static ptrdiff_t vfs_file_by_ptr(vfs_file_shared_t *ptr) {
-    for (size_t i = 0; i < vfs_file_shared_list_len; i++) {
-        if (vfs_file_shared_list[i] == ptr) {
-            return (ptrdiff_t)i;
-        }
-    }
-    return -1;
+// Add a freshly opened shared handle to the inode hash.
+static void shared_insert(vfs_file_shared_t *shared) {
+    vfs_file_shared_t **bucket = shared_bucket(shared->vfs, shared->inode);
+    shared->next               = *bucket;
+    *bucket                    = shared;
 }
 
-// Splice a shared file handle out of the list.
-static void vfs_file_shared_splice(ptrdiff_t i) {
-    // Remove an entry.
-    vfs_file_shared_list_len--;
-    if (vfs_file_shared_list_len) {
-        vfs_file_shared_list[i] = vfs_file_shared_list[vfs_file_shared_list_len];
+// Remove a shared handle from the inode hash if it is in there.
+static void shared_remove(vfs_file_shared_t *shared) {
+    vfs_file_shared_t **link = shared_bucket(shared->vfs, shared->inode);
+    while (*link && *link != shared) {
+        link = &(*link)->next;
     }
-
-    if (vfs_file_shared_list_cap > vfs_file_shared_list_len * 2) {
-        // Shrink the array.
-        size_t new_cap = vfs_file_shared_list_cap / 2;
-        if (new_cap < 2)
-            new_cap = 2;
-        void *mem = realloc(vfs_file_shared_list, sizeof(vfs_file_shared_t *) * new_cap);
-        if (!mem)
-            return;
-        vfs_file_shared_list     = mem;
-        vfs_file_shared_list_cap = new_cap;
+    if (*link) {
+        *link = shared->next;
     }
 }
 
-// Splice a file handle out of the list.
-static void vfs_file_handle_splice(ptrdiff_t i) {
-    // Remove an entry.
-    vfs_file_handle_list_len--;
-    if (vfs_file_handle_list_len) {
-        vfs_file_handle_list[i] = vfs_file_handle_list[vfs_file_handle_list_len];
+// Double the capacity of the handle table.
+static bool handle_table_expand() {
+    size_t new_cap = vfs_handle_table_cap * 2;
+    if (new_cap < VFS_HANDLE_TABLE_MIN) {
+        new_cap = VFS_HANDLE_TABLE_MIN;
     }
-
-    if (vfs_file_handle_list_cap > vfs_file_handle_list_len * 2) {
-        // Shrink the array.
-        size_t new_cap = vfs_file_handle_list_cap / 2;
-        if (new_cap < 2)
-            new_cap = 2;
-        void *mem = realloc(vfs_file_handle_list, sizeof(*vfs_file_handle_list) * new_cap);
-        if (!mem)
-            return;
-        vfs_file_handle_list     = mem;
-        vfs_file_handle_list_cap = new_cap;
+    if (new_cap > VFS_HANDLE_SLOT_MASK + 1) {
+        return false;
+    }
+    void *mem = realloc(vfs_handle_table, sizeof(vfs_handle_slot_t) * new_cap);
+    if (!mem) {
+        return false;
     }
+    vfs_handle_table = mem;
+
+    // Chain the new slots onto the free list, lowest first.
+    for (size_t i = new_cap; i-- > vfs_handle_table_cap;) {
+        vfs_handle_table[i] = (vfs_handle_slot_t){
+            .handle    = NULL,
+            .next_free = vfs_handle_free,
+            .gen       = 0,
+        };
+        vfs_handle_free = (ptrdiff_t)i;
+    }
+    vfs_handle_table_cap = new_cap;
+    return true;
 }
 
+
+
+/* ==== Thread-unsafe functions ==== */
+
 // Find a shared file handle by inode, if any.
-ptrdiff_t vfs_shared_by_inode(vfs_t *vfs, inode_t inode) {
-    for (size_t i = 0; i < vfs_file_shared_list_len; i++) {
-        if (vfs_file_shared_list[i]->vfs == vfs && vfs_file_shared_list[i]->inode == inode) {
-            return (ptrdiff_t)i;
-        }
+vfs_file_shared_t *vfs_shared_by_inode(vfs_t *vfs, inode_t inode) {
+    vfs_file_shared_t *shared = *shared_bucket(vfs, inode);
+    while (shared && (shared->vfs != vfs || shared->inode != inode)) {
+        shared = shared->next;
     }
-    return -1;
+    return shared;
 }
 
 // Get a file handle by number.
-ptrdiff_t vfs_file_by_handle(file_t fileno) {
-    for (size_t i = 0; i < vfs_file_handle_list_len; i++) {
-        if (vfs_file_handle_list[i].fileno == fileno) {
-            return (ptrdiff_t)i;
-        }
+vfs_file_handle_t *vfs_file_by_handle(file_t fileno) {
+    if (fileno < 0) {
+        return NULL;
+    }
+    size_t slot = fileno & VFS_HANDLE_SLOT_MASK;
+    if (slot >= vfs_handle_table_cap) {
+        return NULL;
     }
-    return -1;
+    vfs_file_handle_t *handle = vfs_handle_table[slot].handle;
+    return handle && handle->fileno == fileno ? handle : NULL;
 }
 
 // Create a new empty shared file handle.
-ptrdiff_t vfs_file_create_shared() {
-    if (vfs_file_shared_list_len >= vfs_file_shared_list_cap) {
-        // Expand list.
-        size_t new_cap = vfs_file_shared_list_cap * 2;
-        if (new_cap < 2)
-            new_cap = 2;
-        void *mem = realloc(vfs_file_shared_list, sizeof(vfs_file_shared_t *) * new_cap);
-        if (!mem)
-            return -1;
-        vfs_file_shared_list     = mem;
-        vfs_file_shared_list_cap = new_cap;
-    }
-
-    // Allocate new shared handle.
-    ptrdiff_t          shared = (ptrdiff_t)vfs_file_shared_list_len;
-    vfs_file_shared_t *shptr  = malloc(sizeof(vfs_file_shared_t));
+vfs_file_shared_t *vfs_file_create_shared() {
+    vfs_file_shared_t *shptr = malloc(sizeof(vfs_file_shared_t));
     if (!shptr)
-        return -1;
+        return NULL;
     *shptr = (vfs_file_shared_t){
         .refcount = 0,
-        .index    = shared,
+        .next     = NULL,
         .size     = 0,
         .inode    = 0,
         .vfs      = NULL,
     };
-    vfs_file_shared_list[vfs_file_shared_list_len] = shptr;
-    vfs_file_shared_list_len++;
-
-    return shared;
+    return shptr;
 }
 
 // Create a new file handle.
-// If `shared` is -1, a new empty shared handle is created.
-ptrdiff_t vfs_file_create_handle(ptrdiff_t shared) {
-    if (shared == -1) {
-        // Allocate new shared handle.
-        shared = vfs_file_create_shared();
+// If `shared` is NULL, a new empty shared handle is created.
+vfs_file_handle_t *vfs_file_create_handle(vfs_file_shared_t *shared) {
+    if (vfs_handle_free == -1 && !handle_table_expand()) {
+        return NULL;
     }
-    if (shared < 0) {
-        // Failed to allocate or illegal argument.
-        return -1;
+    vfs_file_handle_t *handle = malloc(sizeof(vfs_file_handle_t));
+    if (!handle) {
+        return NULL;
     }
-
-    if (vfs_file_handle_list_len >= vfs_file_handle_list_cap) {
-        // Expand list.
-        size_t new_cap = vfs_file_handle_list_cap * 2;
-        if (new_cap < 2)
-            new_cap = 2;
-        void *mem = realloc(vfs_file_handle_list, sizeof(*vfs_file_handle_list) * new_cap);
-        if (!mem)
-            return -1;
-        vfs_file_handle_list     = mem;
-        vfs_file_handle_list_cap = new_cap;
+    if (!shared) {
+        // Allocate new shared handle.
+        shared = vfs_file_create_shared();
+        if (!shared) {
+            free(handle);
+            return NULL;
+        }
     }
 
-    // Allocate new handle.
-    ptrdiff_t handle = (ptrdiff_t)vfs_file_handle_list_len;
-    vfs_file_handle_list_len++;
-    vfs_file_handle_list[handle] = (vfs_file_handle_t){
+    // Take a free slot; the file number encodes the slot and its generation.
+    ptrdiff_t          slot = vfs_handle_free;
+    vfs_handle_slot_t *ent  = &vfs_handle_table[slot];
+    *handle                 = (vfs_file_handle_t){
         .offset = 0,
-        .shared = vfs_file_shared_list[shared],
-        .fileno = next_fileno(),
+        .shared = shared,
+        .fileno = (ent->gen << VFS_HANDLE_SLOT_BITS) | (file_t)slot,
         .mutex  = MUTEX_T_INIT,
     };
+    vfs_handle_free = ent->next_free;
+    ent->handle     = handle;
 
     return handle;
 }
 
 // Destroy a shared file handle assuming the underlying file is already closed.
-void vfs_file_destroy_shared(ptrdiff_t shared) {
-    vfs_file_shared_splice(shared);
+void vfs_file_destroy_shared(vfs_file_shared_t *shared) {
+    shared_remove(shared);
+    free(shared);
 }
 
 // Delete a file handle.
 // If this is the last handle referring to one file, the shared handle is closed too.
-void vfs_file_destroy_handle(ptrdiff_t handle) {
-    assert_dev_drop(handle >= 0 && handle < (ptrdiff_t)vfs_file_handle_list_len);
+void vfs_file_destroy_handle(vfs_file_handle_t *handle) {
+    size_t slot = handle->fileno & VFS_HANDLE_SLOT_MASK;
+    assert_dev_drop(slot < vfs_handle_table_cap && vfs_handle_table[slot].handle == handle);
 
     // Drop refcount.
-    vfs_file_handle_list[handle].shared->refcount--;
-    if (vfs_file_handle_list[handle].shared->refcount == 0) {
-        // Close shared handle.
-        vfs_file_close(NULL, vfs_file_handle_list[handle].shared);
-        ptrdiff_t shared = vfs_file_by_ptr(vfs_file_handle_list[handle].shared);
-        vfs_file_shared_splice(shared);
+    handle->shared->refcount--;
+    if (handle->shared->refcount == 0) {
+        // Close shared handle; dirty pages can't be written back without it.
+        if (handle->shared->vfs->media) {
+            vfs_pcache_writeback_file(NULL, handle->shared);
+        }
+        vfs_file_close(NULL, handle->shared);
+        vfs_file_destroy_shared(handle->shared);
     }
 
-    // Splice the handle out of the list.
-    vfs_file_handle_splice(handle);
+    // Return the slot to the free list.
+    vfs_handle_slot_t *ent = &vfs_handle_table[slot];
+    ent->handle            = NULL;
+    ent->gen               = (ent->gen + 1) & VFS_HANDLE_GEN_MASK;
+    ent->next_free         = vfs_handle_free;
+    vfs_handle_free        = (ptrdiff_t)slot;
+    vfs_listing_unref(handle->dir_cache);
+    free(handle);
+}
+
+// Delete all file handles referring to files on a filesystem.
+void vfs_file_destroy_all(vfs_t *vfs) {
+    for (size_t i = 0; i < vfs_handle_table_cap; i++) {
+        vfs_file_handle_t *handle = vfs_handle_table[i].handle;
+        if (handle && handle->shared->vfs == vfs) {
+            vfs_file_destroy_handle(handle);
+        }
+    }
 }
 
 
@@ -253,8 +267,14 @@ void vfs_file_destroy_handle(ptrdiff_t handle) {
 
 // Open the root directory of the root filesystem.
 void vfs_root_open(badge_err_t *ec, vfs_file_shared_t *dir) {
+    badge_err_t ec0;
+    if (!ec)
+        ec = &ec0;
     vfs_t *vfs = &vfs_table[vfs_root_index];
     vfs_impl_call_void(vfs->type, root_open, ec, vfs, dir);
+    if (badge_err_is_ok(ec)) {
+        shared_insert(dir);
+    }
 }
 
 
@@ -264,6 +284,8 @@ void vfs_root_open(badge_err_t *ec, vfs_file_shared_t *dir) {
 // If `open` is true, a new handle to the file is opened.
 void vfs_create_file(badge_err_t *ec, vfs_file_shared_t *dir, char const *name) {
     vfs_impl_call_void(dir->vfs->type, create_file, ec, dir->vfs, dir, name);
+    vfs_dcache_invalidate(dir->vfs, dir->inode, name);
+    vfs_lcache_invalidate(dir->vfs, dir->inode);
 }
 
 // Insert a new directory into the given directory.
@@ -271,20 +293,48 @@ void vfs_create_file(badge_err_t *ec, vfs_file_shared_t *dir, char const *name)
 // If `open` is true, a new handle to the directory is opened.
 void vfs_create_dir(badge_err_t *ec, vfs_file_shared_t *dir, char const *name) {
     vfs_impl_call_void(dir->vfs->type, create_dir, ec, dir->vfs, dir, name);
+    vfs_dcache_invalidate(dir->vfs, dir->inode, name);
+    vfs_lcache_invalidate(dir->vfs, dir->inode);
 }
 
 // Unlink a file from the given directory.
 // If this is the last reference to an inode, the inode is deleted.
 void vfs_unlink(badge_err_t *ec, vfs_file_shared_t *dir, char const *name) {
+    dirent_t ent;
+    bool     found = vfs_dir_find_ent(NULL, dir, &ent, name);
     vfs_impl_call_void(dir->vfs->type, unlink, ec, dir->vfs, dir, name);
+    vfs_dcache_invalidate(dir->vfs, dir->inode, name);
+    vfs_lcache_invalidate(dir->vfs, dir->inode);
+    if (found && ent.is_dir) {
+        // Entries in the directory must not be found if its inode number is reused.
+        vfs_dcache_invalidate_dir(dir->vfs, ent.inode);
+        vfs_lcache_invalidate(dir->vfs, ent.inode);
+    } else if (found && dir->vfs->media) {
+        // Neither must the file's data.
+        vfs_pcache_invalidate_inode(dir->vfs, ent.inode);
+    }
 }
 
 
 
 // Atomically read all directory entries and cache them into the directory handle.
+// Listings are shared through the listing cache, so a directory is only read again after it changes.
 // Refer to `dirent_t` for the structure of the cache.
 void vfs_dir_read(badge_err_t *ec, vfs_file_handle_t *dir) {
-    vfs_impl_call_void(dir->shared->vfs->type, dir_read, ec, dir->shared->vfs, dir);
+    vfs_file_shared_t *shared  = dir->shared;
+    uint32_t           gen;
+    vfs_dir_listing_t *listing = vfs_lcache_lookup(shared->vfs, shared->inode, &gen);
+    if (listing) {
+        badge_err_set_ok(ec);
+    } else {
+        listing = vfs_impl_call(shared->vfs->type, vfs_dir_listing_t *, dir_read, ec, shared->vfs, shared);
+        if (!listing) {
+            return;
+        }
+        vfs_lcache_insert(shared->vfs, shared->inode, listing, gen);
+    }
+    vfs_listing_unref(dir->dir_cache);
+    dir->dir_cache = listing;
 }
 
 // Atomically read the directory entry with the matching name.
@@ -293,6 +343,12 @@ bool vfs_dir_find_ent(badge_err_t *ec, vfs_file_shared_t *dir, dirent_t *ent, ch
     vfs_impl_return(dir->vfs->type, dir_find_ent, ec, dir->vfs, dir, ent, name);
 }
 
+// Get the attributes of an inode.
+// Sets all fields but `device`.
+void vfs_stat(badge_err_t *ec, vfs_t *vfs, inode_t inode, stat_t *stat_out) {
+    vfs_impl_call_void(vfs->type, stat, ec, vfs, inode, stat_out);
+}
+
 
 
 // Open a file for reading and/or writing given parent directory handle.
@@ -300,6 +356,9 @@ bool vfs_dir_find_ent(badge_err_t *ec, vfs_file_shared_t *dir, dirent_t *ent, ch
 void vfs_file_open(
     badge_err_t *ec, vfs_file_shared_t *dir, vfs_file_shared_t *file, char const *name, oflags_t oflags
 ) {
+    badge_err_t ec0;
+    if (!ec)
+        ec = &ec0;
     vfs_t *vfs = dir->vfs;
 
     // Handle opening flags related to file creation.
@@ -317,16 +376,19 @@ void vfs_file_open(
 
         } else if (oflags & OFLAGS_DIRECTORY) {
             // Create directory as requested.
-            vfs_impl_call_void(vfs->type, create_dir, ec, vfs, dir, name);
+            vfs_create_dir(ec, dir, name);
 
         } else {
             // Create file as requested.
-            vfs_impl_call_void(vfs->type, create_file, ec, vfs, dir, name);
+            vfs_create_file(ec, dir, name);
         }
     }
 
     // Open the file in question.
     vfs_impl_call_void(vfs->type, file_open, ec, vfs, dir, file, name);
+    if (badge_err_is_ok(ec)) {
+        shared_insert(file);
+    }
 }
 
 // Close a file opened by `vfs_file_open`.
@@ -337,20 +399,165 @@ void vfs_file_close(badge_err_t *ec, vfs_file_shared_t *file) {
 }
 
 // Read bytes from a file.
+// Block-backed filesystems are read through the page cache.
 void vfs_file_read(badge_err_t *ec, vfs_file_shared_t *file, fileoff_t offset, uint8_t *readbuf, fileoff_t readlen) {
+    if (file->vfs->media) {
+        vfs_pcache_read(ec, file, offset, readbuf, readlen);
+    } else {
+        vfs_file_read_uncached(ec, file, offset, readbuf, readlen);
+    }
+}
+
+// Read bytes from a file, bypassing the page cache.
+void vfs_file_read_uncached(
+    badge_err_t *ec, vfs_file_shared_t *file, fileoff_t offset, uint8_t *readbuf, fileoff_t readlen
+) {
     vfs_impl_call_void(file->vfs->type, file_read, ec, file->vfs, file, offset, readbuf, readlen);
 }
 
 // Write bytes to a file.
+// Block-backed filesystems are written through the page cache.
 void vfs_file_write(
     badge_err_t *ec, vfs_file_shared_t *file, fileoff_t offset, uint8_t const *writebuf, fileoff_t writelen
+) {
+    if (file->vfs->media) {
+        vfs_pcache_write(ec, file, offset, writebuf, writelen);
+    } else {
+        vfs_file_write_uncached(ec, file, offset, writebuf, writelen);
+    }
+}
+
+// Write bytes to a file, bypassing the page cache.
+void vfs_file_write_uncached(
+    badge_err_t *ec, vfs_file_shared_t *file, fileoff_t offset, uint8_t const *writebuf, fileoff_t writelen
 ) {
     vfs_impl_call_void(file->vfs->type, file_write, ec, file->vfs, file, offset, writebuf, writelen);
 }
 
+// Read `readlen` bytes from a file into several buffers, filled in order.
+void vfs_file_readv(
+    badge_err_t *ec, vfs_file_shared_t *file, fileoff_t offset, iovec_t const *iov, int iovcnt, fileoff_t readlen
+) {
+    badge_err_t ec0;
+    if (!ec)
+        ec = &ec0;
+    badge_err_set_ok(ec);
+
+    if (iovcnt > 1 && readlen <= VFS_IOV_BOUNCE) {
+        // Small reads are done in one go and scattered afterwards.
+        uint8_t   bounce[VFS_IOV_BOUNCE];
+        fileoff_t pos = 0;
+        vfs_file_read(ec, file, offset, bounce, readlen);
+        for (int i = 0; i < iovcnt && pos < readlen && badge_err_is_ok(ec); i++) {
+            fileoff_t len = (fileoff_t)iov[i].len < readlen - pos ? (fileoff_t)iov[i].len : readlen - pos;
+            mem_copy(iov[i].base, bounce + pos, len);
+            pos += len;
+        }
+        return;
+    }
+
+    for (int i = 0; i < iovcnt && readlen > 0 && badge_err_is_ok(ec); i++) {
+        fileoff_t len = (fileoff_t)iov[i].len < readlen ? (fileoff_t)iov[i].len : readlen;
+        vfs_file_read(ec, file, offset, iov[i].base, len);
+        offset  += len;
+        readlen -= len;
+    }
+}
+
+// Write bytes to a file from several buffers, written in order.
+void vfs_file_writev(badge_err_t *ec, vfs_file_shared_t *file, fileoff_t offset, iovec_t const *iov, int iovcnt) {
+    badge_err_t ec0;
+    if (!ec)
+        ec = &ec0;
+    badge_err_set_ok(ec);
+
+    fileoff_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        total += (fileoff_t)iov[i].len;
+    }
+    if (iovcnt > 1 && total <= VFS_IOV_BOUNCE) {
+        // Small writes, like a header and a short payload, are gathered and done in one go.
+        uint8_t   bounce[VFS_IOV_BOUNCE];
+        fileoff_t pos = 0;
+        for (int i = 0; i < iovcnt; i++) {
+            mem_copy(bounce + pos, iov[i].base, iov[i].len);
+            pos += (fileoff_t)iov[i].len;
+        }
+        vfs_file_write(ec, file, offset, bounce, total);
+        return;
+    }
+
+    for (int i = 0; i < iovcnt && badge_err_is_ok(ec); i++) {
+        vfs_file_write(ec, file, offset, iov[i].base, (fileoff_t)iov[i].len);
+        offset += (fileoff_t)iov[i].len;
+    }
+}
+
+// Copy bytes from one file to another without going through a caller's buffer.
+void vfs_file_copy(
+    badge_err_t       *ec,
+    vfs_file_shared_t *src,
+    fileoff_t          src_offset,
+    vfs_file_shared_t *dst,
+    fileoff_t          dst_offset,
+    fileoff_t          len
+) {
+    badge_err_t ec0;
+    if (!ec)
+        ec = &ec0;
+    badge_err_set_ok(ec);
+    if (src->vfs == dst->vfs && !src->vfs->media) {
+        // In-memory filesystems copy between the files directly.
+        vfs_impl_call_void(src->vfs->type, file_copy, ec, src->vfs, src, src_offset, dst, dst_offset, len);
+        return;
+    }
+
+    // Otherwise, copy a page at a time; on block-backed filesystems both sides are served by the page cache.
+    uint8_t *buf = malloc(VFS_PCACHE_PAGE_SIZE);
+    if (!buf) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_NOMEM);
+        return;
+    }
+    while (len > 0 && badge_err_is_ok(ec)) {
+        // Chunks are aligned to destination pages so they overwrite whole pages without reading them first.
+        fileoff_t chunk = VFS_PCACHE_PAGE_SIZE - dst_offset % VFS_PCACHE_PAGE_SIZE;
+        if (chunk > len) {
+            chunk = len;
+        }
+        vfs_file_read(ec, src, src_offset, buf, chunk);
+        if (badge_err_is_ok(ec)) {
+            vfs_file_write(ec, dst, dst_offset, buf, chunk);
+        }
+        src_offset += chunk;
+        dst_offset += chunk;
+        len        -= chunk;
+    }
+    free(buf);
+}
+
+// Get the physical page of file data at a page-aligned offset to map into a process, taking a reference to it.
+// The caller drops the reference with `phys_page_unref` when it unmaps the page.
+size_t vfs_file_map_page(badge_err_t *ec, vfs_file_shared_t *file, fileoff_t offset) {
+#if MEMMAP_VMEM
+    if (file->vfs->media) {
+        return vfs_pcache_map_page(ec, file, offset);
+    }
+    return vfs_impl_call(file->vfs->type, size_t, file_map_page, ec, file->vfs, file, offset);
+#else
+    (void)file;
+    (void)offset;
+    badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_UNSUPPORTED);
+    return 0;
+#endif
+}
+
 // Change the length of a file opened by `vfs_file_open`.
 void vfs_file_resize(badge_err_t *ec, vfs_file_shared_t *file, fileoff_t new_size) {
+    fileoff_t old_size = file->size;
     vfs_impl_call_void(file->vfs->type, file_resize, ec, file->vfs, file, new_size);
+    if (file->vfs->media) {
+        vfs_pcache_resize(file, old_size, new_size);
+    }
 }
 
 
@@ -0,0 +1,199 @@
+
+// SPDX-License-Identifier: MIT
+
+#include "filesystem/vfs_lcache.h"
+
+#include "assertions.h"
+#include "filesystem/vfs_internal.h"
+#include "malloc.h"
+#include "meta.h"
+#include "port/hardware_allocation.h"
+#include "shrinker.h"
+
+#include <stddef.h>
+
+// Cached directory listing.
+typedef struct vfs_lentry {
+    // Node in the LRU list; least recently used first.
+    dlist_node_t       node;
+    // Next entry in the same hash bucket.
+    struct vfs_lentry *next;
+    // Filesystem the directory is on.
+    vfs_t             *vfs;
+    // Inode of the directory.
+    inode_t            dir;
+    // Listing of the directory; the cache holds a reference to it.
+    vfs_dir_listing_t *listing;
+} vfs_lentry_t;
+
+// Guards the listing cache.
+static mutex_t       lcache_mtx = MUTEX_T_INIT;
+// Hash buckets of cached listings.
+static vfs_lentry_t *lcache_buckets[VFS_LCACHE_BUCKETS];
+// Cached listings ordered from least to most recently used.
+static dlist_t       lcache_lru = DLIST_EMPTY;
+// Total size of the cached listings in bytes.
+static size_t        lcache_bytes;
+// Incremented on every invalidation so listings read while racing with a change aren't inserted stale.
+static uint32_t      lcache_gen;
+
+
+
+// Find the link in its hash bucket that points to the entry of a directory.
+static vfs_lentry_t **lcache_link(vfs_t *vfs, inode_t dir) {
+    size_t hash  = (size_t)dir * 0x9e3779b9u ^ (size_t)vfs >> 4;
+    hash        ^= hash >> 16;
+
+    vfs_lentry_t **link = &lcache_buckets[hash & (VFS_LCACHE_BUCKETS - 1)];
+    while (*link && ((*link)->vfs != vfs || (*link)->dir != dir)) {
+        link = &(*link)->next;
+    }
+    return link;
+}
+
+// Remove an entry from the cache and drop its listing.
+// Returns the number of bytes the cache no longer uses.
+static size_t lcache_remove(vfs_lentry_t **link) {
+    vfs_lentry_t *entry = *link;
+    size_t        size  = entry->listing->size;
+    *link               = entry->next;
+    dlist_remove(&lcache_lru, &entry->node);
+    lcache_bytes -= size;
+    vfs_listing_unref(entry->listing);
+    free(entry);
+    return size;
+}
+
+// Remove the least recently used entry from the cache.
+// Returns the number of bytes the cache no longer uses.
+static size_t lcache_evict() {
+    vfs_lentry_t *lru = field_parent_ptr(vfs_lentry_t, node, lcache_lru.head);
+    return lcache_remove(lcache_link(lru->vfs, lru->dir));
+}
+
+// Drop least recently used listings when memory runs low.
+// Never waits for the lock, because the allocation that ran out of memory may be holding it.
+static size_t lcache_shrinker(size_t target_pages, void *cookie) {
+    (void)cookie;
+    if (!mutex_acquire(NULL, &lcache_mtx, 0)) {
+        return 0;
+    }
+    size_t freed = 0;
+    while (freed < target_pages * MEMMAP_PAGE_SIZE && lcache_lru.len) {
+        freed += lcache_evict();
+    }
+    mutex_release(NULL, &lcache_mtx);
+    return freed / MEMMAP_PAGE_SIZE;
+}
+
+
+
+// Register the listing cache with memory reclaim.
+void vfs_lcache_init() {
+    shrinker_register("dirlisting", SHRINKER_PRIO_CLEAN, lcache_shrinker, NULL);
+}
+
+// Allocate a listing of `size` bytes for a filesystem to fill in, holding one reference.
+// Returns NULL if out of memory.
+vfs_dir_listing_t *vfs_listing_alloc(size_t size) {
+    vfs_dir_listing_t *listing = malloc(sizeof(vfs_dir_listing_t) + size);
+    if (listing) {
+        atomic_init(&listing->refcount, 1);
+        listing->size = (fileoff_t)size;
+    }
+    return listing;
+}
+
+// Drop a reference to a listing; it is freed when the last reference is gone. Does nothing if `listing` is NULL.
+void vfs_listing_unref(vfs_dir_listing_t *listing) {
+    if (listing && atomic_fetch_sub(&listing->refcount, 1) == 1) {
+        free(listing);
+    }
+}
+
+// Look up the cached listing of a directory and take a reference to it.
+// On a miss, returns NULL and sets `*gen` to the value to pass to `vfs_lcache_insert` after reading the directory.
+vfs_dir_listing_t *vfs_lcache_lookup(vfs_t *vfs, inode_t dir, uint32_t *gen) {
+    assert_always(mutex_acquire(NULL, &lcache_mtx, VFS_MUTEX_TIMEOUT));
+    vfs_lentry_t *entry = *lcache_link(vfs, dir);
+    if (!entry) {
+        *gen = lcache_gen;
+        mutex_release(NULL, &lcache_mtx);
+        return NULL;
+    }
+
+    // Mark as most recently used.
+    dlist_remove(&lcache_lru, &entry->node);
+    dlist_append(&lcache_lru, &entry->node);
+    vfs_dir_listing_t *listing = entry->listing;
+    atomic_fetch_add(&listing->refcount, 1);
+
+    mutex_release(NULL, &lcache_mtx);
+    return listing;
+}
+
+// Add a listing read from the filesystem to the cache, which takes a reference of its own.
+// Dropped if anything was invalidated since the `vfs_lcache_lookup` that returned `gen`, since it may be stale.
+void vfs_lcache_insert(vfs_t *vfs, inode_t dir, vfs_dir_listing_t *listing, uint32_t gen) {
+    if ((size_t)listing->size > VFS_LCACHE_MAX_BYTES) {
+        return;
+    }
+    vfs_lentry_t *entry = malloc(sizeof(vfs_lentry_t));
+    if (!entry) {
+        return;
+    }
+    *entry = (vfs_lentry_t){
+        .node    = DLIST_NODE_EMPTY,
+        .vfs     = vfs,
+        .dir     = dir,
+        .listing = listing,
+    };
+
+    assert_always(mutex_acquire(NULL, &lcache_mtx, VFS_MUTEX_TIMEOUT));
+    if (gen != lcache_gen || *lcache_link(vfs, dir)) {
+        // Possibly stale, or another thread cached it first.
+        mutex_release(NULL, &lcache_mtx);
+        free(entry);
+        return;
+    }
+
+    // Make room by evicting the least recently used listings.
+    while (lcache_lru.len >= VFS_LCACHE_MAX ||
+           (lcache_lru.len && lcache_bytes + (size_t)listing->size > VFS_LCACHE_MAX_BYTES)) {
+        lcache_evict();
+    }
+
+    atomic_fetch_add(&listing->refcount, 1);
+    lcache_bytes           += listing->size;
+    *lcache_link(vfs, dir)  = entry;
+    dlist_append(&lcache_lru, &entry->node);
+    mutex_release(NULL, &lcache_mtx);
+}
+
+// Forget the listing of a directory; must be called after an entry in it is created or removed.
+void vfs_lcache_invalidate(vfs_t *vfs, inode_t dir) {
+    assert_always(mutex_acquire(NULL, &lcache_mtx, VFS_MUTEX_TIMEOUT));
+    lcache_gen++;
+    vfs_lentry_t **link = lcache_link(vfs, dir);
+    if (*link) {
+        lcache_remove(link);
+    }
+    mutex_release(NULL, &lcache_mtx);
+}
+
+// Forget all listings of a filesystem.
+void vfs_lcache_invalidate_vfs(vfs_t *vfs) {
+    assert_always(mutex_acquire(NULL, &lcache_mtx, VFS_MUTEX_TIMEOUT));
+    lcache_gen++;
+    for (size_t i = 0; i < VFS_LCACHE_BUCKETS; i++) {
+        vfs_lentry_t **link = &lcache_buckets[i];
+        while (*link) {
+            if ((*link)->vfs == vfs) {
+                lcache_remove(link);
+            } else {
+                link = &(*link)->next;
+            }
+        }
+    }
+    mutex_release(NULL, &lcache_mtx);
+}
@@ -0,0 +1,538 @@
+
+// SPDX-License-Identifier: MIT
+
+#include "filesystem/vfs_pcache.h"
+
+#include "assertions.h"
+#include "badge_strings.h"
+#include "filesystem/vfs_internal.h"
+#include "log.h"
+#include "malloc.h"
+#include "meta.h"
+#include "page_alloc.h"
+#include "shrinker.h"
+#include "time.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if MEMMAP_VMEM
+#include "cpu/mmu.h"
+#endif
+
+// Cached page of file data.
+typedef struct vfs_cpage {
+    // Node in the LRU list if the page is clean, in the dirty list otherwise.
+    dlist_node_t      node;
+    // Next page in the same hash bucket.
+    struct vfs_cpage *next;
+    // Filesystem the file is on.
+    vfs_t            *vfs;
+    // Inode of the file.
+    inode_t           inode;
+    // Offset in the file divided by `VFS_PCACHE_PAGE_SIZE`.
+    fileoff_t         index;
+    // Physical page holding the data; bytes past the end of the file are zero.
+    size_t            ppn;
+    // Page differs from what is stored in the filesystem.
+    bool              dirty;
+    // Time the page became dirty.
+    timestamp_us_t    dirtied;
+} vfs_cpage_t;
+
+// Guards the page cache.
+static mutex_t      pcache_mtx = MUTEX_T_INIT;
+// Hash buckets of cached pages.
+static vfs_cpage_t *pcache_buckets[VFS_PCACHE_BUCKETS];
+// Clean cached pages ordered from least to most recently used.
+static dlist_t      pcache_lru   = DLIST_EMPTY;
+// Dirty cached pages ordered from least to most recently dirtied.
+static dlist_t      pcache_dirty = DLIST_EMPTY;
+// Incremented whenever file data changes on the filesystem so pages filled while racing with it aren't inserted stale.
+static uint32_t     pcache_gen;
+
+
+
+// Get a kernel pointer to the data of a cached page.
+static inline uint8_t *cpage_data(vfs_cpage_t const *page) {
+#if MEMMAP_VMEM
+    return (uint8_t *)(mmu_hhdm_vaddr + page->ppn * MEMMAP_PAGE_SIZE);
+#else
+    return (uint8_t *)(page->ppn * MEMMAP_PAGE_SIZE);
+#endif
+}
+
+// Find the link in its hash bucket that points to a page.
+static vfs_cpage_t **pcache_link(vfs_t *vfs, inode_t inode, fileoff_t index) {
+    size_t hash = (size_t)inode * 0x9e3779b9u ^ (size_t)index * 0x85ebca6bu ^ (size_t)vfs >> 4;
+    hash       ^= hash >> 16;
+
+    vfs_cpage_t **link = &pcache_buckets[hash & (VFS_PCACHE_BUCKETS - 1)];
+    while (*link && ((*link)->vfs != vfs || (*link)->inode != inode || (*link)->index != index)) {
+        link = &(*link)->next;
+    }
+    return link;
+}
+
+// Free a page that is not in the cache.
+// Pages that are mapped into processes stay allocated until they are unmapped.
+static void cpage_free(vfs_cpage_t *page) {
+#if MEMMAP_VMEM
+    phys_page_unref(page->ppn);
+#else
+    phys_page_free(page->ppn);
+#endif
+    free(page);
+}
+
+// Remove a page from the cache and free it.
+static void pcache_remove(vfs_cpage_t **link) {
+    vfs_cpage_t *page = *link;
+    *link             = page->next;
+    dlist_remove(page->dirty ? &pcache_dirty : &pcache_lru, &page->node);
+    cpage_free(page);
+}
+
+// Remove the least recently used clean page from the cache.
+static void pcache_evict() {
+    vfs_cpage_t *lru = field_parent_ptr(vfs_cpage_t, node, pcache_lru.head);
+    pcache_remove(pcache_link(lru->vfs, lru->inode, lru->index));
+}
+
+// Remove all pages of a filesystem, or of one inode from `min_index` onwards.
+static void pcache_remove_if(vfs_t *vfs, bool match_inode, inode_t inode, fileoff_t min_index) {
+    for (size_t i = 0; i < VFS_PCACHE_BUCKETS; i++) {
+        vfs_cpage_t **link = &pcache_buckets[i];
+        while (*link) {
+            vfs_cpage_t *page = *link;
+            if (page->vfs == vfs && (!match_inode || (page->inode == inode && page->index >= min_index))) {
+                pcache_remove(link);
+            } else {
+                link = &page->next;
+            }
+        }
+    }
+}
+
+// Drop least recently used clean pages when memory runs low.
+// Never waits for the lock, because the allocation that ran out of memory may be holding it.
+static size_t pcache_shrinker(size_t target_pages, void *cookie) {
+    (void)cookie;
+    if (!mutex_acquire(NULL, &pcache_mtx, 0)) {
+        return 0;
+    }
+    size_t freed = 0;
+    while (freed < target_pages && pcache_lru.len) {
+        pcache_evict();
+        freed++;
+    }
+    mutex_release(NULL, &pcache_mtx);
+    return freed;
+}
+
+// Mark a cached page as dirty, moving it from the LRU list to the dirty list.
+// Must be called with `pcache_mtx` held.
+static void pcache_mark_dirty(vfs_cpage_t *page) {
+    if (!page->dirty) {
+        dlist_remove(&pcache_lru, &page->node);
+        page->dirty   = true;
+        page->dirtied = time_us();
+        dlist_append(&pcache_dirty, &page->node);
+    }
+}
+
+// Write a dirty page back to the filesystem and move it to the LRU list.
+// If `file` is NULL, it is looked up by inode; pages of files that are no longer open are dropped.
+// Must be called with `pcache_mtx` and `vfs_handle_mtx` held.
+static void pcache_clean(badge_err_t *ec, vfs_cpage_t *page, vfs_file_shared_t *file) {
+    if (!file) {
+        file = vfs_shared_by_inode(page->vfs, page->inode);
+    }
+    if (file) {
+        fileoff_t valid = file->size - page->index * VFS_PCACHE_PAGE_SIZE;
+        if (valid > VFS_PCACHE_PAGE_SIZE) {
+            valid = VFS_PCACHE_PAGE_SIZE;
+        }
+        if (valid > 0) {
+            vfs_file_write_uncached(ec, file, page->index * VFS_PCACHE_PAGE_SIZE, cpage_data(page), valid);
+        }
+    }
+    // A page that failed to write is not retried, so a bad block can't keep writers throttled forever.
+    if (!badge_err_is_ok(ec)) {
+        logkf(LOG_ERROR, "Failed to write back page %{d} of inode %{d}", (int)page->index, (int)page->inode);
+    }
+    // Fills that read the filesystem before this write would be stale.
+    pcache_gen++;
+    dlist_remove(&pcache_dirty, &page->node);
+    page->dirty = false;
+    dlist_append(&pcache_lru, &page->node);
+}
+
+// Allocate a page and read its data from the filesystem if `read` is true, or zero it otherwise.
+// Returns NULL without setting an error if out of memory.
+static vfs_cpage_t *cpage_load(badge_err_t *ec, vfs_file_shared_t *file, fileoff_t index, bool read) {
+    badge_err_set_ok(ec);
+    vfs_cpage_t *page = malloc(sizeof(vfs_cpage_t));
+    size_t       ppn  = page ? phys_page_alloc(1, false) : 0;
+    if (!ppn) {
+        free(page);
+        return NULL;
+    }
+    *page = (vfs_cpage_t){
+        .node  = DLIST_NODE_EMPTY,
+        .vfs   = file->vfs,
+        .inode = file->inode,
+        .index = index,
+        .ppn   = ppn,
+    };
+
+    // Read the part of the page that is within the file.
+    uint8_t  *data  = cpage_data(page);
+    fileoff_t valid = file->size - index * VFS_PCACHE_PAGE_SIZE;
+    if (!read || valid < 0) {
+        // Truncated by another handle in the meantime.
+        valid = 0;
+    } else if (valid > VFS_PCACHE_PAGE_SIZE) {
+        valid = VFS_PCACHE_PAGE_SIZE;
+    }
+    vfs_file_read_uncached(ec, file, index * VFS_PCACHE_PAGE_SIZE, data, valid);
+    if (!badge_err_is_ok(ec)) {
+        cpage_free(page);
+        return NULL;
+    }
+    mem_set(data + valid, 0, VFS_PCACHE_PAGE_SIZE - valid);
+    return page;
+}
+
+// Add a clean page to the cache, unless the filesystem changed since `gen` or another thread cached it first.
+// Must be called with `pcache_mtx` held.
+// Returns false if the page was not added.
+static bool pcache_insert(vfs_cpage_t *page, uint32_t gen) {
+    vfs_cpage_t **link = pcache_link(page->vfs, page->inode, page->index);
+    if (gen != pcache_gen || *link) {
+        return false;
+    }
+    if (pcache_lru.len + pcache_dirty.len >= VFS_PCACHE_MAX && pcache_lru.len) {
+        pcache_evict();
+        // The new page may have been in the same bucket right after the victim.
+        link = pcache_link(page->vfs, page->inode, page->index);
+    }
+    *link = page;
+    dlist_append(&pcache_lru, &page->node);
+    return true;
+}
+
+// Read one page from the filesystem and add it to the cache.
+// Copies `len` bytes at `in_page` within the page to `readbuf`, if not NULL, even if the page could not be cached.
+static void pcache_fill(
+    badge_err_t       *ec,
+    vfs_file_shared_t *file,
+    fileoff_t          index,
+    fileoff_t          in_page,
+    uint8_t           *readbuf,
+    fileoff_t          len,
+    uint32_t           gen
+) {
+    vfs_cpage_t *page = cpage_load(ec, file, index, true);
+    if (!page && badge_err_is_ok(ec)) {
+        // Out of memory; read only what was asked for.
+        if (readbuf) {
+            vfs_file_read_uncached(ec, file, index * VFS_PCACHE_PAGE_SIZE + in_page, readbuf, len);
+        } else {
+            badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_NOMEM);
+        }
+        return;
+    } else if (!page) {
+        return;
+    }
+    if (readbuf) {
+        mem_copy(readbuf, cpage_data(page) + in_page, len);
+    }
+
+    assert_always(mutex_acquire(NULL, &pcache_mtx, VFS_MUTEX_TIMEOUT));
+    bool inserted = pcache_insert(page, gen);
+    mutex_release(NULL, &pcache_mtx);
+    if (!inserted) {
+        // Possibly stale, or another thread cached it first.
+        cpage_free(page);
+    }
+}
+
+
+
+// Register the page cache with memory reclaim.
+void vfs_pcache_init() {
+    shrinker_register("pagecache", SHRINKER_PRIO_CLEAN, pcache_shrinker, NULL);
+}
+
+// Read bytes from a file through the page cache, filling missing pages from the filesystem.
+// The range must be within the file.
+void vfs_pcache_read(badge_err_t *ec, vfs_file_shared_t *file, fileoff_t offset, uint8_t *readbuf, fileoff_t readlen) {
+    badge_err_t ec0;
+    if (!ec)
+        ec = &ec0;
+    badge_err_set_ok(ec);
+
+    while (readlen > 0) {
+        fileoff_t index   = offset / VFS_PCACHE_PAGE_SIZE;
+        fileoff_t in_page = offset % VFS_PCACHE_PAGE_SIZE;
+        fileoff_t len     = VFS_PCACHE_PAGE_SIZE - in_page;
+        if (len > readlen) {
+            len = readlen;
+        }
+
+        assert_always(mutex_acquire(NULL, &pcache_mtx, VFS_MUTEX_TIMEOUT));
+        vfs_cpage_t *page = *pcache_link(file->vfs, file->inode, index);
+        if (page) {
+            if (!page->dirty) {
+                // Mark as most recently used.
+                dlist_remove(&pcache_lru, &page->node);
+                dlist_append(&pcache_lru, &page->node);
+            }
+            mem_copy(readbuf, cpage_data(page) + in_page, len);
+            mutex_release(NULL, &pcache_mtx);
+        } else {
+            uint32_t gen = pcache_gen;
+            mutex_release(NULL, &pcache_mtx);
+            pcache_fill(ec, file, index, in_page, readbuf, len, gen);
+            if (!badge_err_is_ok(ec)) {
+                return;
+            }
+        }
+
+        offset  += len;
+        readbuf += len;
+        readlen -= len;
+    }
+}
+
+// Read pages into the cache ahead of use; pages that are already cached are skipped.
+void vfs_pcache_prefetch(vfs_file_shared_t *file, fileoff_t offset, fileoff_t len) {
+    badge_err_t ec  = {0};
+    fileoff_t   end = offset + len < file->size ? offset + len : file->size;
+    for (fileoff_t index = offset / VFS_PCACHE_PAGE_SIZE; index * VFS_PCACHE_PAGE_SIZE < end; index++) {
+        assert_always(mutex_acquire(NULL, &pcache_mtx, VFS_MUTEX_TIMEOUT));
+        bool     cached = *pcache_link(file->vfs, file->inode, index);
+        uint32_t gen    = pcache_gen;
+        mutex_release(NULL, &pcache_mtx);
+        if (!cached) {
+            pcache_fill(&ec, file, index, 0, NULL, 0, gen);
+            if (!badge_err_is_ok(&ec)) {
+                return;
+            }
+        }
+    }
+}
+
+#if MEMMAP_VMEM
+// Get the physical page of file data at an offset to map into a process, taking a reference to it.
+// The page must be within the file; it is read into the cache first if it isn't cached yet.
+size_t vfs_pcache_map_page(badge_err_t *ec, vfs_file_shared_t *file, fileoff_t offset) {
+    badge_err_t ec0;
+    if (!ec)
+        ec = &ec0;
+    fileoff_t index = offset / VFS_PCACHE_PAGE_SIZE;
+
+    while (true) {
+        assert_always(mutex_acquire(NULL, &pcache_mtx, VFS_MUTEX_TIMEOUT));
+        vfs_cpage_t *page = *pcache_link(file->vfs, file->inode, index);
+        if (page) {
+            if (!page->dirty) {
+                // Mark as most recently used.
+                dlist_remove(&pcache_lru, &page->node);
+                dlist_append(&pcache_lru, &page->node);
+            }
+            // The reference keeps the page allocated for the mapping after it is evicted.
+            size_t ppn = page->ppn;
+            bool   ok  = phys_page_ref(ppn);
+            mutex_release(NULL, &pcache_mtx);
+            if (!ok) {
+                badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_NOMEM);
+                return 0;
+            }
+            badge_err_set_ok(ec);
+            return ppn;
+        }
+        uint32_t gen = pcache_gen;
+        mutex_release(NULL, &pcache_mtx);
+
+        page = cpage_load(ec, file, index, true);
+        if (!page) {
+            if (badge_err_is_ok(ec)) {
+                badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_NOMEM);
+            }
+            return 0;
+        }
+        assert_always(mutex_acquire(NULL, &pcache_mtx, VFS_MUTEX_TIMEOUT));
+        bool inserted = pcache_insert(page, gen);
+        mutex_release(NULL, &pcache_mtx);
+        if (!inserted) {
+            // Possibly stale, or another thread cached it first; look it up again.
+            cpage_free(page);
+        }
+    }
+}
+#endif
+
+// Write bytes to a file through the page cache; the filesystem is updated when the pages are written back.
+// The file must already be large enough; writers are throttled while too many pages are dirty.
+// Must be called with `vfs_handle_mtx` held.
+void vfs_pcache_write(
+    badge_err_t *ec, vfs_file_shared_t *file, fileoff_t offset, uint8_t const *writebuf, fileoff_t writelen
+) {
+    badge_err_t ec0;
+    if (!ec)
+        ec = &ec0;
+    badge_err_set_ok(ec);
+
+    while (writelen > 0) {
+        fileoff_t index   = offset / VFS_PCACHE_PAGE_SIZE;
+        fileoff_t in_page = offset % VFS_PCACHE_PAGE_SIZE;
+        fileoff_t len     = VFS_PCACHE_PAGE_SIZE - in_page;
+        if (len > writelen) {
+            len = writelen;
+        }
+
+        assert_always(mutex_acquire(NULL, &pcache_mtx, VFS_MUTEX_TIMEOUT));
+        vfs_cpage_t *page = *pcache_link(file->vfs, file->inode, index);
+        if (!page) {
+            uint32_t gen = pcache_gen;
+            mutex_release(NULL, &pcache_mtx);
+
+            // Pages that are overwritten up to the end of the file need not be read first.
+            bool whole = in_page == 0 && (len == VFS_PCACHE_PAGE_SIZE || offset + len >= file->size);
+            page       = cpage_load(ec, file, index, !whole);
+            if (!page && badge_err_is_ok(ec)) {
+                // Out of memory; write through, updating the page in case a reader cached it meanwhile.
+                vfs_file_write_uncached(ec, file, offset, writebuf, len);
+                assert_always(mutex_acquire(NULL, &pcache_mtx, VFS_MUTEX_TIMEOUT));
+                pcache_gen++;
+                page = *pcache_link(file->vfs, file->inode, index);
+                if (page && badge_err_is_ok(ec)) {
+                    mem_copy(cpage_data(page) + in_page, writebuf, len);
+                }
+                mutex_release(NULL, &pcache_mtx);
+            }
+            if (!badge_err_is_ok(ec)) {
+                return;
+            } else if (!page) {
+                offset   += len;
+                writebuf += len;
+                writelen -= len;
+                continue;
+            }
+
+            assert_always(mutex_acquire(NULL, &pcache_mtx, VFS_MUTEX_TIMEOUT));
+            if (!pcache_insert(page, gen)) {
+                // Raced with another thread; try again.
+                mutex_release(NULL, &pcache_mtx);
+                cpage_free(page);
+                continue;
+            }
+        }
+        mem_copy(cpage_data(page) + in_page, writebuf, len);
+        pcache_mark_dirty(page);
+        mutex_release(NULL, &pcache_mtx);
+
+        offset   += len;
+        writebuf += len;
+        writelen -= len;
+    }
+
+    // Writers that outpace the flusher write back the oldest pages themselves.
+    // Errors are logged but not reported to this writer, whose data is already cached.
+    vfs_pcache_writeback(NULL, 0, VFS_PCACHE_DIRTY_MAX, SIZE_MAX);
+}
+
+// Write back dirty pages that became dirty before `expire`, and the oldest ones while more than `keep` are dirty.
+// Writes back at most `max` pages.
+// Must be called with `vfs_handle_mtx` held.
+// Returns the number of pages written back.
+size_t vfs_pcache_writeback(badge_err_t *ec, timestamp_us_t expire, size_t keep, size_t max) {
+    badge_err_t ec0;
+    if (!ec)
+        ec = &ec0;
+    badge_err_set_ok(ec);
+
+    size_t written = 0;
+    while (written < max) {
+        assert_always(mutex_acquire(NULL, &pcache_mtx, VFS_MUTEX_TIMEOUT));
+        vfs_cpage_t *page = pcache_dirty.head ? field_parent_ptr(vfs_cpage_t, node, pcache_dirty.head) : NULL;
+        if (!page || (page->dirtied >= expire && pcache_dirty.len <= keep)) {
+            mutex_release(NULL, &pcache_mtx);
+            break;
+        }
+        pcache_clean(ec, page, NULL);
+        mutex_release(NULL, &pcache_mtx);
+        written++;
+        if (!badge_err_is_ok(ec)) {
+            break;
+        }
+    }
+    return written;
+}
+
+// Write back all dirty pages of a file.
+// Must be called with `vfs_handle_mtx` held.
+void vfs_pcache_writeback_file(badge_err_t *ec, vfs_file_shared_t *file) {
+    badge_err_t ec0;
+    if (!ec)
+        ec = &ec0;
+    badge_err_set_ok(ec);
+
+    assert_always(mutex_acquire(NULL, &pcache_mtx, VFS_MUTEX_TIMEOUT));
+    dlist_node_t *node = pcache_dirty.head;
+    while (node && badge_err_is_ok(ec)) {
+        vfs_cpage_t *page = field_parent_ptr(vfs_cpage_t, node, node);
+        node              = node->next;
+        if (page->vfs == file->vfs && page->inode == file->inode) {
+            pcache_clean(ec, page, file);
+        }
+    }
+    mutex_release(NULL, &pcache_mtx);
+}
+
+// Forget cached pages past the end of a file after it was resized.
+void vfs_pcache_resize(vfs_file_shared_t *file, fileoff_t old_size, fileoff_t new_size) {
+    // A clean page that held the old end is dropped too, because its tail is no longer past the end.
+    fileoff_t first = (old_size < new_size ? old_size : new_size) / VFS_PCACHE_PAGE_SIZE;
+    fileoff_t end   = (old_size + VFS_PCACHE_PAGE_SIZE - 1) / VFS_PCACHE_PAGE_SIZE;
+
+    assert_always(mutex_acquire(NULL, &pcache_mtx, VFS_MUTEX_TIMEOUT));
+    pcache_gen++;
+    vfs_cpage_t *boundary = *pcache_link(file->vfs, file->inode, first);
+    if (boundary && boundary->dirty) {
+        // Unwritten data before the end must be kept; bytes past the end must read as zero.
+        fileoff_t keep = (old_size < new_size ? old_size : new_size) - first * VFS_PCACHE_PAGE_SIZE;
+        mem_set(cpage_data(boundary) + keep, 0, VFS_PCACHE_PAGE_SIZE - keep);
+        first++;
+    }
+    if (end - first > VFS_PCACHE_MAX) {
+        // Cheaper to go through the entire cache.
+        pcache_remove_if(file->vfs, true, file->inode, first);
+    } else {
+        for (fileoff_t index = first; index < end; index++) {
+            vfs_cpage_t **link = pcache_link(file->vfs, file->inode, index);
+            if (*link) {
+                pcache_remove(link);
+            }
+        }
+    }
+    mutex_release(NULL, &pcache_mtx);
+}
+
+// Forget all cached pages of an inode; used when it is deleted so its inode number can be reused.
+void vfs_pcache_invalidate_inode(vfs_t *vfs, inode_t inode) {
+    assert_always(mutex_acquire(NULL, &pcache_mtx, VFS_MUTEX_TIMEOUT));
+    pcache_gen++;
+    pcache_remove_if(vfs, true, inode, 0);
+    mutex_release(NULL, &pcache_mtx);
+}
+
+// Forget all cached pages of a filesystem.
+void vfs_pcache_invalidate_vfs(vfs_t *vfs) {
+    assert_always(mutex_acquire(NULL, &pcache_mtx, VFS_MUTEX_TIMEOUT));
+    pcache_gen++;
+    pcache_remove_if(vfs, false, 0, 0);
+    mutex_release(NULL, &pcache_mtx);
+}
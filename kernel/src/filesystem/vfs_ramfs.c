@@ -5,9 +5,47 @@
 
 #include "assertions.h"
 #include "badge_strings.h"
+#include "filesystem/vfs_lcache.h"
 #include "malloc.h"
+#include "port/hardware_allocation.h"
+#include "vmalloc.h"
 
+#if MEMMAP_VMEM
+#include "memprotect.h"
+#include "page_alloc.h"
+#endif
 
+// Inode buffers with at least this capacity are allocated with `vmalloc`.
+#define VFS_RAMFS_VMALLOC_MIN 16384
+
+
+
+// Free an inode buffer.
+static void free_buf(void *buf, size_t cap) {
+    if (cap >= VFS_RAMFS_VMALLOC_MIN) {
+        vfree(buf);
+    } else {
+        free(buf);
+    }
+}
+
+// Resize an inode buffer, moving it between `malloc` and `vmalloc` depending on its capacity.
+static void *realloc_buf(void *buf, size_t len, size_t old_cap, size_t new_cap) {
+    bool old_large = old_cap >= VFS_RAMFS_VMALLOC_MIN;
+    bool new_large = new_cap >= VFS_RAMFS_VMALLOC_MIN;
+    if (new_cap == 0) {
+        free_buf(buf, old_cap);
+        return NULL;
+    } else if (old_large == new_large) {
+        return new_large ? vrealloc(buf, new_cap) : realloc(buf, new_cap);
+    }
+    void *mem = new_large ? vmalloc(new_cap) : malloc(new_cap);
+    if (mem) {
+        mem_copy(mem, buf, len < new_cap ? len : new_cap);
+        free_buf(buf, old_cap);
+    }
+    return mem;
+}
 
 // Try to resize an inode.
 static bool resize_inode(badge_err_t *ec, vfs_t *vfs, vfs_ramfs_inode_t *inode, size_t size) {
@@ -16,10 +54,14 @@ static bool resize_inode(badge_err_t *ec, vfs_t *vfs, vfs_ramfs_inode_t *inode,
     if (inode->cap >= 2 * size) {
         // If capacity is too large, try to save some memory.
         size_t cap = inode->cap / 2;
-        void  *mem = realloc(inode->buf, inode->cap / 2);
+        if (inode->mapped && cap < VFS_RAMFS_VMALLOC_MIN) {
+            // Moving to `malloc` memory would leave existing mappings with stale copies of the data.
+            cap = VFS_RAMFS_VMALLOC_MIN;
+        }
+        void *mem = cap < inode->cap ? realloc_buf(inode->buf, inode->len, inode->cap, cap) : inode->buf;
         if (mem || cap == 0) {
-            inode->cap /= 2;
-            inode->buf  = mem;
+            inode->cap = cap;
+            inode->buf = mem;
         }
         inode->len = size;
         return true;
@@ -36,7 +78,12 @@ static bool resize_inode(badge_err_t *ec, vfs_t *vfs, vfs_ramfs_inode_t *inode,
         while (cap < size) {
             cap *= 2;
         }
-        void *mem = realloc(inode->buf, cap);
+        if (cap >= VFS_RAMFS_VMALLOC_MIN) {
+            // Large buffers are page-granular, so grow them by a quarter instead of doubling.
+            cap = size + size / 4;
+            cap = (cap + MEMMAP_PAGE_SIZE - 1) / MEMMAP_PAGE_SIZE * MEMMAP_PAGE_SIZE;
+        }
+        void *mem = realloc_buf(inode->buf, inode->len, inode->cap, cap);
         if (mem) {
             inode->cap = cap;
             inode->buf = mem;
@@ -48,13 +95,56 @@ static bool resize_inode(badge_err_t *ec, vfs_t *vfs, vfs_ramfs_inode_t *inode,
     }
 }
 
-// Find an empty inode.
+// Get the inode with a given number.
+static inline vfs_ramfs_inode_t *get_inode(vfs_t *vfs, inode_t inum) {
+    return &vfs->ramfs.inode_list[inum / VFS_RAMFS_INODE_CHUNK][inum % VFS_RAMFS_INODE_CHUNK];
+}
+
+// Add a chunk of unused inodes to the inode table.
+static bool grow_inodes(vfs_t *vfs) {
+    size_t            chunks = vfs->ramfs.inode_list_len / VFS_RAMFS_INODE_CHUNK;
+    size_t            len    = vfs->ramfs.inode_list_len + VFS_RAMFS_INODE_CHUNK;
+    vfs_ramfs_inode_t *chunk = malloc(sizeof(vfs_ramfs_inode_t) * VFS_RAMFS_INODE_CHUNK);
+    if (!chunk) {
+        return false;
+    }
+    void *list = realloc(vfs->ramfs.inode_list, sizeof(*vfs->ramfs.inode_list) * (chunks + 1));
+    if (!list) {
+        free(chunk);
+        return false;
+    }
+    vfs->ramfs.inode_list = list;
+    void *usage           = realloc(vfs->ramfs.inode_usage, sizeof(*vfs->ramfs.inode_usage) * len);
+    if (!usage) {
+        free(chunk);
+        return false;
+    }
+    vfs->ramfs.inode_usage = usage;
+
+    mem_set(chunk, 0, sizeof(vfs_ramfs_inode_t) * VFS_RAMFS_INODE_CHUNK);
+    mem_set(vfs->ramfs.inode_usage + vfs->ramfs.inode_list_len, false, VFS_RAMFS_INODE_CHUNK);
+    vfs->ramfs.inode_list[chunks] = chunk;
+    vfs->ramfs.inode_list_len     = len;
+    return true;
+}
+
+// Find an empty inode, growing the inode table if there is none.
 static ptrdiff_t find_inode(vfs_t *vfs) {
     for (size_t i = VFS_RAMFS_INODE_FIRST; i < vfs->ramfs.inode_list_len; i++) {
         if (!vfs->ramfs.inode_usage[i])
             return (ptrdiff_t)i;
     }
-    return -1;
+    size_t first = vfs->ramfs.inode_list_len;
+    return grow_inodes(vfs) ? (ptrdiff_t)first : -1;
+}
+
+// Free the inode table.
+static void free_inodes(vfs_t *vfs) {
+    for (size_t i = 0; i < vfs->ramfs.inode_list_len / VFS_RAMFS_INODE_CHUNK; i++) {
+        free(vfs->ramfs.inode_list[i]);
+    }
+    free(vfs->ramfs.inode_list);
+    free(vfs->ramfs.inode_usage);
 }
 
 // Decrease the refcount of an inode and delete it if it reaches 0.
@@ -62,7 +152,7 @@ static void pop_inode_refcount(vfs_t *vfs, vfs_ramfs_inode_t *inode) {
     inode->links--;
     if (inode->links == 0) {
         // Free inode.
-        free(inode->buf);
+        free_buf(inode->buf, inode->cap);
         vfs->ramfs.inode_usage[inode->inode] = false;
     }
 }
@@ -146,16 +236,17 @@ static vfs_ramfs_inode_t *
     mem_copy(ent.name, name, name_len + 1);
 
     // Set up inode.
-    vfs_ramfs_inode_t *iptr = &vfs->ramfs.inode_list[inum];
-
-    iptr->buf   = NULL;
-    iptr->len   = 0;
-    iptr->cap   = 0;
-    iptr->inode = inum;
-    iptr->mode  = (type << VFS_RAMFS_MODE_BIT) | 0777; /* TODO. */
-    iptr->links = 1;
-    iptr->uid   = 0; /* TODO. */
-    iptr->gid   = 0; /* TODO. */
+    vfs_ramfs_inode_t *iptr = get_inode(vfs, inum);
+
+    iptr->buf    = NULL;
+    iptr->len    = 0;
+    iptr->cap    = 0;
+    iptr->mapped = false;
+    iptr->inode  = inum;
+    iptr->mode   = (type << VFS_RAMFS_MODE_BIT) | 0777; /* TODO. */
+    iptr->links  = 1;
+    iptr->uid    = 0; /* TODO. */
+    iptr->gid    = 0; /* TODO. */
 
     // Copy into the end of the directory.
     if (insert_dirent(ec, vfs, dirptr, &ent)) {
@@ -194,34 +285,30 @@ void vfs_ramfs_mount(badge_err_t *ec, vfs_t *vfs) {
     atomic_store_explicit(&vfs->ramfs.ram_usage, 0, memory_order_relaxed);
     vfs->type                 = FS_TYPE_RAMFS;
     vfs->ramfs.ram_limit      = 65536;
-    vfs->ramfs.inode_list_len = 32;
-    vfs->ramfs.inode_list     = malloc(sizeof(*vfs->ramfs.inode_list) * vfs->ramfs.inode_list_len);
-    if (!badge_err_is_ok(ec))
-        return;
-    vfs->ramfs.inode_usage = malloc(sizeof(*vfs->ramfs.inode_usage) * vfs->ramfs.inode_list_len);
-    if (!badge_err_is_ok(ec)) {
-        free(vfs->ramfs.inode_list);
+    vfs->ramfs.inode_list_len = 0;
+    vfs->ramfs.inode_list     = NULL;
+    vfs->ramfs.inode_usage    = NULL;
+    if (!grow_inodes(vfs)) {
+        free_inodes(vfs);
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_NOMEM);
         return;
     }
     vfs->inode_root = VFS_RAMFS_INODE_ROOT;
     mutex_init(ec, &vfs->ramfs.mtx, true, false);
 
-    // Clear inode usage.
-    mem_set(vfs->ramfs.inode_list, 0, sizeof(*vfs->ramfs.inode_list) * vfs->ramfs.inode_list_len);
-    mem_set(vfs->ramfs.inode_usage, false, vfs->ramfs.inode_list_len - 2);
-
     // Create root directory.
     vfs->ramfs.inode_usage[VFS_RAMFS_INODE_ROOT] = true;
-    vfs_ramfs_inode_t *iptr                      = &vfs->ramfs.inode_list[VFS_RAMFS_INODE_ROOT];
-
-    iptr->buf   = NULL;
-    iptr->len   = 0;
-    iptr->cap   = 0;
-    iptr->inode = VFS_RAMFS_INODE_ROOT;
-    iptr->mode  = (FILETYPE_DIR << VFS_RAMFS_MODE_BIT) | 0777; /* TODO. */
-    iptr->links = 1;
-    iptr->uid   = 0; /* TODO. */
-    iptr->gid   = 0; /* TODO. */
+    vfs_ramfs_inode_t *iptr                      = get_inode(vfs, VFS_RAMFS_INODE_ROOT);
+
+    iptr->buf    = NULL;
+    iptr->len    = 0;
+    iptr->cap    = 0;
+    iptr->mapped = false;
+    iptr->inode  = VFS_RAMFS_INODE_ROOT;
+    iptr->mode   = (FILETYPE_DIR << VFS_RAMFS_MODE_BIT) | 0777; /* TODO. */
+    iptr->links  = 1;
+    iptr->uid    = 0; /* TODO. */
+    iptr->gid    = 0; /* TODO. */
 
     vfs_ramfs_dirent_t ent = {
         .size     = sizeof(ent) - VFS_RAMFS_NAME_MAX - 1 + sizeof(size_t),
@@ -231,9 +318,8 @@ void vfs_ramfs_mount(badge_err_t *ec, vfs_t *vfs) {
     };
     insert_dirent(ec, vfs, iptr, &ent);
     if (!badge_err_is_ok(ec)) {
-        free(iptr->buf);
-        free(vfs->ramfs.inode_list);
-        free(vfs->ramfs.inode_usage);
+        free_buf(iptr->buf, iptr->cap);
+        free_inodes(vfs);
         mutex_destroy(NULL, &vfs->ramfs.mtx);
     }
 
@@ -242,9 +328,8 @@ void vfs_ramfs_mount(badge_err_t *ec, vfs_t *vfs) {
     ent.name[2]  = 0;
     insert_dirent(ec, vfs, iptr, &ent);
     if (!badge_err_is_ok(ec)) {
-        free(iptr->buf);
-        free(vfs->ramfs.inode_list);
-        free(vfs->ramfs.inode_usage);
+        free_buf(iptr->buf, iptr->cap);
+        free_inodes(vfs);
         mutex_destroy(NULL, &vfs->ramfs.mtx);
     }
 }
@@ -252,8 +337,7 @@ void vfs_ramfs_mount(badge_err_t *ec, vfs_t *vfs) {
 // Unmount a ramfs filesystem.
 void vfs_ramfs_umount(vfs_t *vfs) {
     mutex_destroy(NULL, &vfs->ramfs.mtx);
-    free(vfs->ramfs.inode_list);
-    free(vfs->ramfs.inode_usage);
+    free_inodes(vfs);
 }
 
 
@@ -333,7 +417,7 @@ void vfs_ramfs_unlink(badge_err_t *ec, vfs_t *vfs, vfs_file_shared_t *dir, char
 
 
     // If it is also a directory, assert that it is empty.
-    vfs_ramfs_inode_t *iptr = &vfs->ramfs.inode_list[ent->inode];
+    vfs_ramfs_inode_t *iptr = get_inode(vfs, ent->inode);
     if ((iptr->mode & VFS_RAMFS_MODE_MASK) == FILETYPE_DIR << VFS_RAMFS_MODE_BIT) {
         // Directories that are not empty cannot be removed.
         if (!is_dir_empty(iptr)) {
@@ -380,7 +464,7 @@ static inline size_t measure_dirent(vfs_ramfs_dirent_t *ent) {
 // Convert a RAMFS dirent to a BadgerOS dirent.
 // Returns the record length for a matching `dirent_t`.
 static inline size_t convert_dirent(vfs_t *vfs, dirent_t *out, vfs_ramfs_dirent_t *in) {
-    vfs_ramfs_inode_t *iptr = &vfs->ramfs.inode_list[in->inode];
+    vfs_ramfs_inode_t *iptr = get_inode(vfs, in->inode);
 
     out->record_len  = offsetof(dirent_t, name) + in->name_len + 1;
     out->record_len += (fileoff_t)((size_t)(~out->record_len + 1) % sizeof(size_t));
@@ -393,12 +477,12 @@ static inline size_t convert_dirent(vfs_t *vfs, dirent_t *out, vfs_ramfs_dirent_
     return out->record_len;
 }
 
-// Atomically read all directory entries and cache them into the directory handle.
-// Refer to `dirent_t` for the structure of the cache.
-void vfs_ramfs_dir_read(badge_err_t *ec, vfs_t *vfs, vfs_file_handle_t *dir) {
+// Atomically read all directory entries into a new listing.
+// Refer to `dirent_t` for the structure of the listing.
+vfs_dir_listing_t *vfs_ramfs_dir_read(badge_err_t *ec, vfs_t *vfs, vfs_file_shared_t *dir) {
     assert_always(mutex_acquire_shared(NULL, &vfs->ramfs.mtx, VFS_MUTEX_TIMEOUT));
     size_t             off  = 0;
-    vfs_ramfs_inode_t *iptr = dir->shared->ramfs_file;
+    vfs_ramfs_inode_t *iptr = dir->ramfs_file;
 
     // Measure required memory.
     size_t cap = 0;
@@ -409,21 +493,19 @@ void vfs_ramfs_dir_read(badge_err_t *ec, vfs_t *vfs, vfs_file_handle_t *dir) {
     }
 
     // Allocate memory.
-    void *mem = realloc(dir->dir_cache, cap); // NOLINT
-    if (!mem) {
+    vfs_dir_listing_t *listing = vfs_listing_alloc(cap);
+    if (!listing) {
         mutex_release_shared(NULL, &vfs->ramfs.mtx);
         badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_NOMEM);
-        return;
+        return NULL;
     }
-    dir->dir_cache      = mem;
-    dir->dir_cache_size = (fileoff_t)cap;
 
     // Generate entries.
     size_t out_off = 0;
     off            = 0;
     while (off < iptr->len) {
         vfs_ramfs_dirent_t *in  = (vfs_ramfs_dirent_t *)(iptr->buf + off);
-        dirent_t           *out = (dirent_t *)(dir->dir_cache + out_off);
+        dirent_t           *out = (dirent_t *)(listing->data + out_off);
         convert_dirent(vfs, out, in);
         off     += in->size;
         out_off += out->record_len;
@@ -431,6 +513,7 @@ void vfs_ramfs_dir_read(badge_err_t *ec, vfs_t *vfs, vfs_file_handle_t *dir) {
 
     mutex_release_shared(NULL, &vfs->ramfs.mtx);
     badge_err_set_ok(ec);
+    return listing;
 }
 
 // Atomically read the directory entry with the matching name.
@@ -448,12 +531,37 @@ bool vfs_ramfs_dir_find_ent(badge_err_t *ec, vfs_t *vfs, vfs_file_shared_t *dir,
 
 
 
+// Get the attributes of an inode.
+// Sets all fields but `device`.
+void vfs_ramfs_stat(badge_err_t *ec, vfs_t *vfs, inode_t inode, stat_t *stat_out) {
+    assert_always(mutex_acquire_shared(NULL, &vfs->ramfs.mtx, VFS_MUTEX_TIMEOUT));
+    if (inode < VFS_RAMFS_INODE_ROOT || (size_t)inode >= vfs->ramfs.inode_list_len ||
+        !vfs->ramfs.inode_usage[inode]) {
+        mutex_release_shared(NULL, &vfs->ramfs.mtx);
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_NOTFOUND);
+        return;
+    }
+
+    vfs_ramfs_inode_t *iptr = get_inode(vfs, inode);
+    stat_out->inode         = inode;
+    stat_out->mode          = iptr->mode;
+    stat_out->links         = (long)iptr->links;
+    stat_out->uid           = iptr->uid;
+    stat_out->gid           = iptr->gid;
+    stat_out->size          = (long)iptr->len;
+
+    mutex_release_shared(NULL, &vfs->ramfs.mtx);
+    badge_err_set_ok(ec);
+}
+
+
+
 // Open a file handle for the root directory.
 void vfs_ramfs_root_open(badge_err_t *ec, vfs_t *vfs, vfs_file_shared_t *file) {
     assert_always(mutex_acquire_shared(NULL, &vfs->ramfs.mtx, VFS_MUTEX_TIMEOUT));
 
     // Install in shared file handle.
-    vfs_ramfs_inode_t *iptr = &vfs->ramfs.inode_list[VFS_RAMFS_INODE_ROOT];
+    vfs_ramfs_inode_t *iptr = get_inode(vfs, VFS_RAMFS_INODE_ROOT);
     file->ramfs_file        = iptr;
     file->inode             = VFS_RAMFS_INODE_ROOT;
     file->vfs               = vfs;
@@ -485,7 +593,7 @@ void vfs_ramfs_file_open(
     }
 
     // Increase refcount.
-    vfs_ramfs_inode_t *iptr = &vfs->ramfs.inode_list[ent->inode];
+    vfs_ramfs_inode_t *iptr = get_inode(vfs, ent->inode);
     iptr->links++;
 
     // Install in shared file handle.
@@ -558,6 +666,83 @@ void vfs_ramfs_file_write(
     mutex_release(ec, &vfs->ramfs.mtx);
 }
 
+// Copy bytes from one file to another.
+// The ranges must not overlap if both are in the same file.
+void vfs_ramfs_file_copy(
+    badge_err_t       *ec,
+    vfs_t             *vfs,
+    vfs_file_shared_t *src,
+    fileoff_t          src_offset,
+    vfs_file_shared_t *dst,
+    fileoff_t          dst_offset,
+    fileoff_t          len
+) {
+    if (src_offset < 0 || dst_offset < 0 || len < 0) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_RANGE);
+        return;
+    }
+    assert_always(mutex_acquire(NULL, &vfs->ramfs.mtx, VFS_MUTEX_TIMEOUT));
+
+    vfs_ramfs_inode_t *src_iptr = src->ramfs_file;
+    vfs_ramfs_inode_t *dst_iptr = dst->ramfs_file;
+
+    // Bounds check both files.
+    if (src_offset + len > (ptrdiff_t)src_iptr->len || src_offset + len < src_offset ||
+        dst_offset + len > (ptrdiff_t)dst_iptr->len || dst_offset + len < dst_offset) {
+        mutex_release(NULL, &vfs->ramfs.mtx);
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_RANGE);
+        return;
+    }
+
+    // Checks passed, copy straight between the data buffers.
+    mem_copy(dst_iptr->buf + dst_offset, src_iptr->buf + src_offset, len);
+    mutex_release(NULL, &vfs->ramfs.mtx);
+    badge_err_set_ok(ec);
+}
+
+#if MEMMAP_VMEM
+// Get the physical page of file data at a page-aligned offset to map into a process, taking a reference to it.
+// Small files are moved to `vmalloc` memory first, so that the mapping shares the file's own pages.
+// The file then stays in `vmalloc` memory, even if it shrinks later.
+size_t vfs_ramfs_file_map_page(badge_err_t *ec, vfs_t *vfs, vfs_file_shared_t *file, fileoff_t offset) {
+    if (offset < 0 || offset % MEMMAP_PAGE_SIZE) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_RANGE);
+        return 0;
+    }
+    assert_always(mutex_acquire(NULL, &vfs->ramfs.mtx, VFS_MUTEX_TIMEOUT));
+
+    vfs_ramfs_inode_t *iptr = file->ramfs_file;
+    if (offset >= (ptrdiff_t)iptr->len) {
+        mutex_release(NULL, &vfs->ramfs.mtx);
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_RANGE);
+        return 0;
+    }
+
+    if (iptr->cap < VFS_RAMFS_VMALLOC_MIN) {
+        void *mem = realloc_buf(iptr->buf, iptr->len, iptr->cap, VFS_RAMFS_VMALLOC_MIN);
+        if (!mem) {
+            mutex_release(NULL, &vfs->ramfs.mtx);
+            badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_NOMEM);
+            return 0;
+        }
+        iptr->buf = mem;
+        iptr->cap = VFS_RAMFS_VMALLOC_MIN;
+    }
+    iptr->mapped = true;
+
+    // The page stays allocated for the mapping even if the file is truncated or deleted in the meantime.
+    size_t ppn = memprotect_virt2phys(NULL, (size_t)iptr->buf + offset).page_paddr / MEMMAP_PAGE_SIZE;
+    bool   ok  = phys_page_ref(ppn);
+    mutex_release(NULL, &vfs->ramfs.mtx);
+    if (!ok) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_NOMEM);
+        return 0;
+    }
+    badge_err_set_ok(ec);
+    return ppn;
+}
+#endif
+
 // Change the length of a file opened by `vfs_ramfs_file_open`.
 void vfs_ramfs_file_resize(badge_err_t *ec, vfs_t *vfs, vfs_file_shared_t *file, fileoff_t new_size) {
     if (new_size < 0) {
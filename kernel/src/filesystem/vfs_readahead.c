@@ -0,0 +1,146 @@
+
+// SPDX-License-Identifier: MIT
+
+#include "filesystem/vfs_readahead.h"
+
+#include "assertions.h"
+#include "filesystem/vfs_internal.h"
+#include "log.h"
+#include "scheduler/scheduler.h"
+
+// Queued readahead request.
+// Files are identified by inode because their handles may be closed before the request is handled.
+typedef struct {
+    // Filesystem the file is on.
+    vfs_t    *vfs;
+    // Inode of the file.
+    inode_t   inode;
+    // Offset of the data to prefetch.
+    fileoff_t offset;
+    // Length of the data to prefetch.
+    fileoff_t len;
+} vfs_ra_req_t;
+
+// Guards the readahead queue.
+static mutex_t      ra_mtx = MUTEX_T_INIT;
+// Circular queue of readahead requests.
+static vfs_ra_req_t ra_queue[VFS_READAHEAD_QUEUE];
+// Index of the oldest request in the queue.
+static size_t       ra_head;
+// Number of requests in the queue.
+static size_t       ra_len;
+// Whether the readahead worker has been started.
+static bool         ra_started;
+// Thread handle of the readahead worker.
+static tid_t        ra_thread;
+// Whether the readahead worker found the queue empty and is parked.
+static bool         ra_parked;
+
+
+
+// Prefetches queued readahead requests into the page cache.
+static int ra_thread_func(void *ignored) {
+    (void)ignored;
+
+    while (1) {
+        assert_always(mutex_acquire(NULL, &ra_mtx, TIMESTAMP_US_MAX));
+        bool         pending = ra_len;
+        vfs_ra_req_t req     = ra_queue[ra_head];
+        if (pending) {
+            ra_head = (ra_head + 1) % VFS_READAHEAD_QUEUE;
+            ra_len--;
+        }
+        ra_parked = !pending;
+        mutex_release(NULL, &ra_mtx);
+        if (!pending) {
+            // Park until `ra_submit` queues something.
+            thread_sleep(VFS_READAHEAD_IDLE_US);
+            continue;
+        }
+
+        // The shared handle can't be closed while the handle mutex is held.
+        assert_always(mutex_acquire_shared(NULL, &vfs_handle_mtx, VFS_MUTEX_TIMEOUT));
+        vfs_file_shared_t *file = vfs_shared_by_inode(req.vfs, req.inode);
+        if (file) {
+            vfs_pcache_prefetch(file, req.offset, req.len);
+        }
+        mutex_release_shared(NULL, &vfs_handle_mtx);
+    }
+
+    return 0;
+}
+
+// Queue a readahead request, starting the worker on first use.
+static void ra_submit(vfs_file_shared_t *file, fileoff_t offset, fileoff_t len) {
+    assert_always(mutex_acquire(NULL, &ra_mtx, TIMESTAMP_US_MAX));
+    if (!ra_started) {
+        badge_err_t ec = {0};
+        ra_thread      = thread_new_kernel(&ec, "readahead", ra_thread_func, NULL, SCHED_PRIO_NORMAL);
+        if (badge_err_is_ok(&ec)) {
+            thread_resume(&ec, ra_thread);
+        }
+        if (!badge_err_is_ok(&ec)) {
+            logk(LOG_WARN, "Failed to start readahead worker");
+            mutex_release(NULL, &ra_mtx);
+            return;
+        }
+        ra_started = true;
+    }
+    if (ra_len < VFS_READAHEAD_QUEUE) {
+        ra_queue[(ra_head + ra_len) % VFS_READAHEAD_QUEUE] = (vfs_ra_req_t){
+            .vfs    = file->vfs,
+            .inode  = file->inode,
+            .offset = offset,
+            .len    = len,
+        };
+        ra_len++;
+    }
+    bool wake = ra_parked;
+    ra_parked = false;
+    mutex_release(NULL, &ra_mtx);
+    if (wake) {
+        thread_resume(NULL, ra_thread);
+    }
+}
+
+
+
+// Update the access pattern of a handle after a read and queue prefetching of the data expected to be read next.
+// Must be called with the handle's mutex held.
+void vfs_readahead(vfs_file_handle_t *handle, fileoff_t offset, fileoff_t len) {
+    if (handle->random || !handle->shared->vfs->media) {
+        // Only data on block devices is worth prefetching.
+        return;
+    }
+
+    // Reads that continue where the last one stopped grow the window; anything else resets it.
+    if (offset == handle->ra_next) {
+        handle->ra_window *= 2;
+        if (handle->ra_window < VFS_READAHEAD_MIN) {
+            handle->ra_window = VFS_READAHEAD_MIN;
+        } else if (handle->ra_window > VFS_READAHEAD_MAX) {
+            handle->ra_window = VFS_READAHEAD_MAX;
+        }
+    } else {
+        handle->ra_window = 0;
+        handle->ra_end    = 0;
+    }
+    handle->ra_next = offset + len;
+    if (!handle->ra_window) {
+        return;
+    }
+
+    // Only queue more once the reader has consumed half of what was already queued.
+    if (handle->ra_end < handle->ra_next) {
+        handle->ra_end = handle->ra_next;
+    }
+    fileoff_t end = handle->ra_next + handle->ra_window;
+    if (end > handle->shared->size) {
+        end = handle->shared->size;
+    }
+    if (handle->ra_end - handle->ra_next > handle->ra_window / 2 || end <= handle->ra_end) {
+        return;
+    }
+    ra_submit(handle->shared, handle->ra_end, end - handle->ra_end);
+    handle->ra_end = end;
+}
@@ -0,0 +1,61 @@
+
+// SPDX-License-Identifier: MIT
+
+#include "filesystem/vfs_writeback.h"
+
+#include "assertions.h"
+#include "filesystem/vfs_internal.h"
+#include "filesystem/vfs_pcache.h"
+#include "housekeeping.h"
+
+#include <stdint.h>
+
+
+
+// Writes back pages that have been dirty for too long, or while too many are dirty.
+// Then lets the block devices write back their own caches the same way.
+static void wb_task(int taskno, void *arg) {
+    (void)taskno;
+    (void)arg;
+
+    // Try again next time instead of holding up housekeeping behind a mount or a file being opened.
+    if (!mutex_acquire_shared(NULL, &vfs_mount_mtx, 0)) {
+        return;
+    }
+    if (mutex_acquire_shared(NULL, &vfs_handle_mtx, 0)) {
+        timestamp_us_t expire = time_us() - BLKDEV_WRITE_CACHE_TIMEOUT;
+        vfs_pcache_writeback(NULL, expire, VFS_PCACHE_DIRTY_BG, VFS_WRITEBACK_BATCH);
+        mutex_release_shared(NULL, &vfs_handle_mtx);
+    }
+    for (size_t i = 0; i < FILESYSTEM_MOUNT_MAX; i++) {
+        if (vfs_table[i].mountpoint && vfs_table[i].media && !vfs_table[i].readonly) {
+            blkdev_housekeeping(NULL, vfs_table[i].media);
+        }
+    }
+    mutex_release_shared(NULL, &vfs_mount_mtx);
+}
+
+
+
+// Start writing back dirty data in the background.
+void vfs_writeback_init() {
+    hk_add_repeated(0, VFS_WRITEBACK_INTERVAL, wb_task, NULL);
+}
+
+// Write back all dirty data and flush every mounted filesystem.
+void vfs_writeback_sync(badge_err_t *ec) {
+    badge_err_t ec0;
+    if (!ec)
+        ec = &ec0;
+
+    assert_always(mutex_acquire_shared(NULL, &vfs_mount_mtx, VFS_MUTEX_TIMEOUT));
+    assert_always(mutex_acquire_shared(NULL, &vfs_handle_mtx, VFS_MUTEX_TIMEOUT));
+    vfs_pcache_writeback(ec, TIMESTAMP_US_MAX, 0, SIZE_MAX);
+    mutex_release_shared(NULL, &vfs_handle_mtx);
+    for (size_t i = 0; i < FILESYSTEM_MOUNT_MAX && badge_err_is_ok(ec); i++) {
+        if (vfs_table[i].mountpoint && !vfs_table[i].readonly) {
+            vfs_flush(ec, &vfs_table[i]);
+        }
+    }
+    mutex_release_shared(NULL, &vfs_mount_mtx);
+}
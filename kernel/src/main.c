@@ -4,6 +4,9 @@
 #include "assertions.h"
 #include "cpu/panic.h"
 #include "filesystem.h"
+#include "filesystem/vfs_lcache.h"
+#include "filesystem/vfs_pcache.h"
+#include "filesystem/vfs_writeback.h"
 #include "housekeeping.h"
 #include "interrupt.h"
 #include "isr_ctx.h"
@@ -14,6 +17,7 @@
 #include "process/internal.h"
 #include "process/process.h"
 #include "scheduler/scheduler.h"
+#include "shrinker.h"
 #include "time.h"
 
 #include <stdatomic.h>
@@ -77,6 +81,8 @@ void basic_runtime_init() {
 
     // Housekeeping thread initialization.
     hk_init();
+    // Background memory reclaim initialization.
+    shrinker_init();
     // Add the remainder of the kernel lifetime as a new thread.
     tid_t thread = thread_new_kernel(&ec, "main", (void *)kernel_lifetime_func, NULL, SCHED_PRIO_NORMAL);
     badge_err_assert_always(&ec);
@@ -124,6 +130,11 @@ void syscall_sys_shutdown(bool is_reboot) {
     atomic_store(&kernel_shutdown_mode, 1 + is_reboot);
 }
 
+// Uptime system call implementation.
+int64_t syscall_sys_uptime() {
+    return time_us();
+}
+
 
 
 // After basic runtime initialization, the booting CPU core continues here.
@@ -137,6 +148,11 @@ static void kernel_init() {
     // Full hardware initialization.
     port_init();
 
+    // Filesystem caches.
+    vfs_pcache_init();
+    vfs_lcache_init();
+    vfs_writeback_init();
+
     // Temporary filesystem image.
     fs_mount(&ec, FS_TYPE_RAMFS, NULL, "/", 0);
     badge_err_assert_always(&ec);
@@ -206,5 +222,13 @@ static void userland_shutdown() {
 // This will synchronize all filesystems and clean up any other resources not needed to finish hardware shutdown.
 // When finished, the CPU continues to the platform-specific hardware shutdown / reboot handler.
 static void kernel_shutdown() {
-    // TODO: Filesystems flush.
+    badge_err_t ec = {0};
+    fs_flush(&ec, FILE_NONE);
+    if (!badge_err_is_ok(&ec)) {
+        logk(LOG_ERROR, "Failed to flush filesystems");
+    }
+#ifdef BADGEROS_MALLOC_TRACK_CALLERS
+    // Report kernel allocations that are still live at shutdown.
+    malloc_dump_tags();
+#endif
 }
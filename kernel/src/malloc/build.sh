@@ -1,7 +1,9 @@
 set -e
 
 defines="-DBADGEROS_MALLOC_STANDALONE -DBADGEROS_MALLOC_DEBUG_LEVEL=3"
-sources="main.c static-buddy.c slab-alloc.c"
+sources="main.c static-buddy.c slab-alloc.c shrinker.c"
+# `-iquote` so that headers like badgelib/time.h and common/errno.h don't shadow the system ones.
+defines="${defines} -iquote ../../include/badgelib -iquote ../../../common/include"
 
 echo "64-bit"
 gcc -m64 -g3 -Wall -Wextra ${defines} ${sources} -o main64
@@ -12,6 +14,9 @@ gcc -DSOFTBIT -g3 -Wall -Wextra ${defines} ${sources} -o main64-softbit
 echo "32-bit softbit"
 gcc -DSOFTBIT -m32 -g3 -Wall -Wextra ${defines} ${sources} -o main32-softbit
 
+echo "vmalloc"
+gcc -g3 -Wall -Wextra -iquote vmalloc-stubs -iquote ../../include -iquote ../../include/badgelib -iquote ../../../common/include vmalloc-test.c ../vmalloc.c -o vmalloc-test
+
 echo "wrapper"
 gcc -std=gnu17 -g3 -Wall -Wextra -DPRELOAD ${sources} ${defines} malloc.c -Wl,--wrap,malloc -Wl,--wrap,free -Wl,--wrap,calloc -Wl,--wrap,realloc -Wl,--wrap,reallocarray -Wl,--wrap,aligned_alloc -Wl,--wrap,posix_memalign -fpic -shared -o malloc.so
 
@@ -1,14 +1,233 @@
+#include "shrinker.h"
 #include "static-buddy.h"
 
+#include <inttypes.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <time.h>
 
 #define PAGE_SIZE   4096
 #define MEMORY_SIZE PAGE_SIZE * 65536
 
-int main() {
+// Fragment the pools by freeing random single pages, then compare how many large requests succeed
+// as one physically contiguous buddy block versus as individual pages, which is how `vmalloc` backs them.
+static int fragmentation_stress() {
+    size_t const total_pages = MEMORY_SIZE / PAGE_SIZE * 2;
+    size_t const req_pages   = 16;
+    size_t const requests    = total_pages / req_pages / 4;
+
+    char **pages = calloc(total_pages, sizeof(void *));
+    size_t count = 0;
+    while (count < total_pages && (pages[count] = buddy_allocate(PAGE_SIZE, BLOCK_TYPE_PAGE, 0))) {
+        ++count;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        if (rand() % 2) {
+            buddy_deallocate(pages[i]);
+            pages[i] = NULL;
+        }
+    }
+
+    char **contig     = calloc(requests, sizeof(void *));
+    char **paged      = calloc(requests * req_pages, sizeof(void *));
+    size_t contig_ok  = 0;
+    size_t paged_ok   = 0;
+    size_t paged_used = 0;
+    for (size_t i = 0; i < requests; ++i) {
+        contig[i]  = buddy_allocate(req_pages * PAGE_SIZE, BLOCK_TYPE_PAGE, 0);
+        contig_ok += contig[i] != NULL;
+    }
+    for (size_t i = 0; i < requests; ++i) {
+        size_t j;
+        for (j = 0; j < req_pages; ++j) {
+            paged[paged_used] = buddy_allocate(PAGE_SIZE, BLOCK_TYPE_PAGE, 0);
+            if (!paged[paged_used]) {
+                break;
+            }
+            ++paged_used;
+        }
+        paged_ok += j == req_pages;
+    }
+    printf(
+        "Fragmented pools, %zu x %zu-page requests: contiguous %zu%% succeeded, paged %zu%% succeeded\n",
+        requests,
+        req_pages,
+        contig_ok * 100 / requests,
+        paged_ok * 100 / requests
+    );
+
+    for (size_t i = 0; i < requests; ++i) {
+        buddy_deallocate(contig[i]);
+    }
+    for (size_t i = 0; i < paged_used; ++i) {
+        buddy_deallocate(paged[i]);
+    }
+    for (size_t i = 0; i < count; ++i) {
+        buddy_deallocate(pages[i]);
+    }
+    free(contig);
+    free(paged);
+    free(pages);
+
+    for (int p = 0; p < memory_pool_num; ++p) {
+        memory_pool_t *pool = &memory_pools[p];
+        if (!pool->free_maps[pool->max_order].count) {
+            print_allocator();
+            printf("Didn't free all pages after fragmentation stress\n");
+            return 1;
+        }
+    }
+    return paged_ok < contig_ok;
+}
+
+// Pages held by the test cache for `reclaim_test`.
+static char **cache_pages;
+// Number of entries in `cache_pages`.
+static size_t cache_len;
+
+// Shrinker for the test cache; drops cached pages from the end.
+static size_t cache_shrinker(size_t target_pages, void *cookie) {
+    (void)cookie;
+    size_t freed = 0;
+    while (cache_len && freed < target_pages) {
+        buddy_deallocate(cache_pages[--cache_len]);
+        ++freed;
+    }
+    return freed;
+}
+
+// Fill memory with a reclaimable cache and check that running the shrinkers makes a large allocation possible.
+static int reclaim_test() {
+    size_t const total_pages = MEMORY_SIZE / PAGE_SIZE * 2;
+    size_t const req_pages   = 64;
+
+    cache_pages = calloc(total_pages, sizeof(void *));
+    cache_len   = 0;
+    while (cache_len < total_pages && (cache_pages[cache_len] = buddy_allocate(PAGE_SIZE, BLOCK_TYPE_PAGE, 0))) {
+        ++cache_len;
+    }
+    int handle = shrinker_register("test-cache", SHRINKER_PRIO_CLEAN, cache_shrinker, NULL);
+
+    int   res   = 0;
+    void *block = buddy_allocate(req_pages * PAGE_SIZE, BLOCK_TYPE_PAGE, 0);
+    if (block) {
+        printf("Large allocation succeeded without reclaim\n");
+        res = 1;
+    } else {
+        // Pages are allocated in address order, so dropping the most recent ones frees a contiguous range.
+        size_t freed = shrinker_run(req_pages * 2);
+        block        = buddy_allocate(req_pages * PAGE_SIZE, BLOCK_TYPE_PAGE, 0);
+        printf("Reclaim freed %zu pages, large allocation %s\n", freed, block ? "succeeded" : "failed");
+        res = !block || freed < req_pages;
+    }
+
+    shrinker_unregister(handle);
+    buddy_deallocate(block);
+    cache_shrinker(cache_len, NULL);
+    free(cache_pages);
+    return res;
+}
+
+// Current monotonic time in nanoseconds.
+static uint64_t time_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int cmp_u64(void const *a, void const *b) {
+    uint64_t x = *(uint64_t const *)a;
+    uint64_t y = *(uint64_t const *)b;
+    return (x > y) - (x < y);
+}
+
+// Print throughput and latency percentiles for a set of measured operations.
+static void print_latency(char const *name, uint64_t *lat, size_t count) {
+    uint64_t total = 0;
+    for (size_t i = 0; i < count; ++i) {
+        total += lat[i];
+    }
+    qsort(lat, count, sizeof(uint64_t), cmp_u64);
+    printf(
+        "%-8s %zu ops, %.2f Mops/s, p50 %" PRIu64 " ns, p99 %" PRIu64 " ns, max %" PRIu64 " ns\n",
+        name,
+        count,
+        count * 1000.0 / total,
+        lat[count / 2],
+        lat[count * 99 / 100],
+        lat[count - 1]
+    );
+}
+
+// Measure buddy allocator throughput and latency on pools fragmented the same way as the main test:
+// fill with random 1-10 page allocations, free the first half and fill up again.
+// Then free a random half to leave holes and repeatedly replace random allocations with new ones of random size.
+static int benchmark() {
+    size_t const slots = MEMORY_SIZE / PAGE_SIZE * 2;
+    size_t const ops   = 1 << 20;
+    srand(1);
+
+    char    **allocations = calloc(slots, sizeof(void *));
+    uint64_t *alloc_lat   = calloc(ops, sizeof(uint64_t));
+    uint64_t *free_lat    = calloc(ops, sizeof(uint64_t));
+    size_t    alloc_count = 0;
+    size_t    free_count  = 0;
+    size_t    failures    = 0;
+
+    size_t used;
+    for (used = 0; used < slots; ++used) {
+        allocations[used] = buddy_allocate(PAGE_SIZE * ((rand() % 10) + 1), BLOCK_TYPE_PAGE, 0);
+        if (!allocations[used]) {
+            break;
+        }
+    }
+    for (size_t k = 0; k <= used / 2; ++k) {
+        buddy_deallocate(allocations[k]);
+        allocations[k] = NULL;
+    }
+    for (size_t k = 0; k < used; ++k) {
+        if (!allocations[k]) {
+            allocations[k] = buddy_allocate(PAGE_SIZE * ((rand() % 10) + 1), BLOCK_TYPE_PAGE, 0);
+        }
+    }
+    for (size_t k = 0; k < used; ++k) {
+        if (rand() % 2) {
+            buddy_deallocate(allocations[k]);
+            allocations[k] = NULL;
+        }
+    }
+
+    for (size_t op = 0; op < ops; ++op) {
+        size_t slot = rand() % used;
+        size_t size = PAGE_SIZE * ((rand() % 10) + 1);
+        if (allocations[slot]) {
+            uint64_t start = time_ns();
+            buddy_deallocate(allocations[slot]);
+            free_lat[free_count++] = time_ns() - start;
+        }
+        uint64_t start           = time_ns();
+        allocations[slot]        = buddy_allocate(size, BLOCK_TYPE_PAGE, 0);
+        alloc_lat[alloc_count++] = time_ns() - start;
+        failures                += !allocations[slot];
+    }
+
+    printf("%zu live allocation slots, %zu failed allocations\n", used, failures);
+    print_latency("alloc", alloc_lat, alloc_count);
+    print_latency("free", free_lat, free_count);
+
+    for (size_t k = 0; k < used; ++k) {
+        buddy_deallocate(allocations[k]);
+    }
+    free(allocations);
+    free(alloc_lat);
+    free(free_lat);
+    return 0;
+}
+
+int main(int argc, char **argv) {
     srand(time(NULL));
     char *ram  = malloc(MEMORY_SIZE);
     char *ram2 = malloc(MEMORY_SIZE);
@@ -17,6 +236,10 @@ int main() {
     init_pool(ram2, ram2 + MEMORY_SIZE, 0);
     init_kernel_slabs();
 
+    if (argc > 1 && !strcmp(argv[1], "bench")) {
+        return benchmark();
+    }
+
     // for(int j = 0; j < 1024; ++j) {
     char **allocations = calloc(1, sizeof(void *) * (MEMORY_SIZE / PAGE_SIZE) * 2);
 
@@ -60,13 +283,21 @@ int main() {
     for (int p = 0; p < memory_pool_num; ++p) {
         memory_pool_t *pool = &memory_pools[p];
 
-        if (pool->free_lists[pool->max_order].prev == &pool->free_lists[pool->max_order]) {
+        if (!pool->free_maps[pool->max_order].count) {
             print_allocator();
             printf("Didn't free all pages\n");
             return 1;
         }
     }
 
+    if (fragmentation_stress()) {
+        return 1;
+    }
+
+    if (reclaim_test()) {
+        return 1;
+    }
+
 #define SLAB_ALLOCATIONS (MEMORY_SIZE / 128) * 2
     char **slab_allocations = calloc(1, sizeof(void *) * SLAB_ALLOCATIONS);
     int    slab_sizes[]     = {32, 64, 128, 256};
@@ -81,18 +312,28 @@ int main() {
     }
 
     slab_deallocate(slab_allocations[0]);
+    slab_release_empty();
 
     for (int p = 0; p < memory_pool_num; ++p) {
         memory_pool_t *pool = &memory_pools[p];
 
-        if (pool->free_pages < pool->pages - 4) {
+        if (pool->free_pages != pool->pages) {
             print_allocator();
             printf("Didn't free all pages\n");
             return 1;
         }
     }
 
+    for (int c = 0; c < MEMSTATS_SLAB_CLASSES; ++c) {
+        if (alloc_stats.slab[c].in_use || alloc_stats.slab[c].allocs != alloc_stats.slab[c].frees) {
+            print_allocator_stats();
+            printf("Slab statistics don't balance\n");
+            return 1;
+        }
+    }
+
     print_allocator();
+    print_allocator_stats();
     // printf("Did %zu allocations and %zu deallocations\n", alloc, dealloc);
     free(allocations);
     free(slab_allocations);
@@ -7,6 +7,7 @@
 #endif
 
 #include "debug.h"
+#include "shrinker.h"
 #include "spinlock.h"
 #include "static-buddy.h"
 
@@ -61,12 +62,133 @@ static atomic_flag lock            = ATOMIC_FLAG_INIT;
 
 void kernel_heap_init();
 
+#ifdef BADGEROS_MALLOC_TRACK_CALLERS
+#ifndef BADGEROS_MALLOC_TAG_CAP
+#define BADGEROS_MALLOC_TAG_CAP 8192
+#endif
+
+// Marks a tag table slot that was freed but may be part of a probe chain.
+#define TAG_TOMBSTONE ((void *)1)
+
+// Call-site tag for a live allocation.
+typedef struct {
+    // Allocated pointer, NULL for empty slots.
+    void  *ptr;
+    // Return address of the code that allocated it.
+    void  *caller;
+    // Requested allocation size.
+    size_t size;
+} malloc_tag_t;
+
+// Open-addressing table of live allocations.
+static malloc_tag_t tags[BADGEROS_MALLOC_TAG_CAP];
+// Number of allocations that did not fit in the tag table.
+static size_t       tags_dropped;
+
+// Hash a pointer into the tag table.
+static size_t tag_hash(void *ptr) {
+    size_t x = (size_t)ptr >> 4;
+    x ^= x >> 15;
+    x *= 0x2c1b3c6dU;
+    x ^= x >> 12;
+    return x % BADGEROS_MALLOC_TAG_CAP;
+}
+
+// Record the call site of a new allocation.
+static void tag_add(void *ptr, void *caller, size_t size) {
+    if (!ptr) {
+        return;
+    }
+    size_t i = tag_hash(ptr);
+    for (size_t n = 0; n < BADGEROS_MALLOC_TAG_CAP; n++) {
+        if (tags[i].ptr == NULL || tags[i].ptr == TAG_TOMBSTONE) {
+            tags[i] = (malloc_tag_t){ptr, caller, size};
+            return;
+        }
+        i = (i + 1) % BADGEROS_MALLOC_TAG_CAP;
+    }
+    tags_dropped++;
+}
+
+// Forget the call site of a freed allocation.
+static void tag_remove(void *ptr) {
+    if (!ptr) {
+        return;
+    }
+    size_t i = tag_hash(ptr);
+    for (size_t n = 0; n < BADGEROS_MALLOC_TAG_CAP && tags[i].ptr; n++) {
+        if (tags[i].ptr == ptr) {
+            tags[i].ptr = TAG_TOMBSTONE;
+            return;
+        }
+        i = (i + 1) % BADGEROS_MALLOC_TAG_CAP;
+    }
+}
+
+// Print all live allocations and the code that allocated them.
+void malloc_dump_tags() {
+    SPIN_LOCK_LOCK(lock);
+    size_t count = 0;
+    for (size_t i = 0; i < BADGEROS_MALLOC_TAG_CAP; i++) {
+        if (tags[i].ptr == NULL || tags[i].ptr == TAG_TOMBSTONE) {
+            continue;
+        }
+        count++;
+#ifdef BADGEROS_KERNEL
+        logkf(LOG_INFO, "Live: " FMT_ZI " bytes at " FMT_P " from " FMT_P, tags[i].size, tags[i].ptr, tags[i].caller);
+#else
+        fprintf(stderr, "Live: " FMT_ZI " bytes at " FMT_P " from " FMT_P "\n", tags[i].size, tags[i].ptr, tags[i].caller);
+#endif
+    }
+#ifdef BADGEROS_KERNEL
+    logkf(LOG_INFO, FMT_ZI " live allocations, " FMT_ZI " untracked", count, tags_dropped);
+#else
+    fprintf(stderr, FMT_ZI " live allocations, " FMT_ZI " untracked\n", count, tags_dropped);
+#endif
+    SPIN_LOCK_UNLOCK(lock);
+}
+
+#define TAG_ADD(ptr, size) tag_add(ptr, __builtin_return_address(0), size)
+#define TAG_REMOVE(ptr)    tag_remove(ptr)
+#else
+#define TAG_ADD(ptr, size)
+#define TAG_REMOVE(ptr)
+#endif
+
+// Get a consistent snapshot of the allocator statistics.
+void malloc_get_stats(memstats_t *out) {
+    SPIN_LOCK_LOCK(lock);
+    *out = alloc_stats;
+    SPIN_LOCK_UNLOCK(lock);
+}
+
+// Run the shrinkers after an allocation of `size` bytes failed.
+// Must be called with the lock held; the lock is released while the shrinkers run.
+// Returns whether any memory was freed, in which case the allocation should be retried.
+static bool malloc_reclaim(size_t size) {
+    SPIN_LOCK_UNLOCK(lock);
+    size_t freed = shrinker_run((size + PAGE_SIZE - 1) / PAGE_SIZE);
+    SPIN_LOCK_LOCK(lock);
+    return freed > 0;
+}
+
+// Shrinker that returns retained empty slab pages to the buddy allocator.
+static size_t slab_shrinker(size_t target_pages, void *cookie) {
+    (void)target_pages;
+    (void)cookie;
+    SPIN_LOCK_LOCK(lock);
+    size_t freed = slab_release_empty();
+    SPIN_LOCK_UNLOCK(lock);
+    return freed;
+}
+
 void kernel_heap_init() {
 #ifdef BADGEROS_KERNEL
 #ifndef CONFIG_TARGET_generic
     init_pool(__start_free_sram, __stop_free_sram, 0);
 #endif
     init_kernel_slabs();
+    shrinker_register("slab", SHRINKER_PRIO_RETAINED, slab_shrinker, NULL);
 #else
     SPIN_LOCK_LOCK(lock);
     if (mem_initialized) {
@@ -79,6 +201,7 @@ void kernel_heap_init() {
     void *mem_end   = sbrk(0);
     init_pool(mem_start, mem_end, 0);
     init_kernel_slabs();
+    shrinker_register("slab", SHRINKER_PRIO_RETAINED, slab_shrinker, NULL);
     SPIN_LOCK_UNLOCK(lock);
 #endif
 
@@ -105,6 +228,9 @@ void *__wrap_malloc(size_t size) {
 #endif
     SPIN_LOCK_LOCK(lock);
     void *ptr = _malloc(size);
+    if (!ptr && malloc_reclaim(size))
+        ptr = _malloc(size);
+    TAG_ADD(ptr, size);
     SPIN_LOCK_UNLOCK(lock);
 
     return ptr;
@@ -119,6 +245,9 @@ void *__wrap_aligned_alloc(size_t alignment, size_t size) {
 #endif
     SPIN_LOCK_LOCK(lock);
     void *ptr = _malloc(size);
+    if (!ptr && malloc_reclaim(size))
+        ptr = _malloc(size);
+    TAG_ADD(ptr, size);
     SPIN_LOCK_UNLOCK(lock);
 
     return ptr;
@@ -133,6 +262,9 @@ int __wrap_posix_memalign(void **memptr, size_t alignment, size_t size) {
 #endif
     SPIN_LOCK_LOCK(lock);
     void *ptr = _malloc(size);
+    if (!ptr && malloc_reclaim(size))
+        ptr = _malloc(size);
+    TAG_ADD(ptr, size);
     SPIN_LOCK_UNLOCK(lock);
 
     *memptr = ptr;
@@ -148,8 +280,11 @@ void *__wrap_calloc(size_t nmemb, size_t size) {
 
     SPIN_LOCK_LOCK(lock);
     void *ptr = _malloc(nmemb * size);
+    if (!ptr && malloc_reclaim(nmemb * size))
+        ptr = _malloc(nmemb * size);
     if (ptr)
         __builtin_memset(ptr, 0, nmemb * size); // NOLINT
+    TAG_ADD(ptr, nmemb * size);
     SPIN_LOCK_UNLOCK(lock);
     return ptr;
 }
@@ -178,10 +313,53 @@ void __wrap_free(void *ptr) {
 #endif
 
     SPIN_LOCK_LOCK(lock);
+    TAG_REMOVE(ptr);
     _free(ptr);
     SPIN_LOCK_UNLOCK(lock);
 }
 
+// Get the usable size of an allocation, which may be larger than requested.
+size_t malloc_usable_size(void *ptr) {
+    if (!ptr) {
+        return 0;
+    }
+    size_t size = 0;
+    SPIN_LOCK_LOCK(lock);
+    switch (buddy_get_type(ALIGN_PAGE_DOWN(ptr))) {
+        case BLOCK_TYPE_PAGE: size = buddy_get_size(ptr); break;
+        case BLOCK_TYPE_SLAB: size = slab_get_size(ptr); break;
+        default: BADGEROS_MALLOC_MSG_ERROR("malloc_usable_size(" FMT_P ") = Unknown pointer type", ptr);
+    }
+    SPIN_LOCK_UNLOCK(lock);
+    return size;
+}
+
+// Allocate whole pages for the physical page allocator, running the shrinkers if needed.
+void *heap_alloc_pages(size_t size, bool for_user) {
+    enum block_type type = for_user ? BLOCK_TYPE_USER : BLOCK_TYPE_PAGE;
+    SPIN_LOCK_LOCK(lock);
+    void *ptr = buddy_allocate(size, type, 0);
+    if (!ptr && malloc_reclaim(size))
+        ptr = buddy_allocate(size, type, 0);
+    SPIN_LOCK_UNLOCK(lock);
+    return ptr;
+}
+
+// Get the size of pages allocated with `heap_alloc_pages`.
+size_t heap_pages_size(void *ptr) {
+    SPIN_LOCK_LOCK(lock);
+    size_t size = buddy_get_size(ptr);
+    SPIN_LOCK_UNLOCK(lock);
+    return size;
+}
+
+// Free pages allocated with `heap_alloc_pages`.
+void heap_free_pages(void *ptr) {
+    SPIN_LOCK_LOCK(lock);
+    buddy_deallocate(ptr);
+    SPIN_LOCK_UNLOCK(lock);
+}
+
 // NOLINTNEXTLINE
 void *__wrap_realloc(void *ptr, size_t size) {
 #ifdef PRELOAD
@@ -217,12 +395,18 @@ void *__wrap_realloc(void *ptr, size_t size) {
     if (old_size >= size) {
         if (old_size > MAX_SLAB_SIZE && size > MAX_SLAB_SIZE) {
             new_ptr = buddy_reallocate(ptr, size);
+            if (new_ptr) {
+                TAG_REMOVE(ptr);
+                TAG_ADD(new_ptr, size);
+            }
             SPIN_LOCK_UNLOCK(lock);
             return new_ptr;
         }
     }
 
     new_ptr = _malloc(size);
+    if (!new_ptr && malloc_reclaim(size))
+        new_ptr = _malloc(size);
     if (!new_ptr) {
         BADGEROS_MALLOC_MSG_WARN("realloc: failed to allocate memory, returning NULL");
         SPIN_LOCK_UNLOCK(lock);
@@ -236,6 +420,8 @@ void *__wrap_realloc(void *ptr, size_t size) {
         case BLOCK_TYPE_SLAB: slab_deallocate(ptr); break;
         default: BADGEROS_MALLOC_MSG_ERROR("realloc(" FMT_P ") = Unknown pointer type", ptr);
     }
+    TAG_REMOVE(ptr);
+    TAG_ADD(new_ptr, size);
     SPIN_LOCK_UNLOCK(lock);
     return new_ptr;
 }
@@ -0,0 +1,137 @@
+// SPDX-License-Identifier: MIT
+
+/* Memory reclaim for BadgerOS
+ *
+ * Subsystems that hold on to memory they don't strictly need, like caches or
+ * retained empty pages, register a shrinker. When an allocation fails, the
+ * allocator runs the shrinkers in priority order before giving up.
+ *
+ * The registry lives in a fixed-size array because it's used exactly when the
+ * heap can't be relied upon. Shrinkers are called without the registry lock held
+ * so they are free to call `free` and even `malloc`; a shrinker that runs out of
+ * memory itself does not recurse into reclaim.
+ */
+
+#include "shrinker.h"
+
+#include "debug.h"
+#include "spinlock.h"
+#include "static-buddy.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef BADGEROS_KERNEL
+#include "housekeeping.h"
+#endif
+
+// Start reclaiming in the background when free pages drop below 1/`SHRINKER_LOW_WATERMARK` of all pages.
+#define SHRINKER_LOW_WATERMARK  32
+// Background reclaim stops when free pages reach 1/`SHRINKER_HIGH_WATERMARK` of all pages.
+#define SHRINKER_HIGH_WATERMARK 16
+// Interval for checking the watermarks in microseconds.
+#define SHRINKER_INTERVAL       100000
+
+typedef struct {
+    // Name for debug messages.
+    char const     *name;
+    // Priority; lower values run first.
+    int             priority;
+    // Reclaim callback.
+    shrinker_func_t func;
+    // Cookie passed to `func`.
+    void           *cookie;
+    // Handle returned by `shrinker_register`.
+    int             handle;
+} shrinker_t;
+
+// Lock for the shrinker registry.
+static atomic_flag registry_lock = ATOMIC_FLAG_INIT;
+// Set while shrinkers are running.
+static atomic_flag running       = ATOMIC_FLAG_INIT;
+// Number of registered shrinkers.
+static size_t      shrinkers_len;
+// Registered shrinkers sorted by priority.
+static shrinker_t  shrinkers[SHRINKER_MAX];
+// Handle counter; handles start at 1 so 0 can mean "no shrinker".
+static int         handle_ctr = 1;
+
+int shrinker_register(char const *name, int priority, shrinker_func_t func, void *cookie) {
+    SPIN_LOCK_LOCK(registry_lock);
+    if (shrinkers_len >= SHRINKER_MAX) {
+        SPIN_LOCK_UNLOCK(registry_lock);
+        BADGEROS_MALLOC_MSG_WARN("shrinker_register(" FMT_S ") = -1 (Too many shrinkers)", name);
+        return -1;
+    }
+
+    // Insert after all shrinkers of equal or lower priority value.
+    size_t i = shrinkers_len;
+    while (i > 0 && shrinkers[i - 1].priority > priority) {
+        shrinkers[i] = shrinkers[i - 1];
+        --i;
+    }
+    int handle   = handle_ctr++;
+    shrinkers[i] = (shrinker_t){name, priority, func, cookie, handle};
+    ++shrinkers_len;
+    SPIN_LOCK_UNLOCK(registry_lock);
+
+    return handle;
+}
+
+void shrinker_unregister(int handle) {
+    SPIN_LOCK_LOCK(registry_lock);
+    for (size_t i = 0; i < shrinkers_len; ++i) {
+        if (shrinkers[i].handle == handle) {
+            for (; i + 1 < shrinkers_len; ++i) {
+                shrinkers[i] = shrinkers[i + 1];
+            }
+            --shrinkers_len;
+            break;
+        }
+    }
+    SPIN_LOCK_UNLOCK(registry_lock);
+}
+
+size_t shrinker_run(size_t target_pages) {
+    if (atomic_flag_test_and_set(&running)) {
+        return 0;
+    }
+
+    // Copy the registry so no lock is held while shrinkers run.
+    SPIN_LOCK_LOCK(registry_lock);
+    size_t     len = shrinkers_len;
+    shrinker_t copy[SHRINKER_MAX];
+    for (size_t i = 0; i < len; ++i) {
+        copy[i] = shrinkers[i];
+    }
+    SPIN_LOCK_UNLOCK(registry_lock);
+
+    size_t freed = 0;
+    for (size_t i = 0; i < len && freed < target_pages; ++i) {
+        size_t res  = copy[i].func(target_pages - freed, copy[i].cookie);
+        freed      += res;
+        BADGEROS_MALLOC_MSG_DEBUG("shrinker_run: " FMT_S " freed " FMT_ZI " pages", copy[i].name, res);
+    }
+
+    atomic_flag_clear(&running);
+    return freed;
+}
+
+#ifdef BADGEROS_KERNEL
+// Reclaim memory in the background when free memory is low.
+static void shrinker_hk_task(int taskno, void *arg) {
+    (void)taskno;
+    (void)arg;
+    size_t total = alloc_stats.total_pages;
+    size_t free  = alloc_stats.free_pages;
+    if (free < total / SHRINKER_LOW_WATERMARK) {
+        shrinker_run(total / SHRINKER_HIGH_WATERMARK - free);
+    }
+}
+#endif
+
+void shrinker_init() {
+#ifdef BADGEROS_KERNEL
+    hk_add_repeated(0, SHRINKER_INTERVAL, shrinker_hk_task, NULL);
+#endif
+}
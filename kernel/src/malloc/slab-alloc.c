@@ -199,6 +199,7 @@ void *slab_allocate(size_t size, enum slab_type type, uint32_t flags) {
     page                = get_slab(slab_type);
     if (!page) {
         BADGEROS_MALLOC_MSG_DEBUG("slab_allocate(" FMT_ZI ") No page, returning NULL", size);
+        alloc_stats.slab[slab_type].failures++;
         return NULL;
     }
 
@@ -211,11 +212,13 @@ void *slab_allocate(size_t size, enum slab_type type, uint32_t flags) {
 
         size_t index  = (i * 32) + bit_index;
         void  *retval = ((uint8_t *)page) + DATA_OFFSET + (index * slab_bytes[slab_type]);
+        alloc_stats_add(&alloc_stats.slab[slab_type], slab_bytes[slab_type]);
         BADGEROS_MALLOC_MSG_DEBUG("slab_allocate(" FMT_ZI ") returning " FMT_P, size, retval);
         return retval;
     }
 
     BADGEROS_MALLOC_MSG_ERROR("slab_allocate(" FMT_ZI ") Slab didn't have a free slot, returning NULL", size);
+    alloc_stats.slab[slab_type].failures++;
     return NULL;
 }
 
@@ -241,6 +244,7 @@ void slab_deallocate(void *ptr) {
 
     header->bitmap[word_index] = new_bitmap;
     --header->use_count;
+    alloc_stats_sub(&alloc_stats.slab[header->size], slab_bytes[header->size]);
 
     // Check to see if the slab page is still in the correct bucket. If it is not move it to
     // an emptier bucket
@@ -256,6 +260,21 @@ void slab_deallocate(void *ptr) {
     }
 }
 
+size_t slab_release_empty() {
+    BADGEROS_MALLOC_MSG_DEBUG("slab_release_empty()");
+    size_t freed = 0;
+    for (int i = 0; i < 4; ++i) {
+        slab_header_t *list = &slabs[i].slabs[SLAB_USE_EMPTY];
+        while (!list_empty(list)) {
+            slab_header_t *slab = list->next;
+            list_remove(slab);
+            buddy_deallocate(slab);
+            ++freed;
+        }
+    }
+    return freed;
+}
+
 size_t slab_get_size(void *ptr) {
     BADGEROS_MALLOC_MSG_DEBUG("slab_get_size(" FMT_P ")", ptr);
     if (!ptr) {
@@ -41,20 +41,36 @@
  * of where you start. There's no need to explicitly keep track of buddies this way
  * nor are there any lookups.
  *
- * The allocator works by storing double linked lists of free blocks of each order.
- * When an allocation is made, we take the smallest block that can satisfy our
- * request, and if it is too big we split it down until we have a block of the size
- * we want. With every split a new free block of a lower order gets added to the
- * free list.
+ * The allocator works by storing a bitmap of free blocks for each order, with one
+ * bit per block of that order. When an allocation is made, we take the smallest
+ * block that can satisfy our request, and if it is too big we split it down until
+ * we have a block of the size we want. With every split a new free block of a lower
+ * order gets marked in the bitmap of that order.
  *
- * The allocator starts by pushing all of the pages into a single block at the
+ * Bitmaps are searched with find-first-set through a summary bitmap that has one bit
+ * per non-empty bitmap word, starting from a hint that tracks the lowest summary word
+ * that may have a free block. This also means the lowest
+ * free address is always handed out first, which keeps long-lived allocations
+ * packed together. The order and type of every block lives in an array of a single
+ * byte per page, so checking whether a buddy is free never touches the pages
+ * themselves.
+ *
+ * The allocator starts by marking all of the pages as a single block at the
  * highest order.
  *
+ * Page indices are counted from an address aligned to `BUDDY_ALIGN_ORDER`, so that
+ * blocks up to that order are aligned to their size in memory and can be mapped
+ * as superpages. The pages between that address and the first usable page are
+ * never marked free, so the free pages start as the largest aligned blocks that
+ * fit between there and the end of the pool instead.
+ *
  * Because this would mean we would only be able to manage memory that is an exact
  * power of 2 we introduce a feature called a waste page. A waste page is a page that
  * the buddy allocator tracks, but will never actually give out to callers. This means
  * that at initialization time we don't immediately start off with blocks of differing
- * sizes.
+ * sizes. Waste pages are always at the end of a pool, so a block that starts on a
+ * waste page is entirely waste; such blocks are never marked free, but they are
+ * always treated as a free buddy when merging.
  *
  */
 
@@ -66,6 +82,10 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#ifndef BADGEROS_KERNEL
+#include <inttypes.h>
+#endif
+
 // Fine for our purposes here
 
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
@@ -73,6 +93,12 @@
 
 uint8_t       memory_pool_num = 0;
 memory_pool_t memory_pools[MAX_MEMORY_POOLS];
+memstats_t    alloc_stats;
+
+// Get the statistics entry for a buddy allocation order.
+__attribute__((always_inline)) static inline memstats_class_t *order_stats(uint8_t order) {
+    return &alloc_stats.buddy[MIN(order, MEMSTATS_BUDDY_ORDERS - 1)];
+}
 
 __attribute__((always_inline)) static inline memory_pool_t *ptr_to_pool(void *ptr) {
     for (int i = 0; i < memory_pool_num; ++i) {
@@ -112,11 +138,11 @@ __attribute__((always_inline)) static inline buddy_block_t *index_to_block(memor
 
 __attribute__((always_inline)) static inline void *block_to_address(memory_pool_t *pool, buddy_block_t *block) {
     size_t index = block_to_index(pool, block);
-    return pool->pages_start + (index * PAGE_SIZE);
+    return pool->pages_base + (index * PAGE_SIZE);
 }
 
 __attribute__((always_inline)) static inline buddy_block_t *address_to_block(memory_pool_t *pool, void *ptr) {
-    return &pool->blocks[((size_t)ptr - (size_t)pool->pages_start) / PAGE_SIZE];
+    return &pool->blocks[((size_t)ptr - (size_t)pool->pages_base) / PAGE_SIZE];
 }
 
 __attribute__((always_inline)) static inline size_t next_power_of_two(size_t x) {
@@ -146,95 +172,123 @@ __attribute__((always_inline)) static inline uint8_t get_order(size_t size) {
     }
 }
 
-static void list_init(buddy_block_t *list) {
-    list->prev = list;
-    list->next = list;
-}
+// Number of bits in a free bitmap word.
+#define BITMAP_WORD_BITS (sizeof(size_t) * 8)
 
-__attribute__((always_inline)) static inline void list_push_back(buddy_block_t *list, buddy_block_t *entry) {
-    entry->in_list      = true;
-    buddy_block_t *prev = list->prev;
-    entry->prev         = prev;
-    entry->next         = list;
-    prev->next          = entry;
-    list->prev          = entry;
+// Index of the least significant set bit in a non-zero bitmap word.
+__attribute__((always_inline)) static inline size_t bitmap_word_ctz(size_t word) {
+    if (sizeof(size_t) == 8) {
+        return count_trailing_unset_bits64(word);
+    } else {
+        return count_trailing_unset_bits32(word);
+    }
 }
 
-__attribute__((always_inline)) static inline void list_remove(buddy_block_t *entry) {
-    entry->in_list      = false;
-    buddy_block_t *prev = entry->prev;
-    buddy_block_t *next = entry->next;
-    prev->next          = next;
-    next->prev          = prev;
+// Mark the block at page `index` of order `order` as free.
+__attribute__((always_inline)) static inline void map_set(memory_pool_t *pool, size_t index, uint8_t order) {
+    buddy_free_map_t *map      = &pool->free_maps[order];
+    size_t            bit      = index >> order;
+    size_t            word     = bit / BITMAP_WORD_BITS;
+    size_t            sum_word = word / BITMAP_WORD_BITS;
+    map->bits[word]           |= (size_t)1 << (bit % BITMAP_WORD_BITS);
+    map->summary[sum_word]    |= (size_t)1 << (word % BITMAP_WORD_BITS);
+    map->count++;
+    pool->free_orders |= (uint32_t)1 << order;
+    if (sum_word < map->hint) {
+        map->hint = sum_word;
+    }
 }
 
-__attribute__((always_inline)) static inline bool list_empty(buddy_block_t *list) {
-    if (list->prev == list) {
-        return true;
+// Mark the block at page `index` of order `order` as not free.
+__attribute__((always_inline)) static inline void map_clear(memory_pool_t *pool, size_t index, uint8_t order) {
+    buddy_free_map_t *map  = &pool->free_maps[order];
+    size_t            bit  = index >> order;
+    size_t            word = bit / BITMAP_WORD_BITS;
+    map->bits[word]       &= ~((size_t)1 << (bit % BITMAP_WORD_BITS));
+    if (!map->bits[word]) {
+        map->summary[word / BITMAP_WORD_BITS] &= ~((size_t)1 << (word % BITMAP_WORD_BITS));
     }
+    if (!--map->count) {
+        pool->free_orders &= ~((uint32_t)1 << order);
+    }
+}
+
+// Whether the block at page `index` of order `order` is free.
+__attribute__((always_inline)) static inline bool map_test(memory_pool_t *pool, size_t index, uint8_t order) {
+    buddy_free_map_t *map = &pool->free_maps[order];
+    size_t            bit = index >> order;
+    return (map->bits[bit / BITMAP_WORD_BITS] >> (bit % BITMAP_WORD_BITS)) & 1;
+}
 
-    return false;
+// Find the lowest free block of order `order`; returns its page index or -1 if there is none.
+__attribute__((always_inline)) static inline ptrdiff_t map_find(memory_pool_t *pool, uint8_t order) {
+    buddy_free_map_t *map = &pool->free_maps[order];
+    if (!map->count) {
+        return -1;
+    }
+    while (!map->summary[map->hint]) {
+        ++map->hint;
+    }
+    size_t word = map->hint * BITMAP_WORD_BITS + bitmap_word_ctz(map->summary[map->hint]);
+    size_t bit  = word * BITMAP_WORD_BITS + bitmap_word_ctz(map->bits[word]);
+    return (ptrdiff_t)(bit << order);
 }
 
 /* Split a block
  *
  * The block we're splitting is always the left-most part, so we can just determine
- * the buddy and place that block on the free list.
+ * the buddy and mark that block as free. If the buddy is a waste block, it is
+ * simply left unmarked.
  */
 
-static void split_block(memory_pool_t *pool, buddy_block_t *block) {
-    --block->order;
-    size_t index       = block_to_index(pool, block);
-    size_t buddy_index = index ^ (1 << block->order); // Get buddy of our new lower order
-
-    buddy_block_t *new_block = index_to_block(pool, buddy_index);
-    new_block->order         = block->order;
+static void split_block(memory_pool_t *pool, size_t index) {
+    uint8_t order       = --pool->blocks[index].order;
+    size_t  buddy_index = index ^ ((size_t)1 << order); // Get buddy of our new lower order
 
-    if (!new_block->is_waste) {
-        list_push_back(&pool->free_lists[new_block->order], new_block); // Place buddy on the free list
-    } else {
-        list_push_back(&pool->waste_list, new_block); // Place buddy on the waste list
+    if (buddy_index < pool->pages) {
+        pool->blocks[buddy_index].order = order;
+        pool->blocks[buddy_index].type  = BLOCK_TYPE_FREE;
+        map_set(pool, buddy_index, order); // Mark buddy as free
     }
 }
 
 /* Try merging a block with its buddy
  *
- * First see if our buddy is free, if it is we remove it the free list
+ * First see if our buddy is free, if it is we clear it from the free bitmap
  * and increase the order of ourselves.
  *
  * Merging only occurs when freeing a block, this means that the block we're starting
- * with is never itself on a free list.
+ * with is never itself marked free.
  *
  * There are 3 possibilities here:
  *
- * - The buddy is free and is to the right of us, in this case we free our buddy,
- *   increse our order and return ourselves.
- * - The buddy is free and is to the left of us, in this case we free our buddy,
- *   switch the block pointer to our buddy, increase that order and then return that.
- * - Our buddy isn't free, we return NULL.
+ * - The buddy is free (or waste) and is to the right of us, in this case we take our
+ *   buddy, increse our order and return ourselves.
+ * - The buddy is free and is to the left of us, in this case we take our buddy,
+ *   switch to our buddy's index, increase that order and then return that.
+ * - Our buddy isn't free, we return -1.
  */
 
-static buddy_block_t *try_merge_buddy(memory_pool_t *pool, buddy_block_t *block) {
-    size_t index       = block_to_index(pool, block);
-    size_t buddy_index = index ^ (1 << block->order);
-
-    if (buddy_index > pool->pages + pool->max_order_waste) {
-        return NULL;
+static ptrdiff_t try_merge_buddy(memory_pool_t *pool, size_t index) {
+    uint8_t order = pool->blocks[index].order;
+    if (order >= pool->max_order) {
+        return -1;
     }
+    size_t buddy_index = index ^ ((size_t)1 << order);
 
-    buddy_block_t *buddy = index_to_block(pool, buddy_index);
-    if (buddy->order == block->order && buddy->in_list) {
-        // list_remove(block); // The block itself is never in a list
-        list_remove(buddy);
-
-        // Return the lowest part as the merged block.
-        buddy_block_t *merged_block = index <= buddy_index ? block : buddy;
-        ++merged_block->order;
-
-        return merged_block;
+    if (buddy_index < pool->pages) {
+        if (!map_test(pool, buddy_index, order)) {
+            return -1;
+        }
+        map_clear(pool, buddy_index, order);
     }
 
-    return NULL;
+    // Return the lowest part as the merged block.
+    size_t merged_index              = index < buddy_index ? index : buddy_index;
+    pool->blocks[merged_index].order = order + 1;
+    pool->blocks[merged_index].type  = BLOCK_TYPE_FREE;
+
+    return (ptrdiff_t)merged_index;
 }
 
 /* Free a block
@@ -242,22 +296,18 @@ static buddy_block_t *try_merge_buddy(memory_pool_t *pool, buddy_block_t *block)
  * In order to free a block we need to recursively try to merge the block
  * until we reach a point where there's no more free buddies to merge with.
  *
- * Finally we push the free, merged, block to our free list.
+ * Finally we mark the free, merged, block in the bitmap of its order.
  */
 
-void free_block(memory_pool_t *pool, buddy_block_t *block) {
-    buddy_block_t *free_block = block;
-
-    while ((block = try_merge_buddy(pool, block))) {
-        free_block = block;
+void free_block(memory_pool_t *pool, size_t index) {
+    ptrdiff_t merged;
+    while ((merged = try_merge_buddy(pool, index)) >= 0) {
+        index = merged;
     }
 
-    if (!free_block->is_waste) {
-        pool->max_order_free = MAX(pool->max_order_free, free_block->order);
-        list_push_back(&pool->free_lists[free_block->order], free_block);
-    } else {
-        list_push_back(&pool->waste_list, free_block);
-    }
+    uint8_t order        = pool->blocks[index].order;
+    pool->max_order_free = MAX(pool->max_order_free, order);
+    map_set(pool, index, order);
 }
 
 void init_pool(void *mem_start, void *mem_end, uint32_t flags) {
@@ -265,88 +315,112 @@ void init_pool(void *mem_start, void *mem_end, uint32_t flags) {
         BADGEROS_MALLOC_MSG_WARN("Out of pools; discarding " FMT_P, mem_start);
         return;
     }
-    size_t  total_pages = (mem_end - mem_start) / PAGE_SIZE;
-    uint8_t orders      = get_order(total_pages);
+    // Metadata is sized for the aligned base, which may be below `mem_start`.
+    void  *base_bound  = ALIGN_DOWN(mem_start, ((size_t)PAGE_SIZE << BUDDY_ALIGN_ORDER));
+    size_t total_pages = (mem_end - base_bound) / PAGE_SIZE;
+    if (total_pages > ((size_t)1 << BUDDY_MAX_ORDER)) {
+        BADGEROS_MALLOC_MSG_WARN("Pool too large; discarding memory after " FMT_ZI " pages", (size_t)1 << BUDDY_MAX_ORDER);
+        total_pages = (size_t)1 << BUDDY_MAX_ORDER;
+        mem_end     = base_bound + total_pages * PAGE_SIZE;
+    }
+    uint8_t orders = get_order(total_pages);
 
-    size_t metadata_block_size      = sizeof(buddy_block_t) * total_pages;
-    size_t metadata_free_lists_size = sizeof(buddy_block_t) * (orders + 1);
+    // Every order has a bitmap and a summary of at least one word each; order 0 has one bit per page.
+    size_t bitmap_words = 0;
+    for (int i = 0; i <= orders; ++i) {
+        size_t words  = (((size_t)1 << (orders - i)) + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS;
+        bitmap_words += words + (words + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS;
+    }
+    size_t metadata_free_maps_size = sizeof(buddy_free_map_t) * (orders + 1);
+    size_t metadata_bitmap_size    = sizeof(size_t) * bitmap_words;
+    size_t metadata_block_size     = sizeof(buddy_block_t) * ((size_t)1 << orders);
 
-    memory_pools[memory_pool_num].free_lists = mem_start;
-    memory_pools[memory_pool_num].blocks =
-        ALIGN_UP(memory_pools[memory_pool_num].free_lists + metadata_free_lists_size, 8);
+    memory_pool_t *pool = &memory_pools[memory_pool_num];
+    pool->free_maps     = mem_start;
+    size_t *bitmaps     = ALIGN_UP((void *)pool->free_maps + metadata_free_maps_size, sizeof(size_t));
+    pool->blocks        = (void *)bitmaps + metadata_bitmap_size;
 
-    void *pages_start = ALIGN_PAGE_UP((void *)memory_pools[memory_pool_num].blocks + metadata_block_size);
+    void *pages_start = ALIGN_PAGE_UP((void *)pool->blocks + metadata_block_size);
     void *pages_end   = ALIGN_PAGE_DOWN(mem_end);
+    void *pages_base  = ALIGN_DOWN(pages_start, ((size_t)PAGE_SIZE << BUDDY_ALIGN_ORDER));
 
-    size_t   pages           = ((size_t)pages_end - (size_t)pages_start) / PAGE_SIZE;
+    size_t   lead            = ((size_t)pages_start - (size_t)pages_base) / PAGE_SIZE;
+    size_t   pages           = ((size_t)pages_end - (size_t)pages_base) / PAGE_SIZE;
     // NOLINTNEXTLINE
-    uint32_t max_order_waste = (1 << orders) - pages;
+    uint32_t max_order_waste = ((size_t)1 << orders) - pages;
 
     BADGEROS_MALLOC_MSG_INFO("Initializing pool " FMT_I, memory_pool_num);
     BADGEROS_MALLOC_MSG_INFO(
         "Found " FMT_ZI " pages, usable " FMT_ZI ", overhead " FMT_ZI,
         total_pages,
-        pages,
-        total_pages - pages
+        pages - lead,
+        total_pages - pages + lead
     );
     BADGEROS_MALLOC_MSG_INFO("Mem start: " FMT_P ", pages_start, " FMT_P, mem_start, pages_start);
     BADGEROS_MALLOC_MSG_INFO("Mem end: " FMT_P ", pages_end, " FMT_P, mem_end, pages_end);
     BADGEROS_MALLOC_MSG_INFO("Max orders: " FMT_I ", max_order_waste: " FMT_I, orders, max_order_waste);
-    BADGEROS_MALLOC_MSG_INFO("Waste starts at: " FMT_ZI, pages - max_order_waste);
+    BADGEROS_MALLOC_MSG_INFO("Waste starts at: " FMT_ZI, pages);
     BADGEROS_MALLOC_MSG_INFO("Metadata block size: " FMT_ZI, metadata_block_size);
-    BADGEROS_MALLOC_MSG_INFO("Metadata free lists size: " FMT_ZI, metadata_free_lists_size);
-
-    memory_pools[memory_pool_num].flags           = flags;
-    memory_pools[memory_pool_num].start           = mem_start;
-    memory_pools[memory_pool_num].end             = mem_end;
-    memory_pools[memory_pool_num].pages_start     = pages_start;
-    memory_pools[memory_pool_num].pages_end       = pages_end;
-    memory_pools[memory_pool_num].pages           = pages;
-    memory_pools[memory_pool_num].free_pages      = pages;
-    memory_pools[memory_pool_num].max_order       = orders;
-    memory_pools[memory_pool_num].max_order_waste = max_order_waste;
+    BADGEROS_MALLOC_MSG_INFO("Metadata bitmap size: " FMT_ZI, metadata_bitmap_size);
+
+    pool->flags           = flags;
+    pool->start           = mem_start;
+    pool->end             = mem_end;
+    pool->pages_start     = pages_start;
+    pool->pages_end       = pages_end;
+    pool->pages_base      = pages_base;
+    pool->pages           = pages;
+    pool->free_pages      = pages - lead;
+    pool->max_order       = orders;
+    pool->max_order_waste = max_order_waste;
 
     // Zero out all of our metadata
-    __builtin_memset(memory_pools[memory_pool_num].start, 0, pages_start - mem_start); // NOLINT
+    __builtin_memset(pool->start, 0, pages_start - mem_start); // NOLINT
 
-    // Initialize our free lists to be empty
+    // Initialize our free bitmaps to be empty
     for (int i = 0; i <= orders; ++i) {
-        list_init(&memory_pools[memory_pool_num].free_lists[i]);
+        pool->free_maps[i].words    = (((size_t)1 << (orders - i)) + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS;
+        pool->free_maps[i].bits     = bitmaps;
+        bitmaps                    += pool->free_maps[i].words;
+        pool->free_maps[i].summary  = bitmaps;
+        bitmaps                    += (pool->free_maps[i].words + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS;
     }
-    list_init(&memory_pools[memory_pool_num].waste_list);
 
-    // Mark all of our waste pages as unusable
-    for (size_t i = pages - max_order_waste; i < total_pages; ++i) {
-        memory_pools[memory_pool_num].blocks[i].is_waste = true;
+    // Create the largest aligned free blocks that cover all available pages
+    for (size_t index = lead; index < ((size_t)1 << orders);) {
+        uint8_t order = orders;
+        while (index & (((size_t)1 << order) - 1)) {
+            --order;
+        }
+        pool->blocks[index].order = order;
+        pool->blocks[index].type  = BLOCK_TYPE_FREE;
+        if (index < pages) {
+            map_set(pool, index, order);
+        }
+        index += (size_t)1 << order;
     }
-
-    // Create free block of all available pages
-    memory_pools[memory_pool_num].blocks[0].order = orders;
-    memory_pools[memory_pool_num].blocks[0].next  = &memory_pools[memory_pool_num].blocks[0];
-    memory_pools[memory_pool_num].blocks[0].prev  = &memory_pools[memory_pool_num].blocks[0];
-
-    // Push free block to the free list
-    list_push_back(&memory_pools[memory_pool_num].free_lists[orders], &memory_pools[memory_pool_num].blocks[0]);
-    memory_pools[memory_pool_num].max_order_free = orders;
+    pool->max_order_free = pool->free_orders ? 31 - count_leading_unset_bits32(pool->free_orders) : 0;
     ++memory_pool_num;
+
+    alloc_stats.total_pages    += pages - lead;
+    alloc_stats.free_pages     += pages - lead;
+    alloc_stats.min_free_pages  = alloc_stats.free_pages;
 }
 
 #ifndef BADGEROS_KERNEL
-void print_list(memory_pool_t *pool, buddy_block_t *list, size_t *total) {
-    size_t         blocks     = 0;
-    size_t         list_total = 0;
-    buddy_block_t *block      = list;
-    while (block) {
-        if (block->prev == list) {
-            break;
+void print_order(memory_pool_t *pool, uint8_t order, size_t *total) {
+    buddy_free_map_t *map        = &pool->free_maps[order];
+    size_t            list_total = 0;
+    for (size_t w = 0; w < map->words; ++w) {
+        for (size_t word = map->bits[w]; word; word &= word - 1) {
+            size_t index = (w * BITMAP_WORD_BITS + bitmap_word_ctz(word)) << order;
+            size_t end   = MIN(index + ((size_t)1 << order), pool->pages);
+            list_total  += end - index;
+            printf("(%zi) ", index);
         }
-        ++blocks;
-        block       = block->prev;
-        list_total += 1 << block->order;
-        printf("(%zi) ", block_to_index(pool, block));
     }
     *total += list_total;
-    printf("%zu blocks (%zi pages)\n", blocks, list_total);
+    printf("%zu blocks (%zi pages)\n", map->count, list_total);
 }
 
 void print_allocator() {
@@ -357,48 +431,74 @@ void print_allocator() {
         size_t total = 0;
         for (int i = 0; i <= pool->max_order; ++i) {
             printf("Order %i, ", i);
-            print_list(pool, &pool->free_lists[i], &total);
+            print_order(pool, i, &total);
         }
 
-        printf("Waste: ");
-        print_list(pool, &pool->waste_list, &total);
+        printf("Waste: %" PRIu32 " pages\n", pool->max_order_waste);
 
         printf(
             "Total free pages: (calculated) %zi (stored) %zi max_order_free: %i\n",
-            total - pool->max_order_waste,
+            total,
             pool->free_pages,
             pool->max_order_free
         );
     }
 }
+
+void print_stats_class(char const *name, int index, memstats_class_t const *cls) {
+    if (!cls->allocs && !cls->failures) {
+        return;
+    }
+    printf(
+        "%s %i: allocs %" PRIu64 ", frees %" PRIu64 ", failures %" PRIu64 ", in use %" PRIu64 ", peak %" PRIu64 "\n",
+        name,
+        index,
+        cls->allocs,
+        cls->frees,
+        cls->failures,
+        cls->in_use,
+        cls->peak
+    );
+}
+
+void print_allocator_stats() {
+    for (int i = 0; i < MEMSTATS_SLAB_CLASSES; ++i) {
+        print_stats_class("Slab", 32 << i, &alloc_stats.slab[i]);
+    }
+    for (int i = 0; i < MEMSTATS_BUDDY_ORDERS; ++i) {
+        print_stats_class("Order", i, &alloc_stats.buddy[i]);
+    }
+    printf(
+        "Pages: total %" PRIu64 ", free %" PRIu64 ", min free %" PRIu64 "\n",
+        alloc_stats.total_pages,
+        alloc_stats.free_pages,
+        alloc_stats.min_free_pages
+    );
+}
 #endif
 
 /* Find a suitable block
  *
- * We start by looking at the first block of the appropriate order, if we get a block
- * we validate that the allocation of the desired number of pages doesn't go into
- * a waste page. If it does we try all other pages of that order until we find one
- * that will suit our needs.
+ * We take the lowest free block of the appropriate order or higher. Only the highest
+ * free block of any order can run into the waste pages, and if it does there is no
+ * other free block of that order, so we validate that the allocation of the desired
+ * number of pages doesn't go into a waste page and otherwise try the next order.
  */
 
-__attribute__((always_inline)) static inline buddy_block_t *
+__attribute__((always_inline)) static inline ptrdiff_t
     pool_find_block(memory_pool_t *pool, uint8_t allocation_order, size_t pages) {
-    for (uint8_t a = allocation_order; a <= pool->max_order; ++a) {
-        buddy_block_t *list  = &pool->free_lists[a];
-        buddy_block_t *block = list;
-
-        while (block->prev != list) {
-            block                             = block->prev;
-            buddy_block_t *request_last_block = index_to_block(pool, (block_to_index(pool, block) + pages) - 1);
-
-            if (!request_last_block->is_waste) {
-                list_remove(block);
-                return block;
-            }
+    uint32_t orders = pool->free_orders >> allocation_order << allocation_order;
+    while (orders) {
+        uint8_t   a     = count_trailing_unset_bits32(orders);
+        ptrdiff_t index = map_find(pool, a);
+        if ((size_t)index + pages <= pool->pages) {
+            map_clear(pool, index, a);
+            return index;
         }
+        orders &= orders - 1;
     }
 
-    return NULL;
+    return -1;
 }
 
 /* Allocation
@@ -407,7 +507,7 @@ __attribute__((always_inline)) static inline buddy_block_t *
  * the allocation request (in pages). This block might be too big.
  *
  * If the block is too big we split it by lowering the order of the block
- * we got, and then placing its buddy on the free list of that order.
+ * we got, and then marking its buddy free in the bitmap of that order.
  *
  * We split in a loop until we have a block of the appropriate size. Splitting
  * all the way to the size we need, but never any smaller.
@@ -423,7 +523,7 @@ void *buddy_allocate(size_t size, enum block_type type, uint32_t flags) {
     size_t         pages                     = (size + (PAGE_SIZE - 1)) / PAGE_SIZE;
     uint8_t        allocation_order          = get_order(pages);
     uint8_t        original_allocation_order = allocation_order;
-    buddy_block_t *block                     = NULL;
+    ptrdiff_t      index                     = -1;
     memory_pool_t *pool                      = NULL;
 
     BADGEROS_MALLOC_MSG_DEBUG(
@@ -441,35 +541,38 @@ void *buddy_allocate(size_t size, enum block_type type, uint32_t flags) {
 
         if (allocation_order == pool->max_order) {
             // NOLINTNEXTLINE
-            if (size > (1 << allocation_order) - pool->max_order_waste) {
+            if (pages > ((size_t)1 << allocation_order) - pool->max_order_waste) {
                 BADGEROS_MALLOC_MSG_WARN("buddy_allocate(" FMT_ZI ") = NULL (Allocation too large)", size);
                 continue;
             }
         }
 
-        block = pool_find_block(pool, allocation_order, pages);
-        if (block)
+        index = pool_find_block(pool, allocation_order, pages);
+        if (index >= 0)
             break;
     }
 
-    if (!pool || !block) {
+    if (!pool || index < 0) {
         BADGEROS_MALLOC_MSG_WARN("buddy_allocate(" FMT_ZI ") = NULL (OOM) no pool", size);
+        order_stats(original_allocation_order)->failures++;
         return NULL;
     }
 
-    if (block->order != original_allocation_order) {
-        while (block->order > original_allocation_order) {
-            split_block(pool, block);
-        }
+    buddy_block_t *block = index_to_block(pool, index);
+    while (block->order > original_allocation_order) {
+        split_block(pool, index);
     }
 
-    while (pool->max_order_free && list_empty(&pool->free_lists[pool->max_order_free])) {
-        if (pool->max_order_free)
-            --pool->max_order_free;
-    }
+    pool->max_order_free = pool->free_orders ? 31 - count_leading_unset_bits32(pool->free_orders) : 0;
 
     pool->free_pages -= (1 << block->order);
     block->type       = type;
+
+    alloc_stats_add(order_stats(block->order), (1 << block->order) * PAGE_SIZE);
+    alloc_stats.free_pages -= (1 << block->order);
+    if (alloc_stats.free_pages < alloc_stats.min_free_pages) {
+        alloc_stats.min_free_pages = alloc_stats.free_pages;
+    }
     void *retval      = block_to_address(pool, block);
 
     BADGEROS_MALLOC_MSG_DEBUG("buddy_allocate(" FMT_ZI ") returning " FMT_P, size, retval);
@@ -503,8 +606,8 @@ __attribute__((always_inline)) static inline buddy_block_t *buddy_get_block(void
 /* Deallocation
  *
  * We deallocate by recursively checking for each block whether its buddy is free.
- * If the buddy is free (that is, it is on our free list) then we remove the buddy
- * from the free list and increase our order (doubling our size) until there
+ * If the buddy is free (that is, it is set in the bitmap of its order) then we clear
+ * the buddy from the bitmap and increase our order (doubling our size) until there
  * are no more buddies free.
  *
  * This means that at any time we have the largest possible allocation available.
@@ -522,7 +625,11 @@ void buddy_deallocate(void *ptr) {
 
     pool->free_pages += (1 << block->order);
     block->type       = BLOCK_TYPE_FREE;
-    free_block(pool, block);
+
+    alloc_stats_sub(order_stats(block->order), (1 << block->order) * PAGE_SIZE);
+    alloc_stats.free_pages += (1 << block->order);
+
+    free_block(pool, block_to_index(pool, block));
 }
 
 void *buddy_reallocate(void *ptr, size_t size) {
@@ -0,0 +1,67 @@
+// SPDX-License-Identifier: MIT
+
+// Host stand-in for the badgelib array helpers that vmalloc.c uses, used by vmalloc-test.c.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef int (*array_sort_comp_t)(void const *a, void const *b);
+
+typedef struct {
+    // Index of the match, or where it would be inserted.
+    size_t index;
+    // Whether a match was found.
+    bool   found;
+} array_binsearch_t;
+
+static inline array_binsearch_t
+    array_binsearch(void const *array, size_t ent_size, size_t len, void const *value, array_sort_comp_t comp) {
+    size_t lo = 0, hi = len;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        int    res = comp((char const *)array + mid * ent_size, value);
+        if (res == 0) {
+            return (array_binsearch_t){mid, true};
+        } else if (res < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return (array_binsearch_t){lo, false};
+}
+
+static inline bool array_lencap_sorted_insert(
+    void *array_ptr, size_t ent_size, size_t *len, size_t *cap, void const *ent, array_sort_comp_t comp
+) {
+    char **array = array_ptr;
+    if (*len >= *cap) {
+        size_t new_cap = *cap ? *cap * 2 : 4;
+        void  *mem     = realloc(*array, new_cap * ent_size);
+        if (!mem) {
+            return false;
+        }
+        *array = mem;
+        *cap   = new_cap;
+    }
+    size_t idx = array_binsearch(*array, ent_size, *len, ent, comp).index;
+    memmove(*array + (idx + 1) * ent_size, *array + idx * ent_size, (*len - idx) * ent_size);
+    memcpy(*array + idx * ent_size, ent, ent_size);
+    ++*len;
+    return true;
+}
+
+static inline void
+    array_lencap_remove(void *array_ptr, size_t ent_size, size_t *len, size_t *cap, void *ent_out, size_t idx) {
+    (void)cap;
+    char **array = array_ptr;
+    if (ent_out) {
+        memcpy(ent_out, *array + idx * ent_size, ent_size);
+    }
+    memmove(*array + idx * ent_size, *array + (idx + 1) * ent_size, (*len - idx - 1) * ent_size);
+    --*len;
+}
@@ -0,0 +1,17 @@
+// SPDX-License-Identifier: MIT
+
+// Host stand-in for the kernel assertions, used by vmalloc-test.c.
+
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define assert_always(cond)                                                                                            \
+    do {                                                                                                               \
+        if (!(cond)) {                                                                                                 \
+            fprintf(stderr, "%s:%d: Assertion failed: %s\n", __FILE__, __LINE__, #cond);                              \
+            abort();                                                                                                   \
+        }                                                                                                              \
+    } while (0)
+#define assert_dev_drop(cond) assert_always(cond)
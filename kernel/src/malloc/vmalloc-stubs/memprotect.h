@@ -0,0 +1,38 @@
+// SPDX-License-Identifier: MIT
+
+// Host stand-in for the memory protection driver, implemented by vmalloc-test.c.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define MEMPROTECT_FLAG_R  0x00000001
+#define MEMPROTECT_FLAG_W  0x00000002
+#define MEMPROTECT_FLAG_RW 0x00000003
+
+typedef struct {
+    int dummy;
+} mpu_ctx_t;
+
+typedef struct {
+    // Memory protection flags.
+    uint32_t flags;
+    // Physical address.
+    size_t   paddr;
+    // Page base vaddr.
+    size_t   page_vaddr;
+    // Page base paddr.
+    size_t   page_paddr;
+    // Page size.
+    size_t   page_size;
+} virt2phys_t;
+
+extern mpu_ctx_t mpu_global_ctx;
+
+virt2phys_t memprotect_virt2phys(mpu_ctx_t *ctx, size_t vaddr);
+size_t      memprotect_alloc_vaddr(size_t len);
+void        memprotect_free_vaddr(size_t vaddr);
+bool        memprotect_k(size_t vaddr, size_t paddr, size_t length, uint32_t flags);
+void        memprotect_commit(mpu_ctx_t *ctx);
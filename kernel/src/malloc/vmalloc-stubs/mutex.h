@@ -0,0 +1,49 @@
+// SPDX-License-Identifier: MIT
+
+// Host stand-in for the kernel mutex, used by vmalloc-test.c.
+// The test is single-threaded, so this only checks that locking is balanced and never recursive.
+
+#pragma once
+
+#include "assertions.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TIMESTAMP_US_MAX    INT64_MAX
+#define MUTEX_T_INIT_SHARED ((mutex_t){0})
+
+typedef int64_t timestamp_us_t;
+
+typedef struct {
+    // Exclusive holders, or -1 per shared holder.
+    int held;
+} mutex_t;
+
+static inline bool mutex_acquire(void *ec, mutex_t *mutex, timestamp_us_t timeout) {
+    (void)ec, (void)timeout;
+    assert_always(mutex->held == 0);
+    mutex->held = 1;
+    return true;
+}
+
+static inline bool mutex_release(void *ec, mutex_t *mutex) {
+    (void)ec;
+    assert_always(mutex->held == 1);
+    mutex->held = 0;
+    return true;
+}
+
+static inline bool mutex_acquire_shared(void *ec, mutex_t *mutex, timestamp_us_t timeout) {
+    (void)ec, (void)timeout;
+    assert_always(mutex->held <= 0);
+    mutex->held--;
+    return true;
+}
+
+static inline bool mutex_release_shared(void *ec, mutex_t *mutex) {
+    (void)ec;
+    assert_always(mutex->held < 0);
+    mutex->held++;
+    return true;
+}
@@ -0,0 +1,12 @@
+// SPDX-License-Identifier: MIT
+
+// Host stand-in for the physical page allocator, implemented by vmalloc-test.c.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+size_t phys_page_alloc(size_t page_count, bool for_user);
+bool   phys_page_ref(size_t ppn);
+bool   phys_page_unref(size_t ppn);
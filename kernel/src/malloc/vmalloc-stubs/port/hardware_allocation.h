@@ -0,0 +1,8 @@
+// SPDX-License-Identifier: MIT
+
+// Host stand-in for the port memory layout, used by vmalloc-test.c.
+
+#pragma once
+
+#define MEMMAP_VMEM      1
+#define MEMMAP_PAGE_SIZE 4096
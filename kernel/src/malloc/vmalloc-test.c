@@ -0,0 +1,382 @@
+// SPDX-License-Identifier: MIT
+
+/* Host test for vmalloc.c
+ *
+ * Runs the real kernel vmalloc against stand-ins for the page allocator and the
+ * memory protection driver. Physical memory is a memfd and `memprotect_k` really
+ * maps its pages into a reserved range of the test's address space, so moving
+ * pages between virtual ranges has to preserve their contents just like in the
+ * kernel. The stand-ins also check the rules vmalloc relies on: a page is only
+ * freed after its unmapping has been committed, and a virtual range is only
+ * released once nothing is mapped in it anymore.
+ */
+
+#define _GNU_SOURCE
+#include "assertions.h"
+#include "memprotect.h"
+#include "page_alloc.h"
+#include "port/hardware_allocation.h"
+#include "vmalloc.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define PAGE_SIZE    MEMMAP_PAGE_SIZE
+// Number of physical pages.
+#define PHYS_PAGES   2048
+// Number of pages of virtual address space.
+#define VIRT_PAGES   (1 << 18)
+// Maximum number of unmapped pages waiting for `memprotect_commit`.
+#define STALE_PAGES  1024
+// Maximum number of live virtual ranges.
+#define VIRT_RANGES  256
+// Number of buffers for `random_test`.
+#define RANDOM_BUFS  64
+// Number of operations for `random_test`.
+#define RANDOM_STEPS 4096
+
+#define CHECK(cond)                                                                                                    \
+    do {                                                                                                               \
+        if (!(cond)) {                                                                                                 \
+            printf("%s:%d: Check failed: %s\n", __FILE__, __LINE__, #cond);                                            \
+            return 1;                                                                                                  \
+        }                                                                                                              \
+    } while (0)
+
+// Mapping of a virtual page.
+typedef struct {
+    // Physical page number, 0 if unmapped.
+    size_t ppn;
+    // Unmapped, but not committed yet.
+    bool   stale;
+} vpage_t;
+
+// Virtual range handed out by `memprotect_alloc_vaddr`.
+typedef struct {
+    // First virtual page.
+    size_t start;
+    // Number of pages.
+    size_t pages;
+} vrange_t;
+
+mpu_ctx_t mpu_global_ctx;
+
+// Physical memory.
+static int      phys_fd;
+// Direct mapping of physical memory, used to zero pages.
+static char    *phys_mem;
+// References to each physical page; page number 0 is never handed out.
+static size_t   phys_refs[PHYS_PAGES + 1];
+// Number of virtual pages mapping each physical page, including ones waiting for `memprotect_commit`.
+static size_t   phys_maps[PHYS_PAGES + 1];
+// Number of allocated physical pages.
+static size_t   phys_used;
+// Number of allocations that may still succeed, or -1 for no limit.
+static long     phys_limit = -1;
+// Reserved virtual address space.
+static char    *virt_base;
+// Mapping of each virtual page.
+static vpage_t  vpages[VIRT_PAGES];
+// Virtual pages unmapped since the last `memprotect_commit`.
+static size_t   stale[STALE_PAGES];
+// Number of entries in `stale`.
+static size_t   stale_len;
+// Live virtual ranges.
+static vrange_t vranges[VIRT_RANGES];
+// Number of live virtual ranges.
+static size_t   vranges_len;
+// Next virtual page to hand out; ranges are never reused so stale accesses fault.
+static size_t   virt_next;
+
+
+
+size_t phys_page_alloc(size_t page_count, bool for_user) {
+    (void)for_user;
+    if (page_count != 1 || phys_limit == 0) {
+        return 0;
+    }
+    for (size_t ppn = 1; ppn <= PHYS_PAGES; ppn++) {
+        if (!phys_refs[ppn]) {
+            phys_refs[ppn] = 1;
+            phys_used++;
+            phys_limit -= phys_limit > 0;
+            memset(phys_mem + (ppn - 1) * PAGE_SIZE, 0, PAGE_SIZE);
+            return ppn;
+        }
+    }
+    return 0;
+}
+
+bool phys_page_ref(size_t ppn) {
+    assert_always(ppn && ppn <= PHYS_PAGES && phys_refs[ppn]);
+    phys_refs[ppn]++;
+    return true;
+}
+
+bool phys_page_unref(size_t ppn) {
+    assert_always(ppn && ppn <= PHYS_PAGES && phys_refs[ppn]);
+    if (--phys_refs[ppn]) {
+        return false;
+    }
+    // The page must not be reachable through any mapping or unflushed TLB entry anymore.
+    assert_always(!phys_maps[ppn]);
+    phys_used--;
+    return true;
+}
+
+virt2phys_t memprotect_virt2phys(mpu_ctx_t *ctx, size_t vaddr) {
+    (void)ctx;
+    size_t page = (vaddr - (size_t)virt_base) / PAGE_SIZE;
+    assert_always(vaddr >= (size_t)virt_base && page < VIRT_PAGES);
+    if (!vpages[page].ppn || vpages[page].stale) {
+        return (virt2phys_t){0};
+    }
+    return (virt2phys_t){
+        .flags      = MEMPROTECT_FLAG_RW,
+        .paddr      = vpages[page].ppn * PAGE_SIZE + vaddr % PAGE_SIZE,
+        .page_vaddr = vaddr / PAGE_SIZE * PAGE_SIZE,
+        .page_paddr = vpages[page].ppn * PAGE_SIZE,
+        .page_size  = PAGE_SIZE,
+    };
+}
+
+size_t memprotect_alloc_vaddr(size_t len) {
+    size_t pages = (len + PAGE_SIZE - 1) / PAGE_SIZE;
+    assert_always(vranges_len < VIRT_RANGES && virt_next + pages + 1 <= VIRT_PAGES);
+    vranges[vranges_len++]  = (vrange_t){virt_next, pages};
+    size_t vaddr            = (size_t)virt_base + virt_next * PAGE_SIZE;
+    // Leave a guard page between ranges.
+    virt_next              += pages + 1;
+    return vaddr;
+}
+
+void memprotect_free_vaddr(size_t vaddr) {
+    size_t start = (vaddr - (size_t)virt_base) / PAGE_SIZE;
+    for (size_t i = 0; i < vranges_len; i++) {
+        if (vranges[i].start == start) {
+            for (size_t j = 0; j < vranges[i].pages; j++) {
+                assert_always(!vpages[start + j].ppn);
+            }
+            vranges[i] = vranges[--vranges_len];
+            return;
+        }
+    }
+    assert_always(!"Freed a virtual range that wasn't allocated");
+}
+
+bool memprotect_k(size_t vaddr, size_t paddr, size_t length, uint32_t flags) {
+    assert_always(vaddr % PAGE_SIZE == 0 && paddr % PAGE_SIZE == 0 && length % PAGE_SIZE == 0);
+    for (size_t off = 0; off < length; off += PAGE_SIZE) {
+        size_t page = (vaddr + off - (size_t)virt_base) / PAGE_SIZE;
+        assert_always(vaddr + off >= (size_t)virt_base && page < VIRT_PAGES);
+        void *addr = virt_base + page * PAGE_SIZE;
+        if (flags) {
+            size_t ppn = (paddr + off) / PAGE_SIZE;
+            assert_always(ppn && ppn <= PHYS_PAGES && phys_refs[ppn] && !vpages[page].ppn);
+            vpages[page] = (vpage_t){ppn, false};
+            phys_maps[ppn]++;
+            off_t offset = (off_t)(ppn - 1) * PAGE_SIZE;
+            addr         = mmap(addr, PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, phys_fd, offset);
+        } else {
+            if (vpages[page].ppn && !vpages[page].stale) {
+                assert_always(stale_len < STALE_PAGES);
+                vpages[page].stale = true;
+                stale[stale_len++] = page;
+            }
+            addr = mmap(addr, PAGE_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0);
+        }
+        assert_always(addr != MAP_FAILED);
+    }
+    return true;
+}
+
+void memprotect_commit(mpu_ctx_t *ctx) {
+    assert_always(ctx == &mpu_global_ctx);
+    for (size_t i = 0; i < stale_len; i++) {
+        phys_maps[vpages[stale[i]].ppn]--;
+        vpages[stale[i]] = (vpage_t){0};
+    }
+    stale_len = 0;
+}
+
+
+
+// Fill a buffer with a pattern derived from `seed`.
+static void fill(void *buf, size_t len, unsigned seed) {
+    for (size_t i = 0; i < len; i++) {
+        ((uint8_t *)buf)[i] = (uint8_t)(seed * 31 + i * 7 + i / PAGE_SIZE);
+    }
+}
+
+// Check that a buffer holds the pattern derived from `seed`.
+static bool check(void const *buf, size_t len, unsigned seed) {
+    for (size_t i = 0; i < len; i++) {
+        if (((uint8_t const *)buf)[i] != (uint8_t)(seed * 31 + i * 7 + i / PAGE_SIZE)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Check that a buffer is all zeroes.
+static bool zeroed(void const *buf, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (((uint8_t const *)buf)[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Allocate, use and free single buffers.
+static int basic_test() {
+    CHECK(vmalloc(0) == NULL);
+    CHECK(vmalloc_size(NULL) == 0);
+    vfree(NULL);
+
+    char *buf = vmalloc(3 * PAGE_SIZE + 1);
+    CHECK(buf);
+    CHECK((size_t)buf % PAGE_SIZE == 0);
+    CHECK(vmalloc_size(buf) == 4 * PAGE_SIZE);
+    CHECK(phys_used == 4);
+    CHECK(zeroed(buf, 4 * PAGE_SIZE));
+    fill(buf, 4 * PAGE_SIZE, 1);
+    CHECK(check(buf, 4 * PAGE_SIZE, 1));
+    vfree(buf);
+    CHECK(phys_used == 0);
+
+    // More pages than `UNMAP_BATCH`, so freeing takes several batches.
+    buf = vmalloc(200 * PAGE_SIZE);
+    CHECK(buf);
+    CHECK(phys_used == 200);
+    fill(buf, 200 * PAGE_SIZE, 2);
+    CHECK(check(buf, 200 * PAGE_SIZE, 2));
+    vfree(buf);
+    CHECK(phys_used == 0);
+    return 0;
+}
+
+// Grow and shrink a buffer and check that its pages are moved rather than copied.
+static int realloc_test() {
+    char *buf = vrealloc(NULL, 4 * PAGE_SIZE);
+    CHECK(buf);
+    fill(buf, 4 * PAGE_SIZE, 3);
+    size_t ppns[4];
+    for (size_t i = 0; i < 4; i++) {
+        ppns[i] = memprotect_virt2phys(NULL, (size_t)buf + i * PAGE_SIZE).page_paddr;
+    }
+
+    char *grown = vrealloc(buf, 40 * PAGE_SIZE);
+    CHECK(grown && grown != buf);
+    CHECK(vmalloc_size(grown) == 40 * PAGE_SIZE);
+    CHECK(phys_used == 40);
+    CHECK(check(grown, 4 * PAGE_SIZE, 3));
+    CHECK(zeroed(grown + 4 * PAGE_SIZE, 36 * PAGE_SIZE));
+    for (size_t i = 0; i < 4; i++) {
+        CHECK(memprotect_virt2phys(NULL, (size_t)grown + i * PAGE_SIZE).page_paddr == ppns[i]);
+        CHECK(memprotect_virt2phys(NULL, (size_t)buf + i * PAGE_SIZE).flags == 0);
+    }
+    CHECK(vmalloc_size(buf) == 0);
+    fill(grown, 40 * PAGE_SIZE, 4);
+
+    char *shrunk = vrealloc(grown, 10 * PAGE_SIZE - 1);
+    CHECK(shrunk == grown);
+    CHECK(vmalloc_size(shrunk) == 10 * PAGE_SIZE);
+    CHECK(phys_used == 10);
+    CHECK(check(shrunk, 10 * PAGE_SIZE, 4));
+    CHECK(memprotect_virt2phys(NULL, (size_t)shrunk + 10 * PAGE_SIZE).flags == 0);
+
+    CHECK(vrealloc(shrunk, 0) == NULL);
+    CHECK(phys_used == 0);
+    return 0;
+}
+
+// Run out of physical pages while allocating and growing, and check that nothing leaks.
+static int oom_test() {
+    phys_limit = 5;
+    CHECK(vmalloc(10 * PAGE_SIZE) == NULL);
+    CHECK(phys_used == 0);
+    CHECK(vranges_len == 0);
+
+    phys_limit = 6;
+    char *buf  = vmalloc(4 * PAGE_SIZE);
+    CHECK(buf);
+    fill(buf, 4 * PAGE_SIZE, 5);
+    CHECK(vrealloc(buf, 8 * PAGE_SIZE) == NULL);
+    CHECK(phys_used == 4);
+    CHECK(vranges_len == 1);
+    CHECK(vmalloc_size(buf) == 4 * PAGE_SIZE);
+    CHECK(check(buf, 4 * PAGE_SIZE, 5));
+
+    phys_limit = -1;
+    vfree(buf);
+    CHECK(phys_used == 0);
+    return 0;
+}
+
+// Randomly allocate, resize and free many buffers, checking their contents throughout.
+static int random_test() {
+    char    *bufs[RANDOM_BUFS]  = {0};
+    size_t   sizes[RANDOM_BUFS] = {0};
+    unsigned seeds[RANDOM_BUFS] = {0};
+    srand(1);
+
+    for (unsigned step = 0; step < RANDOM_STEPS; step++) {
+        size_t i    = rand() % RANDOM_BUFS;
+        size_t size = (rand() % 24 + 1) * PAGE_SIZE - rand() % PAGE_SIZE;
+        if (bufs[i]) {
+            CHECK(check(bufs[i], sizes[i], seeds[i]));
+        }
+        if (!bufs[i] || rand() % 2) {
+            // Allocates if the buffer is NULL.
+            char *mem = vrealloc(bufs[i], size);
+            CHECK(mem);
+            CHECK(vmalloc_size(mem) >= size);
+            if (bufs[i]) {
+                CHECK(check(mem, size < sizes[i] ? size : sizes[i], seeds[i]));
+            }
+            bufs[i] = mem;
+        } else {
+            vfree(bufs[i]);
+            bufs[i] = NULL;
+            continue;
+        }
+        sizes[i] = size;
+        seeds[i] = step;
+        fill(bufs[i], size, step);
+    }
+
+    for (size_t i = 0; i < RANDOM_BUFS; i++) {
+        if (bufs[i]) {
+            CHECK(check(bufs[i], sizes[i], seeds[i]));
+        }
+        vfree(bufs[i]);
+    }
+    CHECK(phys_used == 0);
+    CHECK(vranges_len == 0);
+    return 0;
+}
+
+int main() {
+    phys_fd = memfd_create("phys", 0);
+    if (phys_fd < 0 || ftruncate(phys_fd, PHYS_PAGES * PAGE_SIZE)) {
+        perror("memfd");
+        return 1;
+    }
+    phys_mem  = mmap(NULL, PHYS_PAGES * PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, phys_fd, 0);
+    virt_base = mmap(NULL, VIRT_PAGES * PAGE_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (phys_mem == MAP_FAILED || virt_base == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+
+    if (basic_test() || realloc_test() || oom_test() || random_test()) {
+        return 1;
+    }
+    printf("vmalloc: all tests passed\n");
+    return 0;
+}
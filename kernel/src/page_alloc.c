@@ -4,10 +4,11 @@
 #include "page_alloc.h"
 
 #include "badge_strings.h"
+#include "malloc.h"
 #include "port/hardware_allocation.h"
-#include "static-buddy.h"
 #if MEMMAP_VMEM
 #include "cpu/mmu.h"
+#include "mutex.h"
 #endif
 
 
@@ -15,7 +16,7 @@
 // Allocate pages of physical memory.
 // Uses physical page numbers (paddr / MEMMAP_PAGE_SIZE).
 size_t phys_page_alloc(size_t page_count, bool for_user) {
-    void *mem = buddy_allocate(page_count * MEMMAP_PAGE_SIZE, for_user ? BLOCK_TYPE_USER : BLOCK_TYPE_PAGE, 0);
+    void *mem = heap_alloc_pages(page_count * MEMMAP_PAGE_SIZE, for_user);
     if (!mem) {
         return 0;
     }
@@ -31,9 +32,9 @@ size_t phys_page_alloc(size_t page_count, bool for_user) {
 // Uses physical page numbers (paddr / MEMMAP_PAGE_SIZE).
 size_t phys_page_size(size_t ppn) {
 #if MEMMAP_VMEM
-    return buddy_get_size((void *)(ppn * MEMMAP_PAGE_SIZE + mmu_hhdm_vaddr)) / MEMMAP_PAGE_SIZE;
+    return heap_pages_size((void *)(ppn * MEMMAP_PAGE_SIZE + mmu_hhdm_vaddr)) / MEMMAP_PAGE_SIZE;
 #else
-    return buddy_get_size((void *)(ppn * MEMMAP_PAGE_SIZE)) / MEMMAP_PAGE_SIZE;
+    return heap_pages_size((void *)(ppn * MEMMAP_PAGE_SIZE)) / MEMMAP_PAGE_SIZE;
 #endif
 }
 
@@ -41,8 +42,106 @@ size_t phys_page_size(size_t ppn) {
 // Uses physical page numbers (paddr / MEMMAP_PAGE_SIZE).
 void phys_page_free(size_t ppn) {
 #if MEMMAP_VMEM
-    buddy_deallocate((void *)(ppn * MEMMAP_PAGE_SIZE + mmu_hhdm_vaddr));
+    heap_free_pages((void *)(ppn * MEMMAP_PAGE_SIZE + mmu_hhdm_vaddr));
 #else
-    buddy_deallocate((void *)(ppn * MEMMAP_PAGE_SIZE));
+    heap_free_pages((void *)(ppn * MEMMAP_PAGE_SIZE));
 #endif
 }
+
+#if MEMMAP_VMEM
+// Number of hash buckets for shared block reference counts; must be a power of two.
+#define PAGE_REF_BUCKETS 256
+
+// Reference count of a block of physical pages that is mapped more than once.
+typedef struct phys_page_ref_t phys_page_ref_t;
+struct phys_page_ref_t {
+    // Next shared block in the same hash bucket.
+    phys_page_ref_t *next;
+    // Physical page number of the block.
+    size_t           ppn;
+    // Number of references; always at least 2.
+    size_t           refs;
+};
+
+// Hash bucket of shared blocks with its own lock.
+typedef struct {
+    // Mutex that guards the reference counts in this bucket.
+    mutex_t          mtx;
+    // Shared blocks in this bucket; blocks not in any bucket have one reference.
+    phys_page_ref_t *head;
+} page_ref_bucket_t;
+
+// Shared blocks hashed by physical page number; zero-initialized mutexes are `MUTEX_T_INIT`.
+static page_ref_bucket_t page_ref_table[PAGE_REF_BUCKETS];
+
+// Get the hash bucket for a block.
+static page_ref_bucket_t *page_ref_bucket(size_t ppn) {
+    size_t hash = ppn * 0x9e3779b9;
+    return &page_ref_table[(hash ^ hash >> 16) & (PAGE_REF_BUCKETS - 1)];
+}
+
+// Find the link to the reference count of a block; must be called with the bucket's mutex held.
+// Points to the NULL at the end of the bucket if the block is not shared.
+static phys_page_ref_t **page_ref_find(page_ref_bucket_t *bucket, size_t ppn) {
+    phys_page_ref_t **link = &bucket->head;
+    while (*link && (*link)->ppn != ppn) {
+        link = &(*link)->next;
+    }
+    return link;
+}
+
+// Add a reference to a block of physical pages so it can be mapped more than once.
+// The block is only freed after every reference has been dropped with `phys_page_unref`.
+// Uses physical page numbers (paddr / MEMMAP_PAGE_SIZE).
+bool phys_page_ref(size_t ppn) {
+    page_ref_bucket_t *bucket = page_ref_bucket(ppn);
+    mutex_acquire(NULL, &bucket->mtx, TIMESTAMP_US_MAX);
+    phys_page_ref_t *ref = *page_ref_find(bucket, ppn);
+    bool             ok  = true;
+    if (ref) {
+        ref->refs++;
+    } else {
+        ref = malloc(sizeof(phys_page_ref_t));
+        if (ref) {
+            ref->ppn     = ppn;
+            ref->refs    = 2;
+            ref->next    = bucket->head;
+            bucket->head = ref;
+        } else {
+            ok = false;
+        }
+    }
+    mutex_release(NULL, &bucket->mtx);
+    return ok;
+}
+
+// Drop a reference to a block of physical pages, freeing it if this was the last one.
+// Returns whether the block was freed.
+bool phys_page_unref(size_t ppn) {
+    page_ref_bucket_t *bucket = page_ref_bucket(ppn);
+    mutex_acquire(NULL, &bucket->mtx, TIMESTAMP_US_MAX);
+    phys_page_ref_t **link = page_ref_find(bucket, ppn);
+    phys_page_ref_t  *ref  = *link;
+    if (ref) {
+        if (--ref->refs == 1) {
+            *link = ref->next;
+            free(ref);
+        }
+        mutex_release(NULL, &bucket->mtx);
+        return false;
+    }
+    mutex_release(NULL, &bucket->mtx);
+    phys_page_free(ppn);
+    return true;
+}
+
+// Get the number of references to a block of physical pages; blocks that were never shared have one.
+size_t phys_page_refs(size_t ppn) {
+    page_ref_bucket_t *bucket = page_ref_bucket(ppn);
+    mutex_acquire(NULL, &bucket->mtx, TIMESTAMP_US_MAX);
+    phys_page_ref_t *ref  = *page_ref_find(bucket, ppn);
+    size_t           refs = ref ? ref->refs : 1;
+    mutex_release(NULL, &bucket->mtx);
+    return refs;
+}
+#endif
@@ -0,0 +1,408 @@
+
+// SPDX-License-Identifier: MIT
+
+#include "process/ioring.h"
+
+#include "assertions.h"
+#include "filesystem.h"
+#include "log.h"
+#include "malloc.h"
+#include "memprotect.h"
+#include "process/internal.h"
+#include "process/shm.h"
+#include "process/types.h"
+#include "scheduler/scheduler.h"
+#include "usercopy.h"
+
+#if MEMMAP_VMEM
+#include "cpu/mmu.h"
+#endif
+
+_Static_assert(sizeof(ioring_t) <= MEMMAP_PAGE_SIZE, "I/O ring must fit in one page");
+_Static_assert(FILESYSTEM_PATH_MAX < PROC_IORING_CHUNK, "Paths must fit in the I/O ring buffer");
+
+// Asynchronous I/O ring of a process.
+struct proc_ioring_t {
+    // Process the ring belongs to.
+    process_t  *process;
+    // Memory backing the ring; the kernel holds its own reference so the process can't unmap it from under the worker.
+    shm_t      *shm;
+    // Kernel pointer to the ring.
+    ioring_t   *ring;
+    // Thread that performs the submitted operations.
+    tid_t       worker;
+    // Set to make the worker exit.
+    atomic_bool stop;
+    // Set while the worker is parked; kept here because the process can write the flags in the ring.
+    atomic_bool parked;
+    // Thread waiting in `proc_ioring_wait`, 0 if none.
+    atomic_int  waiter;
+    // Lets one thread at a time wait in `proc_ioring_wait`.
+    mutex_t     wait_mtx;
+    // Index of the next submission; kept here because the process can write the copy in the ring.
+    unsigned    sq_head;
+    // Index of the next completion; kept here because the process can write the copy in the ring.
+    unsigned    cq_tail;
+    // Buffer that data is copied through between files and process memory.
+    uint8_t     buf[PROC_IORING_CHUNK];
+};
+
+
+
+// Whether the submission queue is empty.
+static bool ioring_sq_empty(proc_ioring_t *ioring) {
+    return atomic_load(&ioring->ring->sq_tail) == ioring->sq_head;
+}
+
+// Whether the completion queue is full.
+static bool ioring_cq_full(proc_ioring_t *ioring) {
+    return ioring->cq_tail - atomic_load(&ioring->ring->cq_head) >= IORING_CQ_ENTRIES;
+}
+
+// Park the worker while `blocked` holds, until the process rings the doorbell or the ring is destroyed.
+// `flag` is published in the ring to tell the process that it has to ring the doorbell.
+static void ioring_park(proc_ioring_t *ioring, unsigned flag, bool (*blocked)(proc_ioring_t *)) {
+    atomic_store(&ioring->parked, true);
+    atomic_fetch_or(&ioring->ring->flags, flag);
+    // Checked again after publishing the flag so that a change the process made without ringing isn't missed.
+    if (blocked(ioring) && !atomic_load(&ioring->stop)) {
+        thread_sleep(PROC_IORING_PARK_US);
+    }
+    atomic_fetch_and(&ioring->ring->flags, ~flag);
+    atomic_store(&ioring->parked, false);
+}
+
+// Resume the worker if it is parked.
+static void ioring_wake(proc_ioring_t *ioring) {
+    if (atomic_exchange(&ioring->parked, false)) {
+        thread_resume(NULL, ioring->worker);
+    }
+}
+
+// Acquire the process mutex from the worker.
+// Returns false without acquiring it if the ring is being destroyed, which happens while it is held.
+static bool ioring_lock(proc_ioring_t *ioring) {
+    while (!atomic_load(&ioring->stop)) {
+        if (mutex_acquire(NULL, &ioring->process->mtx, PROC_IORING_LOCK_US)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Copy `len` bytes between the buffer and process memory.
+static bool ioring_usercopy(proc_ioring_t *ioring, size_t user_vaddr, size_t len, bool to_user) {
+    if (!ioring_lock(ioring)) {
+        return false;
+    }
+    bool ok = to_user ? copy_to_user_raw(ioring->process, user_vaddr, ioring->buf, len)
+                      : copy_from_user_raw(ioring->process, ioring->buf, user_vaddr, len);
+    mutex_release(NULL, &ioring->process->mtx);
+    return ok;
+}
+
+// Look up the file behind a file descriptor of the process.
+// Returns -1 if it doesn't exist.
+static file_t ioring_find_fd(proc_ioring_t *ioring, int virt) {
+    if (!ioring_lock(ioring)) {
+        return -1;
+    }
+    file_t fd = proc_find_fd_raw(NULL, ioring->process, virt);
+    mutex_release(NULL, &ioring->process->mtx);
+    return fd;
+}
+
+// Perform an `IORING_OP_OPEN`.
+static long ioring_open(proc_ioring_t *ioring, ioring_sqe_t const *sqe) {
+    process_t *const proc = ioring->process;
+    if (!ioring_lock(ioring)) {
+        return -1;
+    }
+    ptrdiff_t len = strlen_from_user_raw(proc, (size_t)sqe->buf, FILESYSTEM_PATH_MAX + 1);
+    bool      ok  = len >= 0 && len <= FILESYSTEM_PATH_MAX;
+    ok            = ok && copy_from_user_raw(proc, ioring->buf, (size_t)sqe->buf, len);
+    mutex_release(NULL, &proc->mtx);
+    if (!ok) {
+        return -1;
+    }
+    ioring->buf[len] = 0;
+
+    file_t fd = fs_open(NULL, (char const *)ioring->buf, sqe->flags);
+    if (fd < 0) {
+        return -1;
+    }
+    if (!ioring_lock(ioring)) {
+        fs_close(NULL, fd);
+        return -1;
+    }
+    badge_err_t ec;
+    int         virt = proc_add_fd_raw(&ec, proc, fd);
+    mutex_release(NULL, &proc->mtx);
+    if (!badge_err_is_ok(&ec)) {
+        fs_close(NULL, fd);
+        return -1;
+    }
+    return virt;
+}
+
+// Perform an `IORING_OP_CLOSE`.
+static long ioring_close(proc_ioring_t *ioring, ioring_sqe_t const *sqe) {
+    if (!ioring_lock(ioring)) {
+        return -1;
+    }
+    badge_err_t ec;
+    file_t      fd = proc_find_fd_raw(NULL, ioring->process, sqe->fd);
+    proc_remove_fd_raw(&ec, ioring->process, sqe->fd);
+    mutex_release(NULL, &ioring->process->mtx);
+    if (!badge_err_is_ok(&ec)) {
+        return -1;
+    }
+    fs_close(NULL, fd);
+    return 0;
+}
+
+// Perform an `IORING_OP_READ` or `IORING_OP_WRITE`, one buffer's worth at a time.
+static long ioring_rw(proc_ioring_t *ioring, ioring_sqe_t const *sqe, bool write) {
+    file_t fd = ioring_find_fd(ioring, sqe->fd);
+    if (fd == -1 || sqe->len < 0 || sqe->offset < -1) {
+        return -1;
+    }
+
+    long done = 0;
+    while (done < sqe->len) {
+        long        chunk  = sqe->len - done < PROC_IORING_CHUNK ? sqe->len - done : PROC_IORING_CHUNK;
+        size_t      uaddr  = (size_t)sqe->buf + done;
+        fileoff_t   offset = sqe->offset == -1 ? -1 : sqe->offset + done;
+        iovec_t     iov    = {.base = ioring->buf, .len = chunk};
+        badge_err_t ec;
+        fileoff_t   res;
+        if (write) {
+            if (!ioring_usercopy(ioring, uaddr, chunk, false)) {
+                break;
+            }
+            res = fs_writev(&ec, fd, &iov, 1, offset);
+        } else {
+            res = fs_readv(&ec, fd, &iov, 1, offset);
+            if (badge_err_is_ok(&ec) && res > 0 && !ioring_usercopy(ioring, uaddr, res, true)) {
+                break;
+            }
+        }
+        if (!badge_err_is_ok(&ec)) {
+            break;
+        }
+        done += res;
+        if (res < chunk) {
+            break;
+        }
+    }
+
+    // Like the synchronous syscalls, a failure only counts if nothing was transferred.
+    return done || !sqe->len ? done : -1;
+}
+
+// Perform an `IORING_OP_FSYNC`.
+static long ioring_fsync(proc_ioring_t *ioring, ioring_sqe_t const *sqe) {
+    file_t fd = ioring_find_fd(ioring, sqe->fd);
+    if (fd == -1) {
+        return -1;
+    }
+    badge_err_t ec;
+    fs_flush(&ec, fd);
+    return badge_err_is_ok(&ec) ? 0 : -1;
+}
+
+// Perform one submitted operation.
+static long ioring_exec(proc_ioring_t *ioring, ioring_sqe_t const *sqe) {
+    switch (sqe->op) {
+        case IORING_OP_NOP: return 0;
+        case IORING_OP_OPEN: return ioring_open(ioring, sqe);
+        case IORING_OP_CLOSE: return ioring_close(ioring, sqe);
+        case IORING_OP_READ: return ioring_rw(ioring, sqe, false);
+        case IORING_OP_WRITE: return ioring_rw(ioring, sqe, true);
+        case IORING_OP_FSYNC: return ioring_fsync(ioring, sqe);
+        default: return -1;
+    }
+}
+
+// Post a completion, waiting for the process to make room if the queue is full.
+// Returns false if the ring was destroyed while waiting.
+static bool ioring_complete(proc_ioring_t *ioring, uint64_t user_data, long res) {
+    ioring_t *const ring = ioring->ring;
+    while (ioring_cq_full(ioring)) {
+        if (atomic_load(&ioring->stop)) {
+            return false;
+        }
+        ioring_park(ioring, IORING_FLAG_CQ_WAKEUP, ioring_cq_full);
+    }
+    ring->cqes[ioring->cq_tail % IORING_CQ_ENTRIES] = (ioring_cqe_t){.user_data = user_data, .res = res};
+    ioring->cq_tail++;
+    atomic_store(&ring->cq_tail, ioring->cq_tail);
+
+    // The waiter registers again before each sleep, so it is only resumed once per sleep.
+    tid_t waiter = atomic_exchange(&ioring->waiter, 0);
+    if (waiter) {
+        thread_resume(NULL, waiter);
+    }
+    return true;
+}
+
+// Takes submissions from the ring and performs them in order.
+// Polls for a short while after each submission so that a busy process never needs a trap to submit,
+// then parks until the process rings the doorbell.
+static int ioring_worker(void *arg) {
+    proc_ioring_t *const ioring = arg;
+    ioring_t *const      ring   = ioring->ring;
+    timestamp_us_t       last   = time_us();
+
+    while (!atomic_load(&ioring->stop)) {
+        if (ioring_sq_empty(ioring)) {
+            if (time_us() - last < PROC_IORING_SPIN_US) {
+                thread_yield();
+            } else {
+                ioring_park(ioring, IORING_FLAG_SQ_WAKEUP, ioring_sq_empty);
+            }
+            continue;
+        }
+
+        // Copied out first so the process can't change the operation while it is performed.
+        ioring_sqe_t sqe = ring->sqes[ioring->sq_head % IORING_SQ_ENTRIES];
+        ioring->sq_head++;
+        atomic_store_explicit(&ring->sq_head, ioring->sq_head, memory_order_release);
+
+        long res = ioring_exec(ioring, &sqe);
+        if (!ioring_complete(ioring, sqe.user_data, res)) {
+            break;
+        }
+        last = time_us();
+    }
+
+    return 0;
+}
+
+
+
+// Create the asynchronous I/O ring of a process, map it into the process and start its worker.
+// Must be called with the process' mutex held.
+// Returns the virtual address of the ring on success, 0 on failure.
+size_t proc_ioring_setup_raw(badge_err_t *ec, process_t *process, size_t vaddr_req) {
+    if (process->ioring) {
+        badge_err_set(ec, ELOC_PROCESS, ECAUSE_EXISTS);
+        return 0;
+    }
+    proc_ioring_t *ioring = calloc(1, sizeof(proc_ioring_t));
+    if (!ioring) {
+        badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOMEM);
+        return 0;
+    }
+    ioring->process = process;
+    atomic_init(&ioring->stop, false);
+    atomic_init(&ioring->parked, false);
+    atomic_init(&ioring->waiter, 0);
+    mutex_init(NULL, &ioring->wait_mtx, false, false);
+
+    ioring->shm = shm_create_anon(ec, process->pid, sizeof(ioring_t));
+    if (!ioring->shm) {
+        free(ioring);
+        return 0;
+    }
+#if MEMMAP_VMEM
+    ioring->ring = (ioring_t *)(mmu_hhdm_vaddr + ioring->shm->ppns[0] * MEMMAP_PAGE_SIZE);
+#else
+    ioring->ring = (ioring_t *)(ioring->shm->ppn * MEMMAP_PAGE_SIZE);
+#endif
+
+    // The mapping takes over a reference of its own.
+    shm_ref(ioring->shm);
+    mutex_acquire(NULL, &process->memmap.mtx, TIMESTAMP_US_MAX);
+    size_t vaddr = proc_map_shm_raw(ec, process, ioring->shm, vaddr_req, MEMPROTECT_FLAG_RW);
+    mutex_release(NULL, &process->memmap.mtx);
+    if (!vaddr) {
+        shm_unref(ioring->shm);
+        shm_unref(ioring->shm);
+        free(ioring);
+        return 0;
+    }
+
+    ioring->worker = thread_new_kernel(ec, "ioring", ioring_worker, ioring, SCHED_PRIO_NORMAL);
+    if (badge_err_is_ok(ec)) {
+        thread_resume(ec, ioring->worker);
+    }
+    if (!badge_err_is_ok(ec)) {
+        mutex_acquire(NULL, &process->memmap.mtx, TIMESTAMP_US_MAX);
+        proc_unmap_raw(NULL, process, vaddr);
+        mutex_release(NULL, &process->memmap.mtx);
+        shm_unref(ioring->shm);
+        free(ioring);
+        return 0;
+    }
+
+    process->ioring = ioring;
+    logkf(LOG_INFO, "Created I/O ring at %{size;x} for process %{d}", vaddr, process->pid);
+    return vaddr;
+}
+
+// Wait until at least `min_complete` completions are in a ring or `timeout` has passed.
+// Returns the number of completions available.
+unsigned proc_ioring_wait(proc_ioring_t *ioring, unsigned min_complete, timestamp_us_t timeout) {
+    ioring_t *const ring = ioring->ring;
+    // Every wait doubles as the doorbell of a parked worker.
+    ioring_wake(ioring);
+    unsigned avail = atomic_load(&ring->cq_tail) - atomic_load(&ring->cq_head);
+    if (avail >= min_complete) {
+        return avail;
+    }
+
+    timestamp_us_t now      = time_us();
+    timestamp_us_t deadline = timeout < 0 || timeout > TIMESTAMP_US_MAX - now ? TIMESTAMP_US_MAX : now + timeout;
+    if (!mutex_acquire(NULL, &ioring->wait_mtx, deadline == TIMESTAMP_US_MAX ? TIMESTAMP_US_MAX : deadline - now)) {
+        return atomic_load(&ring->cq_tail) - atomic_load(&ring->cq_head);
+    }
+    tid_t const self = sched_current_tid();
+    while (1) {
+        // Registered before checking so that a completion posted in between resumes this thread.
+        atomic_store(&ioring->waiter, self);
+        avail = atomic_load(&ring->cq_tail) - atomic_load(&ring->cq_head);
+        now   = time_us();
+        // A process that is being killed waits for this thread to return, so it must not wait forever.
+        if (avail >= min_complete || now >= deadline || (atomic_load(&ioring->process->flags) & PROC_EXITING)) {
+            break;
+        }
+        thread_sleep(deadline - now < PROC_IORING_PARK_US ? deadline - now : PROC_IORING_PARK_US);
+    }
+    atomic_store(&ioring->waiter, 0);
+    mutex_release(NULL, &ioring->wait_mtx);
+    return avail;
+}
+
+// Wake the thread waiting on the ring of a process so it notices the process is exiting; does nothing if it has none.
+// Must be called with the process' mutex held.
+void proc_ioring_interrupt_raw(process_t *process) {
+    proc_ioring_t *ioring = process->ioring;
+    if (!ioring) {
+        return;
+    }
+    tid_t waiter = atomic_exchange(&ioring->waiter, 0);
+    if (waiter) {
+        thread_resume(NULL, waiter);
+    }
+}
+
+// Stop the worker and release the ring of a process; does nothing if the process has none.
+// Must be called with the process' mutex held, after all threads of the process have stopped.
+void proc_ioring_destroy_raw(process_t *process) {
+    proc_ioring_t *ioring = process->ioring;
+    if (!ioring) {
+        return;
+    }
+    process->ioring = NULL;
+
+    // The worker can't take the process mutex anymore, so it exits after the operation it is performing.
+    atomic_store(&ioring->stop, true);
+    ioring_wake(ioring);
+    thread_join(ioring->worker);
+
+    // The process' mapping of the ring is released along with the rest of its memory.
+    shm_unref(ioring->shm);
+    mutex_destroy(NULL, &ioring->wait_mtx);
+    free(ioring);
+}
@@ -11,12 +11,30 @@
 #include "process/process.h"
 #include "process/types.h"
 #include "usercopy.h"
+#include "vmalloc.h"
 #if MEMMAP_VMEM
 #include "cpu/mmu.h"
 #endif
 
 #include <kbelf.h>
 
+// Size of the buffer used for small reads while loading an executable.
+#define KBELFX_BUF_SIZE 512
+
+// Executable file opened by `kbelfx_open`.
+typedef struct {
+    // Kernel file handle.
+    file_t    fd;
+    // Current read position.
+    fileoff_t pos;
+    // Offset in the file of the first byte in `buf`.
+    fileoff_t buf_off;
+    // Number of valid bytes in `buf`.
+    fileoff_t buf_len;
+    // Buffered file data.
+    char      buf[KBELFX_BUF_SIZE];
+} kbelfx_file_t;
+
 
 
 // Measure the length of `str`.
@@ -97,16 +115,20 @@ bool kbelfx_seg_alloc(kbelf_inst inst, size_t segs_len, kbelf_segment *segs) {
         // logkf(LOG_DEBUG, "Segment %{size;d}: %{size;x} - %{size;x}", i, start, end);
     }
     // logkf(LOG_DEBUG, "Require %{size;d} bytes", max_addr - min_addr);
+    if (kbelf_inst_is_pie(inst)) {
+        min_align = proc_map_align(max_addr - min_addr, min_align);
+    }
 
+    mutex_acquire(NULL, &proc->memmap.mtx, TIMESTAMP_US_MAX);
     size_t vaddr_real = proc_map_raw(NULL, proc, min_addr, max_addr - min_addr, min_align, MEMPROTECT_FLAG_RWX);
-    if (!vaddr_real)
-        return false;
-
-    if (!kbelf_inst_is_pie(inst) && vaddr_real != min_addr) {
+    if (vaddr_real && !kbelf_inst_is_pie(inst) && vaddr_real != min_addr) {
         logkf(LOG_ERROR, "Unable to satify virtual address request for non-PIE executable");
         proc_unmap_raw(NULL, proc, vaddr_real);
-        return false;
+        vaddr_real = 0;
     }
+    mutex_release(NULL, &proc->memmap.mtx);
+    if (!vaddr_real)
+        return false;
 
     for (size_t i = 0; i < segs_len; i++) {
         segs[i].vaddr_real   = segs[i].vaddr_req - min_addr + vaddr_real;
@@ -128,40 +150,64 @@ void kbelfx_seg_free(kbelf_inst inst, size_t segs_len, kbelf_segment *segs) {
     (void)segs;
     process_t *proc = proc_get(kbelf_inst_getpid(inst));
     assert_dev_keep(proc != NULL);
+    mutex_acquire(NULL, &proc->memmap.mtx, TIMESTAMP_US_MAX);
     proc_unmap_raw(NULL, proc, (size_t)segs[0].alloc_cookie);
+    mutex_release(NULL, &proc->memmap.mtx);
 }
 
 
 // Open a binary file for reading.
 // User-defined.
 void *kbelfx_open(char const *path) {
-    file_t fd = fs_open(NULL, path, OFLAGS_READONLY);
-    if (fd == -1)
+    kbelfx_file_t *file = malloc(sizeof(kbelfx_file_t));
+    if (!file)
+        return NULL;
+    file->fd = fs_open(NULL, path, OFLAGS_READONLY);
+    if (file->fd == -1) {
+        free(file);
         return NULL;
-    else
-        return (void *)(ptrdiff_t)(fd + 1);
+    }
+    file->pos     = 0;
+    file->buf_off = 0;
+    file->buf_len = 0;
+    return file;
 }
 
 // Close a file.
 // User-defined.
 void kbelfx_close(void *fd) {
-    fs_close(NULL, (int)(ptrdiff_t)fd - 1);
+    kbelfx_file_t *file = fd;
+    fs_close(NULL, file->fd);
+    free(file);
 }
 
 // Reads a single byte from a file.
 // Returns byte on success, -1 on error.
 // User-defined.
 int kbelfx_getc(void *fd) {
-    char      buf;
-    fileoff_t len = fs_read(NULL, (int)(ptrdiff_t)fd - 1, &buf, 1);
-    return len > 0 ? buf : -1;
+    kbelfx_file_t *file = fd;
+    if (file->pos < file->buf_off || file->pos >= file->buf_off + file->buf_len) {
+        // Refill the buffer so strings and headers aren't read one byte per call.
+        fs_seek(NULL, file->fd, file->pos, SEEK_ABS);
+        fileoff_t len = fs_read(NULL, file->fd, file->buf, KBELFX_BUF_SIZE);
+        file->buf_off = file->pos;
+        file->buf_len = len > 0 ? len : 0;
+        if (len <= 0) {
+            return -1;
+        }
+    }
+    return (uint8_t)file->buf[file->pos++ - file->buf_off];
 }
 
 // Reads a number of bytes from a file.
 // Returns the number of bytes read, or less than that on error.
 // User-defined.
 long kbelfx_read(void *fd, void *buf, long buf_len) {
-    return fs_read(NULL, (int)(ptrdiff_t)fd - 1, buf, buf_len);
+    kbelfx_file_t *file = fd;
+    fs_seek(NULL, file->fd, file->pos, SEEK_ABS);
+    fileoff_t len  = fs_read(NULL, file->fd, buf, buf_len);
+    file->pos     += len;
+    return len;
 }
 
 // Reads a number of bytes from a file to a virtual address in the program.
@@ -173,17 +219,22 @@ long kbelfx_load(kbelf_inst inst, void *fd, kbelf_laddr laddr, long len) {
     process_t *proc    = proc_get_unsafe(kbelf_inst_getpid(inst));
     long       tmp_cap = MEMMAP_VMEM ? 2097152 : 16384;
     tmp_cap            = tmp_cap < len ? tmp_cap : len;
-    void *tmp          = malloc(tmp_cap);
-    long  total        = 0;
+    void *tmp          = vmalloc(tmp_cap);
+    if (tmp_cap && !tmp)
+        return -1;
+    kbelfx_file_t *file  = fd;
+    long           total = 0;
+    fs_seek(NULL, file->fd, file->pos, SEEK_ABS);
     while (len > tmp_cap) {
-        total += fs_read(NULL, (int)(ptrdiff_t)fd - 1, tmp, tmp_cap);
+        total += fs_read(NULL, file->fd, tmp, tmp_cap);
         copy_to_user_raw(proc, laddr, tmp, tmp_cap);
         laddr += tmp_cap;
         len   -= tmp_cap;
     }
-    total += fs_read(NULL, (int)(ptrdiff_t)fd - 1, tmp, len);
+    total += fs_read(NULL, file->fd, tmp, len);
     copy_to_user_raw(proc, laddr, tmp, len);
-    free(tmp);
+    vfree(tmp);
+    file->pos += total;
     return total;
 }
 
@@ -191,8 +242,13 @@ long kbelfx_load(kbelf_inst inst, void *fd, kbelf_laddr laddr, long len) {
 // Returns 0 on success, -1 on error.
 // User-defined.
 int kbelfx_seek(void *fd, long pos) {
-    fileoff_t q = fs_seek(NULL, (int)(ptrdiff_t)fd - 1, pos, SEEK_ABS);
-    return pos == q ? 0 : -1;
+    kbelfx_file_t *file = fd;
+    fileoff_t      q    = fs_seek(NULL, file->fd, pos, SEEK_ABS);
+    if (q != pos) {
+        return -1;
+    }
+    file->pos = pos;
+    return 0;
 }
 
 
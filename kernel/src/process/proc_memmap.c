@@ -6,11 +6,14 @@
 #include "badge_strings.h"
 #include "cpu/panic.h"
 #include "log.h"
+#include "malloc.h"
 #include "memprotect.h"
+#include "meta.h"
 #include "page_alloc.h"
 #include "port/hardware_allocation.h"
 #include "process/internal.h"
 #include "process/process.h"
+#include "process/shm.h"
 #include "process/types.h"
 #include "scheduler/cpu.h"
 #include "scheduler/types.h"
@@ -22,154 +25,475 @@
 #endif
 #endif
 
-// Memory map address comparator.
-static int proc_memmap_cmp(void const *a, void const *b) {
-    proc_memmap_ent_t const *a_ptr = a;
-    proc_memmap_ent_t const *b_ptr = b;
-#if MEMAP_VMEM
-    if (a_ptr->vaddr < b_ptr->vaddr)
-        return -1;
-    if (a_ptr->vaddr < b_ptr->vaddr)
-        return 1;
-#else
-    if (a_ptr->paddr < b_ptr->paddr)
-        return -1;
-    if (a_ptr->paddr < b_ptr->paddr)
-        return 1;
-#endif
-    return 0;
+#if MEMMAP_VMEM
+// Maximum number of pages unmapped before their TLB entries are flushed and the pages are freed.
+#define UNMAP_BATCH    64
+// Size of the smallest superpage; regions at least this large are aligned to it.
+#define SUPERPAGE_SIZE (MMU_PAGE_SIZE << MMU_BITS_PER_LEVEL)
+
+// Get the protection flags that pages in a region are mapped with.
+static uint32_t proc_memmap_ent_flags(proc_memmap_ent_t const *region) {
+    uint32_t flags = MEMPROTECT_FLAG_R;
+    if (region->write) {
+        flags |= MEMPROTECT_FLAG_W;
+    }
+    if (region->exec) {
+        flags |= MEMPROTECT_FLAG_X;
+    }
+    return flags;
+}
+
+// Find the region that contains a virtual address.
+// The region tree is only safe to use with the memory map mutex held.
+static proc_memmap_ent_t const *proc_memmap_find(proc_memmap_t const *map, size_t vaddr) {
+    assert_dev_drop(mutex_is_held(&map->mtx));
+    rangetree_node_t *node = rangetree_find(&map->regions, vaddr);
+    return node ? field_parent_ptr(proc_memmap_ent_t, node, node) : NULL;
+}
+
+// Add a region to the region tree.
+// Returns NULL if out of memory.
+static proc_memmap_ent_t *proc_memmap_insert(proc_memmap_t *map, proc_memmap_ent_t const *ent) {
+    assert_dev_drop(mutex_is_held(&map->mtx));
+    proc_memmap_ent_t *region = malloc(sizeof(proc_memmap_ent_t));
+    if (!region) {
+        return NULL;
+    }
+    *region           = *ent;
+    region->node.base = region->vaddr;
+    region->node.size = region->size;
+    assert_dev_keep(rangetree_insert(&map->regions, &region->node));
+    return region;
+}
+
+// Back the entire superpage around `vaddr` with one physically contiguous block, if possible.
+// Only done if the region covers the whole superpage and none of it is resident yet.
+static bool proc_map_populate_super(process_t *proc, proc_memmap_ent_t const *region, size_t vaddr) {
+    proc_memmap_t *map  = &proc->memmap;
+    size_t         base = vaddr - vaddr % SUPERPAGE_SIZE;
+    if (!MMU_SUPPORT_SUPERPAGES || base < region->vaddr || base + SUPERPAGE_SIZE > region->vaddr + region->size) {
+        return false;
+    }
+    for (size_t page = base; page < base + SUPERPAGE_SIZE; page += MEMMAP_PAGE_SIZE) {
+        if (memprotect_virt2phys(&map->mpu_ctx, page).flags & MEMPROTECT_FLAG_RWX) {
+            return false;
+        }
+    }
+
+    size_t ppn = phys_page_alloc(SUPERPAGE_SIZE / MEMMAP_PAGE_SIZE, true);
+    if (ppn % (SUPERPAGE_SIZE / MEMMAP_PAGE_SIZE)) {
+        // Blocks are only aligned to their size if the memory pool is.
+        phys_page_free(ppn);
+        ppn = 0;
+    }
+    if (!ppn) {
+        map->superpage_misses++;
+        return false;
+    }
+    if (!memprotect_u(
+            map,
+            &map->mpu_ctx,
+            base,
+            ppn * MEMMAP_PAGE_SIZE,
+            SUPERPAGE_SIZE,
+            proc_memmap_ent_flags(region)
+        )) {
+        phys_page_free(ppn);
+        map->superpage_misses++;
+        return false;
+    }
+    map->resident += SUPERPAGE_SIZE;
+    map->superpages++;
+    return true;
+}
+
+// Give a process its own copy of a copy-on-write page that is being written to.
+// If no other process shares the page anymore, it is made writable without copying.
+static bool proc_map_cow_copy(process_t *proc, proc_memmap_ent_t const *region, virt2phys_t v2p) {
+    proc_memmap_t *map   = &proc->memmap;
+    size_t         pages = v2p.page_size / MEMMAP_PAGE_SIZE;
+    uint32_t       flags = proc_memmap_ent_flags(region);
+    if (phys_page_refs(v2p.page_paddr / MEMMAP_PAGE_SIZE) == 1) {
+        // The other processes have already copied or unmapped the page.
+        assert_dev_keep(memprotect_u(map, &map->mpu_ctx, v2p.page_vaddr, v2p.page_paddr, v2p.page_size, flags));
+        memprotect_commit(&map->mpu_ctx);
+        return true;
+    }
+
+    // Superpages are copied to a superpage if there is aligned memory for one, or to individual pages otherwise.
+    size_t  ppn  = phys_page_alloc(pages, true);
+    size_t *ppns = NULL;
+    if (ppn % pages) {
+        phys_page_free(ppn);
+        ppn = 0;
+    }
+    if (!ppn && pages > 1) {
+        ppns = calloc(pages, sizeof(size_t));
+        for (size_t i = 0; ppns && i < pages; i++) {
+            ppns[i] = phys_page_alloc(1, true);
+            if (!ppns[i]) {
+                for (size_t j = 0; j < i; j++) {
+                    phys_page_free(ppns[j]);
+                }
+                free(ppns);
+                ppns = NULL;
+            }
+        }
+    }
+    if (!ppn && !ppns) {
+        logkf(LOG_WARN, "Out of memory to copy page at %{size;x} of process %{d}", v2p.page_vaddr, proc->pid);
+        return false;
+    }
+
+    // The shared page is unmapped first so other CPUs can't keep reading it through stale TLB entries.
+    assert_dev_keep(memprotect_u(map, &map->mpu_ctx, v2p.page_vaddr, 0, v2p.page_size, 0));
+    if (ppn) {
+        mem_copy(
+            (void *)(mmu_hhdm_vaddr + ppn * MEMMAP_PAGE_SIZE),
+            (void *)(mmu_hhdm_vaddr + v2p.page_paddr),
+            v2p.page_size
+        );
+        assert_dev_keep(memprotect_u(map, &map->mpu_ctx, v2p.page_vaddr, ppn * MEMMAP_PAGE_SIZE, v2p.page_size, flags));
+    } else {
+        for (size_t i = 0; i < pages; i++) {
+            size_t offset = i * MEMMAP_PAGE_SIZE;
+            mem_copy(
+                (void *)(mmu_hhdm_vaddr + ppns[i] * MEMMAP_PAGE_SIZE),
+                (void *)(mmu_hhdm_vaddr + v2p.page_paddr + offset),
+                MEMMAP_PAGE_SIZE
+            );
+            assert_dev_keep(memprotect_u(
+                map,
+                &map->mpu_ctx,
+                v2p.page_vaddr + offset,
+                ppns[i] * MEMMAP_PAGE_SIZE,
+                MEMMAP_PAGE_SIZE,
+                flags
+            ));
+        }
+        free(ppns);
+    }
+    memprotect_commit(&map->mpu_ctx);
+    phys_page_unref(v2p.page_paddr / MEMMAP_PAGE_SIZE);
+    map->cow_copies++;
+    return true;
+}
+
+// Map the page of a file-backed region at `vaddr`, reading it from the file if it isn't cached yet.
+// Private regions map the file's page copy-on-write, so writing to it makes a copy and the file is never changed.
+static bool proc_map_file_page(process_t *proc, proc_memmap_ent_t const *region, size_t vaddr, bool write) {
+    proc_memmap_t *map   = &proc->memmap;
+    uint32_t       flags = proc_memmap_ent_flags(region);
+    if (!region->file_shared && (flags & MEMPROTECT_FLAG_W)) {
+        flags = (flags & ~MEMPROTECT_FLAG_W) | MEMPROTECT_FLAG_COW;
+    }
+
+    size_t ppn = fs_map_page(NULL, region->file, region->file_offset + (fileoff_t)(vaddr - region->vaddr));
+    if (!ppn) {
+        logkf(LOG_WARN, "Can't map file page at %{size;x} of process %{d}", vaddr, proc->pid);
+        return false;
+    }
+    if (!memprotect_u(map, &map->mpu_ctx, vaddr, ppn * MEMMAP_PAGE_SIZE, MEMMAP_PAGE_SIZE, flags)) {
+        phys_page_unref(ppn);
+        return false;
+    }
+    map->resident += MEMMAP_PAGE_SIZE;
+    if (write && (flags & MEMPROTECT_FLAG_COW)) {
+        return proc_map_cow_copy(proc, region, memprotect_virt2phys(&map->mpu_ctx, vaddr));
+    }
+    return true;
+}
+
+// Get the alignment to use for a new mapping.
+// Mappings of at least a superpage are aligned to one so they can be backed by superpages.
+size_t proc_map_align(size_t size, size_t min_align) {
+    if (MMU_SUPPORT_SUPERPAGES && size >= SUPERPAGE_SIZE && min_align < SUPERPAGE_SIZE) {
+        return SUPERPAGE_SIZE;
+    }
+    return min_align;
 }
 
-#if MEMMAP_VMEM
 // Allocate more memory to a process.
 size_t proc_map_raw(
     badge_err_t *ec, process_t *proc, size_t vaddr_req, size_t min_size, size_t min_align, uint32_t flags
 ) {
-    proc_memmap_t *map = &proc->memmap;
+    proc_memmap_t *map       = &proc->memmap;
+    size_t         min_vaddr = 65536 > MEMMAP_PAGE_SIZE ? 65536 : MEMMAP_PAGE_SIZE;
 
     // Correct virtual address.
     if (min_align & (min_align - 1)) {
         logkf(LOG_WARN, "min_align=%{size;d} ignored because it is not a power of 2", min_align);
         min_align = 1;
     }
-    if (vaddr_req < 65536 || vaddr_req < MEMMAP_PAGE_SIZE) {
-        vaddr_req = 65536 > MEMMAP_PAGE_SIZE ? 65536 : MEMMAP_PAGE_SIZE;
-    } else if (vaddr_req % MEMMAP_PAGE_SIZE) {
-        vaddr_req += MEMMAP_PAGE_SIZE - vaddr_req % MEMMAP_PAGE_SIZE;
+    if (min_align < MEMMAP_PAGE_SIZE) {
+        min_align = MEMMAP_PAGE_SIZE;
+    }
+    if (vaddr_req < min_vaddr) {
+        vaddr_req = min_vaddr;
     }
-    if (vaddr_req & (min_align - 1)) {
-        vaddr_req += min_align - (vaddr_req & (min_align - 1));
+    if (min_size > mmu_half_size - min_vaddr) {
+        logk(LOG_WARN, "Impossible vmem request");
+        badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOMEM);
+        return 0;
     }
-    if (min_size % MEMMAP_PAGE_SIZE) {
+    if (!min_size) {
+        min_size = MEMMAP_PAGE_SIZE;
+    } else if (min_size % MEMMAP_PAGE_SIZE) {
         min_size += MEMMAP_PAGE_SIZE - min_size % MEMMAP_PAGE_SIZE;
     }
-    if (vaddr_req + min_size > mmu_half_size) {
-        vaddr_req = mmu_half_size - min_size;
-        if (vaddr_req & (min_align - 1)) {
-            vaddr_req -= vaddr_req & (min_align - 1);
-        }
-        if (vaddr_req < 65536 || vaddr_req < MEMMAP_PAGE_SIZE) {
-            logk(LOG_WARN, "Impossible vmem request");
-            badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOMEM);
-            return 0;
-        }
+
+    // Use the first free range at or after the requested address, or the first free range at all if there is none.
+    assert_dev_drop(mutex_is_held(&map->mtx));
+    size_t vaddr;
+    if (!rangetree_find_gap(&map->regions, vaddr_req, mmu_half_size, min_size, min_align, &vaddr) &&
+        !rangetree_find_gap(&map->regions, min_vaddr, mmu_half_size, min_size, min_align, &vaddr)) {
+        logk(LOG_WARN, "Out of virtual address space");
+        badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOMEM);
+        return 0;
     }
 
-    // TODO: Disambiguate virtual addresses.
-    uint32_t existing = proc_map_contains_raw(proc, vaddr_req, min_size);
-    if (existing) {
-        logk(LOG_WARN, "Overlapping virtual address requested");
+    // Reserve the range; physical pages are allocated when they are first accessed.
+    proc_memmap_ent_t new_ent = {
+        .vaddr = vaddr,
+        .size  = min_size,
+        .write = flags & MEMPROTECT_FLAG_W,
+        .exec  = flags & MEMPROTECT_FLAG_X,
+        .file  = FILE_NONE,
+    };
+    if (!proc_memmap_insert(map, &new_ent)) {
         badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOMEM);
         return 0;
     }
+    map->reserved += min_size;
+
+    badge_err_set_ok(ec);
+    return vaddr;
+}
+
+// Map a shared memory object into a process.
+// On success, takes over the reference to `shm`, which is dropped when the region is unmapped.
+// Returns actual virtual address on success, 0 on failure.
+size_t proc_map_shm_raw(badge_err_t *ec, process_t *proc, shm_t *shm, size_t vaddr_req, uint32_t flags) {
+    proc_memmap_t *map   = &proc->memmap;
+    size_t         size  = shm->pages * MEMMAP_PAGE_SIZE;
+    size_t         vaddr = proc_map_raw(ec, proc, vaddr_req, size, MEMMAP_PAGE_SIZE, flags);
+    if (!vaddr) {
+        return 0;
+    }
 
-    // Convert to page numbers.
-    size_t vpn   = vaddr_req / MEMMAP_PAGE_SIZE;
-    size_t pages = min_size / MEMMAP_PAGE_SIZE;
-    size_t i     = 0;
-    while (i < pages) {
-        size_t alloc, ppn;
-        for (alloc = __builtin_clzll(pages - i); alloc; alloc >>= 1) {
-            ppn = phys_page_alloc(alloc, true);
-            if (ppn) {
+    // Every page of the object already exists, so all of them are mapped right away.
+    proc_memmap_ent_t *region = (proc_memmap_ent_t *)proc_memmap_find(map, vaddr);
+    region->shm               = shm;
+    for (size_t i = 0; i < shm->pages; i++) {
+        assert_dev_keep(memprotect_u(
+            map,
+            &map->mpu_ctx,
+            vaddr + i * MEMMAP_PAGE_SIZE,
+            shm->ppns[i] * MEMMAP_PAGE_SIZE,
+            MEMMAP_PAGE_SIZE,
+            proc_memmap_ent_flags(region)
+        ));
+    }
+    memprotect_commit(&map->mpu_ctx);
+    map->resident += size;
+    if (map->resident > map->peak_resident) {
+        map->peak_resident = map->resident;
+    }
+
+    logkf(LOG_INFO, "Mapped shared memory %{d} at %{size;x} to process %{d}", shm->id, vaddr, proc->pid);
+    return vaddr;
+}
+
+// Map part of a file into a process; pages are read from the file when they are first accessed.
+// If `shared` is true, writes change the file; otherwise, written pages are copied and the file stays the same.
+// Returns actual virtual address on success, 0 on failure.
+size_t proc_map_file_raw(
+    badge_err_t *ec,
+    process_t   *proc,
+    file_t       file,
+    fileoff_t    offset,
+    size_t       size,
+    size_t       vaddr_req,
+    uint32_t     flags,
+    bool         shared
+) {
+    if (offset < 0 || offset % MEMMAP_PAGE_SIZE || !size || size > (size_t)(__LONG_MAX__ - offset)) {
+        badge_err_set(ec, ELOC_PROCESS, ECAUSE_PARAM);
+        return 0;
+    }
+
+    // The region keeps its own handle so the file stays open after the process closes it.
+    file_t handle = fs_map_open(ec, file, shared && (flags & MEMPROTECT_FLAG_W));
+    if (handle == FILE_NONE) {
+        return 0;
+    }
+    size_t vaddr = proc_map_raw(ec, proc, vaddr_req, size, MEMMAP_PAGE_SIZE, flags);
+    if (!vaddr) {
+        fs_close(NULL, handle);
+        return 0;
+    }
+    proc_memmap_ent_t *region = (proc_memmap_ent_t *)proc_memmap_find(&proc->memmap, vaddr);
+    region->file              = handle;
+    region->file_offset       = offset;
+    region->file_shared       = shared;
+
+    logkf(LOG_INFO, "Mapped %{size;d} bytes of a file at %{size;x} to process %{d}", size, vaddr, proc->pid);
+    return vaddr;
+}
+
+// Share all memory of a process with another process that has nothing mapped yet.
+// Private pages are shared copy-on-write, and shared memory objects and shared file mappings are mapped into both.
+bool proc_map_clone_raw(badge_err_t *ec, process_t *dest, process_t *src) {
+    proc_memmap_t *dest_map = &dest->memmap;
+    proc_memmap_t *src_map  = &src->memmap;
+    assert_dev_drop(mutex_is_held(&src_map->mtx) && mutex_is_held(&dest_map->mtx));
+    assert_dev_drop(dest_map->regions.len == 0);
+
+    // Each region is added before its pages are shared, so pages shared before running out of memory are released
+    // when the destination is unmapped.
+    // Every resident page is mapped into the destination too; pages that were never accessed stay reserved.
+    bool ok = true;
+    for (rangetree_node_t *node = rangetree_first(&src_map->regions); ok && node; node = rangetree_next(node)) {
+        // File-backed regions get their own handle to the file.
+        proc_memmap_ent_t ent = *field_parent_ptr(proc_memmap_ent_t, node, node);
+        if (ent.file != FILE_NONE) {
+            ent.file = fs_map_open(NULL, ent.file, ent.file_shared && ent.write);
+            if (ent.file == FILE_NONE) {
+                ok = false;
                 break;
             }
         }
-        if (!alloc) {
-            badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOMEM);
-            goto error;
+        proc_memmap_ent_t const *region = proc_memmap_insert(dest_map, &ent);
+        if (!region) {
+            if (ent.file != FILE_NONE) {
+                fs_close(NULL, ent.file);
+            }
+            ok = false;
+            break;
         }
-        proc_memmap_ent_t new_ent = {
-            .paddr = ppn * MEMMAP_PAGE_SIZE,
-            .vaddr = vpn * MEMMAP_PAGE_SIZE,
-            .size  = alloc * MEMMAP_PAGE_SIZE,
-            .write = true,
-            .exec  = true,
-        };
-        if (!array_lencap_sorted_insert(
-                &map->regions,
-                sizeof(proc_memmap_ent_t),
-                &map->regions_len,
-                &map->regions_cap,
-                &new_ent,
-                proc_memmap_cmp
-            )) {
-            badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOMEM);
-            phys_page_free(ppn);
-            goto error;
+        dest_map->reserved += region->size;
+        if (region->shm) {
+            shm_ref(region->shm);
         }
-        if (!memprotect_u(
-                &proc->memmap,
-                &proc->memmap.mpu_ctx,
-                (vpn + i) * MEMMAP_PAGE_SIZE,
-                ppn * MEMMAP_PAGE_SIZE,
-                alloc * MEMMAP_PAGE_SIZE,
-                flags
-            )) {
-            badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOMEM);
-            goto error;
+        for (size_t vaddr = region->vaddr; vaddr < region->vaddr + region->size; vaddr += MEMMAP_PAGE_SIZE) {
+            virt2phys_t v2p = memprotect_virt2phys(&src_map->mpu_ctx, vaddr);
+            if (!(v2p.flags & MEMPROTECT_FLAG_RWX)) {
+                continue;
+            }
+            uint32_t flags = v2p.flags & (MEMPROTECT_FLAG_RWX | MEMPROTECT_FLAG_COW);
+            if (!region->shm) {
+                if (!phys_page_ref(v2p.page_paddr / MEMMAP_PAGE_SIZE)) {
+                    ok = false;
+                    break;
+                }
+                if ((flags & MEMPROTECT_FLAG_W) && !region->file_shared) {
+                    // Write-protect the source as well, so whichever process writes first gets the copy.
+                    flags = (flags & ~MEMPROTECT_FLAG_W) | MEMPROTECT_FLAG_COW;
+                    assert_dev_keep(
+                        memprotect_u(src_map, &src_map->mpu_ctx, v2p.page_vaddr, v2p.page_paddr, v2p.page_size, flags)
+                    );
+                }
+            }
+            assert_dev_keep(
+                memprotect_u(dest_map, &dest_map->mpu_ctx, v2p.page_vaddr, v2p.page_paddr, v2p.page_size, flags)
+            );
+            dest_map->resident += v2p.page_size;
+            vaddr               = v2p.page_vaddr + v2p.page_size - MEMMAP_PAGE_SIZE;
         }
-        i += alloc;
     }
+    memprotect_commit(&src_map->mpu_ctx);
+    memprotect_commit(&dest_map->mpu_ctx);
+    dest_map->peak_resident = dest_map->resident;
 
-    memprotect_commit(&proc->memmap.mpu_ctx);
+    if (!ok) {
+        badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOMEM);
+        return false;
+    }
     badge_err_set_ok(ec);
-    return vaddr_req;
-error:
-    logk(LOG_WARN, "TODO: Cleanup when proc_map_raw partially fails");
-    return 0;
+    return true;
 }
 
 // Release memory allocated to a process.
 void proc_unmap_raw(badge_err_t *ec, process_t *proc, size_t base) {
-    proc_memmap_t *map = &proc->memmap;
-    for (size_t i = 0; i < map->regions_len; i++) {
-        if (map->regions[i].vaddr == base) {
-            // Remove region entry.
-            proc_memmap_ent_t region = map->regions[i];
-            array_remove(&map->regions[0], sizeof(map->regions[0]), map->regions_len, NULL, i);
-            map->regions_len--;
+    proc_memmap_t     *map   = &proc->memmap;
+    proc_memmap_ent_t *found = (proc_memmap_ent_t *)proc_memmap_find(map, base);
+    if (!found || found->vaddr != base) {
+        badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOTFOUND);
+        return;
+    }
 
-            // Revoke user access to the memory.
-            assert_dev_keep(memprotect_u(map, &map->mpu_ctx, base, 0, region.size, 0));
-            memprotect_commit(&map->mpu_ctx);
+    // Remove region entry.
+    proc_memmap_ent_t region = *found;
+    rangetree_remove(&map->regions, &found->node);
+    free(found);
+    map->reserved -= region.size;
 
-            // Release physical memory.
-            size_t vaddr = base;
-            while (vaddr < base + region.size) {
-                virt2phys_t v2p = memprotect_virt2phys(&map->mpu_ctx, vaddr);
-                assert_dev_drop(v2p.flags & MEMPROTECT_FLAG_RWX);
-                assert_dev_drop(!(v2p.flags & MEMPROTECT_FLAG_KERNEL));
-                vaddr += phys_page_size(v2p.paddr / MEMMAP_PAGE_SIZE) * MEMMAP_PAGE_SIZE;
-                phys_page_free(v2p.paddr / MEMMAP_PAGE_SIZE);
+    // Revoke user access to the pages that were touched.
+    // Pages are freed in batches, after other CPUs have flushed them from their TLBs.
+    // Superpages never cross region boundaries, so they are always unmapped and freed whole.
+    // Shared memory pages belong to the object, which frees them when it is no longer mapped anywhere.
+    // Copy-on-write pages are only freed once the last process sharing them unmaps them.
+    // File pages are referenced by every mapping of them, so they are released the same way.
+    size_t resident = 0;
+    size_t batch[UNMAP_BATCH];
+    size_t batch_len = 0;
+    for (size_t vaddr = base; vaddr < base + region.size; vaddr += MEMMAP_PAGE_SIZE) {
+        virt2phys_t v2p = memprotect_virt2phys(&map->mpu_ctx, vaddr);
+        if (!(v2p.flags & MEMPROTECT_FLAG_RWX)) {
+            continue;
+        }
+        assert_dev_drop(!(v2p.flags & MEMPROTECT_FLAG_KERNEL));
+        assert_dev_drop(v2p.page_vaddr >= base && v2p.page_vaddr + v2p.page_size <= base + region.size);
+        assert_dev_keep(memprotect_u(map, &map->mpu_ctx, v2p.page_vaddr, 0, v2p.page_size, 0));
+        if (!region.shm) {
+            batch[batch_len++] = v2p.page_paddr / MEMMAP_PAGE_SIZE;
+        }
+        resident += v2p.page_size;
+        vaddr     = v2p.page_vaddr + v2p.page_size - MEMMAP_PAGE_SIZE;
+        if (batch_len == UNMAP_BATCH) {
+            memprotect_commit(&map->mpu_ctx);
+            for (size_t j = 0; j < batch_len; j++) {
+                phys_page_unref(batch[j]);
             }
-
-            badge_err_set_ok(ec);
-            logkf(LOG_INFO, "Unmapped %{size;d} bytes at %{size;x} from process %{d}", region.size, base, proc->pid);
-            return;
+            batch_len = 0;
         }
     }
-    badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOTFOUND);
+    memprotect_commit(&map->mpu_ctx);
+    for (size_t j = 0; j < batch_len; j++) {
+        phys_page_unref(batch[j]);
+    }
+    if (region.shm) {
+        shm_unref(region.shm);
+    }
+    if (region.file != FILE_NONE) {
+        fs_close(NULL, region.file);
+    }
+    map->resident -= resident;
+
+    badge_err_set_ok(ec);
+    logkf(
+        LOG_DEBUG,
+        "Unmapped %{size;d} bytes (%{size;d} resident) at %{size;x} from process %{d}",
+        region.size,
+        resident,
+        base,
+        proc->pid
+    );
+}
+
+// Release all memory allocated to a process.
+void proc_unmap_all_raw(process_t *proc) {
+    rangetree_node_t *node;
+    while ((node = rangetree_first(&proc->memmap.regions))) {
+        proc_unmap_raw(NULL, proc, field_parent_ptr(proc_memmap_ent_t, node, node)->vaddr);
+    }
+}
+
+// Get the size of the region that starts at `base`.
+// Returns 0 if no region starts there.
+size_t proc_map_size_raw(process_t *proc, size_t base) {
+    proc_memmap_ent_t const *region = proc_memmap_find(&proc->memmap, base);
+    return region && region->vaddr == base ? region->size : 0;
 }
 
 // Whether the process owns this range of virtual memory.
@@ -180,12 +504,16 @@ int proc_map_contains_raw(process_t *proc, size_t vaddr, size_t size) {
     }
     int flags = MEMPROTECT_FLAG_RWX;
     while (true) {
-        virt2phys_t info  = memprotect_virt2phys(&proc->memmap.mpu_ctx, vaddr);
-        flags            &= (int)info.flags;
+        // Regions are checked instead of page tables because reserved pages may not be mapped yet.
+        proc_memmap_ent_t const *region = proc_memmap_find(&proc->memmap, vaddr);
+        if (!region) {
+            return 0;
+        }
+        flags &= (int)proc_memmap_ent_flags(region);
         if (!flags) {
             return 0;
         }
-        size_t inc = info.page_size - (vaddr & (info.page_size - 1));
+        size_t inc = region->vaddr + region->size - vaddr;
         if (inc >= size) {
             return flags;
         }
@@ -194,8 +522,132 @@ int proc_map_contains_raw(process_t *proc, size_t vaddr, size_t size) {
     }
 }
 
+// Allocate and map physical pages for the part of a range that hasn't been accessed yet.
+// If `write` is true, copy-on-write pages in the range are copied so they can be written to.
+// Returns false if the process doesn't own the entire range or if out of memory.
+bool proc_map_populate_raw(process_t *proc, size_t vaddr, size_t size, bool write) {
+    proc_memmap_t *map = &proc->memmap;
+    if (!size) {
+        return true;
+    }
+    size_t end = vaddr + size;
+    vaddr     -= vaddr % MEMMAP_PAGE_SIZE;
+
+    bool changed = false;
+    bool ok      = true;
+    while (vaddr < end) {
+        proc_memmap_ent_t const *region = proc_memmap_find(map, vaddr);
+        if (!region) {
+            ok = false;
+            break;
+        }
+        size_t region_end = region->vaddr + region->size;
+        for (; vaddr < end && vaddr < region_end; vaddr += MEMMAP_PAGE_SIZE) {
+            virt2phys_t v2p = memprotect_virt2phys(&map->mpu_ctx, vaddr);
+            if (write && (v2p.flags & MEMPROTECT_FLAG_COW)) {
+                if (!proc_map_cow_copy(proc, region, v2p)) {
+                    ok = false;
+                    break;
+                }
+                continue;
+            } else if (v2p.flags & MEMPROTECT_FLAG_RWX) {
+                continue;
+            }
+            if (region->file != FILE_NONE) {
+                if (!proc_map_file_page(proc, region, vaddr, write)) {
+                    ok = false;
+                    break;
+                }
+                changed = true;
+                continue;
+            }
+            if (proc_map_populate_super(proc, region, vaddr)) {
+                changed = true;
+                vaddr   = vaddr - vaddr % SUPERPAGE_SIZE + SUPERPAGE_SIZE - MEMMAP_PAGE_SIZE;
+                continue;
+            }
+            size_t ppn = phys_page_alloc(1, true);
+            if (!ppn) {
+                logkf(LOG_WARN, "Out of memory for page at %{size;x} of process %{d}", vaddr, proc->pid);
+                ok = false;
+                break;
+            }
+            if (!memprotect_u(
+                    map,
+                    &map->mpu_ctx,
+                    vaddr,
+                    ppn * MEMMAP_PAGE_SIZE,
+                    MEMMAP_PAGE_SIZE,
+                    proc_memmap_ent_flags(region)
+                )) {
+                phys_page_free(ppn);
+                ok = false;
+                break;
+            }
+            changed        = true;
+            map->resident += MEMMAP_PAGE_SIZE;
+        }
+        if (!ok) {
+            break;
+        }
+    }
+
+    if (map->resident > map->peak_resident) {
+        map->peak_resident = map->resident;
+    }
+    if (changed) {
+        memprotect_commit(&map->mpu_ctx);
+    }
+    return ok;
+}
+
+// Handle a page fault on memory that is reserved but not yet resident, or a write to a copy-on-write page.
+// `access` is the `MEMPROTECT_FLAG_R`, `MEMPROTECT_FLAG_W` or `MEMPROTECT_FLAG_X` access that faulted.
+// Returns true if the page was mapped and the access should be retried.
+bool proc_map_fault_raw(process_t *proc, size_t vaddr, uint32_t access) {
+    if (vaddr >= mmu_high_vaddr) {
+        return false;
+    }
+    vaddr          -= vaddr % MEMMAP_PAGE_SIZE;
+    virt2phys_t v2p = memprotect_virt2phys(&proc->memmap.mpu_ctx, vaddr);
+    if ((access & MEMPROTECT_FLAG_W) && (v2p.flags & MEMPROTECT_FLAG_COW)) {
+        proc_memmap_ent_t const *region = proc_memmap_find(&proc->memmap, vaddr);
+        return region && proc_map_cow_copy(proc, region, v2p);
+    } else if (v2p.flags & MEMPROTECT_FLAG_RWX) {
+        // The page is present; unless another thread mapped it since the fault, this is a real access violation.
+        if ((v2p.flags & access) != access) {
+            return false;
+        }
+        mmu_vmem_fence_range(v2p.page_vaddr, v2p.page_size);
+        return true;
+    }
+    if (!proc_map_populate_raw(proc, vaddr, MEMMAP_PAGE_SIZE, access & MEMPROTECT_FLAG_W)) {
+        return false;
+    }
+    proc->memmap.faults++;
+    return true;
+}
+
 #else
 
+// Memory map address comparator.
+static int proc_memmap_cmp(void const *a, void const *b) {
+    proc_memmap_ent_t const *a_ptr = a;
+    proc_memmap_ent_t const *b_ptr = b;
+    if (a_ptr->paddr < b_ptr->paddr)
+        return -1;
+    if (a_ptr->paddr > b_ptr->paddr)
+        return 1;
+    return 0;
+}
+
+// Get the alignment to use for a new mapping.
+// Mappings of at least a superpage are aligned to one so they can be backed by superpages.
+size_t proc_map_align(size_t size, size_t min_align) {
+    (void)size;
+    return min_align;
+}
+
 // Allocate more memory to a process.
 size_t proc_map_raw(
     badge_err_t *ec, process_t *proc, size_t vaddr_req, size_t min_size, size_t min_align, uint32_t flags
@@ -268,12 +720,114 @@ size_t proc_map_raw(
         return 0;
     }
     memprotect_commit(&map->mpu_ctx);
+    map->reserved += size;
+    map->resident += size;
+    if (map->resident > map->peak_resident) {
+        map->peak_resident = map->resident;
+    }
 
     logkf(LOG_INFO, "Mapped %{size;d} bytes at %{size;x} to process %{d}", size, base, proc->pid);
     badge_err_set_ok(ec);
     return vaddr_req;
 }
 
+// Map a shared memory object into a process.
+// On success, takes over the reference to `shm`, which is dropped when the region is unmapped.
+// Returns actual virtual address on success, 0 on failure.
+size_t proc_map_shm_raw(badge_err_t *ec, process_t *proc, shm_t *shm, size_t vaddr_req, uint32_t flags) {
+    (void)vaddr_req;
+    proc_memmap_t *map  = &proc->memmap;
+    size_t         base = shm->ppn * MEMMAP_PAGE_SIZE;
+    size_t         size = shm->pages * MEMMAP_PAGE_SIZE;
+
+#ifdef PROC_MEMMAP_MAX_REGIONS
+    if (map->regions_len >= PROC_MEMMAP_MAX_REGIONS) {
+        logk(LOG_WARN, "Out of regions");
+        badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOMEM);
+        return 0;
+    }
+#endif
+    if (proc_map_contains_raw(proc, base, size)) {
+        // Without VMEM, an object can only be mapped once per process.
+        badge_err_set(ec, ELOC_PROCESS, ECAUSE_EXISTS);
+        return 0;
+    }
+
+    proc_memmap_ent_t new_ent = {
+        .paddr = base,
+        .size  = size,
+        .write = flags & MEMPROTECT_FLAG_W,
+        .exec  = flags & MEMPROTECT_FLAG_X,
+        .shm   = shm,
+    };
+#ifdef PROC_MEMMAP_MAX_REGIONS
+    array_sorted_insert(map->regions, sizeof(proc_memmap_ent_t), map->regions_len, &new_ent, proc_memmap_cmp);
+    map->regions_len++;
+#else
+    if (!array_lencap_sorted_insert(
+            &map->regions,
+            sizeof(proc_memmap_ent_t),
+            &map->regions_len,
+            &map->regions_cap,
+            &new_ent,
+            proc_memmap_cmp
+        )) {
+        badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOMEM);
+        return 0;
+    }
+#endif
+
+    // The object's memory is physically contiguous, so it is mapped at its physical address.
+    assert_dev_keep(memprotect_u(map, &map->mpu_ctx, base, base, size, flags & MEMPROTECT_FLAG_RWX));
+    memprotect_commit(&map->mpu_ctx);
+    map->reserved += size;
+    map->resident += size;
+    if (map->resident > map->peak_resident) {
+        map->peak_resident = map->resident;
+    }
+
+    logkf(LOG_INFO, "Mapped shared memory %{d} at %{size;x} to process %{d}", shm->id, base, proc->pid);
+    badge_err_set_ok(ec);
+    return base;
+}
+
+// Map part of a file into a process; pages are read from the file when they are first accessed.
+// If `shared` is true, writes change the file; otherwise, written pages are copied and the file stays the same.
+// Returns actual virtual address on success, 0 on failure.
+size_t proc_map_file_raw(
+    badge_err_t *ec,
+    process_t   *proc,
+    file_t       file,
+    fileoff_t    offset,
+    size_t       size,
+    size_t       vaddr_req,
+    uint32_t     flags,
+    bool         shared
+) {
+    badge_err_t ec0;
+    if (!ec)
+        ec = &ec0;
+    if (shared) {
+        // Without VMEM, the file's pages can't be mapped; private mappings get a copy of the data instead.
+        badge_err_set(ec, ELOC_PROCESS, ECAUSE_UNSUPPORTED);
+        return 0;
+    } else if (offset < 0 || !size) {
+        badge_err_set(ec, ELOC_PROCESS, ECAUSE_PARAM);
+        return 0;
+    }
+    size_t base = proc_map_raw(ec, proc, vaddr_req, size, 0, flags);
+    if (!base) {
+        return 0;
+    }
+    iovec_t iov = {(void *)base, size};
+    fs_readv(ec, file, &iov, 1, offset);
+    if (!badge_err_is_ok(ec)) {
+        proc_unmap_raw(NULL, proc, base);
+        return 0;
+    }
+    return base;
+}
+
 // Release memory allocated to a process.
 void proc_unmap_raw(badge_err_t *ec, process_t *proc, size_t base) {
     proc_memmap_t *map = &proc->memmap;
@@ -284,7 +838,13 @@ void proc_unmap_raw(badge_err_t *ec, process_t *proc, size_t base) {
             map->regions_len--;
             assert_dev_keep(memprotect_u(map, &map->mpu_ctx, base, base, region.size, 0));
             memprotect_commit(&map->mpu_ctx);
-            phys_page_free(base / MEMMAP_PAGE_SIZE);
+            if (region.shm) {
+                shm_unref(region.shm);
+            } else {
+                phys_page_free(base / MEMMAP_PAGE_SIZE);
+            }
+            map->reserved -= region.size;
+            map->resident -= region.size;
             badge_err_set_ok(ec);
             logkf(LOG_INFO, "Unmapped %{size;d} bytes at %{size;x} from process %{d}", region.size, base, proc->pid);
             return;
@@ -293,6 +853,24 @@ void proc_unmap_raw(badge_err_t *ec, process_t *proc, size_t base) {
     badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOTFOUND);
 }
 
+// Release all memory allocated to a process.
+void proc_unmap_all_raw(process_t *proc) {
+    while (proc->memmap.regions_len) {
+        proc_unmap_raw(NULL, proc, proc->memmap.regions[0].paddr);
+    }
+}
+
+// Get the size of the region that starts at `base`.
+// Returns 0 if no region starts there.
+size_t proc_map_size_raw(process_t *proc, size_t base) {
+    for (size_t i = 0; i < proc->memmap.regions_len; i++) {
+        if (proc->memmap.regions[i].paddr == base) {
+            return proc->memmap.regions[i].size;
+        }
+    }
+    return 0;
+}
+
 // Whether the process owns this range of virtual memory.
 // Returns the lowest common denominator of the access bits.
 int proc_map_contains_raw(process_t *proc, size_t vaddr, size_t size) {
@@ -329,6 +907,15 @@ int proc_map_contains_raw(process_t *proc, size_t vaddr, size_t size) {
     }
     return access;
 }
+
+// Allocate and map physical pages for the part of a range that hasn't been accessed yet.
+// If `write` is true, copy-on-write pages in the range are copied so they can be written to.
+// Returns false if the process doesn't own the entire range or if out of memory.
+bool proc_map_populate_raw(process_t *proc, size_t vaddr, size_t size, bool write) {
+    // Without VMEM, all memory is allocated up front and never shared copy-on-write.
+    (void)write;
+    return !size || proc_map_contains_raw(proc, vaddr, size);
+}
 #endif
 
 
@@ -336,38 +923,44 @@ int proc_map_contains_raw(process_t *proc, size_t vaddr, size_t size) {
 // Allocate more memory to a process.
 // Returns actual virtual address on success, 0 on failure.
 size_t proc_map(badge_err_t *ec, pid_t pid, size_t vaddr_req, size_t min_size, size_t min_align, int flags) {
-    mutex_acquire(NULL, &proc_mtx, TIMESTAMP_US_MAX);
-    process_t *proc = proc_get(pid);
+    mutex_acquire_shared(NULL, &proc_mtx, TIMESTAMP_US_MAX);
+    process_t *proc = proc_get_unsafe(pid);
     size_t     res  = 0;
     if (proc) {
+        mutex_acquire(NULL, &proc->memmap.mtx, TIMESTAMP_US_MAX);
         res = proc_map_raw(ec, proc, vaddr_req, min_size, min_align, flags);
+        mutex_release(NULL, &proc->memmap.mtx);
     } else {
         badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOTFOUND);
     }
-    mutex_release(NULL, &proc_mtx);
+    mutex_release_shared(NULL, &proc_mtx);
     return res;
 }
 
 // Release memory allocated to a process.
 void proc_unmap(badge_err_t *ec, pid_t pid, size_t base) {
-    mutex_acquire(NULL, &proc_mtx, TIMESTAMP_US_MAX);
-    process_t *proc = proc_get(pid);
+    mutex_acquire_shared(NULL, &proc_mtx, TIMESTAMP_US_MAX);
+    process_t *proc = proc_get_unsafe(pid);
     if (proc) {
+        mutex_acquire(NULL, &proc->memmap.mtx, TIMESTAMP_US_MAX);
         proc_unmap_raw(ec, proc, base);
+        mutex_release(NULL, &proc->memmap.mtx);
     } else {
         badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOTFOUND);
     }
-    mutex_release(NULL, &proc_mtx);
+    mutex_release_shared(NULL, &proc_mtx);
 }
 
 // Whether the process owns this range of memory.
 // Returns the lowest common denominator of the access bits bitwise or 8.
 int proc_map_contains(badge_err_t *ec, pid_t pid, size_t base, size_t size) {
     mutex_acquire_shared(NULL, &proc_mtx, TIMESTAMP_US_MAX);
-    process_t *proc = proc_get(pid);
+    process_t *proc = proc_get_unsafe(pid);
     int        ret  = 0;
     if (proc) {
+        mutex_acquire(NULL, &proc->memmap.mtx, TIMESTAMP_US_MAX);
         ret = proc_map_contains_raw(proc, base, size);
+        mutex_release(NULL, &proc->memmap.mtx);
         badge_err_set_ok(ec);
     } else {
         badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOTFOUND);
@@ -375,3 +968,28 @@ int proc_map_contains(badge_err_t *ec, pid_t pid, size_t base, size_t size) {
     mutex_release_shared(NULL, &proc_mtx);
     return ret;
 }
+
+// Get the memory usage of a process.
+// Returns false if the process does not exist.
+bool proc_get_memstats(pid_t pid, proc_memstats_t *stats) {
+    mutex_acquire_shared(NULL, &proc_mtx, TIMESTAMP_US_MAX);
+    process_t *proc = proc_get_unsafe(pid);
+    if (proc) {
+        mutex_acquire(NULL, &proc->memmap.mtx, TIMESTAMP_US_MAX);
+        *stats = (proc_memstats_t){
+            .reserved         = proc->memmap.reserved,
+            .resident         = proc->memmap.resident,
+            .peak_resident    = proc->memmap.peak_resident,
+            .faults           = proc->memmap.faults,
+            .superpages       = proc->memmap.superpages,
+            .superpage_misses = proc->memmap.superpage_misses,
+            .cow_copies       = proc->memmap.cow_copies,
+#if MEMMAP_VMEM
+            .page_tables      = proc->memmap.mpu_ctx.pt_pages * MEMMAP_PAGE_SIZE,
+#endif
+        };
+        mutex_release(NULL, &proc->memmap.mtx);
+    }
+    mutex_release_shared(NULL, &proc_mtx);
+    return proc != NULL;
+}
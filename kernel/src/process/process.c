@@ -17,7 +17,9 @@
 #include "port/hardware_allocation.h"
 #include "port/port.h"
 #include "process/internal.h"
+#include "process/ioring.h"
 #include "process/sighandler.h"
+#include "process/shm.h"
 #include "process/types.h"
 #include "scheduler/cpu.h"
 #include "scheduler/types.h"
@@ -174,10 +176,11 @@ process_t *proc_create_raw(badge_err_t *ec, pid_t parentpid, char const *binary,
         .pid         = pid_counter,
         .memmap =
             {
-                .regions_len = 0,
+                .mtx = MUTEX_T_INIT,
 #if MEMMAP_VMEM
-                .regions_cap = 0,
-                .regions     = NULL,
+                .regions = RANGETREE_EMPTY,
+#else
+                .regions_len = 0,
 #endif
             },
         .mtx        = MUTEX_T_INIT_SHARED,
@@ -295,53 +298,77 @@ static bool proc_setargs_raw_unsafe(badge_err_t *ec, process_t *process, int arg
     return true;
 }
 
-// Load an executable and start a prepared process.
-void proc_start_raw(badge_err_t *ec, process_t *process) {
-    // Claim the process for starting.
-    if (!(atomic_fetch_and(&process->flags, ~PROC_PRESTART) & PROC_PRESTART)) {
-        badge_err_set(ec, ELOC_PROCESS, ECAUSE_STATE);
-        return;
+// Load the executable of a prepared process, unless it was already loaded or cloned from a loaded process.
+static bool proc_load_raw(badge_err_t *ec, process_t *process) {
+    if (process->entry) {
+        badge_err_set_ok(ec);
+        return true;
     }
 
-    mutex_acquire(NULL, &process->mtx, TIMESTAMP_US_MAX);
-
-    // Load the executable.
     kbelf_dyn dyn = kbelf_dyn_create(process->pid);
     if (!dyn) {
         logkf(LOG_ERROR, "Out of memory to start %{cs}", process->binary);
-        mutex_release(NULL, &process->mtx);
         badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOMEM);
-        return;
+        return false;
     }
     if (!kbelf_dyn_set_exec(dyn, process->binary, NULL)) {
         logkf(LOG_ERROR, "Failed to open %{cs}", process->binary);
         kbelf_dyn_destroy(dyn);
-        mutex_release(NULL, &process->mtx);
         badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOTFOUND);
-        return;
+        return false;
     }
     if (!kbelf_dyn_load(dyn)) {
         kbelf_dyn_destroy(dyn);
         logkf(LOG_ERROR, "Failed to load %{cs}", process->binary);
-        mutex_release(NULL, &process->mtx);
         badge_err_set(ec, ELOC_PROCESS, ECAUSE_FORMAT);
+        return false;
+    }
+    process->entry = (size_t)kbelf_dyn_entrypoint(dyn);
+    kbelf_dyn_destroy(dyn);
+    badge_err_set_ok(ec);
+    return true;
+}
+
+// Load an executable and start a prepared process.
+void proc_start_raw(badge_err_t *ec, process_t *process) {
+    // Claim the process for starting.
+    if (!(atomic_fetch_and(&process->flags, ~PROC_PRESTART) & PROC_PRESTART)) {
+        badge_err_set(ec, ELOC_PROCESS, ECAUSE_STATE);
+        return;
+    }
+
+    mutex_acquire(NULL, &process->mtx, TIMESTAMP_US_MAX);
+    timestamp_us_t start = time_us();
+
+    // Load the executable.
+    if (!proc_load_raw(ec, process)) {
+        mutex_release(NULL, &process->mtx);
         return;
     }
 
     // Create the process' main thread.
-    tid_t thread = proc_create_thread_raw(ec, process, (size_t)kbelf_dyn_entrypoint(dyn), 0, SCHED_PRIO_NORMAL);
+    tid_t thread = proc_create_thread_raw(ec, process, process->entry, 0, SCHED_PRIO_NORMAL);
     if (!thread) {
-        kbelf_dyn_unload(dyn);
-        kbelf_dyn_destroy(dyn);
         mutex_release(NULL, &process->mtx);
         return;
     }
     port_fencei();
     atomic_store(&process->flags, PROC_RUNNING);
     thread_resume(ec, thread);
+    timestamp_us_t load_time = time_us() - start;
+    mutex_acquire(NULL, &process->memmap.mtx, TIMESTAMP_US_MAX);
+    size_t resident = process->memmap.resident;
+    size_t reserved = process->memmap.reserved;
+    mutex_release(NULL, &process->memmap.mtx);
     mutex_release(NULL, &process->mtx);
-    kbelf_dyn_destroy(dyn);
-    logkf(LOG_INFO, "Process %{d} started", process->pid);
+    logkf(
+        LOG_INFO,
+        "Process %{d} started in %{i64;d} us, %{size;d} of %{size;d} KiB resident",
+        process->pid,
+        load_time,
+        resident / 1024,
+        reserved / 1024
+    );
 }
 
 
@@ -385,11 +412,10 @@ void proc_delete_thread_raw_unsafe(badge_err_t *ec, process_t *process, sched_th
 
 // Add a file to the process file handle list.
 int proc_add_fd_raw(badge_err_t *ec, process_t *process, file_t real) {
+    // New numbers are always higher than existing ones, so the list stays sorted.
     proc_fd_t fd = {.real = real, .virt = 0};
-    for (size_t i = 0; i < process->fds_len; i++) {
-        if (process->fds[i].virt > fd.virt) {
-            fd.virt = process->fds[i].virt + 1;
-        }
+    if (process->fds_len) {
+        fd.virt = process->fds[process->fds_len - 1].virt + 1;
     }
     if (array_len_insert(&process->fds, sizeof(proc_fd_t), &process->fds_len, &fd, process->fds_len)) {
         badge_err_set_ok(ec);
@@ -400,28 +426,42 @@ int proc_add_fd_raw(badge_err_t *ec, process_t *process, file_t real) {
     }
 }
 
+// Binary search the process file handle list, which is sorted by virtual file number.
+// Returns -1 if not found.
+static ptrdiff_t proc_fd_index(process_t *process, int virt) {
+    size_t lo = 0;
+    size_t hi = process->fds_len;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (process->fds[mid].virt < virt) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < process->fds_len && process->fds[lo].virt == virt ? (ptrdiff_t)lo : -1;
+}
+
 // Find a file in the process file handle list.
 file_t proc_find_fd_raw(badge_err_t *ec, process_t *process, int virt) {
-    for (size_t i = 0; i < process->fds_len; i++) {
-        if (process->fds[i].virt == virt) {
-            badge_err_set_ok(ec);
-            return process->fds[i].real;
-        }
+    ptrdiff_t i = proc_fd_index(process, virt);
+    if (i < 0) {
+        badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOTFOUND);
+        return -1;
     }
-    badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOTFOUND);
-    return -1;
+    badge_err_set_ok(ec);
+    return process->fds[i].real;
 }
 
 // Remove a file from the process file handle list.
 void proc_remove_fd_raw(badge_err_t *ec, process_t *process, int virt) {
-    for (size_t i = 0; i < process->fds_len; i++) {
-        if (process->fds[i].virt == virt) {
-            array_len_remove(&process->fds, sizeof(proc_fd_t), &process->fds_len, NULL, i);
-            badge_err_set_ok(ec);
-            return;
-        }
+    ptrdiff_t i = proc_fd_index(process, virt);
+    if (i < 0) {
+        badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOTFOUND);
+        return;
     }
-    badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOTFOUND);
+    array_len_remove(&process->fds, sizeof(proc_fd_t), &process->fds_len, NULL, i);
+    badge_err_set_ok(ec);
 }
 
 
@@ -518,6 +558,9 @@ void proc_delete_runtime_raw(process_t *process) {
         atomic_thread_fence(memory_order_release);
     }
 
+    // A thread waiting on the I/O ring only checks for this when woken.
+    proc_ioring_interrupt_raw(process);
+
     // Destroy all threads.
     for (size_t i = 0; i < process->threads_len; i++) {
         thread_join(process->threads[i]);
@@ -525,6 +568,9 @@ void proc_delete_runtime_raw(process_t *process) {
     process->threads_len = 0;
     free(process->threads);
 
+    // Stop the I/O ring worker before the files and memory it uses go away.
+    proc_ioring_destroy_raw(process);
+
     // Adopt all children to init.
     if (process->pid != 1) {
         process_t *init = procs[0];
@@ -532,14 +578,22 @@ void proc_delete_runtime_raw(process_t *process) {
         dlist_concat(&init->children, &process->children);
     }
 
+    // Unlink shared memory objects; ones still mapped by other processes stay alive until unmapped.
+    shm_unlink_owned(process->pid);
+
     // Unmap all memory regions.
-    while (process->memmap.regions_len) {
-#if MEMMAP_VMEM
-        proc_unmap_raw(NULL, process, process->memmap.regions[0].vaddr);
-#else
-        proc_unmap_raw(NULL, process, process->memmap.regions[0].paddr);
-#endif
-    }
+    mutex_acquire(NULL, &process->memmap.mtx, TIMESTAMP_US_MAX);
+    logkf(
+        LOG_INFO,
+        "Process %{d} used %{size;d} KiB resident at peak, %{size;d} page faults, %{size;d} of %{size;d} superpages",
+        process->pid,
+        process->memmap.peak_resident / 1024,
+        process->memmap.faults,
+        process->memmap.superpages,
+        process->memmap.superpages + process->memmap.superpage_misses
+    );
+    proc_unmap_all_raw(process);
+    mutex_release(NULL, &process->memmap.mtx);
 
     // TODO: Close pipes and files.
 
@@ -558,6 +612,68 @@ pid_t proc_create(badge_err_t *ec, pid_t parent, char const *binary, int argc, c
     return process ? process->pid : -1;
 }
 
+// Create a new pre-start process from a snapshot of a pre-start template process.
+// The template is loaded when it is first cloned and its memory is shared copy-on-write with every clone.
+pid_t proc_clone(badge_err_t *ec, pid_t parent, pid_t template, int argc, char const *const *argv) {
+    timestamp_us_t start = time_us();
+    process_t     *clone = proc_create_raw(ec, parent, NULL, argc, argv);
+    if (!clone) {
+        return -1;
+    }
+    pid_t pid = clone->pid;
+
+    mutex_acquire_shared(NULL, &proc_mtx, TIMESTAMP_US_MAX);
+    process_t *tmpl   = proc_get_unsafe(template);
+    bool       ok     = false;
+    size_t     shared = 0;
+    if (!tmpl) {
+        badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOTFOUND);
+    } else {
+        mutex_acquire(NULL, &tmpl->mtx, TIMESTAMP_US_MAX);
+        mutex_acquire(NULL, &clone->mtx, TIMESTAMP_US_MAX);
+        clone->binary = tmpl->binary;
+        if (!(atomic_load(&tmpl->flags) & PROC_PRESTART) || !(atomic_load(&clone->flags) & PROC_PRESTART)) {
+            badge_err_set(ec, ELOC_PROCESS, ECAUSE_STATE);
+        } else {
+#if MEMMAP_VMEM
+            ok = proc_load_raw(ec, tmpl);
+            if (ok) {
+                mutex_acquire(NULL, &tmpl->memmap.mtx, TIMESTAMP_US_MAX);
+                mutex_acquire(NULL, &clone->memmap.mtx, TIMESTAMP_US_MAX);
+                ok = proc_map_clone_raw(ec, clone, tmpl);
+                if (ok) {
+                    clone->entry = tmpl->entry;
+                    shared       = clone->memmap.resident;
+                }
+                mutex_release(NULL, &clone->memmap.mtx);
+                mutex_release(NULL, &tmpl->memmap.mtx);
+            }
+#else
+            // Without VMEM, memory can't be shared; the clone loads the executable when it is started instead.
+            ok = true;
+            badge_err_set_ok(ec);
+#endif
+        }
+        mutex_release(NULL, &clone->mtx);
+        mutex_release(NULL, &tmpl->mtx);
+    }
+    mutex_release_shared(NULL, &proc_mtx);
+
+    if (!ok) {
+        proc_delete(pid);
+        return -1;
+    }
+    logkf(
+        LOG_INFO,
+        "Process %{d} cloned from %{d} in %{i64;d} us, %{size;d} KiB shared",
+        pid,
+        template,
+        time_us() - start,
+        shared / 1024
+    );
+    return pid;
+}
+
 // Delete a process and release any resources it had.
 static bool proc_delete_impl(pid_t pid, bool only_prestart) {
     mutex_acquire(NULL, &proc_mtx, TIMESTAMP_US_MAX);
@@ -671,7 +787,7 @@ ptrdiff_t strlen_from_user(pid_t pid, size_t user_vaddr, ptrdiff_t max_len) {
 
 // Copy bytes from user to kernel.
 // Returns whether the user has access to all of these bytes.
-// If the user doesn't have access, no copy is performed.
+// If the user doesn't have access, the copy may have been partially performed.
 bool copy_from_user(pid_t pid, void *kernel_vaddr, size_t user_vaddr, size_t len) {
     mutex_acquire_shared(NULL, &proc_mtx, TIMESTAMP_US_MAX);
     bool res = copy_from_user_raw(proc_get_unsafe(pid), kernel_vaddr, user_vaddr, len);
@@ -681,7 +797,7 @@ bool copy_from_user(pid_t pid, void *kernel_vaddr, size_t user_vaddr, size_t len
 
 // Copy from kernel to user.
 // Returns whether the user has access to all of these bytes.
-// If the user doesn't have access, no copy is performed.
+// If the user doesn't have access, the copy may have been partially performed.
 bool copy_to_user(pid_t pid, size_t user_vaddr, void *const kernel_vaddr, size_t len) {
     mutex_acquire_shared(NULL, &proc_mtx, TIMESTAMP_US_MAX);
     bool res = copy_to_user_raw(proc_get_unsafe(pid), user_vaddr, kernel_vaddr, len);
@@ -0,0 +1,212 @@
+
+// SPDX-License-Identifier: MIT
+
+#include "process/shm.h"
+
+#include "arrays.h"
+#include "log.h"
+#include "malloc.h"
+#include "mutex.h"
+#include "page_alloc.h"
+
+
+
+// Sort `shm_t *` by ID.
+static int shm_cmp(void const *a, void const *b) {
+    shm_t const *shm_a = *(shm_t *const *)a;
+    shm_t const *shm_b = *(shm_t *const *)b;
+    if (shm_a->id < shm_b->id) {
+        return -1;
+    } else if (shm_a->id > shm_b->id) {
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+// Mutex that guards the object list.
+static mutex_t shm_mtx     = MUTEX_T_INIT_SHARED;
+// Number of linked objects.
+static size_t  shms_len;
+// Capacity for linked objects.
+static size_t  shms_cap;
+// Linked objects sorted by ID.
+static shm_t **shms;
+// ID of the next object to be created.
+static int     shm_next_id = 1;
+
+
+
+// Look up a linked object by ID.
+static ptrdiff_t shm_find(int id) {
+    shm_t             dummy     = {.id = id};
+    shm_t            *dummy_ptr = &dummy;
+    array_binsearch_t res       = array_binsearch(shms, sizeof(shm_t *), shms_len, &dummy_ptr, shm_cmp);
+    return res.found ? (ptrdiff_t)res.index : -1;
+}
+
+// Free an object and the memory backing it.
+static void shm_free(shm_t *shm) {
+#if MEMMAP_VMEM
+    if (shm->ppns) {
+        for (size_t i = 0; i < shm->pages; i++) {
+            if (shm->ppns[i]) {
+                phys_page_free(shm->ppns[i]);
+            }
+        }
+        free(shm->ppns);
+    }
+#else
+    if (shm->ppn) {
+        phys_page_free(shm->ppn);
+    }
+#endif
+    free(shm);
+}
+
+
+
+// Allocate an object and the zero-filled memory backing it, holding one reference.
+static shm_t *shm_alloc(badge_err_t *ec, pid_t owner, size_t size) {
+    if (!size) {
+        badge_err_set(ec, ELOC_PROCESS, ECAUSE_PARAM);
+        return NULL;
+    }
+    shm_t *shm = calloc(1, sizeof(shm_t));
+    if (!shm) {
+        badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOMEM);
+        return NULL;
+    }
+    shm->owner = owner;
+    shm->pages = (size + MEMMAP_PAGE_SIZE - 1) / MEMMAP_PAGE_SIZE;
+    atomic_init(&shm->refcount, 1);
+
+    // Allocate the memory up front; it is mapped into every process that uses it.
+#if MEMMAP_VMEM
+    shm->ppns = calloc(shm->pages, sizeof(size_t));
+    if (!shm->ppns) {
+        shm_free(shm);
+        badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOMEM);
+        return NULL;
+    }
+    for (size_t i = 0; i < shm->pages; i++) {
+        shm->ppns[i] = phys_page_alloc(1, true);
+        if (!shm->ppns[i]) {
+            shm_free(shm);
+            badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOMEM);
+            return NULL;
+        }
+    }
+#else
+    shm->ppn = phys_page_alloc(shm->pages, true);
+    if (!shm->ppn) {
+        shm_free(shm);
+        badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOMEM);
+        return NULL;
+    }
+#endif
+    badge_err_set_ok(ec);
+    return shm;
+}
+
+
+
+// Create a zero-filled shared memory object.
+// Returns its ID, or 0 on failure.
+int shm_create(badge_err_t *ec, pid_t owner, size_t size) {
+    shm_t *shm = shm_alloc(ec, owner, size);
+    if (!shm) {
+        return 0;
+    }
+
+    // IDs only increase, so appending keeps the list sorted.
+    mutex_acquire(NULL, &shm_mtx, TIMESTAMP_US_MAX);
+    int  id = shm_next_id++;
+    bool ok = false;
+    if (id > 0) {
+        shm->id = id;
+        ok      = array_lencap_insert(&shms, sizeof(shm_t *), &shms_len, &shms_cap, &shm, shms_len);
+    }
+    mutex_release(NULL, &shm_mtx);
+    if (!ok) {
+        shm_free(shm);
+        badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOMEM);
+        return 0;
+    }
+
+    logkf(
+        LOG_INFO,
+        "Process %{d} created shared memory %{d} of %{size;d} bytes",
+        owner,
+        id,
+        shm->pages * MEMMAP_PAGE_SIZE
+    );
+    badge_err_set_ok(ec);
+    return id;
+}
+
+// Create a zero-filled shared memory object that is never linked, so only the kernel can map it.
+// Returns the object with one reference held by the caller, or NULL on failure.
+shm_t *shm_create_anon(badge_err_t *ec, pid_t owner, size_t size) {
+    return shm_alloc(ec, owner, size);
+}
+
+// Look up a shared memory object and take a reference to it.
+// Returns NULL if no object with this ID is linked.
+shm_t *shm_get(int id) {
+    mutex_acquire_shared(NULL, &shm_mtx, TIMESTAMP_US_MAX);
+    ptrdiff_t idx = shm_find(id);
+    shm_t    *shm = NULL;
+    if (idx >= 0) {
+        shm = shms[idx];
+        atomic_fetch_add(&shm->refcount, 1);
+    }
+    mutex_release_shared(NULL, &shm_mtx);
+    return shm;
+}
+
+// Take another reference to a shared memory object the caller already holds a reference to.
+void shm_ref(shm_t *shm) {
+    atomic_fetch_add(&shm->refcount, 1);
+}
+
+// Drop a reference to a shared memory object; it is freed when the last reference is gone.
+void shm_unref(shm_t *shm) {
+    if (atomic_fetch_sub(&shm->refcount, 1) == 1) {
+        shm_free(shm);
+    }
+}
+
+// Unlink a shared memory object so it can't be mapped again; existing mappings stay valid.
+void shm_unlink(badge_err_t *ec, pid_t owner, int id) {
+    mutex_acquire(NULL, &shm_mtx, TIMESTAMP_US_MAX);
+    ptrdiff_t idx = shm_find(id);
+    if (idx < 0) {
+        mutex_release(NULL, &shm_mtx);
+        badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOTFOUND);
+        return;
+    } else if (shms[idx]->owner != owner) {
+        mutex_release(NULL, &shm_mtx);
+        badge_err_set(ec, ELOC_PROCESS, ECAUSE_PERM);
+        return;
+    }
+    shm_t *shm;
+    array_lencap_remove(&shms, sizeof(shm_t *), &shms_len, &shms_cap, &shm, idx);
+    mutex_release(NULL, &shm_mtx);
+
+    shm_unref(shm);
+    badge_err_set_ok(ec);
+}
+
+// Unlink all shared memory objects created by a process.
+void shm_unlink_owned(pid_t owner) {
+    mutex_acquire(NULL, &shm_mtx, TIMESTAMP_US_MAX);
+    for (size_t i = shms_len; i-- > 0;) {
+        if (shms[i]->owner == owner) {
+            shm_t *shm;
+            array_lencap_remove(&shms, sizeof(shm_t *), &shms_len, &shms_cap, &shm, i);
+            shm_unref(shm);
+        }
+    }
+    mutex_release(NULL, &shm_mtx);
+}
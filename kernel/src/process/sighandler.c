@@ -33,7 +33,9 @@ static inline void memmap_info(process_t *const proc, size_t vaddr) {
 #if MEMMAP_VMEM
     uint32_t flags = memprotect_virt2phys(&proc->memmap.mpu_ctx, vaddr).flags;
 #else
+    mutex_acquire(NULL, &proc->memmap.mtx, TIMESTAMP_US_MAX);
     uint32_t flags = proc_map_contains_raw(proc, vaddr, 1);
+    mutex_release(NULL, &proc->memmap.mtx);
 #endif
     if (flags & MEMPROTECT_FLAG_RWX) {
         char tmp[6] = {0};
@@ -158,6 +160,26 @@ void proc_sigsegv_handler(size_t vaddr) {
     trap_signal_handler(SIGSEGV, vaddr);
 }
 
+#if MEMMAP_VMEM
+// Handles a page fault in the current thread.
+// Allocates memory that was reserved but not accessed yet, copies copy-on-write pages that are written to,
+// or raises a segmentation fault otherwise.
+void proc_pagefault_handler(size_t vaddr, uint32_t access) {
+    process_t *const proc = proc_current();
+    mutex_acquire(NULL, &proc->memmap.mtx, TIMESTAMP_US_MAX);
+    bool handled = proc_map_fault_raw(proc, vaddr, access);
+    mutex_release(NULL, &proc->memmap.mtx);
+    if (!handled) {
+        trap_signal_handler(SIGSEGV, vaddr);
+    }
+    // Retry the faulting access.
+    irq_disable();
+    sched_lower_from_isr();
+    isr_context_switch();
+    __builtin_unreachable();
+}
+#endif
+
 // Raises an illegal instruction fault to the current thread.
 // Called in the kernel side of a used thread when hardware detects an illegal instruction fault.
 void proc_sigill_handler() {
@@ -7,8 +7,11 @@
 #include "cpu/isr.h"
 #include "errno.h"
 #include "interrupt.h"
+#include "malloc.h"
+#include "memprotect.h"
 #include "process/internal.h"
 #include "process/sighandler.h"
+#include "process/shm.h"
 #include "process/types.h"
 #include "rawprint.h"
 #include "scheduler/cpu.h"
@@ -26,38 +29,126 @@
 // This may round up to a multiple of the page size.
 // Alignment may be less than `align` if the kernel doesn't support it.
 void *syscall_mem_alloc(size_t vaddr_req, size_t min_size, size_t min_align, int flags) {
-    return (void *)proc_map_raw(NULL, proc_current(), vaddr_req, min_size, min_align, flags);
+    process_t *const proc = proc_current();
+    min_align             = proc_map_align(min_size, min_align);
+    mutex_acquire(NULL, &proc->memmap.mtx, TIMESTAMP_US_MAX);
+    size_t vaddr = proc_map_raw(NULL, proc, vaddr_req, min_size, min_align, flags);
+    mutex_release(NULL, &proc->memmap.mtx);
+    return (void *)vaddr;
 }
 
 // Get the size of a range of memory previously allocated with `SYSCALL_MEM_ALLOC`.
 // Returns 0 if there is no range starting at the given address.
 size_t syscall_mem_size(void *address) {
     process_t *const proc = proc_current();
-    mutex_acquire_shared(NULL, &proc->mtx, TIMESTAMP_US_MAX);
-    size_t res = 0;
-    for (size_t i = 0; i < proc->memmap.regions_len; i++) {
-#if MEMMAP_VMEM
-        if (proc->memmap.regions[i].vaddr == (size_t)address) {
-            res = proc->memmap.regions[i].size;
-            break;
-        }
-#else
-        if (proc->memmap.regions[i].paddr == (size_t)address) {
-            res = proc->memmap.regions[i].size;
-            break;
-        }
-#endif
-    }
-    mutex_release_shared(NULL, &proc->mtx);
+    mutex_acquire(NULL, &proc->memmap.mtx, TIMESTAMP_US_MAX);
+    size_t res = proc_map_size_raw(proc, (size_t)address);
+    mutex_release(NULL, &proc->memmap.mtx);
     return res;
 }
 
 // Unmap a range of memory previously allocated with `SYSCALL_MEM_ALLOC`.
 // Returns whether a range of memory was unmapped.
 bool syscall_mem_dealloc(void *address) {
-    badge_err_t *ec = {0};
-    proc_unmap_raw(ec, proc_current(), (size_t)address);
-    return badge_err_is_ok(ec);
+    process_t *const proc = proc_current();
+    badge_err_t      ec   = {0};
+    mutex_acquire(NULL, &proc->memmap.mtx, TIMESTAMP_US_MAX);
+    proc_unmap_raw(&ec, proc, (size_t)address);
+    mutex_release(NULL, &proc->memmap.mtx);
+    return badge_err_is_ok(&ec);
+}
+
+// Get kernel memory allocator statistics.
+// Copies at most `cap` bytes of a `memstats_t` into `stats` and returns the full size of `memstats_t`.
+size_t syscall_mem_stats(memstats_t *stats, size_t cap) {
+    memstats_t tmp;
+    malloc_get_stats(&tmp);
+    if (cap > sizeof(memstats_t)) {
+        cap = sizeof(memstats_t);
+    }
+    sigsegv_assert(copy_to_user_raw(proc_current(), (size_t)stats, &tmp, cap), (size_t)stats);
+    return sizeof(memstats_t);
+}
+
+// Get the memory usage of a process (or pid 0 for self).
+// Copies at most `cap` bytes of a `proc_memstats_t` into `stats` and returns the full size of `proc_memstats_t`.
+// Returns 0 if the process does not exist.
+size_t syscall_mem_proc_stats(int pid, proc_memstats_t *stats, size_t cap) {
+    proc_memstats_t tmp;
+    if (!proc_get_memstats(pid ? pid : proc_current_pid(), &tmp)) {
+        return 0;
+    }
+    if (cap > sizeof(proc_memstats_t)) {
+        cap = sizeof(proc_memstats_t);
+    }
+    sigsegv_assert(copy_to_user_raw(proc_current(), (size_t)stats, &tmp, cap), (size_t)stats);
+    return sizeof(proc_memstats_t);
+}
+
+// Create a zero-filled shared memory object of at least `size` bytes.
+// The object can be mapped by any process that knows its ID until it is unlinked or this process exits.
+// Returns the object's ID on success, or a (negative) errno on failure.
+int syscall_mem_shm_create(size_t size) {
+    badge_err_t ec = {0};
+    int         id = shm_create(&ec, proc_current_pid(), size);
+    if (ec.cause == ECAUSE_PARAM) {
+        return -EINVAL;
+    } else if (!badge_err_is_ok(&ec)) {
+        return -ENOMEM;
+    }
+    return id;
+}
+
+// Map a shared memory object at an arbitrary virtual address; each mapping has its own `flags`.
+// The mapping is removed with `SYSCALL_MEM_DEALLOC`; the memory is freed when it is no longer mapped anywhere.
+// Returns NULL on failure.
+void *syscall_mem_shm_map(int id, size_t vaddr_req, int flags) {
+    shm_t *shm = shm_get(id);
+    if (!shm) {
+        return NULL;
+    }
+    process_t *const proc = proc_current();
+    mutex_acquire(NULL, &proc->memmap.mtx, TIMESTAMP_US_MAX);
+    size_t vaddr = proc_map_shm_raw(NULL, proc, shm, vaddr_req, flags & MEMPROTECT_FLAG_RWX);
+    mutex_release(NULL, &proc->memmap.mtx);
+    if (!vaddr) {
+        shm_unref(shm);
+    }
+    return (void *)vaddr;
+}
+
+// Unlink a shared memory object created by this process so it can't be mapped again; existing mappings stay valid.
+// Returns whether an object was unlinked.
+bool syscall_mem_shm_unlink(int id) {
+    badge_err_t ec = {0};
+    shm_unlink(&ec, proc_current_pid(), id);
+    return badge_err_is_ok(&ec);
+}
+
+// Map `size` bytes of an open file starting at `offset`, which must be a multiple of the page size, at an arbitrary
+// virtual address. Pages are read from the file when they are first accessed; accessing pages past its end faults.
+// With `MEMFLAGS_SHARED`, writes change the file; otherwise, they go to private copies of its pages.
+// The mapping is removed with `SYSCALL_MEM_DEALLOC` and stays valid after the file is closed.
+// Returns NULL on failure.
+void *syscall_mem_map_file(int virt, long offset, size_t size, size_t vaddr_req, int flags) {
+    process_t *const proc = proc_current();
+    file_t           fd   = proc_find_fd_raw(NULL, proc, virt);
+    if (fd == FILE_NONE) {
+        return NULL;
+    }
+    mutex_acquire(NULL, &proc->memmap.mtx, TIMESTAMP_US_MAX);
+    size_t vaddr = proc_map_file_raw(
+        NULL,
+        proc,
+        fd,
+        offset,
+        size,
+        vaddr_req,
+        flags & MEMPROTECT_FLAG_RWX,
+        flags & MEMFLAGS_SHARED
+    );
+    mutex_release(NULL, &proc->memmap.mtx);
+    return (void *)vaddr;
 }
 
 
@@ -99,9 +190,7 @@ int syscall_proc_pcreate(char const *binary, int argc, char const *const *argv)
         proc_sigsegv_handler((size_t)binary);
     }
     sigsys_assert(argc >= 0);
-    if (!proc_map_contains_raw(proc, (size_t)argv, argc * sizeof(char const *))) {
-        proc_sigsegv_handler((size_t)argv);
-    }
+    sysutil_memassert(argv, argc * sizeof(char const *), MEMPROTECT_FLAG_R);
     for (int i = 0; i < argc; i++) {
         if (strlen_from_user_raw(proc, (size_t)argv[i], PTRDIFF_MAX) < 0) {
             proc_sigsegv_handler((size_t)argv[i]);
@@ -112,6 +201,36 @@ int syscall_proc_pcreate(char const *binary, int argc, char const *const *argv)
     return proc_create(NULL, proc->pid, binary, argc, argv);
 }
 
+// Create a "pre-start" child process from a snapshot of `template`, another "pre-start" child of this process.
+// The template's executable is loaded when it is first cloned; its memory is then shared copy-on-write with every
+// clone, so starting a clone does not read, relocate or zero the executable again. The clone gets its own arguments.
+// Returns process ID of new child on success, or a (negative) errno on failure.
+int syscall_proc_pclone(int template, int argc, char const *const *argv) {
+    process_t *const proc = proc_current();
+
+    // Verify validity of pointers.
+    sigsys_assert(argc >= 0);
+    sysutil_memassert(argv, argc * sizeof(char const *), MEMPROTECT_FLAG_R);
+    for (int i = 0; i < argc; i++) {
+        if (strlen_from_user_raw(proc, (size_t)argv[i], PTRDIFF_MAX) < 0) {
+            proc_sigsegv_handler((size_t)argv[i]);
+        }
+    }
+    if (!proc_is_parent(proc->pid, template)) {
+        return -ECHILD;
+    }
+
+    badge_err_t ec  = {0};
+    pid_t       pid = proc_clone(&ec, proc->pid, template, argc, argv);
+    if (ec.cause == ECAUSE_STATE) {
+        return -EINVAL;
+    } else if (!badge_err_is_ok(&ec)) {
+        badge_err_log_warn(&ec);
+        return -ENOMEM;
+    }
+    return pid;
+}
+
 // Destroy a "pre-start" child process.
 // Usually used in case of errors.
 bool syscall_proc_pdestroy(int child) {
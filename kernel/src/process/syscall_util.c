@@ -23,8 +23,14 @@ void sigsegv_assert(bool condition, size_t vaddr) {
 }
 
 // Checks whether the process has permission for a range of memory.
+// Pages that haven't been accessed yet are allocated so the kernel can access them directly.
 bool sysutil_memperm(void const *ptr, size_t len, uint32_t flags) {
-    return (proc_map_contains_raw(proc_current(), (size_t)ptr, len) & flags) == flags;
+    process_t *const proc = proc_current();
+    mutex_acquire(NULL, &proc->memmap.mtx, TIMESTAMP_US_MAX);
+    bool ok = (proc_map_contains_raw(proc, (size_t)ptr, len) & flags) == flags &&
+              proc_map_populate_raw(proc, (size_t)ptr, len, flags & MEMPROTECT_FLAG_W);
+    mutex_release(NULL, &proc->memmap.mtx);
+    return ok;
 }
 
 // If the process does not have access, raise SIGSEGV and don't return.
@@ -12,10 +12,12 @@
 #include "interrupt.h"
 #include "isr_ctx.h"
 #include "malloc.h"
+#include "port/hardware_allocation.h"
 #include "process/sighandler.h"
 #include "scheduler/cpu.h"
 #include "scheduler/isr.h"
 #include "scheduler/types.h"
+#include "shrinker.h"
 #include "smp.h"
 
 
@@ -348,18 +350,20 @@ static sched_thread_t *find_thread(tid_t tid) {
     return res.found ? threads[res.index] : NULL;
 }
 
-// Scheduler housekeeping.
-static void sched_housekeeping(int taskno, void *arg) {
-    (void)taskno;
-    (void)arg;
-
+// Free the resources of dead detached threads.
+// If `blocking` is false, gives up instead of waiting if the thread list is in use.
+// Returns the number of threads cleaned up.
+static size_t sched_reap_dead(bool blocking) {
     // Acquire the mutex with interrupts disabled without blocking other threads.
     while (1) {
         irq_disable();
-        if (mutex_acquire_from_isr(NULL, &threads_mtx, 500)) {
+        if (mutex_acquire_from_isr(NULL, &threads_mtx, blocking ? 500 : 0)) {
             break;
         }
         irq_enable();
+        if (!blocking) {
+            return 0;
+        }
         thread_yield();
     }
 
@@ -378,6 +382,7 @@ static void sched_housekeeping(int taskno, void *arg) {
     assert_dev_keep(mutex_release_from_isr(NULL, &unused_mtx));
 
     // Clean up all dead threads.
+    size_t count = tmp.len;
     while (tmp.len) {
         sched_thread_t *thread = (void *)dlist_pop_front(&tmp);
         free((void *)thread->kernel_stack_bottom);
@@ -393,6 +398,25 @@ static void sched_housekeeping(int taskno, void *arg) {
 
     assert_dev_keep(mutex_release_from_isr(NULL, &threads_mtx));
     irq_enable();
+    return count;
+}
+
+// Scheduler housekeeping.
+static void sched_housekeeping(int taskno, void *arg) {
+    (void)taskno;
+    (void)arg;
+    sched_reap_dead(true);
+}
+
+// Shrinker that frees the stacks of dead threads early.
+static size_t sched_shrinker(size_t target_pages, void *cookie) {
+    (void)target_pages;
+    (void)cookie;
+    if (!irq_is_enabled()) {
+        // Reaping threads re-enables interrupts.
+        return 0;
+    }
+    return sched_reap_dead(false) * (CONFIG_STACK_SIZE / MEMMAP_PAGE_SIZE);
 }
 
 // Idle function ran when a CPU has no threads.
@@ -421,6 +445,7 @@ void sched_init() {
         sched_prepare_kernel_entry(&cpu_ctx[i].idle_thread, idle_func, NULL);
     }
     hk_add_repeated(0, 1000000, sched_housekeeping, NULL);
+    shrinker_register("threads", SHRINKER_PRIO_RETAINED, sched_shrinker, NULL);
 }
 
 // Power on and start scheduler on secondary CPUs.
@@ -724,16 +749,24 @@ void thread_suspend(badge_err_t *ec, tid_t tid, bool suspend_kernel) {
 }
 
 // Try to mark a thread as running if a thread is allowed to be resumed.
+// A thread that is still running but about to be suspended has the suspension cancelled instead.
 static bool thread_try_mark_running(sched_thread_t *thread, bool now) {
     int cur = atomic_load(&thread->flags);
     int nextval;
     do {
-        if (cur & (THREAD_EXITED | THREAD_EXITING | THREAD_RUNNING)) {
+        if (cur & (THREAD_EXITED | THREAD_EXITING)) {
             return false;
-        }
-        nextval = (cur | THREAD_RUNNING) & ~THREAD_SUSPENDING;
-        if (now) {
-            nextval |= THREAD_STARTNOW;
+        } else if (cur & THREAD_RUNNING) {
+            if (!(cur & THREAD_SUSPENDING)) {
+                return false;
+            }
+            // Otherwise a thread that suspends itself right after making itself resumable could miss the resume.
+            nextval = cur & ~(THREAD_SUSPENDING | THREAD_KSUSPEND);
+        } else {
+            nextval = (cur | THREAD_RUNNING) & ~THREAD_SUSPENDING;
+            if (now) {
+                nextval |= THREAD_STARTNOW;
+            }
         }
     } while (!atomic_compare_exchange_strong(&thread->flags, &cur, nextval));
     return !(cur & THREAD_RUNNING);
@@ -0,0 +1,241 @@
+// SPDX-License-Identifier: MIT
+
+#include "vmalloc.h"
+
+#include "malloc.h"
+#include "port/hardware_allocation.h"
+
+#if MEMMAP_VMEM
+#include "arrays.h"
+#include "assertions.h"
+#include "memprotect.h"
+#include "mutex.h"
+#include "page_alloc.h"
+
+// Maximum number of pages unmapped before their TLB entries are flushed and the pages are freed.
+#define UNMAP_BATCH 64
+
+// Virtually contiguous allocation.
+typedef struct {
+    // Base virtual address.
+    size_t vaddr;
+    // Number of pages mapped.
+    size_t pages;
+} vmalloc_ent_t;
+
+// Sort `vmalloc_ent_t` by `vaddr`.
+static int vmalloc_ent_cmp(void const *a, void const *b) {
+    vmalloc_ent_t const *ent_a = a;
+    vmalloc_ent_t const *ent_b = b;
+    if (ent_a->vaddr < ent_b->vaddr) {
+        return -1;
+    } else if (ent_a->vaddr > ent_b->vaddr) {
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+// Mutex that guards the allocation list.
+static mutex_t        vmalloc_mtx = MUTEX_T_INIT_SHARED;
+// Number of live allocations.
+static size_t         allocs_len;
+// Capacity for allocations.
+static size_t         allocs_cap;
+// Live allocations sorted by virtual address.
+static vmalloc_ent_t *allocs;
+
+
+
+// Unmap pages from a kernel virtual range and free the physical pages behind them.
+// Pages are freed in batches, after other CPUs have flushed them from their TLBs.
+// Pages that are also mapped into processes stay allocated until they are unmapped there too.
+static void vmalloc_unmap_pages(size_t vaddr, size_t pages) {
+    size_t batch[UNMAP_BATCH];
+    size_t batch_len = 0;
+    for (size_t i = 0; i < pages; i++) {
+        size_t      page_vaddr = vaddr + i * MEMMAP_PAGE_SIZE;
+        virt2phys_t v2p        = memprotect_virt2phys(NULL, page_vaddr);
+        assert_dev_drop(v2p.flags & MEMPROTECT_FLAG_RW);
+        memprotect_k(page_vaddr, 0, MEMMAP_PAGE_SIZE, 0);
+        batch[batch_len++] = v2p.page_paddr / MEMMAP_PAGE_SIZE;
+        if (batch_len == UNMAP_BATCH || i == pages - 1) {
+            memprotect_commit(&mpu_global_ctx);
+            for (size_t j = 0; j < batch_len; j++) {
+                phys_page_unref(batch[j]);
+            }
+            batch_len = 0;
+        }
+    }
+}
+
+// Allocate physical pages and map them into a kernel virtual range.
+// Returns how many pages were mapped, which is less than `pages` if out of memory.
+static size_t vmalloc_map_pages(size_t vaddr, size_t pages) {
+    for (size_t i = 0; i < pages; i++) {
+        size_t ppn = phys_page_alloc(1, false);
+        if (!ppn) {
+            return i;
+        }
+        assert_always(memprotect_k(
+            vaddr + i * MEMMAP_PAGE_SIZE,
+            ppn * MEMMAP_PAGE_SIZE,
+            MEMMAP_PAGE_SIZE,
+            MEMPROTECT_FLAG_RW
+        ));
+    }
+    return pages;
+}
+
+// Look up an allocation by address.
+static ptrdiff_t vmalloc_find(void *ptr) {
+    vmalloc_ent_t     dummy = {.vaddr = (size_t)ptr};
+    array_binsearch_t res   = array_binsearch(allocs, sizeof(vmalloc_ent_t), allocs_len, &dummy, vmalloc_ent_cmp);
+    return res.found ? (ptrdiff_t)res.index : -1;
+}
+
+
+
+// Allocate a zeroed, virtually contiguous kernel buffer.
+// On systems with VMEM, this maps individual physical pages so it does not need physically contiguous memory.
+// On other systems, this is equivalent to `calloc(1, size)`.
+void *vmalloc(size_t size) {
+    if (!size) {
+        return NULL;
+    }
+    size_t        pages = (size + MEMMAP_PAGE_SIZE - 1) / MEMMAP_PAGE_SIZE;
+    vmalloc_ent_t ent   = {
+          .vaddr = memprotect_alloc_vaddr(pages * MEMMAP_PAGE_SIZE),
+          .pages = pages,
+    };
+
+    mutex_acquire(NULL, &vmalloc_mtx, TIMESTAMP_US_MAX);
+    size_t mapped = vmalloc_map_pages(ent.vaddr, pages);
+    if (mapped < pages
+        || !array_lencap_sorted_insert(&allocs, sizeof(vmalloc_ent_t), &allocs_len, &allocs_cap, &ent, vmalloc_ent_cmp)) {
+        vmalloc_unmap_pages(ent.vaddr, mapped);
+        mutex_release(NULL, &vmalloc_mtx);
+        memprotect_commit(&mpu_global_ctx);
+        memprotect_free_vaddr(ent.vaddr);
+        return NULL;
+    }
+    mutex_release(NULL, &vmalloc_mtx);
+
+    memprotect_commit(&mpu_global_ctx);
+    return (void *)ent.vaddr;
+}
+
+// Resize a buffer allocated with `vmalloc`.
+// Existing pages are remapped instead of copied where possible.
+void *vrealloc(void *ptr, size_t size) {
+    if (!ptr) {
+        return vmalloc(size);
+    } else if (!size) {
+        vfree(ptr);
+        return NULL;
+    }
+    size_t pages = (size + MEMMAP_PAGE_SIZE - 1) / MEMMAP_PAGE_SIZE;
+
+    mutex_acquire(NULL, &vmalloc_mtx, TIMESTAMP_US_MAX);
+    ptrdiff_t idx = vmalloc_find(ptr);
+    assert_always(idx >= 0);
+    vmalloc_ent_t old = allocs[idx];
+
+    if (pages <= old.pages) {
+        // Shrink in place.
+        vmalloc_unmap_pages(old.vaddr + pages * MEMMAP_PAGE_SIZE, old.pages - pages);
+        allocs[idx].pages = pages;
+        mutex_release(NULL, &vmalloc_mtx);
+        memprotect_commit(&mpu_global_ctx);
+        return ptr;
+    }
+
+    // The virtual range can't grow in place; move the existing pages to a larger range.
+    size_t new_vaddr = memprotect_alloc_vaddr(pages * MEMMAP_PAGE_SIZE);
+    size_t mapped    = vmalloc_map_pages(new_vaddr + old.pages * MEMMAP_PAGE_SIZE, pages - old.pages);
+    if (mapped < pages - old.pages) {
+        vmalloc_unmap_pages(new_vaddr + old.pages * MEMMAP_PAGE_SIZE, mapped);
+        mutex_release(NULL, &vmalloc_mtx);
+        memprotect_commit(&mpu_global_ctx);
+        memprotect_free_vaddr(new_vaddr);
+        return NULL;
+    }
+    for (size_t i = 0; i < old.pages; i++) {
+        virt2phys_t v2p = memprotect_virt2phys(NULL, old.vaddr + i * MEMMAP_PAGE_SIZE);
+        assert_always(
+            memprotect_k(new_vaddr + i * MEMMAP_PAGE_SIZE, v2p.page_paddr, MEMMAP_PAGE_SIZE, MEMPROTECT_FLAG_RW)
+        );
+    }
+    memprotect_k(old.vaddr, 0, old.pages * MEMMAP_PAGE_SIZE, 0);
+
+    // Replace the entry; the list stays sorted by removing and re-inserting it.
+    vmalloc_ent_t new_ent = {
+        .vaddr = new_vaddr,
+        .pages = pages,
+    };
+    array_lencap_remove(&allocs, sizeof(vmalloc_ent_t), &allocs_len, &allocs_cap, NULL, idx);
+    assert_always(
+        array_lencap_sorted_insert(&allocs, sizeof(vmalloc_ent_t), &allocs_len, &allocs_cap, &new_ent, vmalloc_ent_cmp)
+    );
+    mutex_release(NULL, &vmalloc_mtx);
+
+    memprotect_commit(&mpu_global_ctx);
+    memprotect_free_vaddr(old.vaddr);
+    return (void *)new_vaddr;
+}
+
+// Free a buffer allocated with `vmalloc`.
+void vfree(void *ptr) {
+    if (!ptr) {
+        return;
+    }
+    mutex_acquire(NULL, &vmalloc_mtx, TIMESTAMP_US_MAX);
+    ptrdiff_t idx = vmalloc_find(ptr);
+    assert_always(idx >= 0);
+    vmalloc_ent_t ent;
+    array_lencap_remove(&allocs, sizeof(vmalloc_ent_t), &allocs_len, &allocs_cap, &ent, idx);
+    vmalloc_unmap_pages(ent.vaddr, ent.pages);
+    mutex_release(NULL, &vmalloc_mtx);
+
+    memprotect_commit(&mpu_global_ctx);
+    memprotect_free_vaddr(ent.vaddr);
+}
+
+// Get the usable size of a buffer allocated with `vmalloc`.
+size_t vmalloc_size(void *ptr) {
+    if (!ptr) {
+        return 0;
+    }
+    mutex_acquire_shared(NULL, &vmalloc_mtx, TIMESTAMP_US_MAX);
+    ptrdiff_t idx  = vmalloc_find(ptr);
+    size_t    size = idx >= 0 ? allocs[idx].pages * MEMMAP_PAGE_SIZE : 0;
+    mutex_release_shared(NULL, &vmalloc_mtx);
+    return size;
+}
+
+#else
+
+// Allocate a zeroed, virtually contiguous kernel buffer.
+// On systems with VMEM, this maps individual physical pages so it does not need physically contiguous memory.
+// On other systems, this is equivalent to `calloc(1, size)`.
+void *vmalloc(size_t size) {
+    return calloc(1, size);
+}
+
+// Resize a buffer allocated with `vmalloc`.
+// Existing pages are remapped instead of copied where possible.
+void *vrealloc(void *ptr, size_t size) {
+    return realloc(ptr, size);
+}
+
+// Free a buffer allocated with `vmalloc`.
+void vfree(void *ptr) {
+    free(ptr);
+}
+
+// Get the usable size of a buffer allocated with `vmalloc`.
+size_t vmalloc_size(void *ptr) {
+    return malloc_usable_size(ptr);
+}
+
+#endif